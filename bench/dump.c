@@ -0,0 +1,728 @@
+/*
+ *	BIRD -- Filter Benchmark: Route Dumps
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Route dumps
+ *
+ * The benchmark loads routes either from MRT dumps in the TABLE_DUMP_V2
+ * format (as produced by route collectors) or from the text output of
+ * the |show route all| command, possibly including the reply codes
+ * if it has been captured by |birdc -v| or directly from the control socket.
+ *
+ * Attributes of text dumps are parsed back only for the BGP attributes
+ * BIRD knows how to format, other ones are counted and ignored. MRT dumps
+ * contain the attributes in the wire format, so they are decoded like the
+ * BGP protocol does, unknown ones becoming opaque. MRT dumps don't carry
+ * protocol names, so each peer of the dump becomes a protocol named after
+ * its address.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "nest/bird.h"
+#include "lib/resource.h"
+#include "lib/string.h"
+#include "lib/unaligned.h"
+#include "nest/route.h"
+#include "nest/protocol.h"
+#include "nest/attrs.h"
+#include "nest/mrtdump.h"
+#include "proto/bgp/bgp.h"
+
+#include "fbench.h"
+
+struct dump_attr {
+  char *name;
+  int code;
+  int flags;
+  int type;
+};
+
+static struct dump_attr dump_attrs[] = {
+  { "origin",		BA_ORIGIN,		BAF_TRANSITIVE,			EAF_TYPE_INT },
+  { "as_path",		BA_AS_PATH,		BAF_TRANSITIVE,			EAF_TYPE_AS_PATH },
+  { "next_hop",		BA_NEXT_HOP,		BAF_TRANSITIVE,			EAF_TYPE_IP_ADDRESS },
+  { "med",		BA_MULTI_EXIT_DISC,	BAF_OPTIONAL,			EAF_TYPE_INT },
+  { "local_pref",	BA_LOCAL_PREF,		BAF_TRANSITIVE,			EAF_TYPE_INT },
+  { "atomic_aggr",	BA_ATOMIC_AGGR,		BAF_TRANSITIVE,			EAF_TYPE_OPAQUE },
+  { "aggregator",	BA_AGGREGATOR,		BAF_OPTIONAL | BAF_TRANSITIVE,	EAF_TYPE_OPAQUE },
+  { "community",	BA_COMMUNITY,		BAF_OPTIONAL | BAF_TRANSITIVE,	EAF_TYPE_INT_SET },
+  { "originator_id",	BA_ORIGINATOR_ID,	BAF_OPTIONAL,			EAF_TYPE_ROUTER_ID },
+  { "cluster_list",	BA_CLUSTER_LIST,	BAF_OPTIONAL,			EAF_TYPE_INT_SET },
+  { NULL }
+};
+
+static unsigned dump_skipped;
+
+static struct dump_attr *
+dump_find_attr(char *name, int code)
+{
+  struct dump_attr *d;
+
+  for (d = dump_attrs; d->name; d++)
+    if (name ? !strcmp(d->name, name) : (d->code == code))
+      return d;
+  return NULL;
+}
+
+static eattr *
+dump_add_attr(rta *a, int code, int flags, int type, unsigned len)
+{
+  ea_list *ea = lp_alloc(bench_pool, sizeof(ea_list) + sizeof(eattr));
+  eattr *e = &ea->attrs[0];
+
+  ea->next = a->eattrs;
+  a->eattrs = ea;
+  ea->flags = 0;
+  ea->count = 1;
+  e->id = EA_CODE(EAP_BGP, code);
+  e->flags = flags;
+  e->type = type;
+  if (!(type & EAF_EMBEDDED))
+    {
+      struct adata *ad = lp_alloc(bench_pool, sizeof(struct adata) + len);
+      ad->length = len;
+      e->u.ptr = ad;
+    }
+  return e;
+}
+
+static void
+dump_report(char *name)
+{
+  if (dump_skipped)
+    log(L_WARN "%s: %d malformed routes skipped", name, dump_skipped);
+}
+
+/*
+ *	Text Dumps
+ */
+
+static net *text_net;
+static rta text_rta;
+static int text_pref, text_valid;
+
+static char *
+text_word(char **pp)
+{
+  char *c = *pp;
+  char *w;
+
+  while (*c == ' ' || *c == '\t')
+    c++;
+  w = c;
+  while (*c && *c != ' ' && *c != '\t')
+    c++;
+  if (*c)
+    *c++ = 0;
+  *pp = c;
+  return w;
+}
+
+static int
+text_parse_rid(char *c, u32 *id)
+{
+  unsigned a, b, x, y;
+
+  if (sscanf(c, "%u.%u.%u.%u", &a, &b, &x, &y) != 4 || a > 255 || b > 255 || x > 255 || y > 255)
+    return 0;
+  *id = (a << 24) | (b << 16) | (x << 8) | y;
+  return 1;
+}
+
+static int
+text_parse_path(char *c, byte *buf, unsigned size)
+{
+  byte *p = buf;
+  byte *end = buf + size;
+  byte *seg = NULL;
+  int set = 0;
+
+  for (;;)
+    {
+      while (*c == ' ')
+	c++;
+      if (!*c || *c == '.')		/* End or the path has been truncated */
+	break;
+      if (*c == '{' || *c == '}')
+	{
+	  if (set == (*c == '{'))
+	    return -1;
+	  set = !set;
+	  seg = NULL;
+	  c++;
+	  continue;
+	}
+      if (!isdigit(*c))
+	return -1;
+      if (!seg || seg[1] == 255)
+	{
+	  if (p + 2 > end)
+	    return -1;
+	  seg = p;
+	  seg[0] = set ? AS_PATH_SET : AS_PATH_SEQUENCE;
+	  seg[1] = 0;
+	  p += 2;
+	}
+      if (p + 4 > end)
+	return -1;
+      put_u32(p, strtoul(c, &c, 10));
+      p += 4;
+      seg[1]++;
+    }
+  return p - buf;
+}
+
+static int
+text_parse_attr(rta *a, char *name, char *c)
+{
+  struct dump_attr *d = dump_find_attr(name, 0);
+  byte buf[1024];
+  u32 *z = (u32 *) buf;
+  eattr *e;
+  char *w;
+  int i, l;
+
+  if (!d)
+    return 0;
+  switch (d->code)
+    {
+    case BA_ORIGIN:
+      if (!strcmp(c, "IGP"))
+	i = ORIGIN_IGP;
+      else if (!strcmp(c, "EGP"))
+	i = ORIGIN_EGP;
+      else if (!strcmp(c, "Incomplete"))
+	i = ORIGIN_INCOMPLETE;
+      else
+	return 0;
+      dump_add_attr(a, d->code, d->flags, d->type, 0)->u.data = i;
+      return 1;
+
+    case BA_AS_PATH:
+      if ((l = text_parse_path(c, buf, sizeof(buf))) < 0)
+	return 0;
+      memcpy(dump_add_attr(a, d->code, d->flags, d->type, l)->u.ptr->data, buf, l);
+      return 1;
+
+    case BA_NEXT_HOP:
+      {
+	ip_addr nh[2];
+
+	bzero(nh, sizeof(nh));
+	for (i = 0; i < 2 && *(w = text_word(&c)); i++)
+	  if (!ip_pton(w, &nh[i]))
+	    return 0;
+	if (!i || i * sizeof(ip_addr) > NEXT_HOP_LENGTH)
+	  return 0;
+	memcpy(dump_add_attr(a, d->code, d->flags, d->type, NEXT_HOP_LENGTH)->u.ptr->data, nh, NEXT_HOP_LENGTH);
+	return 1;
+      }
+
+    case BA_MULTI_EXIT_DISC:
+    case BA_LOCAL_PREF:
+      if (!isdigit(*c))
+	return 0;
+      dump_add_attr(a, d->code, d->flags, d->type, 0)->u.data = strtoul(c, NULL, 10);
+      return 1;
+
+    case BA_ATOMIC_AGGR:
+      dump_add_attr(a, d->code, d->flags, d->type, 0);
+      return 1;
+
+    case BA_AGGREGATOR:
+      {
+	u32 id, as;
+
+	w = text_word(&c);
+	if (!text_parse_rid(w, &id) || sscanf(c, "AS%u", &as) != 1)
+	  return 0;
+	e = dump_add_attr(a, d->code, d->flags, d->type, 8);
+	put_u32(e->u.ptr->data, as);
+	put_u32(e->u.ptr->data + 4, id);
+	return 1;
+      }
+
+    case BA_COMMUNITY:
+    case BA_CLUSTER_LIST:
+      for (l = 0; *(w = text_word(&c)) && strcmp(w, "..."); l++)
+	{
+	  unsigned x, y;
+
+	  if (l >= (int) (sizeof(buf) / 4))
+	    return 0;
+	  if (d->code == BA_CLUSTER_LIST)
+	    {
+	      if (!text_parse_rid(w, &z[l]))
+		return 0;
+	    }
+	  else if (sscanf(w, "(%u,%u)", &x, &y) == 2 && x <= 0xffff && y <= 0xffff)
+	    z[l] = (x << 16) | y;
+	  else
+	    return 0;
+	}
+      memcpy(dump_add_attr(a, d->code, d->flags, d->type, 4*l)->u.ptr->data, z, 4*l);
+      return 1;
+
+    case BA_ORIGINATOR_ID:
+      if (!text_parse_rid(c, z))
+	return 0;
+      dump_add_attr(a, d->code, d->flags, d->type, 0)->u.data = z[0];
+      return 1;
+    }
+  return 0;
+}
+
+static void
+text_finish(void)
+{
+  if (text_valid)
+    bench_add_route(text_net, &text_rta, text_pref);
+  text_valid = 0;
+  lp_flush(bench_pool);
+}
+
+static int
+text_route(char *c)
+{
+  static char *dest_names[] = { NULL, NULL, "blackhole", "unreachable", "prohibited" };
+  ip_addr gw = IPA_NONE, from = IPA_NONE;
+  net *n = text_net;
+  int dest, pref = -1;
+  char *w, *end;
+
+  if (*c != ' ')
+    {
+      ip_addr px;
+      int len;
+
+      w = text_word(&c);
+      if (!(end = strchr(w, '/')))
+	return 0;
+      *end++ = 0;
+      len = atoi(end);
+      if (!ip_pton(w, &px) || len < 0 || len > BITS_PER_IP_ADDRESS || !ip_is_prefix(px, len))
+	return 0;
+      n = bench_get_net(px, len);
+    }
+  if (!n)
+    return 0;
+
+  w = text_word(&c);
+  if (!strcmp(w, "via"))
+    {
+      if (!ip_pton(text_word(&c), &gw) || strcmp(text_word(&c), "on"))
+	return 0;
+      text_word(&c);
+      dest = RTD_ROUTER;
+      from = gw;
+    }
+  else if (!strcmp(w, "dev"))
+    {
+      text_word(&c);
+      dest = RTD_DEVICE;
+    }
+  else
+    {
+      for (dest = RTD_BLACKHOLE; dest <= RTD_PROHIBIT; dest++)
+	if (!strcmp(w, dest_names[dest]))
+	  break;
+      if (dest > RTD_PROHIBIT)
+	return 0;
+    }
+
+  while (*c == ' ')
+    c++;
+  if (*c++ != '[' || !(end = strchr(c, ']')))
+    return 0;
+  *end++ = 0;
+  w = text_word(&c);
+  if (c = strstr(c, " from "))
+    if (!ip_pton(c + 6, &from))
+      return 0;
+  if (c = strchr(end, '('))
+    pref = atoi(c + 1);
+
+  text_finish();
+  bzero(&text_rta, sizeof(text_rta));
+  text_rta.proto = bench_get_proto(w);
+  text_rta.source = RTS_DUMMY;
+  text_rta.scope = SCOPE_UNIVERSE;
+  text_rta.cast = RTC_UNICAST;
+  text_rta.dest = dest;
+  text_rta.gw = gw;
+  text_rta.from = from;
+  text_net = n;
+  text_pref = pref;
+  text_valid = 1;
+  return 1;
+}
+
+static void
+text_type(char *c)
+{
+  static char *src_names[] = { "dummy", "static", "inherit", "device", "static-device", "redirect",
+			       "RIP", "OSPF", "OSPF-ext", "OSPF-IA", "OSPF-boundary", "BGP" };
+  static char *cast_names[] = { "unicast", "broadcast", "multicast", "anycast" };
+  unsigned i;
+  char *w;
+
+  w = text_word(&c);
+  for (i = 0; i < ARRAY_SIZE(src_names); i++)
+    if (!strcmp(w, src_names[i]))
+      text_rta.source = i;
+  w = text_word(&c);
+  for (i = 0; i < ARRAY_SIZE(cast_names); i++)
+    if (!strcmp(w, cast_names[i]))
+      text_rta.cast = i;
+  w = text_word(&c);
+  for (i = 0; i <= SCOPE_UNIVERSE; i++)
+    if (!strcmp(w, ip_scope_text(i)))
+      text_rta.scope = i;
+}
+
+static void
+text_attr(char *c)
+{
+  char *val = strstr(c, ": ");
+
+  if (!text_valid)
+    return;
+  if (val)
+    {
+      *val = 0;
+      val += 2;
+    }
+  else
+    val = c + strlen(c);
+  if (!strcmp(c, "Type"))
+    text_type(val);
+  else if (strncmp(c, "BGP.", 4) || !text_parse_attr(&text_rta, c + 4, val))
+    bench_ignored_attrs++;
+}
+
+/**
+ * dump_load_text - load routes from a text dump
+ * @f: file to read
+ *
+ * Reads the output of the |show route all| command. Routes are
+ * terminated by any line which is neither a route nor its attribute,
+ * so the command prompts and the banner of the client are skipped.
+ */
+void
+dump_load_text(FILE *f)
+{
+  char line[4096];
+  int raw = 0;
+
+  text_net = NULL;
+  text_valid = 0;
+  while (fgets(line, sizeof(line), f))
+    {
+      char *c = line;
+      char *e = line + strlen(line);
+
+      while (e > line && (e[-1] == '\n' || e[-1] == '\r'))
+	*--e = 0;
+      /* Strip reply codes and continuation marks */
+      if (e - c >= 5 && isdigit(c[0]) && isdigit(c[1]) && isdigit(c[2]) && isdigit(c[3]) && (c[4] == '-' || c[4] == ' '))
+	c += 5, raw = 1;
+      else if (raw && *c == ' ')
+	c++;
+
+      if (*c == '\t')
+	text_attr(c + 1);
+      else if (!text_route(c))
+	{
+	  text_finish();
+	  text_net = NULL;
+	}
+    }
+  text_finish();
+  dump_report("Text dump");
+}
+
+/*
+ *	MRT Dumps
+ */
+
+struct mrt_peer {
+  ip_addr addr;
+  struct proto *proto;
+};
+
+static struct mrt_peer *mrt_peers;
+static unsigned mrt_peer_count;
+
+#ifdef IPV6
+#define MRT_RIB_UNICAST RIB_IPV6_UNICAST
+#else
+#define MRT_RIB_UNICAST RIB_IPV4_UNICAST
+#endif
+
+static int
+mrt_peer_index(byte *p, unsigned len)
+{
+  unsigned i, l;
+  byte *end = p + len;
+
+  if (len < 6 || len < 8 + (l = get_u16(p + 4)))
+    return 0;
+  p += 6 + l;
+  mrt_peer_count = get_u16(p);
+  p += 2;
+  if (mrt_peers)
+    mb_free(mrt_peers);
+  mrt_peers = mb_allocz(bench_res, mrt_peer_count * sizeof(struct mrt_peer));
+  for (i = 0; i < mrt_peer_count; i++)
+    {
+      struct mrt_peer *peer = &mrt_peers[i];
+      int type;
+      byte name[STD_ADDRESS_P_LENGTH+1];
+
+      if (p >= end)
+	return 0;
+      type = *p;
+      l = 5 + ((type & 1) ? 16 : 4) + ((type & 2) ? 4 : 2);
+      if (p + l > end)
+	return 0;
+      if (((type & 1) ? 16 : 4) == sizeof(ip_addr))
+	{
+	  memcpy(&peer->addr, p + 5, sizeof(ip_addr));
+	  ipa_ntoh(peer->addr);
+	  bsprintf(name, "%I", peer->addr);
+	}
+      else
+	bsprintf(name, "peer%d", i);
+      peer->proto = bench_get_proto(name);
+      p += l;
+    }
+  return 1;
+}
+
+static int
+mrt_decode_attrs(rta *a, byte *p, unsigned len)
+{
+  byte *end = p + len;
+  struct dump_attr *d;
+  eattr *e;
+  unsigned i, l;
+  int flags, code, type;
+
+  while (p < end)
+    {
+      if (end - p < 3)
+	return 0;
+      flags = p[0];
+      code = p[1];
+      if (flags & BAF_EXT_LEN)
+	{
+	  if (end - p < 4)
+	    return 0;
+	  l = get_u16(p + 2);
+	  p += 4;
+	}
+      else
+	{
+	  l = p[2];
+	  p += 3;
+	}
+      if (p + l > end)
+	return 0;
+
+      switch (code)
+	{
+	case BA_MP_REACH_NLRI:
+#ifdef IPV6
+	  /* TABLE_DUMP_V2 contains just the next hop here */
+	  if (l && (p[0] == 16 || p[0] == 32) && p[0] == l - 1)
+	    {
+	      ip_addr *nh;
+
+	      d = dump_find_attr(NULL, BA_NEXT_HOP);
+	      nh = (ip_addr *) dump_add_attr(a, d->code, d->flags, d->type, NEXT_HOP_LENGTH)->u.ptr->data;
+	      bzero(nh, NEXT_HOP_LENGTH);
+	      memcpy(nh, p + 1, p[0]);
+	      ipa_ntoh(nh[0]);
+	      ipa_ntoh(nh[1]);
+	      a->gw = nh[0];
+	    }
+	  else
+	    bench_ignored_attrs++;
+#endif
+	  p += l;
+	  continue;
+	case BA_MP_UNREACH_NLRI:
+	case BA_AS4_PATH:
+	case BA_AS4_AGGREGATOR:
+	  p += l;
+	  continue;
+	}
+
+      d = dump_find_attr(NULL, code);
+      type = d ? d->type : EAF_TYPE_OPAQUE;
+      if ((type == EAF_TYPE_IP_ADDRESS && l != sizeof(ip_addr)) ||
+	  ((type == EAF_TYPE_INT || type == EAF_TYPE_ROUTER_ID) && l != 4 && (l != 1 || code != BA_ORIGIN)) ||
+	  (type == EAF_TYPE_INT_SET && l % 4))
+	{
+	  bench_ignored_attrs++;
+	  p += l;
+	  continue;
+	}
+
+      e = dump_add_attr(a, code, flags, type, l);
+      switch (type)
+	{
+	case EAF_TYPE_INT:
+	case EAF_TYPE_ROUTER_ID:
+	  e->u.data = (l == 1) ? *p : get_u32(p);
+	  break;
+	case EAF_TYPE_IP_ADDRESS:
+	  memcpy(e->u.ptr->data, p, l);
+	  ipa_ntoh(*(ip_addr *) e->u.ptr->data);
+	  a->gw = *(ip_addr *) e->u.ptr->data;
+	  break;
+	case EAF_TYPE_INT_SET:
+	  for (i = 0; i < l/4; i++)
+	    ((u32 *) e->u.ptr->data)[i] = get_u32(p + 4*i);
+	  break;
+	default:
+	  memcpy(e->u.ptr->data, p, l);
+	}
+      p += l;
+    }
+  return 1;
+}
+
+static int
+mrt_rib(byte *p, unsigned len)
+{
+  byte *end = p + len;
+  byte buf[sizeof(ip_addr)];
+  ip_addr prefix;
+  unsigned pxlen, plen, count, i, l;
+  net *n;
+
+  if (len < 5 || (pxlen = p[4]) > BITS_PER_IP_ADDRESS || len < 7 + (plen = (pxlen + 7) / 8))
+    return 0;
+  bzero(buf, sizeof(buf));
+  memcpy(buf, p + 5, plen);
+  memcpy(&prefix, buf, sizeof(prefix));
+  ipa_ntoh(prefix);
+  n = bench_get_net(ipa_and(prefix, ipa_mkmask(pxlen)), pxlen);
+  p += 5 + plen;
+  count = get_u16(p);
+  p += 2;
+
+  for (i = 0; i < count; i++)
+    {
+      struct mrt_peer *peer;
+      rta a;
+
+      if (end - p < 8 || end - p < 8 + (l = get_u16(p + 6)))
+	return 0;
+      if (get_u16(p) >= mrt_peer_count)
+	return 0;
+      peer = &mrt_peers[get_u16(p)];
+      bzero(&a, sizeof(a));
+      a.proto = peer->proto;
+      a.source = RTS_BGP;
+      a.scope = SCOPE_UNIVERSE;
+      a.cast = RTC_UNICAST;
+      a.dest = RTD_ROUTER;
+      a.from = peer->addr;
+      if (mrt_decode_attrs(&a, p + 8, l))
+	bench_add_route(n, &a, -1);
+      else
+	dump_skipped++;
+      lp_flush(bench_pool);
+      p += 8 + l;
+    }
+  return 1;
+}
+
+/**
+ * dump_is_mrt - guess the format of a route dump
+ * @f: file to examine, rewound afterwards
+ *
+ * Returns 1 if the file starts with a valid MRT common header, i.e.
+ * with a known MRT type and a record length fitting in the file, 0 if
+ * it's a text dump. The first byte of an MRT dump is a part of its
+ * timestamp, so it can't be told by itself.
+ */
+int
+dump_is_mrt(FILE *f)
+{
+  byte hdr[MRTDUMP_HDR_LENGTH];
+  long size;
+  unsigned type;
+  int res = 0;
+
+  if (fseek(f, 0, SEEK_END) < 0)
+    return 0;
+  size = ftell(f);
+  rewind(f);
+
+  if (fread(hdr, 1, MRTDUMP_HDR_LENGTH, f) == MRTDUMP_HDR_LENGTH)
+    {
+      /* Types defined by RFC 6396, including the deprecated ones */
+      type = get_u16(hdr + 4);
+      res = ((type <= 17) || (type == 32) || (type == 33) || (type == 48) || (type == 49)) &&
+	(get_u32(hdr + 8) <= size - MRTDUMP_HDR_LENGTH);
+    }
+  rewind(f);
+  return res;
+}
+
+/**
+ * dump_load_mrt - load routes from an MRT dump
+ * @f: file to read
+ *
+ * Reads a TABLE_DUMP_V2 dump (RFC 6396). Only the RIB entries of
+ * the address family BIRD has been compiled for are loaded, all other
+ * records are skipped.
+ */
+void
+dump_load_mrt(FILE *f)
+{
+  byte hdr[MRTDUMP_HDR_LENGTH];
+  byte *buf = NULL;
+  unsigned size = 0, len;
+  int ok;
+
+  mrt_peer_count = 0;
+  while (fread(hdr, 1, MRTDUMP_HDR_LENGTH, f) == MRTDUMP_HDR_LENGTH)
+    {
+      len = get_u32(hdr + 8);
+      if (len > size)
+	{
+	  size = len;
+	  buf = buf ? mb_realloc(bench_res, buf, size) : mb_alloc(bench_res, size);
+	}
+      if (fread(buf, 1, len, f) != len)
+	die("MRT dump: Truncated record");
+      if (get_u16(hdr + 4) != TABLE_DUMP_V2)
+	continue;
+      switch (get_u16(hdr + 6))
+	{
+	case PEER_INDEX_TABLE:
+	  ok = mrt_peer_index(buf, len);
+	  break;
+	case MRT_RIB_UNICAST:
+	  ok = mrt_rib(buf, len);
+	  break;
+	default:
+	  ok = 1;
+	}
+      if (!ok)
+	dump_skipped++;
+    }
+  if (buf)
+    mb_free(buf);
+  dump_report("MRT dump");
+}
@@ -0,0 +1,347 @@
+/*
+ *	BIRD -- Filter Benchmark
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Filter benchmark
+ *
+ * The filter benchmark is a standalone program linked with the filter
+ * interpreter and the route attribute code, but without the I/O loop.
+ * It parses a configuration file, loads routes from a route dump
+ * (either an MRT TABLE_DUMP_V2 file or the text output of the |show route all|
+ * command) and runs a single filter over all of them repeatedly. The format
+ * of the dump is recognized by dump_is_mrt() unless the |-m| option says
+ * the dump is in MRT format.
+ *
+ * The first pass over the routes is not timed; it collects the verdict
+ * distribution and the amount of memory the filter takes from its temporary
+ * &linpool. The following passes measure the throughput of the interpreter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "nest/bird.h"
+#include "lib/lists.h"
+#include "lib/resource.h"
+#include "lib/string.h"
+#include "lib/timer.h"
+#include "nest/route.h"
+#include "nest/protocol.h"
+#include "nest/iface.h"
+#include "nest/cli.h"
+#include "nest/locks.h"
+#include "nest/roa.h"
+#include "conf/conf.h"
+#include "filter/filter.h"
+#include "sysdep/unix/unix.h"
+#include "sysdep/unix/krt.h"
+
+#include "fbench.h"
+
+pool *bench_res;
+linpool *bench_pool;
+unsigned bench_ignored_attrs;
+
+static struct config *bench_config;
+static struct fib bench_fib;
+static list bench_protos;
+static rte **bench_routes;
+static unsigned bench_count, bench_size;
+
+/**
+ * bench_get_net - find or create a network entry
+ * @prefix: network prefix
+ * @pxlen: prefix length
+ *
+ * The routes loaded from the dump are hung on the nodes of a private
+ * FIB, so that filters see the same &net structures as in a routing
+ * table.
+ */
+net *
+bench_get_net(ip_addr prefix, int pxlen)
+{
+  return (net *) fib_get(&bench_fib, &prefix, pxlen);
+}
+
+/**
+ * bench_get_proto - find or create a protocol instance
+ * @name: name of the protocol
+ *
+ * Routes in the dump refer to protocols by name. For each name, a dummy
+ * &proto is created, taking the protocol class and the preference from
+ * the configuration if a protocol of the same name is configured there.
+ */
+struct proto *
+bench_get_proto(char *name)
+{
+  struct proto *p;
+  struct proto_config *pc;
+
+  WALK_LIST(p, bench_protos)
+    if (!strcmp(p->name, name))
+      return p;
+
+  p = mb_allocz(bench_res, sizeof(struct proto));
+  p->name = mb_alloc(bench_res, strlen(name) + 1);
+  strcpy(p->name, name);
+  p->preference = DEF_PREF_BGP;
+  WALK_LIST(pc, bench_config->protos)
+    if (!strcmp(pc->name, name))
+      {
+	p->proto = pc->protocol;
+	p->cf = pc;
+	p->preference = pc->preference;
+      }
+  add_tail(&bench_protos, &p->n);
+  return p;
+}
+
+/**
+ * bench_add_route - add a loaded route
+ * @n: network
+ * @a: route attributes (not cached)
+ * @pref: route preference or -1 to use the protocol default
+ *
+ * The attributes are entered into the attribute cache and the
+ * resulting route is marked copy-on-write, just like the routes
+ * the filters get from the routing table.
+ */
+void
+bench_add_route(net *n, rta *a, int pref)
+{
+  rte *e = rte_get_temp(rta_lookup(a));
+
+  e->net = n;
+  e->sender = a->proto;
+  e->flags |= REF_COW;
+  e->lastmod = now;
+  if (pref >= 0)
+    e->pref = pref;
+
+  if (bench_count == bench_size)
+    {
+      bench_size = bench_size ? 2*bench_size : 1024;
+      bench_routes = bench_routes ? mb_realloc(bench_res, bench_routes, bench_size * sizeof(rte *)) :
+	mb_alloc(bench_res, bench_size * sizeof(rte *));
+    }
+  bench_routes[bench_count++] = e;
+}
+
+/*
+ *	Reading the Configuration
+ */
+
+static int conf_fd;
+
+static int
+cf_read(byte *dest, unsigned int len)
+{
+  int l = read(conf_fd, dest, len);
+  if (l < 0)
+    cf_error("Read error");
+  return l;
+}
+
+static void
+read_config(char *name)
+{
+  struct config *conf = config_alloc(name);
+
+  conf_fd = open(name, O_RDONLY);
+  if (conf_fd < 0)
+    die("Unable to open configuration file %s: %m", name);
+  cf_read_hook = cf_read;
+  if (!config_parse(conf))
+    die("%s, line %d: %s", name, conf->err_lino, conf->err_msg);
+  close(conf_fd);
+  bench_config = conf;
+  roa_commit(conf, NULL);
+}
+
+static struct filter *
+find_filter(char *name)
+{
+  struct symbol *sym = cf_find_symbol(name);
+  struct filter *f;
+
+  switch (sym->class)
+    {
+    case SYM_FILTER:
+      f = sym->def;
+      break;
+    case SYM_PROTO:
+      f = ((struct proto_config *) sym->def)->in_filter;
+      break;
+    default:
+      die("%s is neither a filter nor a protocol", name);
+    }
+  if (f == FILTER_ACCEPT || f == FILTER_REJECT)
+    die("%s: Nothing to benchmark, the filter is trivial", name);
+  return f;
+}
+
+/*
+ *	Loading the Routes
+ */
+
+static void
+load_routes(char *name, int mrt)
+{
+  FILE *f = fopen(name, "r");
+
+  if (!f)
+    die("Unable to open route dump %s: %m", name);
+
+  init_list(&bench_protos);
+  fib_init(&bench_fib, bench_res, sizeof(net), 0, NULL);
+
+  if (mrt || dump_is_mrt(f))
+    dump_load_mrt(f);
+  else
+    dump_load_text(f);
+  fclose(f);
+  lp_flush(bench_pool);
+}
+
+/*
+ *	Running the Filter
+ */
+
+static void
+bench_run(struct filter *filter, int iterations)
+{
+  unsigned verdicts[F_QUITBIRD+1];
+  unsigned modified = 0, allocs = 0;
+  u64 mem = 0, mem_max = 0, start, time;
+  unsigned i, u;
+  int n, res;
+
+  bzero(verdicts, sizeof(verdicts));
+  for (i=0; i<bench_count; i++)
+    {
+      rte *e = bench_routes[i];
+      ea_list *tmpa = NULL;
+
+      res = f_run(filter, &e, &tmpa, bench_pool, 0);
+      verdicts[(res <= F_QUITBIRD) ? res : F_ERROR]++;
+      if (e != bench_routes[i])
+	{
+	  modified++;
+	  rte_free(e);
+	}
+      if (u = lp_used(bench_pool))
+	{
+	  allocs++;
+	  mem += u;
+	  if (u > mem_max)
+	    mem_max = u;
+	}
+      lp_flush(bench_pool);
+    }
+
+  start = tm_current_usec();
+  for (n=0; n<iterations; n++)
+    for (i=0; i<bench_count; i++)
+      {
+	rte *e = bench_routes[i];
+	ea_list *tmpa = NULL;
+
+	f_run(filter, &e, &tmpa, bench_pool, 0);
+	if (e != bench_routes[i])
+	  rte_free(e);
+	lp_flush(bench_pool);
+      }
+  time = tm_current_usec() - start;
+
+  printf("Filter:      %s\n", filter->name);
+  printf("Routes:      %u (%u attributes ignored)\n", bench_count, bench_ignored_attrs);
+  printf("Verdicts:    %u accepted, %u rejected, %u errors, %u modified\n",
+	 verdicts[F_NOP] + verdicts[F_NONL] + verdicts[F_ACCEPT], verdicts[F_REJECT],
+	 verdicts[F_ERROR] + verdicts[F_QUITBIRD], modified);
+  printf("Temp memory: %u runs allocated, %llu bytes per run on average, %llu bytes max\n",
+	 allocs, (unsigned long long) (allocs ? mem / allocs : 0), (unsigned long long) mem_max);
+  printf("Time:        %d iterations in %llu.%03u ms",
+	 iterations, (unsigned long long) (time / 1000), (unsigned) (time % 1000));
+  if (time)
+    printf(", %.0f routes/s, %.1f ns/route",
+	   (double) bench_count * iterations * 1000000 / time,
+	   (double) time * 1000 / ((double) bench_count * iterations));
+  printf("\n");
+}
+
+/*
+ *	Parsing Command-Line Arguments
+ */
+
+static char *opt_list = "c:dmn:";
+static char *config_name = PATH_CONFIG;
+static int iterations = 10;
+static int force_mrt;
+
+static void
+usage(void)
+{
+  fprintf(stderr, "Usage: fbench [-c <config-file>] [-d] [-m] [-n <iterations>] <filter> <route-dump>\n");
+  exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct filter *f;
+  int c;
+
+  log_init_debug(NULL);
+  while ((c = getopt(argc, argv, opt_list)) >= 0)
+    switch (c)
+      {
+      case 'c':
+	config_name = optarg;
+	break;
+      case 'd':
+	log_init_debug("");
+	break;
+      case 'm':
+	force_mrt = 1;
+	break;
+      case 'n':
+	iterations = atoi(optarg);
+	if (iterations <= 0)
+	  usage();
+	break;
+      default:
+	usage();
+      }
+  if (optind != argc - 2)
+    usage();
+
+  log_init(1, 1);
+
+  resource_init();
+  olock_init();
+  io_init();
+  rt_init();
+  roa_init();
+  if_init();
+
+  protos_build();
+  proto_build(&proto_unix_kernel);
+  proto_build(&proto_unix_iface);
+
+  read_config(config_name);
+  f = find_filter(argv[optind]);
+
+  bench_res = rp_new(&root_pool, "Benchmark");
+  bench_pool = lp_new(bench_res, 4080);
+  load_routes(argv[optind+1], force_mrt);
+  if (!bench_count)
+    die("No routes found in %s", argv[optind+1]);
+
+  bench_run(f, iterations);
+  return 0;
+}
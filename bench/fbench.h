@@ -0,0 +1,24 @@
+/*
+ *	BIRD -- Filter Benchmark
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_FBENCH_H_
+#define _BIRD_FBENCH_H_
+
+#include <stdio.h>
+
+extern pool *bench_res;
+extern linpool *bench_pool;
+extern unsigned bench_ignored_attrs;
+
+net *bench_get_net(ip_addr prefix, int pxlen);
+struct proto *bench_get_proto(char *name);
+void bench_add_route(net *n, rta *a, int pref);
+
+int dump_is_mrt(FILE *f);
+void dump_load_text(FILE *f);
+void dump_load_mrt(FILE *f);
+
+#endif
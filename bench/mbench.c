@@ -0,0 +1,645 @@
+/*
+ *	BIRD -- Microbenchmarks of Core Data Structures
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Microbenchmarks
+ *
+ * The microbenchmark program (built and run by |make bench|) measures
+ * the basic operations the daemon spends its time in: FIB lookups and
+ * walks, the route attribute cache, extended attribute lists, AS paths
+ * and community sets, prefix tries of filters, the memory allocators
+ * and OSPF LSA checksums. It's linked with the same code as the daemon
+ * but without the I/O loop.
+ *
+ * All input data are generated from a fixed seed, so the results of two
+ * versions are comparable. Each benchmark group is run several times
+ * (|-r|) and the fastest run is reported, as it's the least disturbed
+ * one. The results are written as tab-separated lines of the benchmark
+ * name, the number of operations and nanoseconds per operation, preceded
+ * by comment lines starting with |#| which describe the build.
+ * The groups to run can be selected by name prefixes given as arguments.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "nest/bird.h"
+#include "lib/lists.h"
+#include "lib/resource.h"
+#include "lib/string.h"
+#include "lib/timer.h"
+#include "lib/unaligned.h"
+#include "nest/route.h"
+#include "nest/protocol.h"
+#include "nest/attrs.h"
+#include "conf/conf.h"
+#include "filter/filter.h"
+#include "proto/bgp/bgp.h"
+#include "sysdep/unix/unix.h"
+
+#ifdef CONFIG_OSPF
+#include "proto/ospf/ospf.h"
+#endif
+
+#define MB_MAX_RESULTS 64
+
+struct mb_result {
+  char *name;
+  unsigned ops;
+  u64 time;				/* Best time over all repeats, in microseconds */
+};
+
+static struct mb_result mb_results[MB_MAX_RESULTS];
+static unsigned mb_result_count;
+static unsigned mb_size = 1000000;	/* Number of entries of large tables (-n) */
+static pool *mb_pool;
+static u32 mb_seed;
+
+/* Xorshift generator, so that the data don't depend on the C library */
+static inline u32
+mb_random(void)
+{
+  mb_seed ^= mb_seed << 13;
+  mb_seed ^= mb_seed >> 17;
+  mb_seed ^= mb_seed << 5;
+  return mb_seed;
+}
+
+static inline ip_addr
+mb_addr(u32 x)
+{
+#ifdef IPV6
+  return ipa_build(0x20010db8, x, 0, 0);
+#else
+  return ipa_from_u32(x);
+#endif
+}
+
+/* Prefix lengths roughly as in the IPv4 Internet routing table */
+static int
+mb_pxlen(void)
+{
+  u32 r = mb_random() % 100;
+
+  if (r < 55)
+    return 24;
+  if (r < 70)
+    return 22 + r % 2;
+  if (r < 90)
+    return 16 + r % 6;
+  return 8 + r % 8;
+}
+
+static void
+mb_report(char *name, unsigned ops, u64 start)
+{
+  u64 time = tm_current_usec() - start;
+  unsigned i;
+
+  for (i = 0; i < mb_result_count; i++)
+    if (!strcmp(mb_results[i].name, name))
+      {
+	if (time < mb_results[i].time)
+	  mb_results[i].time = time;
+	return;
+      }
+
+  ASSERT(mb_result_count < MB_MAX_RESULTS);
+  mb_results[mb_result_count++] = (struct mb_result) { name, ops, time };
+}
+
+static volatile u64 mb_sink;		/* Keeps results of the measured calls alive */
+
+/*
+ *	FIB
+ */
+
+static void
+mb_fib(void)
+{
+  pool *p = rp_new(mb_pool, "FIB");
+  ip_addr *px = mb_alloc(p, mb_size * sizeof(ip_addr));
+  byte *len = mb_alloc(p, mb_size);
+  ip_addr *dst = mb_alloc(p, mb_size * sizeof(ip_addr));
+  struct fib f;
+  unsigned i, cnt = 0;
+  u64 start;
+
+  for (i = 0; i < mb_size; i++)
+    {
+      len[i] = mb_pxlen();
+      px[i] = ipa_and(mb_addr(mb_random()), ipa_mkmask(len[i]));
+      dst[i] = mb_addr(mb_random());
+    }
+  fib_init(&f, p, sizeof(struct fib_node), 0, NULL);
+
+  start = tm_current_usec();
+  for (i = 0; i < mb_size; i++)
+    fib_get(&f, &px[i], len[i]);
+  mb_report("fib_get", mb_size, start);
+
+  start = tm_current_usec();
+  for (i = 0; i < mb_size; i++)
+    cnt += !!fib_find(&f, &px[i], len[i]);
+  mb_report("fib_find", mb_size, start);
+
+  start = tm_current_usec();
+  for (i = 0; i < mb_size; i++)
+    cnt += !!fib_find(&f, &dst[i], 24);
+  mb_report("fib_find_miss", mb_size, start);
+
+  /* Each lookup tries all prefix lengths, so it's run fewer times */
+  start = tm_current_usec();
+  for (i = 0; i < mb_size / 16; i++)
+    cnt += !!fib_route(&f, dst[i], BITS_PER_IP_ADDRESS);
+  mb_report("fib_route", mb_size / 16, start);
+
+  start = tm_current_usec();
+  i = 0;
+  FIB_WALK(&f, n)
+    {
+      cnt += n->pxlen;
+      i++;
+    }
+  FIB_WALK_END;
+  mb_report("fib_walk", i, start);
+
+  mb_sink += cnt;
+  rfree(p);
+}
+
+/*
+ *	Route Attributes
+ */
+
+#define MB_RTA_SETS 20000		/* Distinct attribute sets */
+#define MB_RTA_ROUTES 200000		/* Routes referring to them */
+
+static ea_list *
+mb_bgp_attrs(linpool *lp)
+{
+  unsigned plen = 1 + mb_random() % 4 + mb_random() % 4;
+  unsigned ccnt = (mb_random() % 10 < 4) ? 1 + mb_random() % 6 : 0;
+  int med = mb_random() % 2;
+  ea_list *l = lp_allocz(lp, sizeof(ea_list) + 6 * sizeof(eattr));
+  struct adata *ad;
+  unsigned i;
+
+  l->attrs[l->count++] = (eattr) { .id = EA_CODE(EAP_BGP, BA_ORIGIN), .flags = BAF_TRANSITIVE,
+				   .type = EAF_TYPE_INT, .u.data = mb_random() % 3 };
+
+  ad = lp_alloc(lp, sizeof(struct adata) + 2 + 4 * plen);
+  ad->length = 2 + 4 * plen;
+  ad->data[0] = AS_PATH_SEQUENCE;
+  ad->data[1] = plen;
+  for (i = 0; i < plen; i++)
+    put_u32(ad->data + 2 + 4*i, 64512 + (mb_random() % 1000) * (mb_random() % 8 + 1));
+  l->attrs[l->count++] = (eattr) { .id = EA_CODE(EAP_BGP, BA_AS_PATH), .flags = BAF_TRANSITIVE,
+				   .type = EAF_TYPE_AS_PATH, .u.ptr = ad };
+
+  ad = lp_alloc(lp, sizeof(struct adata) + sizeof(ip_addr));
+  ad->length = sizeof(ip_addr);
+  *(ip_addr *) ad->data = mb_addr(0xc0000200 + mb_random() % 32);
+  l->attrs[l->count++] = (eattr) { .id = EA_CODE(EAP_BGP, BA_NEXT_HOP), .flags = BAF_TRANSITIVE,
+				   .type = EAF_TYPE_IP_ADDRESS, .u.ptr = ad };
+
+  l->attrs[l->count++] = (eattr) { .id = EA_CODE(EAP_BGP, BA_LOCAL_PREF), .flags = BAF_TRANSITIVE,
+				   .type = EAF_TYPE_INT, .u.data = (mb_random() % 10) ? 100 : 200 };
+
+  if (med)
+    l->attrs[l->count++] = (eattr) { .id = EA_CODE(EAP_BGP, BA_MULTI_EXIT_DISC), .flags = BAF_OPTIONAL,
+				     .type = EAF_TYPE_INT, .u.data = mb_random() % 1000 };
+
+  if (ccnt)
+    {
+      ad = lp_alloc(lp, sizeof(struct adata) + 4 * ccnt);
+      ad->length = 4 * ccnt;
+      for (i = 0; i < ccnt; i++)
+	((u32 *) ad->data)[i] = (65000 << 16) | (mb_random() % 200);
+      l->attrs[l->count++] = (eattr) { .id = EA_CODE(EAP_BGP, BA_COMMUNITY), .flags = BAF_OPTIONAL | BAF_TRANSITIVE,
+				       .type = EAF_TYPE_INT_SET, .u.ptr = ad };
+    }
+
+  return l;
+}
+
+static void
+mb_rta(void)
+{
+  pool *p = rp_new(mb_pool, "Attributes");
+  linpool *lp = lp_new(p, 4080);
+  struct proto *src = mb_allocz(p, sizeof(struct proto));
+  ea_list **sets = mb_alloc(p, MB_RTA_SETS * sizeof(ea_list *));
+  u32 *use = mb_alloc(p, MB_RTA_ROUTES * sizeof(u32));
+  rta **res = mb_alloc(p, MB_RTA_ROUTES * sizeof(rta *));
+  rta a;
+  unsigned i;
+  u64 start;
+
+  src->name = "mbench";
+  for (i = 0; i < MB_RTA_SETS; i++)
+    {
+      sets[i] = mb_bgp_attrs(lp);
+      ea_sort(sets[i]);
+    }
+
+  /* A few attribute sets are shared by many routes, most by a few */
+  for (i = 0; i < MB_RTA_ROUTES; i++)
+    {
+      u64 r = mb_random() % 65536;
+      use[i] = (r * r * r / 65536 / 65536) * MB_RTA_SETS / 65536;
+    }
+
+  bzero(&a, sizeof(a));
+  a.proto = src;
+  a.source = RTS_BGP;
+  a.scope = SCOPE_UNIVERSE;
+  a.cast = RTC_UNICAST;
+  a.dest = RTD_ROUTER;
+
+  start = tm_current_usec();
+  for (i = 0; i < MB_RTA_ROUTES; i++)
+    {
+      ea_list *e = sets[use[i]];
+      a.gw = *(ip_addr *) ea_find(e, EA_CODE(EAP_BGP, BA_NEXT_HOP))->u.ptr->data;
+      a.from = a.gw;
+      a.eattrs = e;
+      res[i] = rta_lookup(&a);
+    }
+  mb_report("rta_lookup", MB_RTA_ROUTES, start);
+
+  start = tm_current_usec();
+  for (i = 0; i < MB_RTA_ROUTES; i++)
+    rta_free(res[i]);
+  mb_report("rta_free", MB_RTA_ROUTES, start);
+
+  rfree(p);
+}
+
+/*
+ *	Extended Attribute Lists
+ */
+
+#define MB_EA_OPS 1000000
+
+static void
+mb_ea(void)
+{
+  pool *p = rp_new(mb_pool, "Extended attributes");
+  linpool *lp = lp_new(p, 4080);
+  ea_list *base, *tmp, *extra, *merged;
+  unsigned i, size, cnt = 0;
+  u64 start;
+
+  base = mb_bgp_attrs(lp);
+  while (base->count < 6)
+    base = mb_bgp_attrs(lp);
+
+  /* Reverse order, so that sorting has some work to do */
+  size = sizeof(ea_list) + base->count * sizeof(eattr);
+  tmp = lp_alloc(lp, size);
+  memcpy(tmp, base, size);
+  for (i = 0; i < base->count; i++)
+    tmp->attrs[i] = base->attrs[base->count - 1 - i];
+  base = tmp;
+  tmp = lp_alloc(lp, size);
+
+  start = tm_current_usec();
+  for (i = 0; i < MB_EA_OPS; i++)
+    {
+      memcpy(tmp, base, size);
+      ea_sort(tmp);
+    }
+  mb_report("ea_sort", MB_EA_OPS, start);
+
+  start = tm_current_usec();
+  for (i = 0; i < MB_EA_OPS; i++)
+    cnt += !!ea_find(tmp, EA_CODE(EAP_BGP, (i & 1) ? BA_LOCAL_PREF : BA_ORIGINATOR_ID));
+  mb_report("ea_find", MB_EA_OPS, start);
+
+  /* Temporary attributes on top of the route attributes, as filters make them */
+  extra = lp_allocz(lp, sizeof(ea_list) + 2 * sizeof(eattr));
+  extra->count = 2;
+  extra->attrs[0] = (eattr) { .id = EA_CODE(EAP_BGP, BA_LOCAL_PREF), .type = EAF_TYPE_INT, .u.data = 300 };
+  extra->attrs[1] = (eattr) { .id = EA_CODE(EAP_GENERIC, 0), .type = EAF_TYPE_INT, .u.data = 1 };
+  extra->next = tmp;
+  merged = lp_alloc(lp, ea_scan(extra));
+
+  start = tm_current_usec();
+  for (i = 0; i < MB_EA_OPS; i++)
+    {
+      ea_merge(extra, merged);
+      ea_sort(merged);
+      cnt += merged->count;
+    }
+  mb_report("ea_merge", MB_EA_OPS, start);
+
+  mb_sink += cnt;
+  rfree(p);
+}
+
+/*
+ *	AS Paths and Community Sets
+ */
+
+#define MB_PATH_OPS 1000000
+
+static void
+mb_paths(void)
+{
+  pool *p = rp_new(mb_pool, "Paths");
+  linpool *lp = lp_new(p, 4080);
+  linpool *tlp = lp_new(p, 4080);	/* Results of the measured calls, flushed regularly */
+  struct adata *path = lp_allocz(lp, sizeof(struct adata));
+  struct adata *set = lp_allocz(lp, sizeof(struct adata));
+  struct f_path_mask m[3];
+  unsigned i, cnt = 0, n;
+  u32 as;
+  u64 start;
+
+  for (i = 0; i < 6; i++)
+    path = as_path_prepend(lp, path, 64512 + mb_random() % 1000);
+  for (i = 0; i < 20; i++)
+    set = int_set_add(lp, set, (65000 << 16) | (mb_random() % 1000));
+  n = int_set_get_size(set);
+
+  /* Mask [= * 65001 * =] */
+  m[0] = (struct f_path_mask) { &m[1], PM_ASTERISK, 0, NULL };
+  m[1] = (struct f_path_mask) { &m[2], PM_ASN, 65001, NULL };
+  m[2] = (struct f_path_mask) { NULL, PM_ASTERISK, 0, NULL };
+  as_path_mask_compile(lp, m);
+
+  start = tm_current_usec();
+  for (i = 0; i < MB_PATH_OPS; i++)
+    {
+      cnt += as_path_prepend(tlp, path, 65000)->length;
+      if ((i & 1023) == 1023)
+	lp_flush(tlp);
+    }
+  mb_report("as_path_prepend", MB_PATH_OPS, start);
+  lp_flush(tlp);
+
+  start = tm_current_usec();
+  for (i = 0; i < MB_PATH_OPS; i++)
+    cnt += as_path_getlen(path);
+  mb_report("as_path_getlen", MB_PATH_OPS, start);
+
+  start = tm_current_usec();
+  for (i = 0; i < MB_PATH_OPS; i++)
+    cnt += as_path_get_last(path, &as);
+  mb_report("as_path_get_last", MB_PATH_OPS, start);
+
+  start = tm_current_usec();
+  for (i = 0; i < MB_PATH_OPS; i++)
+    cnt += as_path_is_member(path, 65001);
+  mb_report("as_path_is_member", MB_PATH_OPS, start);
+
+  start = tm_current_usec();
+  for (i = 0; i < MB_PATH_OPS; i++)
+    cnt += as_path_match(path, m);
+  mb_report("as_path_match", MB_PATH_OPS, start);
+
+  start = tm_current_usec();
+  for (i = 0; i < MB_PATH_OPS; i++)
+    cnt += int_set_contains(set, (65000 << 16) | (i % 1000));
+  mb_report("int_set_contains", MB_PATH_OPS, start);
+
+  start = tm_current_usec();
+  for (i = 0; i < MB_PATH_OPS; i++)
+    {
+      cnt += int_set_add(tlp, set, (65001 << 16) | (i % 1000))->length;
+      if ((i & 1023) == 1023)
+	lp_flush(tlp);
+    }
+  mb_report("int_set_add", MB_PATH_OPS, start);
+  lp_flush(tlp);
+
+  start = tm_current_usec();
+  for (i = 0; i < MB_PATH_OPS; i++)
+    {
+      cnt += int_set_del(tlp, set, ((u32 *) set->data)[i % n])->length;
+      if ((i & 1023) == 1023)
+	lp_flush(tlp);
+    }
+  mb_report("int_set_del", MB_PATH_OPS, start);
+
+  mb_sink += cnt;
+  rfree(p);
+}
+
+/*
+ *	Prefix Tries
+ */
+
+static void
+mb_trie(void)
+{
+  pool *p = rp_new(mb_pool, "Trie");
+  unsigned n = mb_size / 10;
+  struct f_prefix *px = mb_alloc(p, mb_size * sizeof(struct f_prefix));
+  struct f_trie *t;
+  unsigned i, cnt = 0;
+  u64 start;
+
+  /* The trie allocates from the configuration memory */
+  cfg_mem = lp_new(p, 4080);
+
+  for (i = 0; i < n; i++)
+    {
+      int l = mb_pxlen();
+      px[i].ip = ipa_and(mb_addr(mb_random()), ipa_mkmask(l));
+      px[i].len = l | LEN_PLUS;
+    }
+
+  start = tm_current_usec();
+  t = f_new_trie();
+  for (i = 0; i < n; i++)
+    trie_add_prefix(t, &px[i]);
+  mb_report("trie_add_prefix", n, start);
+
+  for (i = 0; i < mb_size; i++)
+    {
+      int l = mb_pxlen();
+      px[i].ip = ipa_and(mb_addr(mb_random()), ipa_mkmask(l));
+      px[i].len = l;
+    }
+
+  start = tm_current_usec();
+  for (i = 0; i < mb_size; i++)
+    cnt += trie_match_prefix(t, &px[i]);
+  mb_report("trie_match_prefix", mb_size, start);
+
+  cfg_mem = NULL;
+  mb_sink += cnt;
+  rfree(p);
+}
+
+/*
+ *	Memory Allocators
+ */
+
+#define MB_ALLOC_BATCH 1024
+#define MB_ALLOC_OPS (1024*MB_ALLOC_BATCH)
+
+static void
+mb_alloc_bench(void)
+{
+  pool *p = rp_new(mb_pool, "Allocators");
+  slab *s = sl_new(p, 64);
+  linpool *lp = lp_new(p, 4080);
+  void **obj = mb_alloc(p, MB_ALLOC_BATCH * sizeof(void *));
+  unsigned i, j;
+  u64 start;
+
+  start = tm_current_usec();
+  for (i = 0; i < MB_ALLOC_OPS / MB_ALLOC_BATCH; i++)
+    {
+      for (j = 0; j < MB_ALLOC_BATCH; j++)
+	obj[j] = sl_alloc(s);
+      for (j = 0; j < MB_ALLOC_BATCH; j++)
+	sl_free(s, obj[MB_ALLOC_BATCH - 1 - j]);
+    }
+  mb_report("sl_alloc_free", MB_ALLOC_OPS, start);
+
+  start = tm_current_usec();
+  for (i = 0; i < MB_ALLOC_OPS / MB_ALLOC_BATCH; i++)
+    {
+      for (j = 0; j < MB_ALLOC_BATCH; j++)
+	obj[j] = lp_alloc(lp, 16 + 8 * (j % 32));
+      lp_flush(lp);
+    }
+  mb_report("lp_alloc", MB_ALLOC_OPS, start);
+
+  rfree(p);
+}
+
+/*
+ *	OSPF
+ */
+
+#ifdef CONFIG_OSPF
+
+#define MB_LSA_LINKS 64
+#define MB_LSA_OPS 100000
+
+static void
+mb_lsasum(void)
+{
+  unsigned blen = sizeof(struct ospf_lsa_rt) + MB_LSA_LINKS * sizeof(struct ospf_lsa_rt_link);
+  struct ospf_lsa_header h;
+  u32 *body = xmalloc(blen);
+  unsigned i;
+  u64 start;
+
+  for (i = 0; i < blen / 4; i++)
+    body[i] = mb_random();
+  bzero(&h, sizeof(h));
+  h.id = 0x01020304;
+  h.rt = 0x01020304;
+  h.sn = LSA_INITSEQNO;
+  h.length = sizeof(h) + blen;
+
+  start = tm_current_usec();
+  for (i = 0; i < MB_LSA_OPS; i++)
+    lsasum_calculate(&h, body);
+  mb_report("lsasum_calculate", MB_LSA_OPS, start);
+
+  mb_sink += h.checksum;
+  xfree(body);
+}
+
+#endif
+
+/*
+ *	Running the Benchmarks
+ */
+
+struct mb_group {
+  char *name;
+  void (*run)(void);
+};
+
+static struct mb_group mb_groups[] = {
+  { "fib", mb_fib },
+  { "rta", mb_rta },
+  { "ea", mb_ea },
+  { "path", mb_paths },
+  { "trie", mb_trie },
+  { "alloc", mb_alloc_bench },
+#ifdef CONFIG_OSPF
+  { "lsasum", mb_lsasum },
+#endif
+  { NULL, NULL }
+};
+
+static void
+usage(void)
+{
+  fprintf(stderr, "Usage: mbench [-n <entries>] [-r <repeats>] [<group>...]\n");
+  exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct mb_group *g;
+  int repeats = 3;
+  int c, i, r;
+
+  log_init_debug(NULL);
+  while ((c = getopt(argc, argv, "n:r:")) >= 0)
+    switch (c)
+      {
+      case 'n':
+	mb_size = atoi(optarg);
+	if (mb_size < 1000)
+	  usage();
+	break;
+      case 'r':
+	repeats = atoi(optarg);
+	if (repeats <= 0)
+	  usage();
+	break;
+      default:
+	usage();
+      }
+
+  log_init(1, 1);
+  resource_init();
+  io_init();
+  rt_init();
+  mb_pool = rp_new(&root_pool, "Microbenchmarks");
+
+  for (g = mb_groups; g->name; g++)
+    {
+      for (i = optind; i < argc; i++)
+	if (!strncmp(argv[i], g->name, strlen(argv[i])))
+	  break;
+      if ((optind < argc) && (i == argc))
+	continue;
+
+      for (r = 0; r < repeats; r++)
+	{
+	  mb_seed = 0x2f6b4a1d;
+	  g->run();
+	}
+    }
+
+  printf("# BIRD %s microbenchmarks\n", BIRD_VERSION);
+#ifdef IPV6
+  printf("# ipv6 1\n");
+#else
+  printf("# ipv6 0\n");
+#endif
+  printf("# entries %u\n", mb_size);
+  printf("# repeats %d\n", repeats);
+  printf("# name\tops\tns/op\n");
+  for (i = 0; i < mb_result_count; i++)
+    printf("%s\t%u\t%.1f\n", mb_results[i].name, mb_results[i].ops,
+	   (double) mb_results[i].time * 1000 / mb_results[i].ops);
+  return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ *	BIRD -- Benchmarks: Placeholders for the Unix Entry Point
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#include "nest/bird.h"
+#include "lib/lists.h"
+#include "nest/cli.h"
+#include "conf/conf.h"
+#include "sysdep/unix/unix.h"
+
+/*
+ *	The rest of the daemon expects these to be supplied by the Unix
+ *	entry point. The benchmarks never get to the I/O loop nor the CLI,
+ *	so they are just placeholders.
+ */
+
+void async_config(void) { }
+void async_dump(void) { }
+void async_shutdown(void) { }
+void cmd_reconfig(char *name UNUSED, int type UNUSED) { }
+void cmd_shutdown(void) { }
+int sysdep_commit(struct config *new UNUSED, struct config *old UNUSED) { return 0; }
+void sysdep_shutdown_done(void) { }
+void cli_write_trigger(cli *c UNUSED) { }
+int cli_get_command(cli *c UNUSED) { return 0; }
+
+void
+sysdep_preconfig(struct config *c)
+{
+  init_list(&c->logfiles);
+}
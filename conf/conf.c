@@ -29,7 +29,9 @@
  * to get a new &config structure, then use config_parse() to parse a
  * configuration file and fill all fields of the structure
  * and finally ask the config manager to switch to the new
- * config by calling config_commit().
+ * config by calling config_commit(). A large configuration can also be
+ * parsed in the background by config_parse_async(), so that routing isn't
+ * stalled while the new configuration is being read.
  *
  * CLI commands are parsed in a very similar way -- there is also a stripped-down
  * &config structure associated with them and they are lex-ed and parsed by the
@@ -46,6 +48,7 @@
 #include "nest/route.h"
 #include "nest/protocol.h"
 #include "nest/iface.h"
+#include "nest/roa.h"
 #include "lib/resource.h"
 #include "lib/string.h"
 #include "lib/event.h"
@@ -87,6 +90,29 @@ config_alloc(byte *name)
   return c;
 }
 
+static void
+config_parse_begin(struct config *c)
+{
+  cf_lex_init(0);
+  sysdep_preconfig(c);
+  protos_preconfig(c);
+  rt_preconfig(c);
+  roa_preconfig(c);
+}
+
+static void
+config_parse_end(struct config *c)
+{
+  protos_postconfig(c);
+  filters_postconfig(c);
+  if (EMPTY_LIST(c->protos))
+    cf_error("No protocol is specified in the config file");
+#ifdef IPV6
+  if (!c->router_id)
+    cf_error("Router ID must be configured manually on IPv6 routers");
+#endif
+}
+
 /**
  * config_parse - parse a configuration
  * @c: configuration
@@ -103,26 +129,154 @@ config_alloc(byte *name)
 int
 config_parse(struct config *c)
 {
+  struct cf_pstate *ps = cf_pstate_new();
+
   DBG("Parsing configuration file `%s'\n", c->file_name);
   new_config = c;
   cfg_mem = c->mem;
   if (setjmp(conf_jmpbuf))
+    {
+      cf_pstate_delete(ps);
+      return 0;
+    }
+  config_parse_begin(c);
+  cf_parse_tokens(ps, 0);
+  config_parse_end(c);
+  cf_pstate_delete(ps);
+  return 1;
+}
+
+/*
+ *	Parsing in the background
+ */
+
+#define CONFIG_PARSE_SLICE 2048		/* Tokens parsed in a single run of the parse event */
+
+static struct config *parse_config;	/* Configuration being parsed in the background */
+static struct cf_pstate *parse_state;
+static int (*parse_read_hook)(byte *buf, unsigned int max);
+static void (*parse_done)(struct config *, int);
+static event *parse_event;
+static event_list parse_wait_list;	/* Events postponed until parsing finishes */
+
+static void
+config_parse_finish(int res)
+{
+  struct config *c = parse_config;
+
+  ev_postpone(parse_event);
+  if (parse_state)
+    cf_pstate_delete(parse_state);
+  parse_state = NULL;
+  parse_config = NULL;
+  add_tail_list(&global_event_list, &parse_wait_list);
+  init_list(&parse_wait_list);
+  parse_done(c, res);
+}
+
+static void
+config_parse_cont(void *unused UNUSED)
+{
+  struct config *c = parse_config;
+
+  new_config = c;
+  cfg_mem = c->mem;
+  cf_read_hook = parse_read_hook;
+  if (setjmp(conf_jmpbuf))
+    {
+      config_parse_finish(0);
+      return;
+    }
+  if (!parse_state)
+    {
+      DBG("Parsing configuration file `%s' in background\n", c->file_name);
+      parse_state = cf_pstate_new();
+      config_parse_begin(c);
+    }
+  if (cf_parse_tokens(parse_state, CONFIG_PARSE_SLICE))
+    {
+      ev_schedule(parse_event);
+      return;
+    }
+  config_parse_end(c);
+  config_parse_finish(1);
+}
+
+/**
+ * config_parse_async - parse a configuration in the background
+ * @c: configuration
+ * @done: function to be called when parsing finishes
+ *
+ * config_parse_async() does the same as config_parse(), but instead
+ * of parsing the whole configuration at once, it parses it in slices of
+ * %CONFIG_PARSE_SLICE tokens from an event, so that protocols keep running
+ * while a large configuration is being read. The input is read by the
+ * @cf_read_hook set at the time of the call. When parsing finishes,
+ * @done is called with the configuration and the result of parsing
+ * as returned by config_parse(). The running configuration is not touched
+ * until the caller decides to commit the new one.
+ *
+ * CLI commands are handled by the same lexer and parser, so they have to
+ * wait until parsing finishes (see config_parse_wait()). Only one configuration
+ * can be parsed in the background at a time.
+ */
+void
+config_parse_async(struct config *c, void (*done)(struct config *, int))
+{
+  ASSERT(!parse_config);
+  if (!parse_event)
+    {
+      parse_event = ev_new(&root_pool);
+      parse_event->hook = config_parse_cont;
+      ev_init_list(&parse_wait_list);
+    }
+  parse_config = c;
+  parse_read_hook = cf_read_hook;
+  parse_done = done;
+  ev_schedule(parse_event);
+}
+
+/**
+ * config_parse_busy - test whether a configuration is being parsed
+ *
+ * Returns 1 if there is a configuration being parsed in the background
+ * (see config_parse_async()), 0 otherwise.
+ */
+int
+config_parse_busy(void)
+{
+  return !!parse_config;
+}
+
+/**
+ * config_parse_wait - wait for background parsing to finish
+ * @e: event
+ *
+ * If there is a configuration being parsed in the background, @e is put
+ * aside, scheduled again after parsing finishes and the function returns 1.
+ * Otherwise, it returns 0 and the caller can use the parser right away.
+ */
+int
+config_parse_wait(event *e)
+{
+  if (!parse_config)
     return 0;
-  cf_lex_init(0);
-  sysdep_preconfig(c);
-  protos_preconfig(c);
-  rt_preconfig(c);
-  cf_parse();
-  protos_postconfig(c);
-  if (EMPTY_LIST(c->protos))
-    cf_error("No protocol is specified in the config file");
-#ifdef IPV6
-  if (!c->router_id)
-    cf_error("Router ID must be configured manually on IPv6 routers");
-#endif
+  ev_enqueue(&parse_wait_list, e);
   return 1;
 }
 
+/*
+ * If there is a configuration being parsed in the background, stop
+ * parsing and report a failure to the @done hook, which is expected
+ * to check @shutting_down for the reason.
+ */
+static void
+config_parse_abort(void)
+{
+  if (parse_config)
+    config_parse_finish(0);
+}
+
 /**
  * cli_parse - parse a CLI command
  * @c: temporary config structure
@@ -133,13 +287,19 @@ config_parse(struct config *c)
 int
 cli_parse(struct config *c)
 {
+  struct cf_pstate *ps = cf_pstate_new();
+
   new_config = c;
-  c->sym_fallback = config->sym_hash;
+  c->sym_fallback = config;
   cfg_mem = c->mem;
   if (setjmp(conf_jmpbuf))
-    return 0;
+    {
+      cf_pstate_delete(ps);
+      return 0;
+    }
   cf_lex_init(1);
-  cf_parse();
+  cf_parse_tokens(ps, 0);
+  cf_pstate_delete(ps);
   return 1;
 }
 
@@ -210,8 +370,12 @@ config_do_commit(struct config *c, int type)
   force_restart |= global_commit(c, old_config);
   DBG("rt_commit\n");
   rt_commit(c, old_config);
+  DBG("roa_commit\n");
+  roa_commit(c, old_config);
   DBG("protos_commit\n");
   protos_commit(c, old_config, force_restart, type);
+  if (!old_config)
+    rt_snapshot_restore(c);
   new_config = NULL;			/* Just to be sure nobody uses that now */
   if (old_config)
     nobs = --old_config->obstacle_count;
@@ -333,6 +497,7 @@ order_shutdown(void)
   init_list(&c->tables);
   c->shutdown = 1;
   shutting_down = 1;
+  config_parse_abort();
   config_commit(c, RECONFIG_HARD);
   shutting_down = 2;
 }
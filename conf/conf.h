@@ -12,6 +12,8 @@
 #include "lib/resource.h"
 #include "lib/timer.h"
 
+struct event;
+
 /* Configuration structure */
 
 struct config {
@@ -19,8 +21,12 @@ struct config {
   linpool *mem;				/* Linear pool containing configuration data */
   list protos;				/* Configured protocol instances (struct proto_config) */
   list tables;				/* Configured routing tables (struct rtable_config) */
+  list roa_tables;			/* Configured ROA tables (struct roa_table_config) */
   list logfiles;			/* Configured log fils (sysdep) */
+  unsigned log_buffer;			/* Size of the log ring, 0 means synchronous logging (sysdep) */
+  int log_drop;				/* Drop messages when the log ring is full (sysdep) */
   int mrtdump_file;			/* Configured MRTDump file (sysdep, fd in unix) */
+  char *metrics_socket;			/* Path of the metrics socket (sysdep) */
   struct rtable_config *master_rtc;	/* Configuration of master routing table */
 
   u32 router_id;			/* Our Router ID */
@@ -29,17 +35,23 @@ struct config {
   u32 listen_bgp_flags;			/* Listening BGP socket should use these flags */
   unsigned proto_default_debug;		/* Default protocol debug mask */
   unsigned proto_default_mrtdump;	/* Default protocol mrtdump mask */
+  unsigned proto_default_trace;		/* Default protocol binary trace mask */
   struct timeformat tf_route;		/* Time format for 'show route' */
   struct timeformat tf_proto;		/* Time format for 'show protocol' */
   struct timeformat tf_log;		/* Time format for the logfile */
   struct timeformat tf_base;		/* Time format for other purposes */
 
   int cli_debug;			/* Tracing of CLI connections and commands */
+  int filter_profile;			/* Collect filter profiling statistics */
+  unsigned latency_sample;		/* Trace every n-th route change, 0 means never */
+  int latency_log;			/* Log every traced latency */
   char *err_msg;			/* Parser error message */
   int err_lino;				/* Line containing error */
   char *file_name;			/* Name of configuration file */
   struct symbol **sym_hash;		/* Lexer: symbol hash table */
-  struct symbol **sym_fallback;		/* Lexer: fallback symbol hash table */
+  unsigned int sym_hash_size;		/* Lexer: number of buckets of the symbol hash table */
+  unsigned int sym_count;		/* Lexer: number of symbols in the hash table */
+  struct config *sym_fallback;		/* Lexer: config to search for symbols not defined here */
   int obstacle_count;			/* Number of items blocking freeing of this config */
   int shutdown;				/* This is a pseudo-config for daemon shutdown */
   bird_clock_t load_time;		/* When we've got this configuration */
@@ -56,6 +68,9 @@ extern bird_clock_t boot_time;
 
 struct config *config_alloc(byte *name);
 int config_parse(struct config *);
+void config_parse_async(struct config *, void (*done)(struct config *, int));
+int config_parse_busy(void);
+int config_parse_wait(struct event *);
 int cli_parse(struct config *);
 void config_free(struct config *);
 int config_commit(struct config *, int type);
@@ -87,6 +102,7 @@ extern int (*cf_read_hook)(byte *buf, unsigned int max);
 struct symbol {
   struct symbol *next;
   struct sym_scope *scope;
+  unsigned int hash;			/* Hash of the name, see cf_hash() */
   int class;
   int aux;
   void *aux2;
@@ -102,6 +118,7 @@ struct symbol {
 #define SYM_FILTER 4
 #define SYM_TABLE 5
 #define SYM_IPA 6
+#define SYM_ROA 7
 
 #define SYM_VARIABLE 0x100	/* 0x100-0x1ff are variable types */
 
@@ -116,10 +133,14 @@ void cf_push_scope(struct symbol *);
 void cf_pop_scope(void);
 struct symbol *cf_walk_symbols(struct config *cf, struct symbol *sym, int *pos);
 char *cf_symbol_class_name(struct symbol *sym);
+void cf_stmt_fingerprint(u64 *dest);
 
 /* Parser */
 
-int cf_parse(void);
+struct cf_pstate;
+struct cf_pstate *cf_pstate_new(void);
+void cf_pstate_delete(struct cf_pstate *);
+int cf_parse_tokens(struct cf_pstate *, int max);
 
 /* Sysdep hooks */
 
@@ -56,6 +56,9 @@ m4_divert(0)DNL
 m4_undivert(1)DNL
 %}
 
+%define api.pure
+%define api.push-pull push
+
 m4_undivert(2)DNL
 
 %%
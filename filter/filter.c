@@ -43,8 +43,12 @@
 #include "nest/protocol.h"
 #include "nest/iface.h"
 #include "nest/attrs.h"
+#include "nest/cli.h"
+#include "nest/roa.h"
 #include "conf/conf.h"
 #include "filter/filter.h"
+#include "proto/bgp/bgp.h"
+#include "lib/probe.h"
 
 #define P(a,b) ((a<<8) | b)
 
@@ -296,6 +300,8 @@ static struct rte **f_rte, *f_rte_old;
 static struct linpool *f_pool;
 static struct ea_list **f_tmp_attrs;
 static int f_flags;
+static u32 *f_line_hits;
+static int f_lines;
 
 /*
  * rta_cow - prepare rta for modification by filter
@@ -364,6 +370,9 @@ interpret(struct f_inst *what)
   if (!what)
     return res;
 
+  if (f_line_hits && (what->lineno < f_lines))
+    f_line_hits[what->lineno]++;
+
   switch(what->code) {
   case ',':
     TWOARGS;
@@ -744,7 +753,7 @@ interpret(struct f_inst *what)
     return res;
   case P('c','a'): /* CALL: this is special: if T_RETURN and returning some value, mask it out  */
     ONEARG;
-    res = interpret(what->a2.p);
+    res = interpret(((struct f_function *) what->a2.p)->body);
     if (res.type == T_RETURN)
       return res;
     res.type &= ~T_RETURN;    
@@ -819,6 +828,40 @@ interpret(struct f_inst *what)
     }
     break;
 
+  case P('R','C'):	/* ROA check */
+    {
+      struct roa_table *rt = ((struct f_inst_roa_check *) what)->rtc->table;
+      ip_addr prefix;
+      int pxlen;
+      u32 asn = 0;
+
+      if (what->arg1)
+	{
+	  TWOARGS;
+	  if ((v1.type != T_PREFIX) || (v2.type != T_INT))
+	    runtime("Invalid argument to roa_check()");
+	  prefix = v1.val.px.ip;
+	  pxlen = v1.val.px.len;
+	  asn = v2.val.i;
+	}
+      else
+	{
+	  /* Check the route itself, the origin AS is the last one in its AS path */
+	  eattr *e = ea_find((*f_rte)->attrs->eattrs, EA_CODE(EAP_BGP, BA_AS_PATH));
+	  if (!e || e->type != EAF_TYPE_AS_PATH)
+	    runtime("Missing AS_PATH attribute");
+	  prefix = (*f_rte)->net->n.prefix;
+	  pxlen = (*f_rte)->net->n.pxlen;
+	  as_path_get_last(e->u.ptr, &asn);
+	}
+
+      if (!rt)
+	runtime("Missing ROA table");
+      res.type = T_ENUM_ROA;
+      res.val.i = roa_check(rt, prefix, pxlen, asn);
+    }
+    break;
+
   default:
     bug( "Unknown instruction %d (%c)", what->code, what->code & 0xff);
   }
@@ -838,6 +881,27 @@ interpret(struct f_inst *what)
 
 #define A2_SAME if (f1->a2.i != f2->a2.i) return 0;
 
+/*
+ * Each function is compared only once, no matter how many times it is called.
+ * While comparing the body, the function is assumed to be same, which
+ * terminates the recursion of self-calling functions.
+ */
+static int
+f_function_same(struct f_function *new, struct f_function *old)
+{
+  if (new == old)
+    return 1;
+  if (new->hash != old->hash)
+    return 0;
+  if (new->cmp != old)
+    {
+      new->cmp = old;
+      new->cmp_same = 1;
+      new->cmp_same = i_same(new->body, old->body);
+    }
+  return new->cmp_same;
+}
+
 /*
  * i_same - function that does real comparing of instruction trees, you should call filter_same from outside
  */
@@ -852,7 +916,7 @@ i_same(struct f_inst *f1, struct f_inst *f2)
     return 0;
   if (f1->code != f2->code)
     return 0;
-  if (f1 == f2)		/* It looks strange, but it is possible with call rewriting trickery */
+  if (f1 == f2)
     return 1;
 
   switch(f1->code) {
@@ -929,12 +993,7 @@ i_same(struct f_inst *f1, struct f_inst *f2)
 
   case 'r': ONEARG; break;
   case P('c','p'): ONEARG; break;
-  case P('c','a'): /* Call rewriting trickery to avoid exponential behaviour */
-             ONEARG; 
-	     if (!i_same(f1->a2.p, f2->a2.p))
-	       return 0; 
-	     f2->a2.p = f1->a2.p;
-	     break;
+  case P('c','a'): ONEARG; if (!f_function_same(f1->a2.p, f2->a2.p)) return 0; break;
   case P('c','v'): break; /* internal instruction */ 
   case P('S','W'): ONEARG; if (!same_tree(f1->a2.p, f2->a2.p)) return 0; break;
   case P('i','M'): TWOARGS; break;
@@ -942,12 +1001,208 @@ i_same(struct f_inst *f1, struct f_inst *f2)
   case P('C','a'): TWOARGS; break;
   case P('a','f'):
   case P('a','l'): ONEARG; break;
+  case P('R','C'):
+    TWOARGS;
+    /* Tables are compared by name, as in the case of variables */
+    if (strcmp(((struct f_inst_roa_check *) f1)->rtc->name,
+	       ((struct f_inst_roa_check *) f2)->rtc->name))
+      return 0;
+    break;
   default:
     bug( "Unknown instruction %d in same (%c)", f1->code, f1->code & 0xff);
   }
   return i_same(f1->next, f2->next);
 }
 
+/*
+ *	Structural hashes
+ */
+
+static inline u64
+h_mix(u64 h, u32 x)
+{
+  return (h ^ x) * 0x100000001b3ULL;
+}
+
+static inline u64
+h_mix64(u64 h, u64 x)
+{
+  return h_mix(h_mix(h, x), x >> 32);
+}
+
+static u64
+h_ip(u64 h, ip_addr a)
+{
+  u32 w[sizeof(ip_addr) / 4];
+  unsigned i;
+
+  memcpy(w, &a, sizeof(ip_addr));
+  for (i=0; i < sizeof(ip_addr) / 4; i++)
+    h = h_mix(h, w[i]);
+  return h;
+}
+
+static u64
+h_str(u64 h, char *s)
+{
+  while (*s)
+    h = h_mix(h, *s++);
+  return h_mix(h, 0);
+}
+
+static u64
+h_val(u64 h, struct f_val v)
+{
+  h = h_mix(h, v.type);
+  switch (v.type)
+    {
+    case T_ENUM:
+    case T_INT:
+    case T_BOOL:
+    case T_PAIR:
+      return h_mix(h, v.val.i);
+    case T_IP:
+      return h_ip(h, v.val.px.ip);
+    case T_PREFIX:
+      return h_mix(h_ip(h, v.val.px.ip), v.val.px.len);
+    case T_STRING:
+      return h_str(h, v.val.s);
+    default:
+      return h;
+    }
+}
+
+static u64 h_inst(u64 h, struct f_inst *f);
+
+static u64
+h_tree(u64 h, struct f_tree *t)
+{
+  if (!t)
+    return h_mix(h, 0);
+  h = h_mix(h, 1);
+  h = h_val(h, t->from);
+  h = h_val(h, t->to);
+  h = h_tree(h, t->left);
+  h = h_tree(h, t->right);
+  return h_inst(h, t->data);
+}
+
+static u64
+h_trie_node(u64 h, struct f_trie_node *n)
+{
+  if (!n)
+    return h_mix(h, 0);
+  h = h_mix(h, n->plen + 1);
+  h = h_ip(h, n->addr);
+  h = h_ip(h, n->accept);
+  h = h_trie_node(h, n->c[0]);
+  return h_trie_node(h, n->c[1]);
+}
+
+#define HARG(y) h = h_inst(h, f->y);
+#define HONEARG HARG(a1.p)
+#define HTWOARGS HARG(a1.p) HARG(a2.p)
+#define HA2 h = h_mix(h, f->a2.i);
+
+/*
+ * h_inst - the hashing counterpart of i_same(). It must never take into
+ * account anything i_same() ignores, so that same instruction trees
+ * always get the same hash.
+ */
+static u64
+h_inst(u64 h, struct f_inst *f)
+{
+  for (; f; f = f->next)
+    {
+      h = h_mix(h, f->code);
+      h = h_mix(h, f->aux);
+      switch (f->code) {
+      case ',':
+      case '+':
+      case '-':
+      case '*':
+      case '/':
+      case '|':
+      case '&':
+      case P('m','p'):
+      case P('!','='):
+      case P('=','='):
+      case '<':
+      case P('<','='): HTWOARGS; break;
+
+      case '!': HONEARG; break;
+      case '~': HTWOARGS; break;
+      case P('d','e'): HONEARG; break;
+
+      case 's':
+	HARG(a2.p);
+	{
+	  struct symbol *sym = f->a1.p;
+	  h = h_mix(h_str(h, sym->name), sym->class);
+	}
+	break;
+
+      case 'c':
+	switch (f->aux) {
+	case T_PREFIX_SET:
+	  {
+	    struct f_trie *t = f->a2.p;
+	    h = h_trie_node(h_mix(h, t->zero), &t->root);
+	  }
+	  break;
+	case T_SET: h = h_tree(h, f->a2.p); break;
+	case T_STRING: h = h_str(h, f->a2.p); break;
+	default: HA2;
+	}
+	break;
+      case 'C': h = h_val(h, * (struct f_val *) f->a1.p); break;
+      case 'V': h = h_str(h, f->a2.p); break;
+      case 'p': case 'L': HONEARG; break;
+      case '?': HTWOARGS; break;
+      case '0': case 'E': break;
+      case P('p',','): HONEARG; HA2; break;
+      case 'P':
+      case 'a': HA2; break;
+      case P('e','a'): HA2; break;
+      case P('P','S'):
+      case P('a','S'):
+      case P('e','S'): HONEARG; HA2; break;
+
+      case 'r': HONEARG; break;
+      case P('c','p'): HONEARG; break;
+      case P('c','a'): HONEARG; h = h_mix64(h, ((struct f_function *) f->a2.p)->hash); break;
+      case P('c','v'): break;
+      case P('S','W'): HONEARG; h = h_tree(h, f->a2.p); break;
+      case P('i','M'): HTWOARGS; break;
+      case P('A','p'): HTWOARGS; break;
+      case P('C','a'): HTWOARGS; break;
+      case P('a','f'):
+      case P('a','l'): HONEARG; break;
+      case P('R','C'): HTWOARGS; h = h_str(h, ((struct f_inst_roa_check *) f)->rtc->name); break;
+      default:
+	bug( "Unknown instruction %d in hash (%c)", f->code, f->code & 0xff);
+      }
+    }
+  return h_mix(h, 0);
+}
+
+/**
+ * i_hash - compute structural hash of an instruction tree
+ * @f: the instruction tree
+ *
+ * The hash covers everything i_same() compares, including contents
+ * of constant sets. Calls of functions are represented by the hash
+ * of the function called, so the hash of a filter changes whenever
+ * any function it depends on changes. It's computed once when the
+ * filter is parsed, so filter_same() can tell changed filters
+ * without walking them.
+ */
+u64
+i_hash(struct f_inst *f)
+{
+  return h_inst(0xcbf29ce484222325ULL, f);
+}
+
 /**
  * f_run - external entry point to filters
  * @filter: pointer to filter to run
@@ -955,12 +1210,17 @@ i_same(struct f_inst *f1, struct f_inst *f2)
  * @rte: pointer to pointer to &rte being filtered. When route is modified, this is changed with rte_cow().
  * @tmp_pool: all filter allocations go from this pool
  * @flags: flags
+ *
+ * When filter profiling is enabled, the run is accounted to the
+ * filter's &f_stats.
  */
 int
 f_run(struct filter *filter, struct rte **rte, struct ea_list **tmp_attrs, struct linpool *tmp_pool, int flags)
 {
   struct f_inst *inst;
   struct f_val res;
+  struct f_stats *st = filter->stats;
+  u64 start = 0;
   DBG( "Running filter `%s'...", filter->name );
 
   f_flags = flags;
@@ -969,7 +1229,26 @@ f_run(struct filter *filter, struct rte **rte, struct ea_list **tmp_attrs, struc
   f_rte_old = *rte;
   f_pool = tmp_pool;
   inst = filter->root;
+  if (st)
+    {
+      f_line_hits = st->line_hits;
+      f_lines = st->lines;
+      start = tm_current_usec();
+    }
   res = interpret(inst);
+  if (st)
+    {
+      f_line_hits = NULL;
+      st->time += tm_current_usec() - start;
+      st->runs++;
+      if ((res.type != T_RETURN) || (res.val.i == F_ERROR))
+	st->errors++;
+      else if (res.val.i == F_ACCEPT)
+	st->accepted++;
+      else
+	st->rejected++;
+    }
+  PROBE2(filter_done, filter->name, (res.type == T_RETURN) ? res.val.i : F_ERROR);
   if (res.type != T_RETURN) {
     log( L_ERR "Filter %s did not return accept nor reject. Make up your mind", filter->name); 
     return F_ERROR;
@@ -1007,12 +1286,15 @@ f_eval_asn(struct f_inst *expr)
 /**
  * filter_same - compare two filters
  * @new: first filter to be compared
- * @old: second filter to be compared, notice that this filter is
- * damaged while comparing.
+ * @old: second filter to be compared
  *
  * Returns 1 in case filters are same, otherwise 0. If there are
  * underlying bugs, it will rather say 0 on same filters than say
  * 1 on different.
+ *
+ * Filters with different structural hashes are different. Otherwise
+ * the instruction trees are compared, but only once for each pair of
+ * filters, so a filter shared by many protocols costs a single walk.
  */
 int
 filter_same(struct filter *new, struct filter *old)
@@ -1022,5 +1304,203 @@ filter_same(struct filter *new, struct filter *old)
   if (old == FILTER_ACCEPT || old == FILTER_REJECT ||
       new == FILTER_ACCEPT || new == FILTER_REJECT)
     return 0;
-  return i_same(new->root, old->root);
+  if (new->hash != old->hash)
+    return 0;
+  if (new->cmp != old)
+    {
+      new->cmp = old;
+      new->cmp_same = i_same(new->root, old->root);
+    }
+  return new->cmp_same;
+}
+
+/*
+ *	Filter profiling
+ */
+
+static inline int
+f_is_anonymous(struct filter *f)
+{
+  return (f != FILTER_ACCEPT) && (f != FILTER_REJECT) && !f->name;
+}
+
+static void
+f_stats_init(struct filter *f, u32 *hits, int lines)
+{
+  if (f == FILTER_ACCEPT || f == FILTER_REJECT || f->stats)
+    return;
+
+  f->stats = cfg_allocz(sizeof(struct f_stats));
+  f->stats->line_hits = hits;
+  f->stats->lines = lines;
+}
+
+/**
+ * filters_postconfig - prepare filters of a new configuration
+ * @c: new configuration
+ *
+ * If filter profiling is enabled in @c, allocate statistics for all
+ * named filters and for all anonymous filters of protocols. All of them
+ * share one array of per-line hit counters covering the whole config.
+ */
+void
+filters_postconfig(struct config *c)
+{
+  struct proto_config *pc;
+  struct symbol *sym = NULL;
+  int pos = 0;
+  int lines = conf_lino + 1;
+  u32 *hits;
+
+  if (!c->filter_profile)
+    return;
+
+  hits = cfg_allocz(lines * sizeof(u32));
+  if (c->sym_hash)
+    while (sym = cf_walk_symbols(c, sym, &pos))
+      if (sym->class == SYM_FILTER)
+	f_stats_init(sym->def, hits, lines);
+  WALK_LIST(pc, c->protos)
+    {
+      f_stats_init(pc->in_filter, hits, lines);
+      f_stats_init(pc->out_filter, hits, lines);
+    }
+}
+
+static void
+f_show_stats(char *name, char *dir, struct filter *f, int lines)
+{
+  struct f_stats *st;
+  int i;
+
+  if (f == FILTER_ACCEPT || f == FILTER_REJECT || !(st = f->stats))
+    return;
+
+  cli_msg(-1018, "%-16s %-6s %10u %10u %10u %10u %12Lu %8Lu", name, dir,
+	  st->runs, st->accepted, st->rejected, st->errors,
+	  st->time, st->runs ? st->time * 1000 / st->runs : (u64) 0);
+
+  if (lines)
+    for (i = f->first_line; (i <= f->last_line) && (i < st->lines); i++)
+      if (st->line_hits[i])
+	cli_msg(-1018, "  line %-6d %10u", i, st->line_hits[i]);
+}
+
+/**
+ * filters_show_stats - show filter profiling statistics
+ * @sym: filter or protocol to show, %NULL for all filters
+ *
+ * Implements the |show filter stats| CLI command. For a single filter
+ * (or filters of a single protocol), per-line instruction counts
+ * are listed as well.
+ */
+void
+filters_show_stats(struct symbol *sym)
+{
+  struct proto_config *pc;
+  int pos = 0;
+
+  if (!config->filter_profile)
+    {
+      cli_msg(8008, "Filter profiling is disabled");
+      return;
+    }
+  if (sym && (sym->class != SYM_FILTER) && (sym->class != SYM_PROTO))
+    {
+      cli_msg(9002, "%s is not a filter or a protocol", sym->name);
+      return;
+    }
+
+  cli_msg(-2018, "%-16s %-6s %10s %10s %10s %10s %12s %8s", "filter", "dir",
+	  "runs", "accepted", "rejected", "errors", "time[us]", "avg[ns]");
+  if (sym && (sym->class == SYM_FILTER))
+    f_show_stats(sym->name, "", sym->def, 1);
+  else if (sym)
+    {
+      pc = sym->def;
+      f_show_stats(pc->name, "import", pc->in_filter, 1);
+      f_show_stats(pc->name, "export", pc->out_filter, 1);
+    }
+  else
+    {
+      while (sym = cf_walk_symbols(config, sym, &pos))
+	if (sym->class == SYM_FILTER)
+	  f_show_stats(sym->name, "", sym->def, 0);
+      WALK_LIST(pc, config->protos)
+	{
+	  if (f_is_anonymous(pc->in_filter))
+	    f_show_stats(pc->name, "import", pc->in_filter, 0);
+	  if (f_is_anonymous(pc->out_filter))
+	    f_show_stats(pc->name, "export", pc->out_filter, 0);
+	}
+    }
+  cli_msg(0, "");
+}
+
+static struct f_stats *
+f_reset_stats(struct filter *f, int lines)
+{
+  struct f_stats *st;
+  int i;
+
+  if (f == FILTER_ACCEPT || f == FILTER_REJECT || !(st = f->stats))
+    return NULL;
+
+  st->runs = st->accepted = st->rejected = st->errors = 0;
+  st->time = 0;
+  if (lines)
+    for (i = f->first_line; (i <= f->last_line) && (i < st->lines); i++)
+      st->line_hits[i] = 0;
+  return st;
+}
+
+/**
+ * filters_reset_stats - reset filter profiling statistics
+ * @sym: filter or protocol, %NULL for all filters
+ *
+ * Implements the |reset filter stats| CLI command.
+ */
+void
+filters_reset_stats(struct symbol *sym)
+{
+  struct proto_config *pc;
+  struct f_stats *st = NULL;
+  int pos = 0;
+
+  if (cli_access_restricted())
+    return;
+
+  if (!config->filter_profile)
+    {
+      cli_msg(8008, "Filter profiling is disabled");
+      return;
+    }
+  if (sym && (sym->class == SYM_FILTER))
+    f_reset_stats(sym->def, 1);
+  else if (sym && (sym->class == SYM_PROTO))
+    {
+      pc = sym->def;
+      f_reset_stats(pc->in_filter, 1);
+      f_reset_stats(pc->out_filter, 1);
+    }
+  else if (sym)
+    {
+      cli_msg(9002, "%s is not a filter or a protocol", sym->name);
+      return;
+    }
+  else
+    {
+      /* All filters share the line counters, clear them at once */
+      while (sym = cf_walk_symbols(config, sym, &pos))
+	if (sym->class == SYM_FILTER)
+	  st = f_reset_stats(sym->def, 0) ? : st;
+      WALK_LIST(pc, config->protos)
+	{
+	  st = f_reset_stats(pc->in_filter, 0) ? : st;
+	  st = f_reset_stats(pc->out_filter, 0) ? : st;
+	}
+      if (st)
+	memset(st->line_hits, 0, st->lines * sizeof(u32));
+    }
+  cli_msg(17, "Filter statistics reset");
 }
@@ -56,15 +56,46 @@ struct f_val {
   } val;
 };
 
+struct f_stats {
+  u32 runs;				/* Number of evaluations */
+  u32 accepted, rejected, errors;	/* Results of evaluations */
+  u64 time;				/* Time spent in the filter (in microseconds) */
+  u32 *line_hits;			/* Instructions executed per config line */
+  int lines;				/* Size of @line_hits */
+};
+
 struct filter {
   char *name;
   struct f_inst *root;
+  u64 hash;				/* Structural hash, see i_hash() */
+  struct filter *cmp;			/* Filter we have been last compared with by filter_same() */
+  int cmp_same;				/* ... and the result */
+  struct f_stats *stats;		/* Profiling counters, NULL if profiling is off */
+  u32 roa_deps;				/* ROA tables used by the filter, see roa_deps_mask() */
+  int first_line, last_line;		/* Where the filter is defined */
+};
+
+struct f_function {
+  struct f_inst *body;
+  u64 hash;				/* Structural hash of the body */
+  u32 roa_deps;				/* ROA tables used by the function */
+  struct f_function *cmp;		/* Function we have been last compared with */
+  int cmp_same;				/* ... and the result */
+};
+
+struct roa_table_config;
+struct symbol;
+
+struct f_inst_roa_check {
+  struct f_inst i;
+  struct roa_table_config *rtc;
 };
 
 struct f_inst *f_new_inst(void);
 struct f_inst *f_new_dynamic_attr(int type, int f_type, int code);	/* Type as core knows it, type as filters know it, and code of dynamic attribute */
 struct f_tree *f_new_tree(void);
 struct f_inst *f_generate_complex(int operation, int operation_aux, struct f_inst *dyn, struct f_inst *argument);
+struct f_inst *f_generate_roa_check(struct symbol *sym, struct f_inst *prefix, struct f_inst *asn);
 
 struct f_tree *build_tree(struct f_tree *);
 struct f_tree *find_tree(struct f_tree *t, struct f_val val);
@@ -86,7 +117,13 @@ u32 f_eval_asn(struct f_inst *expr);
 char *filter_name(struct filter *filter);
 int filter_same(struct filter *new, struct filter *old);
 
+struct config;
+void filters_postconfig(struct config *c);
+void filters_show_stats(struct symbol *sym);
+void filters_reset_stats(struct symbol *sym);
+
 int i_same(struct f_inst *f1, struct f_inst *f2);
+u64 i_hash(struct f_inst *f);
 void f_prefix_get_bounds(struct f_prefix *px, int *l, int *h);
 
 void f_prefix_get_bounds(struct f_prefix *px, int *l, int *h);
@@ -104,6 +141,9 @@ void val_print(struct f_val v);
 #define FILTER_ACCEPT NULL
 #define FILTER_REJECT ((void *) 1)
 
+static inline u32 filter_roa_deps(struct filter *f)
+{ return (f && f != FILTER_REJECT) ? f->roa_deps : 0; }
+
 /* Type numbers must be in 0..0xff range */
 #define T_MASK 0xff
 
@@ -125,6 +165,7 @@ void val_print(struct f_val v);
 #define T_ENUM_SCOPE 0x32
 #define T_ENUM_RTC 0x33
 #define T_ENUM_RTD 0x34
+#define T_ENUM_ROA 0x35
 /* new enums go here */
 #define T_ENUM_EMPTY 0x3f	/* Special hack for atomic_aggr */
 
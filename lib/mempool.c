@@ -43,13 +43,15 @@ struct linpool {
 static void lp_free(resource *);
 static void lp_dump(resource *);
 static resource *lp_lookup(resource *, unsigned long);
+static unsigned long lp_memsize(resource *);
 
 static struct resclass lp_class = {
   "LinPool",
   sizeof(struct linpool),
   lp_free,
   lp_dump,
-  lp_lookup
+  lp_lookup,
+  lp_memsize
 };
 
 /**
@@ -174,6 +176,28 @@ lp_allocz(linpool *m, unsigned size)
   return z;
 }
 
+/**
+ * lp_used - get amount of memory taken from a &linpool
+ * @m: linear memory pool
+ *
+ * This function returns the number of bytes allocated from @m since
+ * its creation or the last lp_flush(), including alignment padding
+ * and unused tails of the chunks left behind.
+ */
+unsigned
+lp_used(linpool *m)
+{
+  struct lp_chunk *c;
+  unsigned used = m->total_large;
+
+  for (c = m->first; c && c != m->current; c = c->next)
+    if (m->ptr >= c->data && m->ptr <= c->data + c->size)
+      used += m->ptr - c->data;
+    else
+      used += c->size;
+  return used;
+}
+
 /**
  * lp_flush - flush a linear memory pool
  * @m: linear memory pool
@@ -235,6 +259,22 @@ lp_dump(resource *r)
 	m->total_large);
 }
 
+static unsigned long
+lp_memsize(resource *r)
+{
+  linpool *m = (linpool *) r;
+  struct lp_chunk *c;
+  int cnt = 0;
+
+  for(c=m->first; c; c=c->next)
+    cnt++;
+  for(c=m->first_large; c; c=c->next)
+    cnt++;
+  return ALLOC_OVERHEAD + sizeof(struct linpool) +
+    cnt * (ALLOC_OVERHEAD + sizeof(struct lp_chunk)) +
+    m->total + m->total_large;
+}
+
 static resource *
 lp_lookup(resource *r, unsigned long a)
 {
@@ -34,11 +34,11 @@ static int skip_atoi(const char **s)
 
 #define do_div(n,base) ({ \
 int __res; \
-__res = ((unsigned long) n) % (unsigned) base; \
-n = ((unsigned long) n) / (unsigned) base; \
+__res = ((u64) n) % (unsigned) base; \
+n = ((u64) n) / (unsigned) base; \
 __res; })
 
-static char * number(char * str, long num, int base, int size, int precision,
+static char * number(char * str, s64 num, int base, int size, int precision,
 	int type, int remains)
 {
 	char c,sign,tmp[66];
@@ -121,7 +121,8 @@ static char * number(char * str, long num, int base, int size, int precision,
  * format specifiers: |%I| for formatting of IP addresses (any non-zero
  * width is automatically replaced by standard IP address width which
  * depends on whether we use IPv4 or IPv6; |%#I| gives hexadecimal format),
- * |%R| for Router / Network ID (u32 value printed as IPv4 address)
+ * |%R| for Router / Network ID (u32 value printed as IPv4 address),
+ * |L| qualifier for 64-bit integers (e.g. |%Lu| for u64)
  * and |%m| resp. |%M| for error messages (uses strerror() to translate @errno code to
  * message text). On the other hand, it doesn't support floating
  * point numbers.
@@ -132,7 +133,7 @@ static char * number(char * str, long num, int base, int size, int precision,
 int bvsnprintf(char *buf, int size, const char *fmt, va_list args)
 {
 	int len;
-	unsigned long num;
+	u64 num;
 	int i, base;
 	u32 x;
 	char *str, *start;
@@ -318,9 +319,13 @@ int bvsnprintf(char *buf, int size, const char *fmt, va_list args)
 				--fmt;
 			continue;
 		}
-		if (qualifier == 'l')
+		if (qualifier == 'L')
+			num = va_arg(args, u64);
+		else if (qualifier == 'l') {
 			num = va_arg(args, unsigned long);
-		else if (qualifier == 'h') {
+			if (flags & SIGN)
+				num = (long) num;
+		} else if (qualifier == 'h') {
 			num = (unsigned short) va_arg(args, int);
 			if (flags & SIGN)
 				num = (short) num;
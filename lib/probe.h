@@ -0,0 +1,41 @@
+/*
+ *	BIRD Library -- Static Tracing Probes
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_PROBE_H_
+#define _BIRD_PROBE_H_
+
+/*
+ *  When configured with --enable-probes, the PROBE macros define USDT
+ *  (SystemTap SDT) probes of provider "bird" which can be used by perf,
+ *  bpftrace or SystemTap. An inactive probe costs a single NOP, its
+ *  arguments are just left in registers or memory described by ELF notes.
+ *  Without the option, the macros expand to nothing and their arguments
+ *  are not evaluated at all.
+ *
+ *  Strings are passed as pointers, IP addresses as pointers to &ip_addr.
+ */
+
+#ifdef CONFIG_PROBES
+
+#include <sys/sdt.h>
+
+#define PROBE0(name)			STAP_PROBE(bird, name)
+#define PROBE1(name, a)			STAP_PROBE1(bird, name, a)
+#define PROBE2(name, a, b)		STAP_PROBE2(bird, name, a, b)
+#define PROBE3(name, a, b, c)		STAP_PROBE3(bird, name, a, b, c)
+#define PROBE4(name, a, b, c, d)	STAP_PROBE4(bird, name, a, b, c, d)
+
+#else
+
+#define PROBE0(name)			do { } while (0)
+#define PROBE1(name, a)			do { } while (0)
+#define PROBE2(name, a, b)		do { } while (0)
+#define PROBE3(name, a, b, c)		do { } while (0)
+#define PROBE4(name, a, b, c, d)	do { } while (0)
+
+#endif
+
+#endif
@@ -37,13 +37,15 @@ struct pool {
 static void pool_dump(resource *);
 static void pool_free(resource *);
 static resource *pool_lookup(resource *, unsigned long);
+static unsigned long pool_memsize(resource *);
 
 static struct resclass pool_class = {
   "Pool",
   sizeof(pool),
   pool_free,
   pool_dump,
-  pool_lookup
+  pool_lookup,
+  pool_memsize
 };
 
 pool root_pool;
@@ -107,6 +109,38 @@ pool_lookup(resource *P, unsigned long a)
   return NULL;
 }
 
+static unsigned long
+pool_memsize(resource *P)
+{
+  pool *p = (pool *) P;
+  resource *r;
+  unsigned long sum = sizeof(pool) + ALLOC_OVERHEAD;
+
+  WALK_LIST(r, p->inside)
+    sum += rmemsize(r);
+  return sum;
+}
+
+/**
+ * rp_walk - walk pools inside a pool
+ * @p: pool
+ * @hook: function to be called for each pool
+ * @data: data passed to the @hook
+ *
+ * rp_walk() calls @hook for each pool directly inside the pool @p
+ * (not recursively) with the name of the pool and the amount of memory
+ * used by the pool as returned by rmemsize().
+ */
+void
+rp_walk(pool *p, void (*hook)(void *data, char *name, unsigned long size), void *data)
+{
+  resource *r;
+
+  WALK_LIST(r, p->inside)
+    if (r->class == &pool_class)
+      hook(data, ((pool *) r)->name, rmemsize(r));
+}
+
 /**
  * rmove - move a resource
  * @res: resource
@@ -177,6 +211,31 @@ rdump(void *res)
     debug("NULL\n");
 }
 
+/**
+ * rmemsize - find out memory usage of a resource
+ * @res: resource
+ *
+ * This function returns the number of bytes of memory occupied
+ * by the given resource including the overhead of the memory
+ * allocator. For pools, the memory used by all the resources
+ * inside is included.
+ *
+ * It works by calling a class-specific memsize function,
+ * resources without one are accounted by the size of their
+ * structure.
+ */
+unsigned long
+rmemsize(void *res)
+{
+  resource *r = res;
+
+  if (!r)
+    return 0;
+  if (r->class->memsize)
+    return r->class->memsize(r);
+  return r->class->size + ALLOC_OVERHEAD;
+}
+
 /**
  * ralloc - create a resource
  * @p: pool to create the resource in
@@ -277,12 +336,21 @@ mbl_lookup(resource *r, unsigned long a)
   return NULL;
 }
 
+static unsigned long
+mbl_memsize(resource *r)
+{
+  struct mblock *m = (struct mblock *) r;
+
+  return ALLOC_OVERHEAD + sizeof(struct mblock) + m->size;
+}
+
 static struct resclass mb_class = {
   "Memory",
   0,
   mbl_free,
   mbl_debug,
-  mbl_lookup
+  mbl_lookup,
+  mbl_memsize
 };
 
 /**
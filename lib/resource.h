@@ -26,6 +26,7 @@ struct resclass {
   void (*free)(resource *);		/* Freeing function */
   void (*dump)(resource *);		/* Dump to debug output */
   resource *(*lookup)(resource *, unsigned long);	/* Look up address (only for debugging) */
+  unsigned long (*memsize)(resource *);	/* Return size of memory used by the resource, may be NULL */
 };
 
 /* Generic resource manipulation */
@@ -38,6 +39,8 @@ void rfree(void *);			/* Free single resource */
 void rdump(void *);			/* Dump to debug output */
 void rlookup(unsigned long);		/* Look up address (only for debugging) */
 void rmove(void *, pool *);		/* Move to a different pool */
+unsigned long rmemsize(void *res);	/* Return size of memory used by resource and its children */
+void rp_walk(pool *, void (*hook)(void *data, char *name, unsigned long size), void *data);
 
 void *ralloc(pool *, struct resclass *);
 
@@ -59,6 +62,7 @@ void *lp_alloc(linpool *, unsigned size);	/* Aligned */
 void *lp_allocu(linpool *, unsigned size);	/* Unaligned */
 void *lp_allocz(linpool *, unsigned size);	/* With clear */
 void lp_flush(linpool *);			/* Free everything, but leave linpool */
+unsigned lp_used(linpool *);			/* Bytes allocated since last flush */
 
 /* Slabs */
 
@@ -73,6 +77,8 @@ void sl_free(slab *, void *);
  * outside resource manager and possibly sysdep code.
  */
 
+#define ALLOC_OVERHEAD 8		/* Estimated overhead of a single xmalloc() */
+
 #ifdef HAVE_LIBDMALLOC
 /*
  * The standard dmalloc macros tend to produce lots of namespace
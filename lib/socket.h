@@ -38,6 +38,7 @@ typedef struct birdsock {
 
   ip_addr faddr;			/* For packet protocols: source of current packet */
   unsigned fport;
+  int rcv_ttl;				/* TTL of current packet, -1 if unknown (see SKF_TTL_RX) */
 
   int fd;				/* System-dependent data */
   node n;
@@ -78,6 +79,7 @@ sk_send_buffer_empty(sock *sk)
 /* Socket flags */
 
 #define SKF_V6ONLY	1	/* Use  IPV6_V6ONLY socket option */
+#define SKF_TTL_RX	2	/* Report TTL of received packets in rcv_ttl */
 
 
 /*
@@ -379,8 +379,8 @@ pm_mark(struct pm_pos *pos, int i, int plen, int *nl, int *nh)
  * is marked.
  */
 
-int
-as_path_match(struct adata *path, struct f_path_mask *mask)
+static int
+as_path_match_slow(struct adata *path, struct f_path_mask *mask)
 {
   struct pm_pos pos[2048 + 1];
   int plen = parse_path(path, pos);
@@ -439,3 +439,189 @@ as_path_match(struct adata *path, struct f_path_mask *mask)
 
   return pos[plen].mark;
 }
+
+
+/*
+ * Compiled path masks
+ *
+ * Most AS paths consist of AS_PATH_SEQUENCE segments only and then
+ * matching a path mask is an ordinary wildcard match of the mask
+ * against a string of ASNs. For such paths, we use a bit-parallel
+ * NFA compiled from the mask during configuration: state @i means
+ * that the first @i items of the mask have been matched, the set of
+ * active states is kept in a single word and ASNs are fed directly
+ * from the encoded path. Mask items with a fixed ASN are looked up in
+ * a small open-addressing hash table giving the set of states the
+ * ASN advances, so the cost per ASN does not depend on the number of
+ * ASNs in the mask. Items given by expressions are evaluated once per
+ * match. Paths containing AS_PATH_SET segments and masks longer than
+ * %PM_NFA_MAXLEN fall back to as_path_match_slow().
+ */
+
+#define PM_NFA_MAXLEN 31
+
+struct pm_nfa_asn {
+  u32 asn;
+  u32 states;				/* States advanced by this ASN, 0 for free slot */
+};
+
+struct pm_nfa {
+  u32 star;				/* States looping on any ASN ('*') */
+  u32 any;				/* States advanced by any ASN ('?') */
+  u32 expr;				/* States advanced by ASN given by an expression */
+  u32 final;				/* Accepting state */
+  u32 hash_mask;			/* Hash table size - 1 */
+  struct pm_nfa_asn hash[0];
+};
+
+static inline unsigned
+pm_nfa_hash(u32 asn, u32 hash_mask)
+{
+  return (asn * 0x9e3779b1) >> 16 & hash_mask;
+}
+
+static struct pm_nfa_asn *
+pm_nfa_find(struct pm_nfa *nfa, u32 asn)
+{
+  unsigned h = pm_nfa_hash(asn, nfa->hash_mask);
+
+  while (nfa->hash[h].states && nfa->hash[h].asn != asn)
+    h = (h + 1) & nfa->hash_mask;
+  return &nfa->hash[h];
+}
+
+/**
+ * as_path_mask_compile - prepare path mask for fast matching
+ * @pool: linear pool to allocate the automaton from
+ * @mask: path mask
+ *
+ * Compiles the path mask to an automaton used by as_path_match()
+ * and attaches it to the first item of the mask. Masks which cannot
+ * be compiled are left untouched and matched by the generic algorithm.
+ */
+void
+as_path_mask_compile(struct linpool *pool, struct f_path_mask *mask)
+{
+  struct f_path_mask *m;
+  struct pm_nfa *nfa;
+  struct pm_nfa_asn *a;
+  int i, len = 0;
+  unsigned size = 2;
+
+  if (!mask)
+    return;
+
+  for (m = mask; m; m = m->next)
+    len++;
+  if (len > PM_NFA_MAXLEN)
+    return;
+
+  while (size < 2 * len)
+    size *= 2;
+  nfa = lp_allocz(pool, sizeof(struct pm_nfa) + size * sizeof(struct pm_nfa_asn));
+  nfa->hash_mask = size - 1;
+  nfa->final = 1U << len;
+
+  for (m = mask, i = 0; m; m = m->next, i++)
+    switch (m->kind)
+      {
+      case PM_ASN:
+	a = pm_nfa_find(nfa, m->val);
+	a->asn = m->val;
+	a->states |= 1 << i;
+	break;
+      case PM_QUESTION:
+	nfa->any |= 1 << i;
+	break;
+      case PM_ASTERISK:
+	nfa->star |= 1 << i;
+	break;
+      case PM_ASN_EXPR:
+	nfa->expr |= 1 << i;
+	break;
+      }
+
+  mask->nfa = nfa;
+}
+
+/* Follow epsilon transitions: '*' may also match an empty sequence */
+static inline u32
+pm_nfa_closure(struct pm_nfa *nfa, u32 s)
+{
+  u32 t;
+
+  while ((t = s | ((s & nfa->star) << 1)) != s)
+    s = t;
+  return s;
+}
+
+static int
+pm_nfa_run(struct pm_nfa *nfa, struct f_path_mask *mask, struct adata *path)
+{
+  u8 *p = path->data;
+  u8 *q = p + path->length;
+  u32 expr_asn[PM_NFA_MAXLEN];
+  u32 s, adv, asn;
+  int i, len;
+
+  if (nfa->expr)
+    for (i = 0; mask; mask = mask->next, i++)
+      if (mask->kind == PM_ASN_EXPR)
+	expr_asn[i] = f_eval_asn((struct f_inst *) mask->val);
+
+  s = pm_nfa_closure(nfa, 1);
+  while (p < q)
+    {
+      p++;				/* Only sequences here */
+      len = *p++;
+      while (len--)
+	{
+	  asn = get_as(p);
+	  p += BS;
+
+	  adv = nfa->any | pm_nfa_find(nfa, asn)->states;
+	  if (nfa->expr)
+	    for (i = 0; (nfa->expr >> i) && (i < PM_NFA_MAXLEN); i++)
+	      if ((nfa->expr & (1 << i)) && (expr_asn[i] == asn))
+		adv |= 1 << i;
+
+	  s = pm_nfa_closure(nfa, ((s & adv) << 1) | (s & nfa->star));
+	  if (!s)
+	    return 0;
+	}
+    }
+
+  return !!(s & nfa->final);
+}
+
+static int
+as_path_has_sets(struct adata *path)
+{
+  u8 *p = path->data;
+  u8 *q = p + path->length;
+
+  while (p < q)
+    {
+      if (p[0] != AS_PATH_SEQUENCE)
+	return 1;
+      p += 2 + BS * p[1];
+    }
+  return 0;
+}
+
+/**
+ * as_path_match - match AS path against a path mask
+ * @path: AS path
+ * @mask: path mask
+ *
+ * Returns 1 if the path matches the mask, 0 otherwise. Uses the
+ * automaton prepared by as_path_mask_compile() when possible.
+ */
+int
+as_path_match(struct adata *path, struct f_path_mask *mask)
+{
+  if (mask && mask->nfa && !as_path_has_sets(path))
+    return pm_nfa_run(mask->nfa, mask, path);
+
+  return as_path_match_slow(path, mask);
+}
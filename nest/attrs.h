@@ -44,9 +44,11 @@ struct f_path_mask {
   struct f_path_mask *next;
   int kind;
   uintptr_t val;
+  struct pm_nfa *nfa;			/* Compiled mask, only in the first item */
 };
 
 int as_path_match(struct adata *path, struct f_path_mask *mask);
+void as_path_mask_compile(struct linpool *pool, struct f_path_mask *mask);
 
 /* a-set.c */
 
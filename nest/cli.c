@@ -42,7 +42,11 @@
  * an execution routine corresponding to the command, which either constructs
  * the whole reply and returns it back or (in case it expects the reply will be long)
  * it prints a partial reply and asks the CLI module (using the @cont hook)
- * to call it again when the output is transferred to the user.
+ * to call it again when the output is transferred to the user. Such
+ * a continuation should stop producing output when cli_tx_full() says
+ * that enough of it is already waiting for the user. Commands
+ * received while a new configuration is being parsed in the background
+ * wait until the parser is free again.
  *
  * The @this_cli variable points to a &cli structure of the session being
  * currently parsed, but it's of course available only in command handlers
@@ -95,9 +99,30 @@ cli_alloc_out(cli *c, int size)
       o->next = NULL;
     }
   o->wpos += size;
+  c->tx_size += size;
   return o->wpos - size;
 }
 
+static int
+cli_reply_prefix(cli *c, byte *buf, int code)
+{
+  int cd = code;
+  int size;
+
+  if (cd < 0)
+    {
+      cd = -cd;
+      if (cd == c->last_reply)
+	size = bsprintf(buf, " ");
+      else
+	size = bsprintf(buf, "%04d-", cd);
+    }
+  else
+    size = bsprintf(buf, "%04d ", cd);
+  c->last_reply = cd;
+  return size;
+}
+
 /**
  * cli_printf - send reply to a CLI connection
  * @c: CLI connection
@@ -121,20 +146,9 @@ cli_printf(cli *c, int code, char *msg, ...)
 {
   va_list args;
   byte buf[1024];
-  int cd = code;
   int size, cnt;
 
-  if (cd < 0)
-    {
-      cd = -cd;
-      if (cd == c->last_reply)
-	size = bsprintf(buf, " ");
-      else
-	size = bsprintf(buf, "%04d-", cd);
-    }
-  else
-    size = bsprintf(buf, "%04d ", cd);
-  c->last_reply = cd;
+  size = cli_reply_prefix(c, buf, code);
   va_start(args, msg);
   cnt = bvsnprintf(buf+size, sizeof(buf)-size-1, msg, args);
   va_end(args);
@@ -148,6 +162,32 @@ cli_printf(cli *c, int code, char *msg, ...)
   memcpy(cli_alloc_out(c, size), buf, size);
 }
 
+/**
+ * cli_put_line - send a preformatted line of reply
+ * @c: CLI connection
+ * @code: numeric code of the reply, negative for continuation lines
+ * @text: text of the line (not containing newlines)
+ * @len: its length
+ *
+ * This is a faster variant of cli_printf() for commands producing
+ * a lot of output formatted by themselves. The line is copied directly
+ * to the output buffers, so it must be shorter than %CLI_TX_BUF_SIZE.
+ */
+void
+cli_put_line(cli *c, int code, byte *text, unsigned int len)
+{
+  byte pfx[8];
+  int size = cli_reply_prefix(c, pfx, code);
+  byte *d;
+
+  ASSERT(size + len < CLI_TX_BUF_SIZE);
+  d = cli_alloc_out(c, size + len + 1);
+
+  memcpy(d, pfx, size);
+  memcpy(d + size, text, len);
+  d[size + len] = '\n';
+}
+
 static void
 cli_copy_message(cli *c)
 {
@@ -208,6 +248,7 @@ cli_free_out(cli *c)
     }
   c->tx_write = c->tx_pos = NULL;
   c->async_msg_size = 0;
+  c->tx_size = 0;
 }
 
 void
@@ -275,6 +316,8 @@ cli_event(void *data)
     ;
   else if (c->cont)
     c->cont(c);
+  else if (config_parse_wait(c->event))
+    ;				/* The parser is busy reading a new configuration */
   else
     {
       err = cli_get_command(c);
@@ -15,6 +15,7 @@
 #define CLI_RX_BUF_SIZE 4096
 #define CLI_TX_BUF_SIZE 4096
 #define CLI_MAX_ASYNC_QUEUE 4096
+#define CLI_MAX_CONT_QUEUE 16384	/* Continuations should stop when that much output is queued */
 
 struct cli_out {
   struct cli_out *next;
@@ -41,6 +42,7 @@ typedef struct cli {
   unsigned int log_mask;		/* Mask of allowed message levels */
   unsigned int log_threshold;		/* When free < log_threshold, store only important messages */
   unsigned int async_msg_size;		/* Total size of async messages queued in tx_buf */
+  unsigned int tx_size;			/* Total size of data queued in tx_buf */
 } cli;
 
 extern pool *cli_pool;
@@ -50,8 +52,14 @@ extern struct cli *this_cli;		/* Used during parsing */
 
 void cli_printf(cli *, int, char *, ...);
 #define cli_msg(x...) cli_printf(this_cli, x)
+void cli_put_line(cli *, int code, byte *text, unsigned int len);
 void cli_set_log_echo(cli *, unsigned int mask, unsigned int size);
 
+static inline int cli_tx_full(cli *c)
+{
+  return c->tx_size >= CLI_MAX_CONT_QUEUE;
+}
+
 /* Functions provided to sysdep layer */
 
 cli *cli_new(void *);
@@ -0,0 +1,200 @@
+/*
+ *	BIRD -- Convergence Latency Tracing
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Convergence latency tracing
+ *
+ * To find out how long it takes before a route change received from
+ * a neighbor gets to the kernel and to other neighbors, a sample of
+ * route changes can be traced through the daemon.
+ *
+ * A protocol calls latency_begin() when it starts processing an input
+ * which may change its routes (a BGP UPDATE, an OSPF routing table
+ * calculation) and latency_end() when it's finished. Every N-th such
+ * input (see the &latency_sample configuration option) is traced: its
+ * start time is kept in @latency_origin and as the route changes go
+ * synchronously through rte_update() and the export hooks, their
+ * delays are accounted at several points (%LAT_IMPORT when the change
+ * is accepted to a table, %LAT_EXPORT after each rt_notify() hook,
+ * %LAT_KERNEL after the kernel has been updated). Stages which happen
+ * later, like sending of a BGP UPDATE, keep the histogram and
+ * the start time with the queued data and call latency_add() when done.
+ *
+ * Latencies are collected in histograms with power-of-two buckets, one
+ * for each stage and pair of source and destination protocol. They are
+ * identified by protocol names, so they survive reconfiguration, and
+ * they are never freed, so the queued data may point to them.
+ */
+
+#include "nest/bird.h"
+#include "nest/protocol.h"
+#include "nest/cli.h"
+#include "nest/latency.h"
+#include "conf/conf.h"
+#include "lib/resource.h"
+#include "lib/string.h"
+#include "lib/timer.h"
+
+u64 latency_origin;
+
+static struct proto *latency_source;	/* Protocol which has started the traced change */
+static int latency_depth;		/* Nesting of latency_begin() calls */
+static unsigned latency_counter;	/* Inputs since the last traced one */
+static list latency_hists;
+static pool *latency_pool;
+static struct latency_hist *latency_last;	/* Cache of the last latency_get() */
+
+static char *latency_stage_names[LAT_MAX] = { "import", "export", "kernel", "tx" };
+
+/**
+ * latency_begin - start processing of an input
+ * @p: protocol processing it
+ *
+ * If the input is chosen by sampling, route changes caused by it
+ * are traced until the matching latency_end().
+ */
+void
+latency_begin(struct proto *p)
+{
+  if (latency_depth++ || !config->latency_sample)
+    return;
+  if (++latency_counter < config->latency_sample)
+    return;
+
+  latency_counter = 0;
+  latency_source = p;
+  latency_origin = tm_current_usec();
+}
+
+/**
+ * latency_end - finish processing of an input
+ */
+void
+latency_end(void)
+{
+  if (!--latency_depth)
+    latency_origin = 0;
+}
+
+/**
+ * latency_get - find a histogram
+ * @stage: stage of propagation
+ * @dst: name of the destination protocol (or table)
+ *
+ * Finds (or creates) the histogram of the given stage for the traced
+ * change and @dst. It may be called only while @latency_origin is set.
+ */
+struct latency_hist *
+latency_get(int stage, char *dst)
+{
+  struct latency_hist *h = latency_last;
+  char *src = latency_source->name;
+  unsigned sl, dl;
+
+  if (h && (h->stage == stage) && !strcmp(h->dst, dst) && !strcmp(h->src, src))
+    return h;
+
+  if (!latency_pool)
+    {
+      latency_pool = rp_new(&root_pool, "Latency");
+      init_list(&latency_hists);
+    }
+
+  WALK_LIST(h, latency_hists)
+    if ((h->stage == stage) && !strcmp(h->dst, dst) && !strcmp(h->src, src))
+      return latency_last = h;
+
+  sl = strlen(src) + 1;
+  dl = strlen(dst) + 1;
+  h = mb_allocz(latency_pool, sizeof(struct latency_hist) + sl + dl);
+  h->stage = stage;
+  h->src = (char *) (h + 1);
+  h->dst = h->src + sl;
+  memcpy(h->src, src, sl);
+  memcpy(h->dst, dst, dl);
+  add_tail(&latency_hists, &h->n);
+  return latency_last = h;
+}
+
+/**
+ * latency_add - account a latency
+ * @h: histogram
+ * @start: start time of the change
+ */
+void
+latency_add(struct latency_hist *h, u64 start)
+{
+  u64 d = tm_current_usec() - start;
+  u32 us = (d > 0xffffffff) ? 0xffffffff : d;
+  int i;
+
+  for (i = 0; (i < LAT_BUCKETS - 1) && (us >> (i+1)); i++)
+    ;
+  h->bucket[i]++;
+  h->count++;
+  h->sum += us;
+  if (us > h->max)
+    h->max = us;
+
+  if (config->latency_log)
+    log(L_TRACE "Latency %s -> %s %s: %u us", h->src, h->dst, latency_stage_names[h->stage], us);
+}
+
+/* Upper bound of the percentile @q of @h */
+static u32
+latency_percentile(struct latency_hist *h, unsigned q)
+{
+  u64 want = ((u64) h->count * q + 99) / 100;
+  u64 sum = 0;
+  int i;
+
+  for (i = 0; i < LAT_BUCKETS - 1; i++)
+    if ((sum += h->bucket[i]) >= want)
+      return MIN(2 << i, h->max);
+  return h->max;
+}
+
+void
+latency_show(void)
+{
+  struct latency_hist *h;
+
+  if (!config->latency_sample)
+    {
+      cli_msg(8011, "Latency tracing is disabled");
+      return;
+    }
+
+  cli_msg(-2022, "%-16s %-16s %-6s %8s %8s %8s %8s %8s %8s", "source", "destination", "stage",
+	  "count", "avg[us]", "p50", "p90", "p99", "max");
+  if (latency_pool)
+    WALK_LIST(h, latency_hists)
+      if (h->count)
+	cli_msg(-1022, "%-16s %-16s %-6s %8u %8u %8u %8u %8u %8u", h->src, h->dst,
+		latency_stage_names[h->stage], h->count, (u32) (h->sum / h->count),
+		latency_percentile(h, 50), latency_percentile(h, 90),
+		latency_percentile(h, 99), h->max);
+  cli_msg(0, "");
+}
+
+void
+latency_reset(void)
+{
+  struct latency_hist *h;
+
+  if (cli_access_restricted())
+    return;
+
+  /* Histograms may be referenced from queued data, so they are only cleared */
+  if (latency_pool)
+    WALK_LIST(h, latency_hists)
+      {
+	h->count = h->max = 0;
+	h->sum = 0;
+	bzero(h->bucket, sizeof(h->bucket));
+      }
+  cli_msg(19, "Latency statistics reset");
+}
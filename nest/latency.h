@@ -0,0 +1,49 @@
+/*
+ *	BIRD -- Convergence Latency Tracing
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_LATENCY_H_
+#define _BIRD_LATENCY_H_
+
+#include "lib/lists.h"
+
+struct proto;
+
+/* Stages of propagation of a route change */
+
+#define LAT_IMPORT	0		/* Accepted to a routing table */
+#define LAT_EXPORT	1		/* Passed to the rt_notify() hook of a protocol */
+#define LAT_KERNEL	2		/* Written to the kernel routing table */
+#define LAT_TX		3		/* Sent to a BGP neighbor */
+#define LAT_MAX		4
+
+#define LAT_BUCKETS	24		/* Bucket i counts latencies below 2^(i+1) us, the last one all longer */
+
+struct latency_hist {
+  node n;
+  int stage;				/* LAT_* */
+  char *src;				/* Protocol which has started the change */
+  char *dst;				/* Protocol (or table for LAT_IMPORT) which has got it */
+  u32 count, max;
+  u64 sum;				/* All in microseconds */
+  u32 bucket[LAT_BUCKETS];
+};
+
+extern u64 latency_origin;		/* Start of the traced change, 0 if not tracing */
+
+void latency_begin(struct proto *p);
+void latency_end(void);
+struct latency_hist *latency_get(int stage, char *dst);
+void latency_add(struct latency_hist *h, u64 start);
+void latency_show(void);
+void latency_reset(void);
+
+static inline void
+latency_record(int stage, char *dst)
+{
+  latency_add(latency_get(stage, dst), latency_origin);
+}
+
+#endif
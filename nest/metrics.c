@@ -0,0 +1,302 @@
+/*
+ *	BIRD -- Metrics Export
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Metrics
+ *
+ * Monitoring systems often poll the router for its statistics, which is
+ * expensive if they have to parse the output of the CLI commands and the
+ * daemon has to format it. Instead, BIRD can provide a snapshot of its
+ * statistics in the OpenMetrics text format on a dedicated socket
+ * (see the sysdep part for the socket itself).
+ *
+ * metrics_render() produces the whole snapshot in a single memory block
+ * without going through the CLI machinery. It includes protocol states
+ * and route statistics (&proto_stats), sizes of routing tables,
+ * the size of the route attribute cache, memory used by the top-level
+ * resource pools and a histogram of the main loop iteration times
+ * (&io_loop_stats).
+ */
+
+#include <stdarg.h>
+
+#include "nest/bird.h"
+#include "nest/protocol.h"
+#include "nest/route.h"
+#include "nest/metrics.h"
+#include "conf/conf.h"
+#include "lib/resource.h"
+#include "lib/string.h"
+#include "lib/timer.h"
+
+struct metrics_buf {
+  pool *pool;
+  byte *start, *pos, *end;
+};
+
+#define METRICS_LINE_MAX 1024		/* Longest line a single metrics_printf() may produce */
+
+static void
+metrics_printf(struct metrics_buf *b, char *fmt, ...)
+{
+  va_list args;
+  int l;
+
+  if (b->end - b->pos < METRICS_LINE_MAX)
+    {
+      unsigned size = 2 * (b->end - b->start);
+      unsigned used = b->pos - b->start;
+      b->start = mb_realloc(b->pool, b->start, size);
+      b->pos = b->start + used;
+      b->end = b->start + size;
+    }
+  va_start(args, fmt);
+  l = bvsnprintf(b->pos, b->end - b->pos, fmt, args);
+  va_end(args);
+  ASSERT(l >= 0);
+  b->pos += l;
+}
+
+/* Label values have to escape backslashes, quotes and newlines */
+static char *
+metrics_label(char *buf, unsigned size, char *s)
+{
+  char *d = buf, *e = buf + size - 2;
+
+  for (; *s && d < e; s++)
+    switch (*s)
+      {
+      case '\\':
+      case '"':
+	*d++ = '\\';
+	*d++ = *s;
+	break;
+      case '\n':
+	*d++ = '\\';
+	*d++ = 'n';
+	break;
+      default:
+	*d++ = *s;
+      }
+  *d = 0;
+  return buf;
+}
+
+static void
+metrics_header(struct metrics_buf *b, char *name, char *type, char *help)
+{
+  metrics_printf(b, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+static void
+metrics_protocols(struct metrics_buf *b)
+{
+  struct proto_config *pc;
+  struct proto *p;
+  byte info[256], ibuf[512];
+
+#define WALK_PROTOS WALK_LIST(pc, config->protos) if (p = pc->proto)
+
+  metrics_header(b, "bird_protocol", "info", "Protocol instance, its state and protocol specific status (e.g. BGP session state)");
+  WALK_PROTOS
+    {
+      info[0] = 0;
+      if (p->proto->get_status)
+	p->proto->get_status(p, info);
+      metrics_printf(b, "bird_protocol_info{proto=\"%s\",type=\"%s\",table=\"%s\",state=\"%s\",status=\"%s\"} 1\n",
+		     p->name, p->proto->name, p->table->name, proto_state_name(p),
+		     metrics_label(ibuf, sizeof(ibuf), info));
+    }
+
+  metrics_header(b, "bird_protocol_up", "gauge", "Whether the protocol is up");
+  WALK_PROTOS
+    metrics_printf(b, "bird_protocol_up{proto=\"%s\"} %d\n", p->name,
+		   (p->proto_state == PS_UP) && (p->core_state == FS_HAPPY));
+
+  metrics_header(b, "bird_protocol_state_change_seconds", "gauge", "Monotonic time of the last state change");
+  WALK_PROTOS
+    metrics_printf(b, "bird_protocol_state_change_seconds{proto=\"%s\"} %u\n", p->name,
+		   (unsigned) p->last_state_change);
+
+  metrics_header(b, "bird_protocol_routes", "gauge", "Number of routes of the protocol");
+  WALK_PROTOS
+    {
+      struct proto_stats *s = &p->stats;
+      metrics_printf(b, "bird_protocol_routes{proto=\"%s\",kind=\"imported\"} %u\n", p->name, s->imp_routes);
+      metrics_printf(b, "bird_protocol_routes{proto=\"%s\",kind=\"exported\"} %u\n", p->name, s->exp_routes);
+      metrics_printf(b, "bird_protocol_routes{proto=\"%s\",kind=\"preferred\"} %u\n", p->name, s->pref_routes);
+    }
+
+  metrics_header(b, "bird_protocol_import_updates", "counter", "Route updates sent by the protocol to its table");
+  WALK_PROTOS
+    {
+      struct proto_stats *s = &p->stats;
+      metrics_printf(b, "bird_protocol_import_updates_total{proto=\"%s\",result=\"received\"} %u\n", p->name, s->imp_updates_received);
+      metrics_printf(b, "bird_protocol_import_updates_total{proto=\"%s\",result=\"invalid\"} %u\n", p->name, s->imp_updates_invalid);
+      metrics_printf(b, "bird_protocol_import_updates_total{proto=\"%s\",result=\"filtered\"} %u\n", p->name, s->imp_updates_filtered);
+      metrics_printf(b, "bird_protocol_import_updates_total{proto=\"%s\",result=\"ignored\"} %u\n", p->name, s->imp_updates_ignored);
+      metrics_printf(b, "bird_protocol_import_updates_total{proto=\"%s\",result=\"accepted\"} %u\n", p->name, s->imp_updates_accepted);
+    }
+
+  metrics_header(b, "bird_protocol_import_withdraws", "counter", "Route withdraws sent by the protocol to its table");
+  WALK_PROTOS
+    {
+      struct proto_stats *s = &p->stats;
+      metrics_printf(b, "bird_protocol_import_withdraws_total{proto=\"%s\",result=\"received\"} %u\n", p->name, s->imp_withdraws_received);
+      metrics_printf(b, "bird_protocol_import_withdraws_total{proto=\"%s\",result=\"invalid\"} %u\n", p->name, s->imp_withdraws_invalid);
+      metrics_printf(b, "bird_protocol_import_withdraws_total{proto=\"%s\",result=\"ignored\"} %u\n", p->name, s->imp_withdraws_ignored);
+      metrics_printf(b, "bird_protocol_import_withdraws_total{proto=\"%s\",result=\"accepted\"} %u\n", p->name, s->imp_withdraws_accepted);
+    }
+
+  metrics_header(b, "bird_protocol_export_updates", "counter", "Route updates sent by the table to the protocol");
+  WALK_PROTOS
+    {
+      struct proto_stats *s = &p->stats;
+      metrics_printf(b, "bird_protocol_export_updates_total{proto=\"%s\",result=\"received\"} %u\n", p->name, s->exp_updates_received);
+      metrics_printf(b, "bird_protocol_export_updates_total{proto=\"%s\",result=\"rejected\"} %u\n", p->name, s->exp_updates_rejected);
+      metrics_printf(b, "bird_protocol_export_updates_total{proto=\"%s\",result=\"filtered\"} %u\n", p->name, s->exp_updates_filtered);
+      metrics_printf(b, "bird_protocol_export_updates_total{proto=\"%s\",result=\"accepted\"} %u\n", p->name, s->exp_updates_accepted);
+    }
+
+  metrics_header(b, "bird_protocol_export_withdraws", "counter", "Route withdraws sent by the table to the protocol");
+  WALK_PROTOS
+    {
+      struct proto_stats *s = &p->stats;
+      metrics_printf(b, "bird_protocol_export_withdraws_total{proto=\"%s\",result=\"received\"} %u\n", p->name, s->exp_withdraws_received);
+      metrics_printf(b, "bird_protocol_export_withdraws_total{proto=\"%s\",result=\"accepted\"} %u\n", p->name, s->exp_withdraws_accepted);
+    }
+
+  metrics_header(b, "bird_protocol_memory_bytes", "gauge", "Memory used by the protocol instance");
+  WALK_PROTOS
+    metrics_printf(b, "bird_protocol_memory_bytes{proto=\"%s\"} %lu\n", p->name, rmemsize(p->pool));
+
+#undef WALK_PROTOS
+}
+
+static void
+metrics_tables(struct metrics_buf *b)
+{
+  struct rtable_config *tc;
+  unsigned int count, size;
+
+  metrics_header(b, "bird_table_networks", "gauge", "Number of networks with at least one route");
+  WALK_LIST(tc, config->tables)
+    if (tc->table)
+      metrics_printf(b, "bird_table_networks{table=\"%s\"} %u\n", tc->name, tc->table->net_count);
+
+  metrics_header(b, "bird_table_routes", "gauge", "Number of routes in the table");
+  WALK_LIST(tc, config->tables)
+    if (tc->table)
+      metrics_printf(b, "bird_table_routes{table=\"%s\"} %u\n", tc->name, tc->table->rte_count);
+
+  rta_cache_stats(&count, &size);
+  metrics_header(b, "bird_rta_cache_entries", "gauge", "Number of cached route attribute sets");
+  metrics_printf(b, "bird_rta_cache_entries %u\n", count);
+  metrics_header(b, "bird_rta_cache_buckets", "gauge", "Size of the route attribute cache hash table");
+  metrics_printf(b, "bird_rta_cache_buckets %u\n", size);
+}
+
+#define METRICS_MAX_POOLS 32
+
+struct metrics_pools {
+  int n;
+  char *name[METRICS_MAX_POOLS];
+  unsigned long size[METRICS_MAX_POOLS];
+};
+
+/* Pools with the same name (e.g. configurations) are summed up */
+static void
+metrics_pool_hook(void *data, char *name, unsigned long size)
+{
+  struct metrics_pools *mp = data;
+  int i;
+
+  for (i = 0; i < mp->n; i++)
+    if (!strcmp(mp->name[i], name))
+      {
+	mp->size[i] += size;
+	return;
+      }
+  if (mp->n < METRICS_MAX_POOLS)
+    {
+      mp->name[mp->n] = name;
+      mp->size[mp->n++] = size;
+    }
+}
+
+static void
+metrics_memory(struct metrics_buf *b)
+{
+  struct metrics_pools mp;
+  unsigned long total = 0;
+  int i;
+
+  mp.n = 0;
+  rp_walk(&root_pool, metrics_pool_hook, &mp);
+  metrics_header(b, "bird_memory_bytes", "gauge", "Memory used by the top-level resource pools");
+  for (i = 0; i < mp.n; i++)
+    {
+      metrics_printf(b, "bird_memory_bytes{pool=\"%s\"} %lu\n", mp.name[i], mp.size[i]);
+      total += mp.size[i];
+    }
+  metrics_printf(b, "bird_memory_bytes{pool=\"Total\"} %lu\n", total);
+}
+
+static void
+metrics_io_loop(struct metrics_buf *b)
+{
+  struct io_loop_stats *st = &io_loop_stats;
+  u64 sum = 0;
+  unsigned limit = 100;
+  int i;
+
+  metrics_header(b, "bird_io_loop_seconds", "histogram", "Time spent by a single iteration of the main loop between two polls");
+  for (i = 0; i < IO_LOOP_BUCKETS - 1; i++, limit *= 10)
+    {
+      sum += st->hist[i];
+      metrics_printf(b, "bird_io_loop_seconds_bucket{le=\"%u.%06u\"} %Lu\n",
+		     limit / 1000000, limit % 1000000, sum);
+    }
+  metrics_printf(b, "bird_io_loop_seconds_bucket{le=\"+Inf\"} %Lu\n", st->loops);
+  metrics_printf(b, "bird_io_loop_seconds_count %Lu\n", st->loops);
+  metrics_printf(b, "bird_io_loop_seconds_sum %Lu.%06u\n",
+		 st->busy_usec / 1000000, (unsigned) (st->busy_usec % 1000000));
+}
+
+/**
+ * metrics_render - render a snapshot of the metrics
+ * @p: pool to allocate the result in
+ * @len: where to store the length of the result
+ *
+ * This function formats all the metrics in the OpenMetrics text format
+ * and returns them in a memory block allocated in @p, which the caller
+ * is expected to free by mb_free() when it's no longer needed.
+ */
+byte *
+metrics_render(pool *p, unsigned *len)
+{
+  struct metrics_buf b;
+
+  b.pool = p;
+  b.start = b.pos = mb_alloc(p, 4 * METRICS_LINE_MAX);
+  b.end = b.start + 4 * METRICS_LINE_MAX;
+
+  metrics_header(&b, "bird", "info", "BIRD daemon");
+  metrics_printf(&b, "bird_info{version=\"%s\"} 1\n", BIRD_VERSION);
+  metrics_header(&b, "bird_config_load_seconds", "gauge", "Monotonic time of loading of the current configuration");
+  metrics_printf(&b, "bird_config_load_seconds %u\n", (unsigned) config->load_time);
+  metrics_header(&b, "bird_now_seconds", "gauge", "Current monotonic time");
+  metrics_printf(&b, "bird_now_seconds %u\n", (unsigned) now);
+
+  metrics_protocols(&b);
+  metrics_tables(&b);
+  metrics_memory(&b);
+  metrics_io_loop(&b);
+  metrics_printf(&b, "# EOF\n");
+
+  *len = b.pos - b.start;
+  return b.start;
+}
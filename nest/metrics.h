@@ -0,0 +1,14 @@
+/*
+ *	BIRD -- Metrics Export
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_METRICS_H_
+#define _BIRD_METRICS_H_
+
+#include "lib/resource.h"
+
+byte *metrics_render(pool *p, unsigned *len);
+
+#endif
@@ -15,6 +15,7 @@
 
 /* MRTdump types */
 
+#define TABLE_DUMP_V2		13
 #define BGP4MP			16
 
 /* MRTdump subtypes */
@@ -23,6 +24,10 @@
 #define BGP4MP_MESSAGE_AS4	4
 #define BGP4MP_STATE_CHANGE_AS4	5
 
+#define PEER_INDEX_TABLE	1
+#define RIB_IPV4_UNICAST	2
+#define RIB_IPV6_UNICAST	4
+
 
 /* implemented in sysdep */
 void mrt_dump_message(struct proto *p, u16 type, u16 subtype, byte *buf, u32 len);
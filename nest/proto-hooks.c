@@ -65,6 +65,21 @@ struct proto *init(struct proto_config *c)
 int reconfigure(struct proto *p, struct proto_config *c)
 { DUMMY; }
 
+/**
+ * adopt - switch instance to an identical configuration
+ * @p: an instance
+ * @c: new configuration
+ *
+ * When the definition of a protocol hasn't changed at all, the core
+ * doesn't call reconfigure(), but only asks the protocol by this optional
+ * hook to replace all its references to the old configuration by references
+ * to the new one. The hook must not do anything else, it's called for
+ * every unchanged protocol during reconfiguration. Protocols without
+ * this hook are reconfigured by the reconfigure() hook as usual.
+ */
+void adopt(struct proto *p, struct proto_config *c)
+{ DUMMY; }
+
 /**
  * dump - dump protocol state
  * @p: an instance
@@ -19,11 +19,12 @@
 #include "nest/iface.h"
 #include "nest/cli.h"
 #include "filter/filter.h"
+#include "nest/trace.h"
 
 static pool *proto_pool;
 
 static list protocol_list;
-static list proto_list;
+list proto_list;
 
 #define PD(pr, msg, args...) do { if (pr->debug & D_STATES) { log(L_TRACE "%s: " msg, pr->name , ## args); } } while(0)
 
@@ -33,13 +34,14 @@ static list initial_proto_list;
 static list flush_proto_list;
 
 static event *proto_flush_event;
+static event *proto_commit_event;
 
 static char *p_states[] = { "DOWN", "START", "UP", "STOP" };
 static char *c_states[] = { "HUNGRY", "FEEDING", "HAPPY", "FLUSHING" };
 
 static void proto_flush_all(void *);
+static void protos_commit_cont(void *);
 static void proto_rethink_goal(struct proto *p);
-static char *proto_state_name(struct proto *p);
 
 static void
 proto_enqueue(list *l, struct proto *p)
@@ -106,6 +108,7 @@ proto_new(struct proto_config *c, unsigned size)
   p->cf = c;
   p->debug = c->debug;
   p->mrtdump = c->mrtdump;
+  trace_set(p, c->trace, c->trace_events);
   p->name = c->name;
   p->preference = c->preference;
   p->disabled = c->disabled;
@@ -155,8 +158,11 @@ proto_add_announce_hook(struct proto *p, struct rtable *t)
   h->table = t;
   h->proto = p;
   h->next = p->ahooks;
+  h->exported = NULL;
+  h->exported_slab = NULL;
   p->ahooks = h;
   add_tail(&t->hooks, &h->n);
+  rt_export_reset(h);
   return h;
 }
 
@@ -196,6 +202,9 @@ proto_config_new(struct protocol *pr, unsigned size)
   c->table = c->global->master_rtc;
   c->debug = new_config->proto_default_debug;
   c->mrtdump = new_config->proto_default_mrtdump;
+  c->trace = new_config->proto_default_trace;
+  c->trace_events = TRACE_DEFAULT_EVENTS;
+  cf_stmt_fingerprint(&c->hash);
   return c;
 }
 
@@ -293,6 +302,7 @@ proto_reconfigure(struct proto *p, struct proto_config *oc, struct proto_config
 
   p->debug = nc->debug;
   p->mrtdump = nc->mrtdump;
+  trace_set(p, nc->trace, nc->trace_events);
 
   /* Execute protocol specific reconfigure hook */
   if (! (p->proto->reconfigure && p->proto->reconfigure(p, nc)))
@@ -306,6 +316,9 @@ proto_reconfigure(struct proto *p, struct proto_config *oc, struct proto_config
   p->out_filter = nc->out_filter;
   p->preference = nc->preference;
 
+  if (!filter_roa_deps(p->in_filter))
+    rt_import_flush(p);
+
   if (import_changed || export_changed)
     log(L_INFO "Reloading protocol %s", p->name);
 
@@ -327,6 +340,114 @@ proto_reconfigure(struct proto *p, struct proto_config *oc, struct proto_config
   return 1;
 }
 
+/*
+ * When the definition of a protocol hasn't changed at all (its fingerprint
+ * is the same), we only switch the running instance to the new config
+ * and skip all the checks done by proto_reconfigure().
+ */
+static int
+proto_adopt(struct proto *p, struct proto_config *oc, struct proto_config *nc)
+{
+  if ((nc->hash != oc->hash) ||
+      !p->proto->adopt ||
+      (p->proto_state == PS_DOWN) ||
+      (nc->protocol != oc->protocol) ||
+      (nc->disabled != oc->disabled) ||
+      (nc->table->table != oc->table->table) ||
+      (proto_get_router_id(nc) != proto_get_router_id(oc)))
+    return 0;
+
+  p->proto->adopt(p, nc);
+  p->cf = nc;
+  p->name = nc->name;
+  p->in_filter = nc->in_filter;
+  p->out_filter = nc->out_filter;
+  p->debug = nc->debug;
+  p->mrtdump = nc->mrtdump;
+  trace_set(p, nc->trace, nc->trace_events);
+  return 1;
+}
+
+#define PROTO_COMMIT_SLICE 64		/* Protocols processed in a single run of the commit event */
+
+static struct config *commit_old;	/* Config whose protocols are being processed, NULL if none */
+static struct proto_config *commit_pos;	/* Next protocol of @commit_old to process */
+static int commit_force, commit_type;
+
+/* Returns 0 if there was nothing to do */
+static int
+proto_commit_one(struct proto_config *oc)
+{
+  struct proto *p = oc->proto;
+  struct proto_config *nc = p->cf_new;
+
+  if (p->cf != oc)			/* Already switched to the new config by proto_adopt() */
+    return 0;
+
+  if (nc)
+    {
+      /* We will try to reconfigure protocol p */
+      if (! commit_force && proto_reconfigure(p, oc, nc, commit_type))
+	return 1;
+
+      /* Unsuccessful, we will restart it */
+      if (!p->disabled && !nc->disabled)
+	log(L_INFO "Restarting protocol %s", p->name);
+      else if (p->disabled && !nc->disabled)
+	log(L_INFO "Enabling protocol %s", p->name);
+      else if (!p->disabled && nc->disabled)
+	log(L_INFO "Disabling protocol %s", p->name);
+
+      PD(p, "Restarting");
+    }
+  else
+    {
+      if (!shutting_down)
+	log(L_INFO "Removing protocol %s", p->name);
+      PD(p, "Unconfigured");
+    }
+  p->reconfiguring = 1;
+  config_add_obstacle(commit_old);
+  proto_rethink_goal(p);
+  return 1;
+}
+
+static void
+protos_start_initial(void)
+{
+  struct proto *p, *n;
+
+  DBG("Protocol start\n");
+  WALK_LIST_DELSAFE(p, n, initial_proto_list)
+    proto_rethink_goal(p);
+}
+
+static void
+protos_commit_cont(void *unused UNUSED)
+{
+  struct config *old = commit_old;
+  struct proto_config *oc = commit_pos;
+  int max = PROTO_COMMIT_SLICE;
+
+  while (oc->n.next && max)
+    {
+      max -= proto_commit_one(oc);
+      oc = (struct proto_config *) oc->n.next;
+    }
+  commit_pos = oc;
+
+  if (oc->n.next)
+    {
+      ev_schedule(proto_commit_event);
+      return;
+    }
+
+  DBG("\tdone\n");
+  commit_old = NULL;
+  protos_start_initial();
+  config_del_obstacle(old);
+}
+
 /**
  * protos_commit - commit new protocol configuration
  * @new: new configuration
@@ -346,7 +467,9 @@ proto_reconfigure(struct proto *p, struct proto_config *oc, struct proto_config
  * When a protocol exists in the old configuration, but it doesn't in the
  * new one, it's shut down and deleted after the shutdown completes.
  *
- * When a protocol exists in both configurations, the core decides
+ * When a protocol exists in both configurations and its definition
+ * hasn't changed at all (see cf_stmt_fingerprint()), it's just switched
+ * to the new configuration by the adopt() hook. Otherwise, the core decides
  * whether it's possible to reconfigure it dynamically - it checks all
  * the core properties of the protocol (changes in filters are ignored
  * if type is RECONFIG_SOFT) and if they match, it asks the
@@ -354,12 +477,16 @@ proto_reconfigure(struct proto *p, struct proto_config *oc, struct proto_config
  * to switch to the new configuration.  If it isn't possible, the
  * protocol is shut down and a new instance is started with the new
  * configuration after the shutdown is completed.
+ *
+ * Unchanged protocols are handled at once, the remaining ones are processed
+ * in slices of %PROTO_COMMIT_SLICE changed protocols from an event, holding an obstacle
+ * on the old configuration until all of them are done. New protocols are
+ * started afterwards.
  */
 void
 protos_commit(struct config *new, struct config *old, int force_reconfig, int type)
 {
   struct proto_config *oc, *nc;
-  struct proto *p, *n;
 
   DBG("protos_commit:\n");
   if (old)
@@ -374,32 +501,12 @@ protos_commit(struct config *new, struct config *old, int force_reconfig, int ty
 	      /* No need to check description */
 	      nc = sym->def;
 	      nc->proto = p;
-
-	      /* We will try to reconfigure protocol p */
-	      if (! force_reconfig && proto_reconfigure(p, oc, nc, type))
+	      if (! force_reconfig && proto_adopt(p, oc, nc))
 		continue;
-
-	      /* Unsuccessful, we will restart it */
-	      if (!p->disabled && !nc->disabled)
-		log(L_INFO "Restarting protocol %s", p->name);
-	      else if (p->disabled && !nc->disabled)
-		log(L_INFO "Enabling protocol %s", p->name);
-	      else if (!p->disabled && nc->disabled)
-		log(L_INFO "Disabling protocol %s", p->name);
-
-	      PD(p, "Restarting");
 	      p->cf_new = nc;
 	    }
 	  else
-	    {
-	      if (!shutting_down)
-		log(L_INFO "Removing protocol %s", p->name);
-	      PD(p, "Unconfigured");
-	      p->cf_new = NULL;
-	    }
-	  p->reconfiguring = 1;
-	  config_add_obstacle(old);
-	  proto_rethink_goal(p);
+	    p->cf_new = NULL;
 	}
     }
 
@@ -410,11 +517,21 @@ protos_commit(struct config *new, struct config *old, int force_reconfig, int ty
 	  log(L_INFO "Adding protocol %s", nc->name);
 	proto_init(nc);
       }
-  DBG("\tdone\n");
 
-  DBG("Protocol start\n");
-  WALK_LIST_DELSAFE(p, n, initial_proto_list)
-    proto_rethink_goal(p);
+  if (!old)
+    {
+      DBG("\tdone\n");
+      protos_start_initial();
+      return;
+    }
+
+  /* The rest is done by protos_commit_cont(), the first slice right now */
+  commit_old = old;
+  commit_pos = HEAD(old->protos);
+  commit_force = force_reconfig;
+  commit_type = type;
+  config_add_obstacle(old);
+  protos_commit_cont(NULL);
 }
 
 static void
@@ -429,6 +546,8 @@ proto_rethink_goal(struct proto *p)
       config_del_obstacle(p->cf->global);
       rem_node(&p->n);
       rem_node(&p->glob_node);
+      trace_set(p, 0, 0);
+      rt_prune_stale_all(p);
       mb_free(p);
       if (!nc)
 	return;
@@ -560,10 +679,24 @@ protos_build(void)
 #endif
 #ifdef CONFIG_BGP
   proto_build(&proto_bgp);
+#endif
+#ifdef CONFIG_BMP
+  proto_build(&proto_bmp);
+#endif
+#ifdef CONFIG_GENERATOR
+  proto_build(&proto_generator);
+#endif
+#ifdef CONFIG_AGGREGATOR
+  proto_build(&proto_aggregator);
+#endif
+#ifdef CONFIG_BFD
+  proto_build(&proto_bfd);
 #endif
   proto_pool = rp_new(&root_pool, "Protocols");
   proto_flush_event = ev_new(proto_pool);
   proto_flush_event->hook = proto_flush_all;
+  proto_commit_event = ev_new(proto_pool);
+  proto_commit_event->hook = protos_commit_cont;
 }
 
 static void
@@ -571,6 +704,13 @@ proto_fell_down(struct proto *p)
 {
   DBG("Protocol %s down\n", p->name);
 
+  /* Stale routes restored for the protocol are counted in its statistics */
+  rt_prune_stale(p->table, p);
+#ifdef CONFIG_PIPE
+  if (proto_is_pipe(p))
+    rt_prune_stale(pipe_get_peer_table(p), p);
+#endif
+
   if (p->stats.imp_routes != 0)
     log(L_ERR "Protocol %s is down but still has %d routes", p->name, p->stats.imp_routes);
 
@@ -644,7 +784,13 @@ proto_schedule_feed(struct proto *p, int initial)
 
   /* Hack: reset exp_routes during refeed, and do not decrease it later */
   if (!initial)
-    p->stats.exp_routes = 0;
+    {
+      struct announce_hook *h;
+
+      p->stats.exp_routes = 0;
+      for (h = p->ahooks; h; h = h->next)
+	rt_export_reset(h);
+    }
 
   proto_relink(p);
   p->attn->hook = initial ? proto_feed_initial : proto_feed_more;
@@ -713,6 +859,7 @@ proto_notify_state(struct proto *p, unsigned ps)
 	proto_schedule_flush(p);
 
       neigh_prune(); // FIXME convert neighbors to resource?
+      rt_import_flush(p);
       rfree(p->pool);
       p->pool = NULL;
 
@@ -767,7 +914,7 @@ proto_flush_all(void *unused UNUSED)
  *  CLI Commands
  */
 
-static char *
+char *
 proto_state_name(struct proto *p)
 {
 #define P(x,y) ((x << 4) | y)
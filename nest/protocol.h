@@ -44,6 +44,7 @@ struct protocol {
   void (*postconfig)(struct proto_config *);			/* After configuring each instance */
   struct proto * (*init)(struct proto_config *);		/* Create new instance */
   int (*reconfigure)(struct proto *, struct proto_config *);	/* Try to reconfigure instance, returns success */
+  void (*adopt)(struct proto *, struct proto_config *);		/* Switch instance to an identical config */
   void (*dump)(struct proto *);			/* Debugging dump */
   void (*dump_attrs)(struct rte *);		/* Dump protocol-dependent attributes */
   int (*start)(struct proto *);			/* Start the instance */
@@ -70,7 +71,8 @@ void protos_dump_all(void);
 
 extern struct protocol
   proto_device, proto_rip, proto_static,
-  proto_ospf, proto_pipe, proto_bgp;
+  proto_ospf, proto_pipe, proto_bgp, proto_bmp, proto_generator,
+  proto_aggregator, proto_bfd;
 
 /*
  *	Routing Protocol Instance
@@ -84,10 +86,13 @@ struct proto_config {
   char *name;
   char *dsc;
   u32 debug, mrtdump;			/* Debugging bitfields, both use D_* constants */
+  u32 trace;				/* Events recorded to the trace ring, D_* constants */
+  unsigned trace_events;		/* Size of the trace ring */
   unsigned preference, disabled;	/* Generic parameters */
   u32 router_id;			/* Protocol specific router ID */
   struct rtable_config *table;		/* Table we're attached to */
   struct filter *in_filter, *out_filter; /* Attached filters */
+  u64 hash;				/* Fingerprint of the definition, see cf_stmt_fingerprint() */
 
   /* Protocol-specific data follow... */
 };
@@ -129,6 +134,8 @@ struct proto {
   char *name;				/* Name of this instance (== cf->name) */
   u32 debug;				/* Debugging flags */
   u32 mrtdump;				/* MRTDump flags */
+  u32 trace;				/* Binary tracing flags */
+  struct trace_ring *trace_ring;	/* Recorded events, see nest/trace.c */
   unsigned preference;			/* Default route preference */
   unsigned accept_ra_types;		/* Which types of route announcements are accepted (RA_OPTIMAL or RA_ANY) */
   unsigned disabled;			/* Manually disabled */
@@ -187,6 +194,7 @@ struct proto {
   struct filter *in_filter;		/* Input filter */
   struct filter *out_filter;		/* Output filter */
   struct announce_hook *ahooks;		/* Announcement hooks for this protocol */
+  struct fib *import_table;		/* Routes as received before the import filter, see rt_reimport() */
 
   struct fib_iterator *feed_iterator;	/* Routing table iterator used during protocol feeding */
   struct announce_hook *feed_ahook;	/* Announce hook we currently feed */
@@ -205,6 +213,7 @@ void *proto_config_new(struct protocol *, unsigned size);
 void proto_request_feeding(struct proto *p);
 
 void proto_cmd_show(struct proto *, unsigned int, int);
+char *proto_state_name(struct proto *p);
 void proto_cmd_disable(struct proto *, unsigned int, int);
 void proto_cmd_enable(struct proto *, unsigned int, int);
 void proto_cmd_restart(struct proto *, unsigned int, int);
@@ -226,6 +235,7 @@ proto_get_router_id(struct proto_config *pc)
 }
 
 extern list active_proto_list;
+extern list proto_list;
 
 /*
  *  Each protocol instance runs two different state machines:
@@ -339,6 +349,8 @@ struct announce_hook {
   struct rtable *table;
   struct proto *proto;
   struct announce_hook *next;		/* Next hook for the same protocol */
+  struct fib *exported;			/* Exported routes by network, only if the export filter uses ROA tables */
+  struct slab *exported_slab;		/* Entries of @exported lists */
 };
 
 struct announce_hook *proto_add_announce_hook(struct proto *, struct rtable *);
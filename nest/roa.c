@@ -0,0 +1,861 @@
+/*
+ *	BIRD -- Route Origin Authorization
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Route Origin Authorization
+ *
+ * ROA tables hold Route Origin Authorizations used for the origin
+ * validation of routes (RFC 6811). Each ROA item says that the prefix
+ * and its subprefixes up to the length @maxlen may be originated by the
+ * AS @asn.
+ *
+ * The items are kept in a compressed binary trie indexed by their
+ * prefix, each &roa_node holding the list of items for its prefix.
+ * Validation of a route by roa_check() is a single walk from the root
+ * towards the route's prefix which visits exactly the nodes covering it:
+ * the route is valid if any of their items matches both its origin AS and
+ * its length, invalid if there are some items, but none of them matches,
+ * and unknown if there are no items at all.
+ *
+ * There are three sources of ROA items: static items in the configuration,
+ * a ROA file (typically exported by an RPKI validator) and the |add roa|
+ * command. Both the static items and the file are reloaded during
+ * reconfiguration (the file also by the |reload roa| command) by marking
+ * their old items stale, adding the new ones and sweeping the stale
+ * rest, so only the items really added or removed count as changes.
+ *
+ * Each change is recorded in a second trie of changed prefixes and an
+ * event propagating them is scheduled. Only protocols with filters calling
+ * roa_check() on the table (see &filter->roa_deps) are affected, and only
+ * for the networks covered by the changed prefixes. Exports are
+ * re-evaluated using rt_refeed_nets(). Protocols with such import filters
+ * keep their routes as received in their import tables, so the routes are
+ * passed through the import filter again by rt_reimport() without asking
+ * the protocol (e.g. for a BGP route refresh). Pipes are an exception:
+ * routes going in both their directions are exports of a table.
+ */
+
+#undef LOCAL_DEBUG
+
+#include <stdio.h>
+
+#include "nest/bird.h"
+#include "nest/route.h"
+#include "nest/protocol.h"
+#include "nest/cli.h"
+#include "nest/roa.h"
+#include "lib/event.h"
+#include "lib/string.h"
+#include "conf/conf.h"
+#include "filter/filter.h"
+
+#define ROA_MAX_CHANGES 4096		/* Re-evaluate everything if there are more changes */
+
+list roa_table_list;			/* List of all ROA tables */
+static pool *roa_pool;
+static int roa_table_ids;
+
+static void roa_update(void *P);
+
+/*
+ *	The Trie
+ */
+
+static struct roa_node *
+roa_node_new(struct roa_table *t, ip_addr addr, int plen)
+{
+  struct roa_node *n = sl_alloc(t->node_slab);
+
+  bzero(n, sizeof(struct roa_node));
+  n->addr = addr;
+  n->plen = plen;
+  return n;
+}
+
+static inline void
+roa_node_attach(struct roa_node *parent, struct roa_node *child)
+{
+  parent->c[ipa_getbit(child->addr, parent->plen) ? 1 : 0] = child;
+}
+
+/* Find or create a node for @addr/@plen in the trie starting at @root */
+static struct roa_node *
+roa_node_get(struct roa_table *t, struct roa_node *root, ip_addr addr, int plen)
+{
+  struct roa_node *o = NULL, *n = root, *a, *b;
+
+  addr = ipa_and(addr, ipa_mkmask(plen));
+  while (n)
+    {
+      ip_addr cmask = ipa_mkmask(MIN(plen, n->plen));
+
+      if (ipa_nonzero(ipa_and(ipa_xor(addr, n->addr), cmask)))
+	{
+	  /* We are out of path - add branching node 'b' between 'o' and 'n' */
+	  int blen = ipa_pxlen(addr, n->addr);
+	  b = roa_node_new(t, ipa_and(addr, ipa_mkmask(blen)), blen);
+	  a = roa_node_new(t, addr, plen);
+	  roa_node_attach(o, b);
+	  roa_node_attach(b, n);
+	  roa_node_attach(b, a);
+	  return a;
+	}
+
+      if (plen == n->plen)
+	return n;
+
+      if (plen < n->plen)
+	{
+	  /* The new node goes between 'o' and 'n' */
+	  a = roa_node_new(t, addr, plen);
+	  roa_node_attach(o, a);
+	  roa_node_attach(a, n);
+	  return a;
+	}
+
+      o = n;
+      n = n->c[ipa_getbit(addr, n->plen) ? 1 : 0];
+    }
+
+  a = roa_node_new(t, addr, plen);
+  roa_node_attach(o, a);
+  return a;
+}
+
+/* Find a node for @addr/@plen, return also its parent and grandparent */
+static struct roa_node *
+roa_node_find(struct roa_node *n, ip_addr addr, int plen, struct roa_node **parent, struct roa_node **grandparent)
+{
+  *parent = *grandparent = NULL;
+  addr = ipa_and(addr, ipa_mkmask(plen));
+  while (n && (n->plen <= plen) && ipa_in_net(addr, n->addr, n->plen))
+    {
+      if (n->plen == plen)
+	return n;
+      *grandparent = *parent;
+      *parent = n;
+      n = n->c[ipa_getbit(addr, n->plen) ? 1 : 0];
+    }
+  return NULL;
+}
+
+/*
+ * Remove node @n with parent @o if it's useless, i.e., it has no items
+ * and it's not a branching node. The root is never removed.
+ */
+static int
+roa_node_unlink(struct roa_table *t, struct roa_node *n, struct roa_node *o)
+{
+  if (n->items || !o || (n->c[0] && n->c[1]))
+    return 0;
+
+  o->c[o->c[1] == n] = n->c[0] ? n->c[0] : n->c[1];
+  sl_free(t->node_slab, n);
+  return 1;
+}
+
+static void
+roa_node_free(struct roa_table *t, struct roa_node *n)
+{
+  if (n->c[0])
+    roa_node_free(t, n->c[0]);
+  if (n->c[1])
+    roa_node_free(t, n->c[1]);
+  sl_free(t->node_slab, n);
+}
+
+/*
+ *	Tracking of Changes
+ */
+
+static void
+roa_flush_changes(struct roa_table *t)
+{
+  struct roa_node *r = &t->chg_root;
+
+  if (r->c[0])
+    roa_node_free(t, r->c[0]);
+  if (r->c[1])
+    roa_node_free(t, r->c[1]);
+  r->c[0] = r->c[1] = NULL;
+  r->changed = 0;
+  t->changes = 0;
+  t->changed_all = 0;
+}
+
+static void
+roa_changed(struct roa_table *t, ip_addr addr, int plen)
+{
+  struct roa_node *n;
+
+  /* Nothing depends on a table which is just being created */
+  if (!t->update_event)
+    return;
+
+  if (t->changed_all)
+    return;
+
+  if (t->changes < ROA_MAX_CHANGES)
+    {
+      n = roa_node_get(t, &t->chg_root, addr, plen);
+      if (!n->changed)
+	{
+	  n->changed = 1;
+	  t->changes++;
+	}
+    }
+  else
+    {
+      roa_flush_changes(t);
+      t->changed_all = 1;
+    }
+
+  ev_schedule(t->update_event);
+}
+
+static int
+roa_is_changed(struct roa_table *t, ip_addr addr, int plen)
+{
+  struct roa_node *n = &t->chg_root;
+
+  if (t->changed_all)
+    return 1;
+
+  while (n && (n->plen <= plen) && ipa_in_net(addr, n->addr, n->plen))
+    {
+      if (n->changed)
+	return 1;
+      if (n->plen == plen)
+	break;
+      n = n->c[ipa_getbit(addr, n->plen) ? 1 : 0];
+    }
+  return 0;
+}
+
+static int
+roa_want_hook(struct announce_hook *h, void *data)
+{
+  struct roa_table *t = data;
+  struct proto *p = h->proto;
+  struct filter *f = p->out_filter;
+
+#ifdef CONFIG_PIPE
+  /* The secondary direction of the pipe */
+  if (proto_is_pipe(p) && (p->table != h->table))
+    f = p->in_filter;
+#endif
+
+  return filter_roa_deps(f) & roa_deps_mask(t->cf);
+}
+
+static int
+roa_want_net(net *n, void *data)
+{
+  return roa_is_changed(data, n->n.prefix, n->n.pxlen);
+}
+
+static int
+roa_want_import(struct fib_node *n, void *data)
+{
+  return roa_is_changed(data, n->prefix, n->pxlen);
+}
+
+static void
+roa_update(void *P)
+{
+  struct roa_table *t = P;
+  u32 mask = roa_deps_mask(t->cf);
+  struct proto *p;
+
+  DBG("ROA table %s: propagating %d changes%s\n", t->name, t->changes, t->changed_all ? " (all)" : "");
+  WALK_LIST(p, active_proto_list)
+    if ((p->proto_state == PS_UP) && (filter_roa_deps(p->in_filter) & mask)
+#ifdef CONFIG_PIPE
+	&& !proto_is_pipe(p)
+#endif
+	)
+      rt_reimport(p, roa_want_import, t);
+
+  rt_refeed_nets(roa_want_hook, roa_want_net, t);
+
+  roa_flush_changes(t);
+}
+
+/*
+ *	ROA Items
+ */
+
+/**
+ * roa_add_item - add a ROA item
+ * @t: ROA table
+ * @prefix: network prefix
+ * @pxlen: prefix length
+ * @maxlen: maximum length of the prefixes covered by the item
+ * @asn: AS number allowed to originate them
+ * @src: source of the item (%ROA_SRC_CONFIG, %ROA_SRC_FILE or %ROA_SRC_DYNAMIC)
+ *
+ * The item is added to the table unless the same item from the same source
+ * is already there. In the latter case, the stale mark of the existing
+ * item is removed.
+ */
+void
+roa_add_item(struct roa_table *t, ip_addr prefix, int pxlen, int maxlen, u32 asn, int src)
+{
+  struct roa_node *n = roa_node_get(t, &t->root, prefix, pxlen);
+  struct roa_item *it;
+
+  for (it = n->items; it; it = it->next)
+    if ((it->asn == asn) && (it->maxlen == maxlen) && (it->src == src))
+      {
+	it->stale = 0;
+	return;
+      }
+
+  it = sl_alloc(t->item_slab);
+  it->asn = asn;
+  it->maxlen = maxlen;
+  it->src = src;
+  it->stale = 0;
+  it->next = n->items;
+  n->items = it;
+  t->items++;
+  roa_changed(t, n->addr, n->plen);
+}
+
+/**
+ * roa_delete_item - delete a ROA item
+ * @t: ROA table
+ * @prefix: network prefix
+ * @pxlen: prefix length
+ * @maxlen: maximum prefix length
+ * @asn: AS number
+ * @src: source of the item
+ *
+ * Returns 1 if the item has been found and deleted, 0 otherwise.
+ */
+int
+roa_delete_item(struct roa_table *t, ip_addr prefix, int pxlen, int maxlen, u32 asn, int src)
+{
+  struct roa_node *n, *o, *g;
+  struct roa_item *it, **ip;
+
+  n = roa_node_find(&t->root, prefix, pxlen, &o, &g);
+  if (!n)
+    return 0;
+
+  for (ip = &n->items; it = *ip; ip = &it->next)
+    if ((it->asn == asn) && (it->maxlen == maxlen) && (it->src == src))
+      {
+	*ip = it->next;
+	sl_free(t->item_slab, it);
+	t->items--;
+	roa_changed(t, n->addr, n->plen);
+
+	/* The parent may become a useless branching node */
+	if (roa_node_unlink(t, n, o))
+	  roa_node_unlink(t, o, g);
+	return 1;
+      }
+
+  return 0;
+}
+
+static void
+roa_mark_stale(struct roa_node *n, int src, int stale)
+{
+  struct roa_item *it;
+
+  for (it = n->items; it; it = it->next)
+    if (it->src == src)
+      it->stale = stale;
+
+  if (n->c[0])
+    roa_mark_stale(n->c[0], src, stale);
+  if (n->c[1])
+    roa_mark_stale(n->c[1], src, stale);
+}
+
+static void
+roa_prune_node(struct roa_table *t, struct roa_node *n, struct roa_node *o, int src, int stale)
+{
+  struct roa_item *it, **ip;
+  int removed = 0;
+
+  /* Children first, so that we see whether we are still a branching node */
+  if (n->c[0])
+    roa_prune_node(t, n->c[0], n, src, stale);
+  if (n->c[1])
+    roa_prune_node(t, n->c[1], n, src, stale);
+
+  ip = &n->items;
+  while (it = *ip)
+    if (((src == ROA_SRC_ANY) || (it->src == src)) && (!stale || it->stale))
+      {
+	*ip = it->next;
+	sl_free(t->item_slab, it);
+	t->items--;
+	removed++;
+      }
+    else
+      ip = &it->next;
+
+  if (removed)
+    roa_changed(t, n->addr, n->plen);
+
+  roa_node_unlink(t, n, o);
+}
+
+/**
+ * roa_flush - remove ROA items
+ * @t: ROA table
+ * @src: source of items to be removed or %ROA_SRC_ANY
+ */
+void
+roa_flush(struct roa_table *t, int src)
+{
+  roa_prune_node(t, &t->root, NULL, src, 0);
+}
+
+/**
+ * roa_check - validate origin of a route
+ * @t: ROA table
+ * @prefix: network prefix of the route
+ * @pxlen: prefix length
+ * @asn: origin AS of the route (zero if unknown)
+ *
+ * Returns %ROA_VALID if any ROA item covering the prefix allows
+ * @asn to originate it, %ROA_INVALID if there are covering items,
+ * but none of them matches and %ROA_UNKNOWN if there are no covering
+ * items at all. Items for AS 0 never match.
+ */
+int
+roa_check(struct roa_table *t, ip_addr prefix, int pxlen, u32 asn)
+{
+  struct roa_node *n = &t->root;
+  struct roa_item *it;
+  int covered = 0;
+
+  while (n && (n->plen <= pxlen) && ipa_in_net(prefix, n->addr, n->plen))
+    {
+      for (it = n->items; it; it = it->next)
+	{
+	  if (asn && (it->asn == asn) && (pxlen <= it->maxlen))
+	    return ROA_VALID;
+	  covered = 1;
+	}
+
+      if (n->plen == pxlen)
+	break;
+      n = n->c[ipa_getbit(prefix, n->plen) ? 1 : 0];
+    }
+
+  return covered ? ROA_INVALID : ROA_UNKNOWN;
+}
+
+/*
+ *	ROA Files
+ */
+
+/* Returns 1 for a ROA, 0 for lines to be ignored and -1 for errors */
+static int
+roa_parse_line(char *line, ip_addr *prefix, int *pxlen, int *maxlen, u32 *asn)
+{
+  char addr[64];
+
+  /* Skip comments, headers and empty lines */
+  if (line[0] != 'A' || line[1] != 'S' || line[2] < '0' || line[2] > '9')
+    return 0;
+
+  if (sscanf(line, "AS%u , %63[^/]/%d , %d", asn, addr, pxlen, maxlen) != 4)
+    return -1;
+
+  /* ROAs for the other address family */
+#ifndef IPV6
+  if (strchr(addr, ':'))
+    return 0;
+#else
+  if (!strchr(addr, ':'))
+    return 0;
+#endif
+
+  if (!ip_pton(addr, prefix) ||
+      (*pxlen < 0) || (*pxlen > MAX_PREFIX_LENGTH) || !ip_is_prefix(*prefix, *pxlen) ||
+      (*maxlen < *pxlen) || (*maxlen > MAX_PREFIX_LENGTH))
+    return -1;
+
+  return 1;
+}
+
+/**
+ * roa_load_file - load ROA items from a file
+ * @t: ROA table
+ * @name: file name
+ *
+ * The file is expected in the CSV format exported by RPKI validators,
+ * that is one ROA per line in the form |AS<asn>,<prefix>,<maxlen>|,
+ * optionally followed by more fields which are ignored. Header lines,
+ * comments and ROAs of the other address family are skipped.
+ *
+ * The file replaces all items loaded from a file before. If it cannot
+ * be read, the table is left unchanged and -1 is returned, otherwise
+ * the function returns the number of items in the file.
+ */
+int
+roa_load_file(struct roa_table *t, char *name)
+{
+  FILE *f = fopen(name, "r");
+  char line[256];
+  ip_addr prefix;
+  int pxlen, maxlen, lino = 0, count = 0;
+  u32 asn;
+
+  if (!f)
+    {
+      log(L_ERR "ROA table %s: Cannot open %s: %m", t->name, name);
+      return -1;
+    }
+
+  roa_mark_stale(&t->root, ROA_SRC_FILE, 1);
+  while (fgets(line, sizeof(line), f))
+    {
+      lino++;
+      switch (roa_parse_line(line, &prefix, &pxlen, &maxlen, &asn))
+	{
+	case 1:
+	  roa_add_item(t, prefix, pxlen, maxlen, asn, ROA_SRC_FILE);
+	  count++;
+	  break;
+	case -1:
+	  log(L_WARN "ROA table %s: %s, line %d: Invalid ROA ignored", t->name, name, lino);
+	  break;
+	}
+    }
+
+  if (ferror(f))
+    {
+      log(L_ERR "ROA table %s: Error reading %s: %m", t->name, name);
+      roa_mark_stale(&t->root, ROA_SRC_FILE, 0);
+      fclose(f);
+      return -1;
+    }
+
+  fclose(f);
+  roa_prune_node(t, &t->root, NULL, ROA_SRC_FILE, 1);
+  return count;
+}
+
+/*
+ *	Configuration
+ */
+
+/**
+ * roa_init - initialize ROA tables
+ *
+ * This function is called during BIRD startup.
+ */
+void
+roa_init(void)
+{
+  roa_pool = rp_new(&root_pool, "ROA tables");
+  init_list(&roa_table_list);
+}
+
+void
+roa_preconfig(struct config *c)
+{
+  init_list(&c->roa_tables);
+  roa_table_ids = 0;
+}
+
+struct roa_table_config *
+roa_new_table_config(struct symbol *s)
+{
+  struct roa_table_config *rtc = cfg_allocz(sizeof(struct roa_table_config));
+
+  cf_define_symbol(s, SYM_ROA, rtc);
+  rtc->name = s->name;
+  rtc->id = roa_table_ids++;
+  add_tail(&new_config->roa_tables, &rtc->n);
+  return rtc;
+}
+
+void
+roa_add_item_config(struct roa_table_config *rtc, ip_addr prefix, int pxlen, int maxlen, u32 asn)
+{
+  struct roa_item_config *ric = cfg_allocz(sizeof(struct roa_item_config));
+
+  ric->prefix = prefix;
+  ric->pxlen = pxlen;
+  ric->maxlen = maxlen;
+  ric->asn = asn;
+  ric->next = rtc->roa_items;
+  rtc->roa_items = ric;
+}
+
+/**
+ * roa_default_table_config - the default ROA table for CLI commands
+ *
+ * Returns the first ROA table of the current configuration or %NULL
+ * if there is none.
+ */
+struct roa_table_config *
+roa_default_table_config(void)
+{
+  return EMPTY_LIST(config->roa_tables) ? NULL : HEAD(config->roa_tables);
+}
+
+static void
+roa_reconfigure(struct roa_table *t)
+{
+  struct roa_item_config *ric;
+
+  roa_mark_stale(&t->root, ROA_SRC_CONFIG, 1);
+  for (ric = t->cf->roa_items; ric; ric = ric->next)
+    roa_add_item(t, ric->prefix, ric->pxlen, ric->maxlen, ric->asn, ROA_SRC_CONFIG);
+  roa_prune_node(t, &t->root, NULL, ROA_SRC_CONFIG, 1);
+
+  if (t->cf->file)
+    roa_load_file(t, t->cf->file);
+  else
+    roa_flush(t, ROA_SRC_FILE);
+}
+
+static void
+roa_new_table(struct roa_table_config *cf)
+{
+  pool *p = rp_new(roa_pool, "ROA table");
+  struct roa_table *t = mb_allocz(p, sizeof(struct roa_table));
+
+  DBG("\t%s: created\n", cf->name);
+  t->pool = p;
+  t->name = cf->name;
+  t->cf = cf;
+  t->node_slab = sl_new(p, sizeof(struct roa_node));
+  t->item_slab = sl_new(p, sizeof(struct roa_item));
+  cf->table = t;
+  add_tail(&roa_table_list, &t->n);
+
+  roa_reconfigure(t);
+
+  t->update_event = ev_new(p);
+  t->update_event->hook = roa_update;
+  t->update_event->data = t;
+}
+
+/**
+ * roa_commit - commit new ROA table configuration
+ * @new: new configuration
+ * @old: original configuration or %NULL if it's boot time config
+ *
+ * Tables existing in both configurations are kept together with their
+ * dynamic items, their static items and ROA files are reloaded. Tables
+ * missing in the new configuration are freed immediately; filters of the
+ * old configuration still referring to them fail with a runtime error.
+ */
+void
+roa_commit(struct config *new, struct config *old)
+{
+  struct roa_table_config *cf;
+  struct roa_table *t, *tt;
+
+  if (new->shutdown)
+    return;
+
+  DBG("roa_commit:\n");
+  if (old)
+    WALK_LIST_DELSAFE(t, tt, roa_table_list)
+      {
+	struct symbol *sym = cf_find_symbol(t->name);
+	if (sym && sym->class == SYM_ROA)
+	  {
+	    DBG("\t%s: same\n", t->name);
+	    cf = sym->def;
+	    cf->table = t;
+	    t->name = cf->name;
+	    t->cf = cf;
+	    roa_reconfigure(t);
+	  }
+	else
+	  {
+	    DBG("\t%s: deleted\n", t->name);
+	    t->cf->table = NULL;
+	    rem_node(&t->n);
+	    rfree(t->pool);
+	  }
+      }
+
+  WALK_LIST(cf, new->roa_tables)
+    if (!cf->table)
+      roa_new_table(cf);
+}
+
+/*
+ *	CLI Commands
+ */
+
+static void
+roa_show_node(struct cli *c, struct roa_node *n, u32 asn)
+{
+  struct roa_item *it;
+
+  for (it = n->items; it; it = it->next)
+    if (!asn || (it->asn == asn))
+      cli_printf(c, -1019, "%I/%d max %d as %u", n->addr, n->plen, it->maxlen, it->asn);
+}
+
+/*
+ * Nodes are shown in the preorder, which is the same as the order by
+ * address and then by length. The continuation remembers the last node
+ * shown and skips everything up to it, so the trie may freely change
+ * between the calls.
+ */
+static int
+roa_show_subtree(struct cli *c, struct roa_show_data *d, struct roa_node *n, int *max)
+{
+  if (!n)
+    return 1;
+
+  if ((d->last_plen >= 0) &&
+      (ipa_compare(ipa_or(n->addr, ipa_not(ipa_mkmask(n->plen))), d->last_addr) < 0))
+    return 1;
+
+  if (n->items && ((d->last_plen < 0) || (ipa_compare(n->addr, d->last_addr) > 0) ||
+		   (ipa_equal(n->addr, d->last_addr) && (n->plen > d->last_plen))))
+    {
+      if (!(*max)--)
+	return 0;
+      roa_show_node(c, n, d->asn);
+      d->last_addr = n->addr;
+      d->last_plen = n->plen;
+    }
+
+  return roa_show_subtree(c, d, n->c[0], max) && roa_show_subtree(c, d, n->c[1], max);
+}
+
+static void
+roa_show_cont(struct cli *c)
+{
+  struct roa_show_data *d = c->rover;
+  struct roa_node *n = &d->table->root;
+#ifdef DEBUGGING
+  int max = 4;
+#else
+  int max = 64;
+#endif
+
+  if (d->running_on_config != config)
+    {
+      cli_printf(c, 8004, "Stopped due to reconfiguration");
+      goto done;
+    }
+
+  if (d->mode == ROA_SHOW_IN)
+    {
+      /* Find the root of the subtree of prefixes in d->prefix */
+      while (n && (n->plen < d->pxlen) && ipa_in_net(d->prefix, n->addr, n->plen))
+	n = n->c[ipa_getbit(d->prefix, n->plen) ? 1 : 0];
+      if (n && !ipa_in_net(n->addr, d->prefix, d->pxlen))
+	n = NULL;
+    }
+
+  if (!roa_show_subtree(c, d, n, &max))
+    return;
+
+  cli_printf(c, 0, "");
+done:
+  c->cont = c->cleanup = NULL;
+}
+
+/**
+ * roa_show - the |show roa| command
+ * @d: parsed arguments
+ */
+void
+roa_show(struct roa_show_data *d)
+{
+  struct roa_node *n, *o, *g;
+
+  switch (d->mode)
+    {
+    case ROA_SHOW_ALL:
+    case ROA_SHOW_IN:
+      d->last_plen = -1;
+      this_cli->cont = roa_show_cont;
+      this_cli->cleanup = NULL;
+      this_cli->rover = d;
+      return;
+
+    case ROA_SHOW_PX:
+      if (n = roa_node_find(&d->table->root, d->prefix, d->pxlen, &o, &g))
+	roa_show_node(this_cli, n, d->asn);
+      break;
+
+    case ROA_SHOW_FOR:
+      n = &d->table->root;
+      while (n && (n->plen <= d->pxlen) && ipa_in_net(d->prefix, n->addr, n->plen))
+	{
+	  roa_show_node(this_cli, n, d->asn);
+	  if (n->plen == d->pxlen)
+	    break;
+	  n = n->c[ipa_getbit(d->prefix, n->plen) ? 1 : 0];
+	}
+      break;
+    }
+  cli_msg(0, "");
+}
+
+void
+roa_cmd_add(struct roa_table_config *rtc, ip_addr prefix, int pxlen, int maxlen, u32 asn)
+{
+  if (cli_access_restricted())
+    return;
+
+  roa_add_item(rtc->table, prefix, pxlen, maxlen, asn, ROA_SRC_DYNAMIC);
+  cli_msg(0, "");
+}
+
+void
+roa_cmd_delete(struct roa_table_config *rtc, ip_addr prefix, int pxlen, int maxlen, u32 asn)
+{
+  if (cli_access_restricted())
+    return;
+
+  if (roa_delete_item(rtc->table, prefix, pxlen, maxlen, asn, ROA_SRC_DYNAMIC))
+    cli_msg(0, "");
+  else
+    cli_msg(8009, "No such ROA");
+}
+
+void
+roa_cmd_flush(struct roa_table_config *rtc)
+{
+  if (cli_access_restricted())
+    return;
+
+  roa_flush(rtc->table, ROA_SRC_DYNAMIC);
+  cli_msg(0, "");
+}
+
+void
+roa_cmd_reload(struct roa_table_config *rtc)
+{
+  int count;
+
+  if (cli_access_restricted())
+    return;
+
+  if (!rtc->file)
+    {
+      cli_msg(8010, "%s: No ROA file configured", rtc->name);
+      return;
+    }
+
+  count = roa_load_file(rtc->table, rtc->file);
+  if (count < 0)
+    cli_msg(8010, "%s: Cannot load %s", rtc->name, rtc->file);
+  else
+    cli_msg(18, "%s: %d ROAs loaded, %u in table", rtc->name, count, rtc->table->items);
+}
@@ -0,0 +1,119 @@
+/*
+ *	BIRD -- Route Origin Authorization
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_ROA_H_
+#define _BIRD_ROA_H_
+
+#include "lib/lists.h"
+#include "lib/resource.h"
+#include "lib/ip.h"
+
+/* Results of roa_check() (T_ENUM_ROA) */
+
+#define ROA_UNKNOWN	0
+#define ROA_VALID	1
+#define ROA_INVALID	2
+
+/* Sources of ROA items */
+
+#define ROA_SRC_ANY	0
+#define ROA_SRC_CONFIG	1		/* Static ROAs from the configuration */
+#define ROA_SRC_FILE	2		/* ROAs loaded from the ROA file */
+#define ROA_SRC_DYNAMIC	3		/* ROAs added by the add roa command */
+
+struct roa_item {
+  struct roa_item *next;
+  u32 asn;
+  byte maxlen;
+  byte src;				/* ROA_SRC_* */
+  byte stale;				/* Not seen during the current reload */
+};
+
+struct roa_node {
+  struct roa_node *c[2];
+  ip_addr addr;
+  byte plen;
+  byte changed;				/* Change trie: ROA for this prefix has changed */
+  struct roa_item *items;		/* ROAs for exactly this prefix */
+};
+
+struct roa_item_config {
+  struct roa_item_config *next;
+  ip_addr prefix;
+  byte pxlen, maxlen;
+  u32 asn;
+};
+
+struct roa_table_config {
+  node n;
+  char *name;
+  struct roa_table *table;
+  struct roa_item_config *roa_items;	/* Static ROA items */
+  char *file;				/* File to load ROA items from */
+  int id;				/* Index of the table in the config, see roa_deps_mask() */
+};
+
+struct roa_table {
+  node n;				/* Node in list of all ROA tables */
+  char *name;
+  pool *pool;
+  slab *node_slab, *item_slab;
+  struct roa_table_config *cf;		/* Configuration of this table */
+  struct roa_node root;			/* Trie of ROAs, root is ::/0 */
+  unsigned items;			/* Number of ROA items */
+  struct roa_node chg_root;		/* Trie of changed prefixes not yet propagated */
+  unsigned changes;			/* Number of nodes in the change trie */
+  int changed_all;			/* Too many changes, re-evaluate everything */
+  struct event *update_event;		/* Propagation of ROA changes to protocols */
+};
+
+/* Each ROA table has a bit in the ROA dependency mask of filters */
+static inline u32 roa_deps_mask(struct roa_table_config *cf)
+{ return 1U << (cf->id % 32); }
+
+struct config;
+struct symbol;
+
+extern list roa_table_list;
+
+void roa_init(void);
+void roa_preconfig(struct config *);
+void roa_commit(struct config *new, struct config *old);
+struct roa_table_config *roa_new_table_config(struct symbol *s);
+struct roa_table_config *roa_default_table_config(void);
+void roa_add_item_config(struct roa_table_config *rtc, ip_addr prefix, int pxlen, int maxlen, u32 asn);
+
+void roa_add_item(struct roa_table *t, ip_addr prefix, int pxlen, int maxlen, u32 asn, int src);
+int roa_delete_item(struct roa_table *t, ip_addr prefix, int pxlen, int maxlen, u32 asn, int src);
+void roa_flush(struct roa_table *t, int src);
+int roa_check(struct roa_table *t, ip_addr prefix, int pxlen, u32 asn);
+int roa_load_file(struct roa_table *t, char *name);
+
+#define ROA_SHOW_ALL	0
+#define ROA_SHOW_PX	1
+#define ROA_SHOW_IN	2
+#define ROA_SHOW_FOR	3
+
+struct roa_show_data {
+  struct roa_table *table;
+  int mode;				/* ROA_SHOW_* */
+  ip_addr prefix;
+  int pxlen;
+  u32 asn;				/* Show only ROAs for this AS if nonzero */
+  ip_addr last_addr;			/* Continuation: last node we have shown */
+  int last_plen;
+  struct config *running_on_config;
+};
+
+void roa_show(struct roa_show_data *d);
+
+/* CLI commands modifying ROA tables */
+void roa_cmd_add(struct roa_table_config *rtc, ip_addr prefix, int pxlen, int maxlen, u32 asn);
+void roa_cmd_delete(struct roa_table_config *rtc, ip_addr prefix, int pxlen, int maxlen, u32 asn);
+void roa_cmd_flush(struct roa_table_config *rtc);
+void roa_cmd_reload(struct roa_table_config *rtc);
+
+#endif
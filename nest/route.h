@@ -15,6 +15,7 @@
 
 struct protocol;
 struct proto;
+struct announce_hook;
 struct symbol;
 struct filter;
 struct cli;
@@ -120,8 +121,23 @@ struct rtable_config {
   struct proto_config *krt_attached;	/* Kernel syncer attached to this table */
   int gc_max_ops;			/* Maximum number of operations before GC is run */
   int gc_min_time;			/* Minimum time between two consecutive GC runs */
+  int sorted;				/* Keep an ordered index of networks */
+  char *snapshot;			/* Snapshot file name, NULL if none */
+  unsigned snapshot_period;		/* Time between two periodic snapshots, 0 means only at shutdown */
+  unsigned stale_time;			/* How long routes restored from the snapshot wait for their protocols */
 };
 
+#define RT_DEFAULT_STALE_TIME 300
+
+struct rt_index_node {
+  struct rt_index_node *c[2];
+  ip_addr addr;
+  byte plen;
+  struct network *net;			/* Network with exactly this prefix, NULL if none */
+};
+
+#define RTS_MAX 14			/* Number of route sources, see RTS_* below */
+
 typedef struct rtable {
   node n;				/* Node in list of all tables */
   struct fib fib;
@@ -137,6 +153,15 @@ typedef struct rtable {
   struct event *gc_event;		/* Garbage collector event */
   int gc_counter;			/* Number of operations since last GC */
   bird_clock_t gc_time;			/* Time of last GC */
+  unsigned net_count;			/* Number of networks with at least one route */
+  unsigned rte_count;			/* Number of routes */
+  unsigned src_count[RTS_MAX];		/* Number of routes by their source (RTS_*) */
+  struct rt_index_node *index;		/* Trie of networks with routes (root is 0/0), NULL if not sorted */
+  slab *index_slab;			/* Nodes of the index */
+  void (*index_notify)(struct network *, void *); /* Called when a network is added to or removed from the index */
+  void *index_notify_data;
+  struct timer *snapshot_timer;		/* Periodic snapshot, NULL if none */
+  struct timer *stale_timer;		/* Removal of stale routes, NULL if none */
 } rtable;
 
 typedef struct network {
@@ -180,6 +205,7 @@ typedef struct rte {
 } rte;
 
 #define REF_COW 1			/* Copy this rte on write */
+#define REF_STALE 2			/* Restored from a snapshot, not yet confirmed by its protocol */
 
 /* Types of route announcement, also used as flags */
 #define RA_OPTIMAL 1			/* Announcement of optimal route change */
@@ -199,6 +225,7 @@ rte *rte_find(net *net, struct proto *p);
 rte *rte_get_temp(struct rta *);
 void rte_update(rtable *tab, net *net, struct proto *p, struct proto *src, rte *new);
 void rte_discard(rtable *tab, rte *old);
+void rte_restore(rtable *tab, net *net, struct proto *p, rte *new);
 void rte_dump(rte *);
 void rte_free(rte *);
 rte *rte_do_cow(rte *);
@@ -207,9 +234,21 @@ void rt_dump(rtable *);
 void rt_dump_all(void);
 int rt_feed_baby(struct proto *p);
 void rt_feed_baby_abort(struct proto *p);
+void rt_refeed_nets(int (*want_hook)(struct announce_hook *, void *), int (*want_net)(net *, void *), void *data);
+void rt_reimport(struct proto *p, int (*want)(struct fib_node *, void *), void *data);
+void rt_export_reset(struct announce_hook *a);
+void rt_import_flush(struct proto *p);
 void rt_prune(rtable *tab);
 void rt_prune_all(void);
+int rt_prune_stale(rtable *tab, struct proto *p);
+void rt_prune_stale_all(struct proto *p);
+void rt_snapshot_init(void);
+void rt_snapshot_setup(rtable *t, struct rtable_config *cf);
+int rt_snapshot_write(rtable *t);
+void rt_snapshot_restore(struct config *c);
 struct rtable_config *rt_new_table(struct symbol *s);
+net *rt_index_cover(rtable *t, ip_addr addr, int plen);
+void rt_index_walk(rtable *t, ip_addr addr, int plen, void (*hook)(net *, void *), void *data);
 
 struct rt_show_data {
   ip_addr prefix;
@@ -223,7 +262,12 @@ struct rt_show_data {
   int export_mode, primary_only;
   struct config *running_on_config;
   int net_counter, rt_counter, show_counter;
+  int src_counter[RTS_MAX];		/* Shown routes by their source */
   int stats, show_for;
+  int bulk;				/* Machine-readable output, see rt_show_bulk() */
+  int show_in;				/* Show networks inside the prefix */
+  ip_addr last_addr;			/* Last network shown when walking the index */
+  int last_plen;
 };
 void rt_show(struct rt_show_data *);
 
@@ -265,6 +309,7 @@ typedef struct rta {
 #define RTS_OSPF_EXT2 10		/* OSPF external route type 2 */
 #define RTS_BGP 11			/* BGP route */
 #define RTS_PIPE 12			/* Inter-table wormhole */
+#define RTS_AGGREGATE 13		/* Aggregate of other routes */
 
 #define RTC_UNICAST 0
 #define RTC_BROADCAST 1
@@ -356,6 +401,7 @@ void rta__free(rta *r);
 static inline void rta_free(rta *r) { if (r && !--r->uc) rta__free(r); }
 void rta_dump(rta *);
 void rta_dump_all(void);
+void rta_cache_stats(unsigned int *count, unsigned int *size);
 void rta_show(struct cli *, rta *, ea_list *);
 
 extern struct protocol *attr_class_to_protocol[EAP_MAX];
@@ -370,6 +416,7 @@ extern struct protocol *attr_class_to_protocol[EAP_MAX];
 #define DEF_PREF_RIP		120	/* RIP */
 #define DEF_PREF_BGP		100	/* BGP */
 #define DEF_PREF_PIPE		70	/* Routes piped from other tables */
+#define DEF_PREF_AGGREGATE	50	/* Aggregates of other routes */
 #define DEF_PREF_INHERITED	10	/* Routes inherited from other routing daemons */
 
 #endif
@@ -703,7 +703,8 @@ rta_dump(rta *a)
   static char *rts[] = { "RTS_DUMMY", "RTS_STATIC", "RTS_INHERIT", "RTS_DEVICE",
 			 "RTS_STAT_DEV", "RTS_REDIR", "RTS_RIP",
 			 "RTS_OSPF", "RTS_OSPF_IA", "RTS_OSPF_EXT1",
-                         "RTS_OSPF_EXT2", "RTS_BGP" };
+                         "RTS_OSPF_EXT2", "RTS_BGP", "RTS_PIPE",
+			 "RTS_AGGREGATE" };
   static char *rtc[] = { "", " BC", " MC", " AC" };
   static char *rtd[] = { "", " DEV", " HOLE", " UNREACH", " PROHIBIT" };
 
@@ -747,11 +748,24 @@ rta_dump_all(void)
   debug("\n");
 }
 
+/**
+ * rta_cache_stats - report size of attribute cache
+ * @count: where to store the number of cached attribute sets
+ * @size: where to store the number of hash table buckets
+ */
+void
+rta_cache_stats(unsigned int *count, unsigned int *size)
+{
+  *count = rta_cache_count;
+  *size = rta_cache_size;
+}
+
 void
 rta_show(struct cli *c, rta *a, ea_list *eal)
 {
-  static char *src_names[] = { "dummy", "static", "inherit", "device", "static-device", "redirect",
-			       "RIP", "OSPF", "OSPF-ext", "OSPF-IA", "OSPF-boundary", "BGP" };
+  static char *src_names[RTS_MAX] = { "dummy", "static", "inherit", "device", "static-device", "redirect",
+				      "RIP", "OSPF", "OSPF-ext", "OSPF-IA", "OSPF-boundary", "BGP", "pipe",
+				      "aggregate" };
   static char *cast_names[] = { "unicast", "broadcast", "multicast", "anycast" };
   int i;
   byte buf[EA_FORMAT_BUF_SIZE];
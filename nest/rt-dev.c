@@ -92,9 +92,16 @@ dev_reconfigure(struct proto *p, struct proto_config *new)
   return iface_patts_equal(&o->iface_list, &n->iface_list, NULL);
 }
 
+static void
+dev_adopt(struct proto *p UNUSED, struct proto_config *new UNUSED)
+{
+  /* We keep no private pointers to the configuration */
+}
+
 struct protocol proto_device = {
   name:		"Direct",
   template:	"direct%d",
   init:		dev_init,
-  reconfigure:	dev_reconfigure
+  reconfigure:	dev_reconfigure,
+  adopt:	dev_adopt
 };
@@ -0,0 +1,706 @@
+/*
+ *	BIRD -- Routing Table Snapshots
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Routing table snapshots
+ *
+ * A routing table configured with a snapshot file has its contents
+ * saved to the file during shutdown and optionally also periodically.
+ * When BIRD starts again, the routes are read back before the protocols
+ * deliver their own ones, so the table (and the kernel FIB fed from it)
+ * is usable right away instead of after all BGP sessions and IGPs
+ * converge.
+ *
+ * The restored routes are marked with %REF_STALE. They behave like
+ * ordinary routes of their protocols, but they are kept in the table
+ * while the protocols are still starting (see rt_prune()). When a protocol
+ * announces the same route again, the mark is just cleared, a different
+ * one replaces the stale route as usual. When the stale time of the table
+ * expires, the routes which haven't been confirmed are removed by
+ * rt_prune_stale(). This is the local equivalent of graceful restart.
+ *
+ * The snapshot is a single file in the native byte order which is read
+ * by mmap() without any parsing. It consists of a header followed by three
+ * areas: an array of &snap_route's, the route attributes and the strings.
+ * Each cached &rta is stored once as &snap_rta followed by its extended
+ * attributes, each attribute with variable length data being immediately
+ * followed by the data in the form of &adata padded to 4 bytes. Protocols
+ * and interfaces are referenced by their names in the string area, so
+ * routes of protocols or interfaces which don't exist after the restart are
+ * skipped. Routes of protocols which are already running when the snapshot
+ * is restored are skipped as well, as such protocols have already sent
+ * their fresh routes.
+ *
+ * RIP routes are never saved as they carry pointers to the protocol's
+ * private data.
+ */
+
+#undef LOCAL_DEBUG
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "nest/bird.h"
+#include "nest/route.h"
+#include "nest/protocol.h"
+#include "nest/iface.h"
+#include "lib/resource.h"
+#include "lib/string.h"
+#include "lib/alloca.h"
+#include "conf/conf.h"
+
+#define SNAP_MAGIC "BIRDSNAP"
+#define SNAP_VERSION 1
+#define SNAP_U_SIZE 16			/* Saved part of rte->u */
+
+struct snap_header {
+  char magic[8];			/* SNAP_MAGIC */
+  u32 version;				/* SNAP_VERSION */
+  u32 addr_size;			/* sizeof(ip_addr) to catch IPv4/IPv6 mismatch */
+  u32 size;				/* Size of the whole file */
+  u32 time;				/* When the snapshot was taken (now_real) */
+  u32 routes, route_count;		/* Offset of the route array and its length */
+  u32 rtas, rta_size;			/* Offset and size of the attribute area */
+  u32 strings, string_size;		/* Offset and size of the string area */
+};
+
+struct snap_route {
+  ip_addr prefix;
+  byte pxlen;
+  byte pflags;
+  u16 pref;
+  u32 rta;				/* Offset in the attribute area */
+  u32 sender;				/* Sending protocol, offset in the string area */
+  byte u[SNAP_U_SIZE];			/* Protocol-dependent data (OSPF and krt only) */
+};
+
+struct snap_rta {
+  u32 proto;				/* Originating protocol, offset in the string area */
+  u32 iface;				/* Interface name, offset in the string area, 0 if none */
+  ip_addr gw;
+  ip_addr from;
+  byte source, scope, cast, dest;
+  byte flags;
+  byte rfu;
+  u16 ea_count;				/* Number of extended attributes following */
+};
+
+struct snap_eattr {
+  u16 id;
+  byte flags;
+  byte type;
+  u32 data;				/* Embedded value or the length of &adata following */
+};
+
+static pool *snap_pool;
+static linpool *snap_lp;
+
+void
+rt_snapshot_init(void)
+{
+  snap_pool = rp_new(&root_pool, "Table snapshots");
+  snap_lp = lp_new(snap_pool, 4080);
+}
+
+
+/*
+ *	Writing of snapshots
+ */
+
+struct snap_buf {
+  byte *data;
+  u32 len, size;
+};
+
+struct snap_key {
+  void *ptr;
+  u32 off;
+};
+
+struct snap_writer {
+  struct snap_buf routes, rtas, strings;
+  struct snap_key *keys;		/* Offsets of already stored rta's and names */
+  unsigned keys_size, keys_count;
+};
+
+static void *
+snap_put(struct snap_buf *b, unsigned len)
+{
+  void *d;
+
+  if (b->len + len > b->size)
+    {
+      while (b->len + len > b->size)
+	b->size = b->size ? 2 * b->size : 4096;
+      b->data = xrealloc(b->data, b->size);
+    }
+  d = b->data + b->len;
+  bzero(d, len);
+  b->len += len;
+  return d;
+}
+
+static inline unsigned
+snap_hash(void *ptr)
+{
+  return ((unsigned long) ptr >> 3) * 0x9e3779b1;
+}
+
+static struct snap_key *
+snap_find(struct snap_writer *w, void *ptr)
+{
+  unsigned i;
+
+  if (2 * w->keys_count >= w->keys_size)
+    {
+      struct snap_key *old = w->keys;
+      unsigned old_size = w->keys_size;
+
+      w->keys_size = old_size ? 2 * old_size : 1024;
+      w->keys = xmalloc(w->keys_size * sizeof(struct snap_key));
+      bzero(w->keys, w->keys_size * sizeof(struct snap_key));
+      for (i = 0; i < old_size; i++)
+	if (old[i].ptr)
+	  *snap_find(w, old[i].ptr) = old[i];
+      xfree(old);
+    }
+
+  i = snap_hash(ptr) & (w->keys_size - 1);
+  while (w->keys[i].ptr && w->keys[i].ptr != ptr)
+    i = (i + 1) & (w->keys_size - 1);
+  return &w->keys[i];
+}
+
+static u32
+snap_string(struct snap_writer *w, void *key, char *s1, char *s2)
+{
+  struct snap_key *k = snap_find(w, key);
+  unsigned l1, l2;
+  char *d;
+
+  if (k->ptr)
+    return k->off;
+
+  /* Protocols are stored as "<class> <name>", interfaces by their names */
+  l1 = strlen(s1);
+  l2 = s2 ? strlen(s2) + 1 : 0;
+  k->ptr = key;
+  k->off = w->strings.len;
+  w->keys_count++;
+  d = snap_put(&w->strings, l1 + l2 + 1);
+  memcpy(d, s1, l1);
+  if (s2)
+    {
+      d[l1] = ' ';
+      memcpy(d + l1 + 1, s2, l2 - 1);
+    }
+  return k->off;
+}
+
+static inline u32
+snap_proto(struct snap_writer *w, struct proto *p)
+{
+  return snap_string(w, p, p->proto->name, p->name);
+}
+
+static u32
+snap_rta(struct snap_writer *w, rta *a)
+{
+  struct snap_key *k = snap_find(w, a);
+  struct snap_rta *sa;
+  ea_list *l;
+  u32 off, proto, iface;
+  unsigned count = 0;
+  int i;
+
+  if (k->ptr)
+    return k->off;
+  k->ptr = a;
+  w->keys_count++;
+
+  /* The key table may grow while storing the names, k is invalid since then */
+  off = k->off = w->rtas.len;
+  proto = snap_proto(w, a->proto);
+  iface = a->iface ? snap_string(w, a->iface, a->iface->name, NULL) : 0;
+
+  sa = snap_put(&w->rtas, sizeof(struct snap_rta));
+  sa->proto = proto;
+  sa->iface = iface;
+  sa->gw = a->gw;
+  sa->from = a->from;
+  sa->source = a->source;
+  sa->scope = a->scope;
+  sa->cast = a->cast;
+  sa->dest = a->dest;
+  sa->flags = a->flags;
+
+  for (l = a->eattrs; l; l = l->next)
+    for (i = 0; i < l->count; i++)
+      {
+	eattr *e = &l->attrs[i];
+	struct snap_eattr *se = snap_put(&w->rtas, sizeof(struct snap_eattr));
+
+	se->id = e->id;
+	se->flags = e->flags;
+	se->type = e->type;
+	if (e->type & EAF_EMBEDDED)
+	  se->data = e->u.data;
+	else
+	  {
+	    se->data = e->u.ptr->length;
+	    memcpy(snap_put(&w->rtas, BIRD_ALIGN(e->u.ptr->length, 4)), e->u.ptr->data, e->u.ptr->length);
+	  }
+	count++;
+      }
+
+  ((struct snap_rta *) (w->rtas.data + off))->ea_count = count;
+  return off;
+}
+
+static inline int
+snap_wanted(rte *e)
+{
+  return (e->attrs->source != RTS_RIP) &&
+    (e->sender->core_state != FS_FLUSHING) &&
+    (e->attrs->proto->core_state != FS_FLUSHING);
+}
+
+/**
+ * rt_snapshot_write - save a routing table to its snapshot file
+ * @t: routing table
+ *
+ * The snapshot is written to a temporary file which is renamed
+ * to the configured name when complete, so an existing snapshot
+ * is never damaged.
+ *
+ * Result: number of routes saved or -1 on error.
+ */
+int
+rt_snapshot_write(rtable *t)
+{
+  struct snap_writer w;
+  struct snap_header h;
+  char *name = t->config->snapshot;
+  char *tmp;
+  FILE *f;
+  int saved = 0;
+
+  bzero(&w, sizeof(w));
+  snap_put(&w.strings, 1);		/* Offset 0 means no string */
+
+  FIB_WALK(&t->fib, fn)
+    {
+      net *n = (net *) fn;
+      rte *e;
+
+      for (e = n->routes; e; e = e->next)
+	if (snap_wanted(e))
+	  {
+	    /* Don't keep a pointer to the route array, names are stored in the meantime */
+	    u32 rta = snap_rta(&w, e->attrs);
+	    u32 sender = snap_proto(&w, e->sender);
+	    struct snap_route *r = snap_put(&w.routes, sizeof(struct snap_route));
+
+	    r->prefix = n->n.prefix;
+	    r->pxlen = n->n.pxlen;
+	    r->pflags = e->pflags;
+	    r->pref = e->pref;
+	    r->rta = rta;
+	    r->sender = sender;
+	    if ((e->attrs->source >= RTS_OSPF && e->attrs->source <= RTS_OSPF_EXT2) ||
+		e->attrs->source == RTS_INHERIT)
+	      memcpy(r->u, &e->u, MIN(sizeof(e->u), SNAP_U_SIZE));
+	    saved++;
+	  }
+    }
+  FIB_WALK_END;
+
+  bzero(&h, sizeof(h));
+  memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+  h.version = SNAP_VERSION;
+  h.addr_size = sizeof(ip_addr);
+  h.time = now_real;
+  h.routes = sizeof(h);
+  h.route_count = saved;
+  h.rtas = h.routes + w.routes.len;
+  h.rta_size = w.rtas.len;
+  h.strings = h.rtas + w.rtas.len;
+  h.string_size = w.strings.len;
+  h.size = h.strings + w.strings.len;
+
+  tmp = alloca(strlen(name) + 5);
+  strcpy(tmp, name);
+  strcat(tmp, ".tmp");
+  f = fopen(tmp, "w");
+  if (!f)
+    {
+      log(L_ERR "Table %s: Cannot create snapshot %s: %m", t->name, tmp);
+      saved = -1;
+      goto done;
+    }
+  fwrite(&h, sizeof(h), 1, f);
+  fwrite(w.routes.data, 1, w.routes.len, f);
+  fwrite(w.rtas.data, 1, w.rtas.len, f);
+  fwrite(w.strings.data, 1, w.strings.len, f);
+  if (ferror(f) | fclose(f))
+    {
+      log(L_ERR "Table %s: Error writing snapshot %s: %m", t->name, tmp);
+      unlink(tmp);
+      saved = -1;
+      goto done;
+    }
+  if (rename(tmp, name) < 0)
+    {
+      log(L_ERR "Table %s: Cannot rename %s to %s: %m", t->name, tmp, name);
+      unlink(tmp);
+      saved = -1;
+    }
+
+ done:
+  xfree(w.routes.data);
+  xfree(w.rtas.data);
+  xfree(w.strings.data);
+  xfree(w.keys);
+  DBG("Table %s: %d routes saved to %s\n", t->name, saved, name);
+  return saved;
+}
+
+static void
+rt_snapshot_timer(timer *tm)
+{
+  rt_snapshot_write(tm->data);
+}
+
+static void
+rt_stale_timer(timer *tm)
+{
+  rtable *t = tm->data;
+  int n = rt_prune_stale(t, NULL);
+
+  if (n)
+    log(L_INFO "Table %s: %d stale routes removed", t->name, n);
+  rfree(tm);
+  t->stale_timer = NULL;
+}
+
+/**
+ * rt_snapshot_setup - set up periodic snapshots of a table
+ * @t: routing table
+ * @cf: new configuration of the table or %NULL if it's being deleted
+ */
+void
+rt_snapshot_setup(rtable *t, struct rtable_config *cf)
+{
+  timer *tm = t->snapshot_timer;
+
+  if (cf && cf->snapshot && cf->snapshot_period)
+    {
+      if (!tm)
+	{
+	  tm = t->snapshot_timer = tm_new(snap_pool);
+	  tm->hook = rt_snapshot_timer;
+	  tm->data = t;
+	}
+      if (tm->recurrent != cf->snapshot_period)
+	{
+	  tm->recurrent = cf->snapshot_period;
+	  tm_start(tm, cf->snapshot_period);
+	}
+    }
+  else if (tm)
+    {
+      rfree(tm);
+      t->snapshot_timer = NULL;
+    }
+
+  if (!cf && t->stale_timer)
+    {
+      rfree(t->stale_timer);
+      t->stale_timer = NULL;
+    }
+}
+
+
+/*
+ *	Reading of snapshots
+ */
+
+struct snap_reader {
+  rtable *table;
+  struct config *conf;
+  byte *rtas;
+  char *strings;
+  struct snap_header *h;
+  rta **rta_cache;			/* Looked up rta's indexed by offset/4 */
+  struct proto **proto_cache;		/* Resolved protocols indexed by string offset */
+  int error;
+};
+
+#define SNAP_NO_PROTO ((struct proto *) 1)	/* Cached miss in proto_cache */
+
+static char *
+snap_get_string(struct snap_reader *r, u32 off)
+{
+  if (!off || off >= r->h->string_size)
+    {
+      r->error = 1;
+      return NULL;
+    }
+  return r->strings + off;
+}
+
+static struct proto *
+snap_get_proto(struct snap_reader *r, u32 off)
+{
+  struct proto_config *pc;
+  char *s = snap_get_string(r, off);
+  char *name;
+  unsigned len;
+
+  if (!s)
+    return NULL;
+  if (r->proto_cache[off])
+    return (r->proto_cache[off] != SNAP_NO_PROTO) ? r->proto_cache[off] : NULL;
+
+  name = strchr(s, ' ');
+  if (!name)
+    {
+      r->error = 1;
+      return NULL;
+    }
+  len = name++ - s;
+  WALK_LIST(pc, r->conf->protos)
+    if (pc->proto && !strcmp(pc->name, name) &&
+	!strncmp(pc->protocol->name, s, len) && !pc->protocol->name[len])
+      return r->proto_cache[off] = pc->proto;
+  r->proto_cache[off] = SNAP_NO_PROTO;
+  return NULL;
+}
+
+static rta *
+snap_get_rta(struct snap_reader *r, u32 off)
+{
+  struct snap_rta *sa;
+  ea_list *l = NULL;
+  rta a, *ca;
+  u32 pos;
+  unsigned i;
+
+  if ((off % 4) || (r->h->rta_size < sizeof(struct snap_rta)) ||
+      (off > r->h->rta_size - sizeof(struct snap_rta)))
+    {
+      r->error = 1;
+      return NULL;
+    }
+  if (r->rta_cache[off / 4])
+    return r->rta_cache[off / 4];
+
+  sa = (struct snap_rta *) (r->rtas + off);
+  bzero(&a, sizeof(a));
+  a.proto = snap_get_proto(r, sa->proto);
+  if (!a.proto)
+    return NULL;
+  if (sa->iface)
+    {
+      char *name = snap_get_string(r, sa->iface);
+      if (!name)
+	return NULL;
+      a.iface = if_find_by_name(name);
+      if (!a.iface || !(a.iface->flags & IF_UP))
+	return NULL;
+    }
+  a.source = sa->source;
+  a.scope = sa->scope;
+  a.cast = sa->cast;
+  a.dest = sa->dest;
+  a.flags = sa->flags;
+  a.gw = sa->gw;
+  a.from = sa->from;
+
+  if (sa->ea_count)
+    {
+      l = lp_alloc(snap_lp, sizeof(ea_list) + sa->ea_count * sizeof(eattr));
+      l->next = NULL;
+      l->flags = 0;
+      l->count = sa->ea_count;
+    }
+  pos = off + sizeof(struct snap_rta);
+  for (i = 0; i < sa->ea_count; i++)
+    {
+      struct snap_eattr *se = (struct snap_eattr *) (r->rtas + pos);
+      eattr *e = &l->attrs[i];
+
+      if (pos + sizeof(struct snap_eattr) > r->h->rta_size)
+	goto bad;
+      e->id = se->id;
+      e->flags = se->flags;
+      e->type = se->type;
+      pos += sizeof(struct snap_eattr);
+      if (se->type & EAF_EMBEDDED)
+	e->u.data = se->data;
+      else
+	{
+	  /* The length and the data following it form an &adata */
+	  if (se->data > r->h->rta_size - pos)
+	    goto bad;
+	  e->u.ptr = (struct adata *) &se->data;
+	  pos += BIRD_ALIGN(se->data, 4);
+	}
+    }
+
+  a.eattrs = l;
+  ca = r->rta_cache[off / 4] = rta_lookup(&a);
+  lp_flush(snap_lp);
+  return ca;
+
+ bad:
+  lp_flush(snap_lp);
+  r->error = 1;
+  return NULL;
+}
+
+static void
+snap_read(rtable *t, char *name, struct config *c)
+{
+  struct snap_reader r;
+  struct snap_header *h;
+  struct snap_route *routes;
+  struct stat st;
+  byte *map;
+  unsigned i, restored = 0, skipped = 0;
+  int fd;
+
+  fd = open(name, O_RDONLY);
+  if (fd < 0)
+    {
+      if (errno != ENOENT)
+	log(L_ERR "Table %s: Cannot open snapshot %s: %m", t->name, name);
+      return;
+    }
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(struct snap_header))
+    {
+      close(fd);
+      log(L_ERR "Table %s: Invalid snapshot %s", t->name, name);
+      return;
+    }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    {
+      log(L_ERR "Table %s: Cannot map snapshot %s: %m", t->name, name);
+      return;
+    }
+
+  h = (struct snap_header *) map;
+  if (memcmp(h->magic, SNAP_MAGIC, sizeof(h->magic)) ||
+      h->version != SNAP_VERSION ||
+      h->addr_size != sizeof(ip_addr) ||
+      h->size != st.st_size ||
+      h->routes > h->size ||
+      h->route_count > (h->size - h->routes) / sizeof(struct snap_route) ||
+      (h->routes % 4) || (h->rtas % 4) ||
+      h->rtas > h->size || h->rta_size > h->size - h->rtas ||
+      h->strings > h->size || h->string_size > h->size - h->strings ||
+      !h->string_size || map[h->strings + h->string_size - 1])
+    {
+      log(L_ERR "Table %s: Invalid snapshot %s", t->name, name);
+      munmap(map, st.st_size);
+      return;
+    }
+
+  bzero(&r, sizeof(r));
+  r.table = t;
+  r.conf = c;
+  r.h = h;
+  r.rtas = map + h->rtas;
+  r.strings = (char *) map + h->strings;
+  r.rta_cache = xmalloc((h->rta_size / 4 + 1) * sizeof(rta *));
+  bzero(r.rta_cache, (h->rta_size / 4 + 1) * sizeof(rta *));
+  r.proto_cache = xmalloc(h->string_size * sizeof(struct proto *));
+  bzero(r.proto_cache, h->string_size * sizeof(struct proto *));
+
+  routes = (struct snap_route *) (map + h->routes);
+  for (i = 0; i < h->route_count && !r.error; i++)
+    {
+      struct snap_route *sr = &routes[i];
+      struct proto *sender;
+      rta *a;
+      net *n;
+      rte *e;
+
+      if (sr->pxlen > BITS_PER_IP_ADDRESS ||
+	  !ipa_equal(sr->prefix, ipa_and(sr->prefix, ipa_mkmask(sr->pxlen))))
+	{
+	  r.error = 1;
+	  break;
+	}
+      sender = snap_get_proto(&r, sr->sender);
+      if (!sender || sender->core_state != FS_HUNGRY)
+	{
+	  skipped++;
+	  continue;
+	}
+      a = snap_get_rta(&r, sr->rta);
+      if (!a)
+	{
+	  skipped++;
+	  continue;
+	}
+
+      n = net_get(t, sr->prefix, sr->pxlen);
+      e = rte_get_temp(rta_clone(a));
+      e->net = n;
+      e->pflags = sr->pflags;
+      e->pref = sr->pref;
+      bzero(&e->u, sizeof(e->u));
+      memcpy(&e->u, sr->u, MIN(sizeof(e->u), SNAP_U_SIZE));
+      rte_restore(t, n, sender, e);
+      restored++;
+    }
+
+  if (r.error)
+    log(L_ERR "Table %s: Snapshot %s is damaged", t->name, name);
+  log(L_INFO "Table %s: %u routes restored from snapshot taken %d s ago, %u skipped",
+      t->name, restored, (int) (now_real - h->time), skipped);
+
+  for (i = 0; i <= h->rta_size / 4; i++)
+    if (r.rta_cache[i])
+      rta_free(r.rta_cache[i]);
+  xfree(r.rta_cache);
+  xfree(r.proto_cache);
+  munmap(map, st.st_size);
+
+  if (restored)
+    {
+      timer *tm = t->stale_timer = tm_new(snap_pool);
+      tm->hook = rt_stale_timer;
+      tm->data = t;
+      tm_start(tm, t->config->stale_time);
+    }
+}
+
+/**
+ * rt_snapshot_restore - restore routing tables from their snapshots
+ * @c: initial configuration
+ *
+ * This function is called when the first configuration has been
+ * committed. The protocols already exist, but most of them haven't
+ * started yet, so their routes can be restored as stale ones.
+ */
+void
+rt_snapshot_restore(struct config *c)
+{
+  struct rtable_config *rc;
+
+  WALK_LIST(rc, c->tables)
+    if (rc->snapshot && rc->table)
+      snap_read(rc->table, rc->snapshot, c);
+}
@@ -26,6 +26,16 @@
  * (see the route attribute module for a precise explanation) holding the
  * remaining route attributes which are expected to be shared by multiple
  * routes in order to conserve memory.
+ *
+ * Tables configured as sorted also keep an index of their networks
+ * ordered by prefix, which is used for sorted output and for listing
+ * of all networks inside a given prefix.
+ *
+ * Protocols whose import filter depends on ROA tables keep a copy of
+ * each route as it was received, before the import filter, in their
+ * import table. When the ROA tables change, these routes are just passed
+ * through the filter again by rt_reimport() instead of being reloaded
+ * from the protocol.
  */
 
 #undef LOCAL_DEBUG
@@ -35,6 +45,9 @@
 #include "nest/protocol.h"
 #include "nest/cli.h"
 #include "nest/iface.h"
+#include "nest/latency.h"
+#include "nest/trace.h"
+#include "lib/probe.h"
 #include "lib/resource.h"
 #include "lib/event.h"
 #include "lib/string.h"
@@ -48,8 +61,11 @@ static linpool *rte_update_pool;
 
 static pool *rt_table_pool;
 static list routing_tables;
+static unsigned rt_stale_count;		/* Number of stale routes in all tables */
 
 static void rt_format_via(rte *e, byte *via);
+static void rt_index_add(rtable *t, net *n);
+static void rt_index_remove(rtable *t, net *n);
 
 static void
 rte_init(struct fib_node *N)
@@ -148,6 +164,8 @@ rte_trace_in(unsigned int flag, struct proto *p, rte *e, char *msg)
 {
   if (p->debug & flag)
     rte_trace(p, e, '>', msg);
+  if (p->trace & flag)
+    trace_route(p, e, '>', msg);
 }
 
 static inline void
@@ -155,17 +173,136 @@ rte_trace_out(unsigned int flag, struct proto *p, rte *e, char *msg)
 {
   if (p->debug & flag)
     rte_trace(p, e, '<', msg);
+  if (p->trace & flag)
+    trace_route(p, e, '<', msg);
+}
+
+/*
+ *	Exported routes
+ *
+ * Partial refeeds (see rt_refeed_nets()) announce routes as replacing
+ * themselves, so the export filter can't tell whether the route has been
+ * exported before. For hooks whose export filter depends on ROA tables
+ * (the only users of partial refeeds), we remember which routes have
+ * been exported, keyed by the network and, for %RA_ANY hooks, by the
+ * originating protocol.
+ */
+
+struct export_node {
+  struct fib_node n;
+  struct export_src *srcs;
+};
+
+struct export_src {
+  struct export_src *next;
+  struct proto *src;			/* NULL for RA_OPTIMAL hooks */
+};
+
+static struct filter *
+rt_hook_filter(struct announce_hook *a)
+{
+  struct proto *p = a->proto;
+
+#ifdef CONFIG_PIPE
+  /* The secondary direction of the pipe */
+  if (proto_is_pipe(p) && (p->table != a->table))
+    return p->in_filter;
+#endif
+  return p->out_filter;
+}
+
+static void
+rt_export_init(struct fib_node *N)
+{
+  ((struct export_node *) N)->srcs = NULL;
+}
+
+/**
+ * rt_export_reset - forget routes exported through an announce hook
+ * @a: announce hook
+ *
+ * It's called when the hook is created and when a refeed of the protocol
+ * starts. The set of exported routes is kept only if the export filter
+ * of the hook depends on ROA tables.
+ */
+void
+rt_export_reset(struct announce_hook *a)
+{
+  pool *p = a->proto->pool;
+
+  if (a->exported)
+    {
+      fib_free(a->exported);
+      mb_free(a->exported);
+      rfree(a->exported_slab);
+      a->exported = NULL;
+      a->exported_slab = NULL;
+    }
+
+  if (filter_roa_deps(rt_hook_filter(a)))
+    {
+      a->exported = mb_alloc(p, sizeof(struct fib));
+      fib_init(a->exported, p, sizeof(struct export_node), 0, rt_export_init);
+      a->exported_slab = sl_new(p, sizeof(struct export_src));
+    }
+}
+
+static int
+rt_export_test(struct announce_hook *a, net *net, struct proto *src)
+{
+  struct export_node *en = fib_find(a->exported, &net->n.prefix, net->n.pxlen);
+  struct export_src *es;
+
+  if (en)
+    for (es = en->srcs; es; es = es->next)
+      if (es->src == src)
+	return 1;
+  return 0;
+}
+
+static void
+rt_export_set(struct announce_hook *a, net *net, struct proto *src, int exported)
+{
+  struct export_node *en;
+  struct export_src *es, **ep;
+
+  if (!exported)
+    {
+      en = fib_find(a->exported, &net->n.prefix, net->n.pxlen);
+      if (!en)
+	return;
+      for (ep = &en->srcs; es = *ep; ep = &es->next)
+	if (es->src == src)
+	  {
+	    *ep = es->next;
+	    sl_free(a->exported_slab, es);
+	    break;
+	  }
+      if (!en->srcs)
+	fib_delete(a->exported, en);
+      return;
+    }
+
+  en = fib_get(a->exported, &net->n.prefix, net->n.pxlen);
+  for (es = en->srcs; es; es = es->next)
+    if (es->src == src)
+      return;
+  es = sl_alloc(a->exported_slab);
+  es->src = src;
+  es->next = en->srcs;
+  en->srcs = es;
 }
 
 static inline void
-do_rte_announce(struct announce_hook *a, int type UNUSED, net *net, rte *new, rte *old, ea_list *tmpa, int refeed)
+do_rte_announce(struct announce_hook *a, int type, net *net, rte *new, rte *old, ea_list *tmpa, int refeed)
 {
   struct proto *p = a->proto;
   struct filter *filter = p->out_filter;
   struct proto_stats *stats = &p->stats;
   rte *new0 = new;
   rte *old0 = old;
-  int ok;
+  struct proto *src = NULL;
+  int ok, was = 0;
 
   int fast_exit_hack = 0;
 
@@ -249,6 +386,18 @@ do_rte_announce(struct announce_hook *a, int type UNUSED, net *net, rte *new, rt
 	}
     }
 
+  if (a->exported)
+    {
+      if (type == RA_ANY)
+	src = (new0 ? new0 : old0)->attrs->proto;
+
+      /* Whether the route replacing itself has been exported is known just from here */
+      was = rt_export_test(a, net, src);
+      if ((refeed == 2) && !was)
+	old = NULL;
+      rt_export_set(a, net, src, !!new);
+    }
+
   /* FIXME - This is broken because of incorrect 'old' value (see above) */
   if (!new && !old)
     return;
@@ -259,11 +408,23 @@ do_rte_announce(struct announce_hook *a, int type UNUSED, net *net, rte *new, rt
     stats->exp_withdraws_accepted++;
 
   /* Hack: We do not decrease exp_routes during refeed, we instead
-     reset exp_routes at the start of refeed. */
-  if (new)
-    stats->exp_routes++;
-  if (old && !refeed)
-    stats->exp_routes--;
+     reset exp_routes at the start of refeed. Partial refeeds
+     (refeed == 2) change it only when the verdict of the filter
+     has changed. */
+  if (refeed == 2)
+    {
+      if (new && !was)
+	stats->exp_routes++;
+      if (!new && was)
+	stats->exp_routes--;
+    }
+  else
+    {
+      if (new)
+	stats->exp_routes++;
+      if (old && !refeed)
+	stats->exp_routes--;
+    }
 
   if (p->debug & D_ROUTES)
     {
@@ -287,6 +448,8 @@ do_rte_announce(struct announce_hook *a, int type UNUSED, net *net, rte *new, rt
     }
   else
     p->rt_notify(p, a->table, net, new, old, new->attrs->eattrs);
+  if (latency_origin)
+    latency_record(LAT_EXPORT, p->name);
   if (new && new != new0)	/* Discard temporary rte's */
     rte_free(new);
   if (old && old != old0)
@@ -327,6 +490,7 @@ rte_announce(rtable *tab, unsigned type, net *net, rte *new, rte *old, ea_list *
 {
   struct announce_hook *a;
 
+  PROBE4(rte_announce, tab->name, &net->n.prefix, net->n.pxlen, type);
   if (type == RA_OPTIMAL)
     {
       if (new)
@@ -393,7 +557,7 @@ rte_same(rte *x, rte *y)
 {
   return
     x->attrs == y->attrs &&
-    x->flags == y->flags &&
+    (x->flags & ~REF_STALE) == (y->flags & ~REF_STALE) &&
     x->pflags == y->pflags &&
     x->pref == y->pref &&
     (!x->attrs->proto->rte_same || x->attrs->proto->rte_same(x, y));
@@ -439,10 +603,15 @@ rte_recalculate(rtable *table, net *net, struct proto *p, struct proto *src, rte
 
 	  if (new && rte_same(old, new))
 	    {
-	      /* No changes, ignore the new route */
+	      /* No changes, ignore the new route. A stale one is confirmed. */
 	      stats->imp_updates_ignored++;
 	      rte_trace_in(D_ROUTES, p, new, "ignored");
 	      rte_free_quick(new);
+	      if (old->flags & REF_STALE)
+		{
+		  old->flags &= ~REF_STALE;
+		  rt_stale_count--;
+		}
 	      old->lastmod = now;
 	      return;
 	    }
@@ -468,6 +637,9 @@ rte_recalculate(rtable *table, net *net, struct proto *p, struct proto *src, rte
   if (old)
     stats->imp_routes--;
 
+  if (latency_origin)
+    latency_record(LAT_IMPORT, table->name);
+
   rte_announce(table, RA_ANY, net, new, old, tmpa);
 
   
@@ -539,6 +711,31 @@ rte_recalculate(rtable *table, net *net, struct proto *p, struct proto *src, rte
       rte_trace_in(D_ROUTES, p, new, "added");
     }
 
+  /* Update table statistics and the index */
+  if (!old_best != !net->routes)
+    {
+      table->net_count += net->routes ? 1 : -1;
+      if (table->index)
+	{
+	  if (net->routes)
+	    rt_index_add(table, net);
+	  else
+	    rt_index_remove(table, net);
+	  if (table->index_notify)
+	    table->index_notify(net, table->index_notify_data);
+	}
+    }
+  if (new)
+    {
+      table->rte_count++;
+      table->src_count[new->attrs->source]++;
+    }
+  if (old)
+    {
+      table->rte_count--;
+      table->src_count[old->attrs->source]--;
+    }
+
   /* Log the route removal */
   if (!new && old && (p->debug & D_ROUTES))
     {
@@ -554,6 +751,8 @@ rte_recalculate(rtable *table, net *net, struct proto *p, struct proto *src, rte
     {
       if (p->rte_remove)
 	p->rte_remove(net, old);
+      if (old->flags & REF_STALE)
+	rt_stale_count--;
       rte_free_quick(old);
     }
   if (new)
@@ -620,17 +819,136 @@ rte_update_unlock(void)
  * finishes.
  */
 
+/*
+ *	Import tables
+ */
+
+struct import_entry {
+  struct fib_node n;
+  rte *e;				/* Copy of the route as received */
+};
+
+static void
+rt_import_init(struct fib_node *N)
+{
+  ((struct import_entry *) N)->e = NULL;
+}
+
+/* Does the route from @p to @table go to the import table? */
+static inline int
+rt_import_wanted(rtable *table, struct proto *p, struct proto *src)
+{
+#ifdef CONFIG_PIPE
+  if (proto_is_pipe(p))
+    return 0;
+#endif
+  return (table == p->table) && (src == p) && filter_roa_deps(p->in_filter);
+}
+
+static void
+rt_import_update(struct proto *p, net *net, rte *new)
+{
+  struct import_entry *ie;
+
+  if (!p->import_table)
+    {
+      if (!new)
+	return;
+      p->import_table = mb_alloc(p->pool, sizeof(struct fib));
+      fib_init(p->import_table, p->pool, sizeof(struct import_entry), 0, rt_import_init);
+    }
+
+  if (!new)
+    {
+      ie = fib_find(p->import_table, &net->n.prefix, net->n.pxlen);
+      if (ie)
+	{
+	  rte_free(ie->e);
+	  fib_delete(p->import_table, ie);
+	}
+      return;
+    }
+
+  ie = fib_get(p->import_table, &net->n.prefix, net->n.pxlen);
+  if (ie->e)
+    rte_free(ie->e);
+  ie->e = sl_alloc(rte_slab);
+  memcpy(ie->e, new, sizeof(rte));
+  ie->e->attrs = (new->attrs->aflags & RTAF_CACHED) ? rta_clone(new->attrs) : rta_lookup(new->attrs);
+  ie->e->flags = 0;
+}
+
+/**
+ * rt_import_flush - free the import table of a protocol
+ * @p: protocol
+ *
+ * It's called when the protocol goes down or when its import filter
+ * no longer needs the table.
+ */
+void
+rt_import_flush(struct proto *p)
+{
+  if (!p->import_table)
+    return;
+
+  FIB_WALK(p->import_table, fn)
+    {
+      rte_free(((struct import_entry *) fn)->e);
+    }
+  FIB_WALK_END;
+  fib_free(p->import_table);
+  mb_free(p->import_table);
+  p->import_table = NULL;
+}
+
+/**
+ * rt_reimport - pass kept routes through the import filter again
+ * @p: protocol
+ * @want: selects networks to be re-imported, %NULL for all of them
+ * @data: passed to @want
+ *
+ * The routes in the import table of the protocol are re-imported
+ * to its table for the networks accepted by @want, as if they were
+ * received from the protocol again. It's used when something the
+ * import filter depends on has changed for a known part of the
+ * address space.
+ */
+void
+rt_reimport(struct proto *p, int (*want)(struct fib_node *, void *), void *data)
+{
+  if (!p->import_table)
+    return;
+
+  FIB_WALK(p->import_table, fn)
+    {
+      struct import_entry *ie = (struct import_entry *) fn;
+      net *n;
+      rte *e;
+
+      if (want && !want(fn, data))
+	continue;
+
+      n = net_get(p->table, fn->prefix, fn->pxlen);
+      e = rte_do_cow(ie->e);
+      e->net = n;
+      rte_update(p->table, n, p, p, e);
+    }
+  FIB_WALK_END;
+}
+
 void
 rte_update(rtable *table, net *net, struct proto *p, struct proto *src, rte *new)
 {
   ea_list *tmpa = NULL;
   struct proto_stats *stats = &p->stats;
+  int keep = rt_import_wanted(table, p, src);
 
 #ifdef CONFIG_PIPE
   if (proto_is_pipe(p) && (p->table == table))
     stats = pipe_get_peer_stats(p);
 #endif
 
+  PROBE4(rte_update_entry, p->name, &net->n.prefix, net->n.pxlen, !!new);
   rte_update_lock();
   if (new)
     {
@@ -649,8 +967,12 @@ rte_update(rtable *table, net *net, struct proto *p, struct proto *src, rte *new
 	{
 	  rte_trace_in(D_FILTERS, p, new, "invalid");
 	  stats->imp_updates_invalid++;
+	  if (keep)
+	    rt_import_update(p, net, NULL);
 	  goto drop;
 	}
+      if (keep)
+	rt_import_update(p, net, new);
       if (filter == FILTER_REJECT)
 	{
 	  stats->imp_updates_filtered++;
@@ -677,16 +999,22 @@ rte_update(rtable *table, net *net, struct proto *p, struct proto *src, rte *new
       new->flags |= REF_COW;
     }
   else
-    stats->imp_withdraws_received++;
+    {
+      stats->imp_withdraws_received++;
+      if (keep)
+	rt_import_update(p, net, NULL);
+    }
 
   rte_recalculate(table, net, p, src, new, tmpa);
   rte_update_unlock();
+  PROBE4(rte_update_return, p->name, &net->n.prefix, net->n.pxlen, 1);
   return;
 
 drop:
   rte_free(new);
   rte_recalculate(table, net, p, src, NULL, NULL);
   rte_update_unlock();
+  PROBE4(rte_update_return, p->name, &net->n.prefix, net->n.pxlen, 0);
 }
 
 void
@@ -697,6 +1025,43 @@ rte_discard(rtable *t, rte *old)	/* Non-filtered route deletion, used during gar
   rte_update_unlock();
 }
 
+/**
+ * rte_restore - enter a route restored from a snapshot
+ * @table: table to be updated
+ * @net: network node
+ * @p: protocol which has sent the route to the table
+ * @new: the route (with cached attributes)
+ *
+ * This function inserts a route read from a table snapshot (see
+ * rt_snapshot_restore()). The route isn't validated nor filtered again,
+ * as it has passed both before it was saved, but it's marked as stale.
+ * It's ignored if the originating protocol already has a route for
+ * the network.
+ */
+void
+rte_restore(rtable *table, net *net, struct proto *p, rte *new)
+{
+  struct proto *src = new->attrs->proto;
+  ea_list *tmpa = NULL;
+  rte *e;
+
+  for (e = net->routes; e; e = e->next)
+    if (e->attrs->proto == src)
+      {
+	rte_free_quick(new);
+	return;
+      }
+
+  rte_update_lock();
+  new->sender = p;
+  new->flags |= REF_COW | REF_STALE;
+  rt_stale_count++;
+  if (src->make_tmp_attrs)
+    tmpa = src->make_tmp_attrs(new, rte_update_pool);
+  rte_recalculate(table, net, p, src, new, tmpa);
+  rte_update_unlock();
+}
+
 /**
  * rte_dump - dump a route
  * @e: &rte to be dumped
@@ -744,6 +1109,7 @@ rt_dump(rtable *t)
   FIB_WALK_END;
   WALK_LIST(a, t->hooks)
     debug("\tAnnounces routes to protocol %s\n", a->proto->name);
+  debug("\t%d routes for %d networks\n", t->rte_count, t->net_count);
   debug("\n");
 }
 
@@ -771,6 +1137,209 @@ rt_gc(void *tab)
   rt_prune(t);
 }
 
+/*
+ *	Ordered index of networks
+ *
+ *	A compressed binary trie of networks having any routes, kept only
+ *	for sorted tables. The preorder of the trie is the same as the order
+ *	by address and then by length and all networks inside a prefix form
+ *	a single subtree.
+ */
+
+static struct rt_index_node *
+rt_index_node_new(rtable *t, ip_addr addr, int plen)
+{
+  struct rt_index_node *n = sl_alloc(t->index_slab);
+
+  bzero(n, sizeof(struct rt_index_node));
+  n->addr = addr;
+  n->plen = plen;
+  return n;
+}
+
+static inline void
+rt_index_attach(struct rt_index_node *parent, struct rt_index_node *child)
+{
+  parent->c[ipa_getbit(child->addr, parent->plen) ? 1 : 0] = child;
+}
+
+/* Find or create a node for @addr/@plen, the root covers everything */
+static struct rt_index_node *
+rt_index_get(rtable *t, ip_addr addr, int plen)
+{
+  struct rt_index_node *o = NULL, *n = t->index, *a, *b;
+
+  while (n)
+    {
+      ip_addr cmask = ipa_mkmask(MIN(plen, n->plen));
+
+      if (ipa_nonzero(ipa_and(ipa_xor(addr, n->addr), cmask)))
+	{
+	  /* We are out of path - add branching node 'b' between 'o' and 'n' */
+	  int blen = ipa_pxlen(addr, n->addr);
+	  b = rt_index_node_new(t, ipa_and(addr, ipa_mkmask(blen)), blen);
+	  a = rt_index_node_new(t, addr, plen);
+	  rt_index_attach(o, b);
+	  rt_index_attach(b, n);
+	  rt_index_attach(b, a);
+	  return a;
+	}
+
+      if (plen == n->plen)
+	return n;
+
+      if (plen < n->plen)
+	{
+	  /* The new node goes between 'o' and 'n' */
+	  a = rt_index_node_new(t, addr, plen);
+	  rt_index_attach(o, a);
+	  rt_index_attach(a, n);
+	  return a;
+	}
+
+      o = n;
+      n = n->c[ipa_getbit(addr, n->plen) ? 1 : 0];
+    }
+
+  a = rt_index_node_new(t, addr, plen);
+  rt_index_attach(o, a);
+  return a;
+}
+
+static void
+rt_index_add(rtable *t, net *n)
+{
+  rt_index_get(t, n->n.prefix, n->n.pxlen)->net = n;
+}
+
+/*
+ * Remove node @n with parent @o if it's useless, i.e., it has no network
+ * and it's not a branching node. The root is never removed.
+ */
+static int
+rt_index_unlink(rtable *t, struct rt_index_node *n, struct rt_index_node *o)
+{
+  if (n->net || !o || (n->c[0] && n->c[1]))
+    return 0;
+
+  o->c[o->c[1] == n] = n->c[0] ? n->c[0] : n->c[1];
+  sl_free(t->index_slab, n);
+  return 1;
+}
+
+static void
+rt_index_remove(rtable *t, net *net)
+{
+  struct rt_index_node *g = NULL, *o = NULL, *n = t->index;
+
+  while (n->plen < net->n.pxlen)
+    {
+      g = o;
+      o = n;
+      n = n->c[ipa_getbit(net->n.prefix, n->plen) ? 1 : 0];
+      ASSERT(n);
+    }
+  ASSERT(n->net == net);
+  n->net = NULL;
+
+  /* The parent may have become a useless branching node */
+  if (rt_index_unlink(t, n, o))
+    rt_index_unlink(t, o, g);
+}
+
+static void
+rt_index_setup(rtable *t, int sorted)
+{
+  if (sorted && !t->index)
+    {
+      t->index_slab = sl_new(rt_table_pool, sizeof(struct rt_index_node));
+      t->index = rt_index_node_new(t, IPA_NONE, 0);
+      FIB_WALK(&t->fib, fn)
+	{
+	  net *n = (net *) fn;
+	  if (n->routes)
+	    rt_index_add(t, n);
+	}
+      FIB_WALK_END;
+    }
+  else if (!sorted && t->index)
+    {
+      rfree(t->index_slab);
+      t->index_slab = NULL;
+      t->index = NULL;
+    }
+}
+
+/**
+ * rt_index_cover - find the covering network
+ * @t: sorted routing table
+ * @addr: network prefix
+ * @plen: prefix length
+ *
+ * Result: the longest network with any routes strictly covering
+ * @addr/@plen or %NULL if there is none.
+ */
+net *
+rt_index_cover(rtable *t, ip_addr addr, int plen)
+{
+  struct rt_index_node *n = t->index;
+  net *cover = NULL;
+
+  while (n && (n->plen < plen) && ipa_in_net(addr, n->addr, n->plen))
+    {
+      if (n->net)
+	cover = n->net;
+      n = n->c[ipa_getbit(addr, n->plen) ? 1 : 0];
+    }
+  return cover;
+}
+
+static void
+rt_index_walk_nets(struct rt_index_node *n, void (*hook)(net *, void *), void *data)
+{
+  if (!n)
+    return;
+  if (n->net)
+    hook(n->net, data);
+  else
+    {
+      rt_index_walk_nets(n->c[0], hook, data);
+      rt_index_walk_nets(n->c[1], hook, data);
+    }
+}
+
+/**
+ * rt_index_walk - walk networks directly inside a prefix
+ * @t: sorted routing table
+ * @addr: network prefix
+ * @plen: prefix length
+ * @hook: function called for each network
+ * @data: its argument
+ *
+ * The @hook is called for all networks with routes strictly inside
+ * @addr/@plen which are not inside any other such network, i.e. for
+ * the networks @addr/@plen would be the cover of. The table must
+ * not be modified by the @hook.
+ */
+void
+rt_index_walk(rtable *t, ip_addr addr, int plen, void (*hook)(net *, void *), void *data)
+{
+  struct rt_index_node *n = t->index;
+
+  while (n && (n->plen < plen) && ipa_in_net(addr, n->addr, n->plen))
+    n = n->c[ipa_getbit(addr, n->plen) ? 1 : 0];
+  if (!n || (n->plen < plen) || !ipa_in_net(n->addr, addr, plen))
+    return;
+
+  if (n->plen == plen)
+    {
+      rt_index_walk_nets(n->c[0], hook, data);
+      rt_index_walk_nets(n->c[1], hook, data);
+    }
+  else
+    rt_index_walk_nets(n, hook, data);
+}
+
 void
 rt_setup(pool *p, rtable *t, char *name, struct rtable_config *cf)
 {
@@ -798,6 +1367,7 @@ void
 rt_init(void)
 {
   rta_init();
+  rt_snapshot_init();
   rt_table_pool = rp_new(&root_pool, "Routing tables");
   rte_update_pool = lp_new(rt_table_pool, 4080);
   rte_slab = sl_new(rt_table_pool, sizeof(rte));
@@ -819,6 +1389,7 @@ rt_prune(rtable *tab)
   int rcnt = 0, rdel = 0, ncnt = 0, ndel = 0;
 
   DBG("Pruning route table %s\n", tab->name);
+  PROBE1(rt_prune_start, tab->name);
 #ifdef DEBUGGING
   fib_check(&tab->fib);
 #endif
@@ -832,7 +1403,8 @@ again:
     rescan:
       for (e=n->routes; e; e=e->next, rcnt++)
 	if (e->sender->core_state != FS_HAPPY &&
-	    e->sender->core_state != FS_FEEDING)
+	    e->sender->core_state != FS_FEEDING &&
+	    !((e->flags & REF_STALE) && e->sender->core_state == FS_HUNGRY))
 	  {
 	    rte_discard(tab, e);
 	    rdel++;
@@ -848,6 +1420,7 @@ again:
     }
   FIB_ITERATE_END(f);
   DBG("Pruned %d of %d routes and %d of %d networks\n", rdel, rcnt, ndel, ncnt);
+  PROBE3(rt_prune_done, tab->name, rdel, ndel);
 #ifdef DEBUGGING
   fib_check(&tab->fib);
 #endif
@@ -855,6 +1428,69 @@ again:
   tab->gc_time = now;
 }
 
+/**
+ * rt_prune_stale - remove stale routes
+ * @tab: routing table
+ * @p: protocol or %NULL
+ *
+ * The routes restored from a snapshot which haven't been confirmed
+ * by their protocols since then are removed from the table when
+ * the stale time of the table expires. Stale routes are kept even
+ * if their protocols are not running, so when such a protocol
+ * is freed, its stale routes must be removed from all tables
+ * (see rt_prune_stale_all()). They are also removed from the table
+ * of a protocol going down, as they're accounted in its statistics.
+ *
+ * Result: number of routes removed.
+ */
+int
+rt_prune_stale(rtable *tab, struct proto *p)
+{
+  struct fib_iterator fit;
+  int rdel = 0;
+
+  if (!rt_stale_count)
+    return 0;
+
+  FIB_ITERATE_INIT(&fit, &tab->fib);
+again:
+  FIB_ITERATE_START(&tab->fib, &fit, f)
+    {
+      net *n = (net *) f;
+      rte *e;
+    rescan:
+      for (e=n->routes; e; e=e->next)
+	if ((e->flags & REF_STALE) && (!p || e->sender == p || e->attrs->proto == p))
+	  {
+	    rte_discard(tab, e);
+	    rdel++;
+	    goto rescan;
+	  }
+      if (!n->routes)
+	{
+	  FIB_ITERATE_PUT(&fit, f);
+	  fib_delete(&tab->fib, f);
+	  goto again;
+	}
+    }
+  FIB_ITERATE_END(f);
+  return rdel;
+}
+
+/**
+ * rt_prune_stale_all - remove stale routes of a protocol
+ * @p: protocol instance about to be freed
+ */
+void
+rt_prune_stale_all(struct proto *p)
+{
+  rtable *t;
+
+  if (rt_stale_count)
+    WALK_LIST(t, routing_tables)
+      rt_prune_stale(t, p);
+}
+
 /**
  * rt_prune_all - prune all routing tables
  *
@@ -879,6 +1515,7 @@ rt_new_table(struct symbol *s)
   add_tail(&new_config->tables, &c->n);
   c->gc_max_ops = 1000;
   c->gc_min_time = 5;
+  c->stale_time = RT_DEFAULT_STALE_TIME;
   return c;
 }
 
@@ -921,6 +1558,8 @@ rt_unlock_table(rtable *r)
       struct config *conf = r->deleted;
       DBG("Deleting routing table %s\n", r->name);
       rem_node(&r->n);
+      rt_index_setup(r, 0);
+      rt_snapshot_setup(r, NULL);
       fib_free(&r->fib);
       mb_free(r);
       config_del_obstacle(conf);
@@ -960,10 +1599,18 @@ rt_commit(struct config *new, struct config *old)
 		  r->table = ot;
 		  ot->name = r->name;
 		  ot->config = r;
+		  rt_index_setup(ot, r->sorted);
+		  rt_snapshot_setup(ot, r);
 		}
 	      else
 		{
 		  DBG("\t%s: deleted\n", o->name);
+		  if (new->shutdown && o->snapshot)
+		    {
+		      int n = rt_snapshot_write(ot);
+		      if (n >= 0)
+			log(L_INFO "Table %s: %d routes saved to snapshot", ot->name, n);
+		    }
 		  ot->deleted = old;
 		  config_add_obstacle(old);
 		  rt_lock_table(ot);
@@ -979,6 +1626,8 @@ rt_commit(struct config *new, struct config *old)
 	rtable *t = mb_alloc(rt_table_pool, sizeof(struct rtable));
 	DBG("\t%s: created\n", r->name);
 	rt_setup(rt_table_pool, t, r->name, r);
+	rt_index_setup(t, r->sorted);
+	rt_snapshot_setup(t, r);
 	add_tail(&routing_tables, &t->n);
 	r->table = t;
       }
@@ -1069,6 +1718,72 @@ next_hook:
   goto again;
 }
 
+static inline void
+do_refeed_net(struct announce_hook *h, int type, net *n, rte *e)
+{
+  struct proto *q = e->attrs->proto;
+  ea_list *tmpa;
+
+  rte_update_lock();
+  tmpa = q->make_tmp_attrs ? q->make_tmp_attrs(e, rte_update_pool) : NULL;
+  do_rte_announce(h, type, n, e, e, tmpa, 2);
+  rte_update_unlock();
+}
+
+/**
+ * rt_refeed_nets - re-announce selected networks
+ * @want_hook: selects announce hooks to be refed
+ * @want_net: selects networks to be re-announced
+ * @data: passed to both @want_hook and @want_net
+ *
+ * Unlike proto_request_feeding(), which sends the whole table to a
+ * protocol again, this function re-announces just the networks accepted
+ * by @want_net to the announce hooks accepted by @want_hook. It's used
+ * when something the export filters depend on has changed for a known
+ * part of the address space. Each table is walked at most once.
+ *
+ * As we don't know whether the routes have been exported before, they
+ * are announced as replacing themselves, so a route rejected by the
+ * filter now gets withdrawn.
+ */
+void
+rt_refeed_nets(int (*want_hook)(struct announce_hook *, void *), int (*want_net)(net *, void *), void *data)
+{
+  struct announce_hook *h;
+  rtable *t;
+  rte *e;
+
+  WALK_LIST(t, routing_tables)
+    {
+      int hooks = 0;
+
+      WALK_LIST(h, t->hooks)
+	if (h->proto->core_state == FS_HAPPY && want_hook(h, data))
+	  hooks++;
+      if (!hooks)
+	continue;
+
+      FIB_WALK(&t->fib, fn)
+	{
+	  net *n = (net *) fn;
+
+	  if (!n->routes || !want_net(n, data))
+	    continue;
+
+	  WALK_LIST(h, t->hooks)
+	    if (h->proto->core_state == FS_HAPPY && want_hook(h, data))
+	      {
+		if (h->proto->accept_ra_types == RA_OPTIMAL)
+		  do_refeed_net(h, RA_OPTIMAL, n, n->routes);
+		else if (h->proto->accept_ra_types == RA_ANY)
+		  for (e = n->routes; e; e = e->next)
+		    do_refeed_net(h, RA_ANY, n, e);
+	      }
+	}
+      FIB_WALK_END;
+    }
+}
+
 /**
  * rt_feed_baby_abort - abort protocol feeding
  * @p: protocol
@@ -1135,12 +1850,109 @@ rt_show_rte(struct cli *c, byte *ia, rte *e, struct rt_show_data *d, ea_list *tm
     a->proto->proto->get_route_info(e, info, tmpa);
   else
     bsprintf(info, " (%d)", e->pref);
-  cli_printf(c, -1007, "%-18s %s [%s %s%s]%s%s", ia, via, a->proto->name,
-	     tm, from, primary ? " *" : "", info);
+  cli_printf(c, -1007, "%-18s %s [%s %s%s]%s%s%s", ia, via, a->proto->name,
+	     tm, from, primary ? " *" : "", (e->flags & REF_STALE) ? " stale" : "", info);
   if (d->verbose)
     rta_show(c, a, tmpa);
 }
 
+/*
+ *  Bulk output: one JSON object per route on each line, formatted
+ *  directly to a line buffer. All strings put there are names of
+ *  protocols and interfaces, so they are short enough.
+ */
+
+#define RT_BULK_LINE 512
+
+static inline byte *
+rt_bulk_raw(byte *p, char *s)
+{
+  while (*s)
+    *p++ = *s++;
+  return p;
+}
+
+static byte *
+rt_bulk_str(byte *p, char *s)
+{
+  static char hex[] = "0123456789abcdef";
+
+  *p++ = '"';
+  for (; *s; s++)
+    if (*s == '"' || *s == '\\')
+      {
+	*p++ = '\\';
+	*p++ = *s;
+      }
+    else if ((byte) *s < 0x20)
+      {
+	p = rt_bulk_raw(p, "\\u00");
+	*p++ = hex[(byte) *s >> 4];
+	*p++ = hex[*s & 15];
+      }
+    else
+      *p++ = *s;
+  *p++ = '"';
+  return p;
+}
+
+static byte *
+rt_bulk_num(byte *p, unsigned int x)
+{
+  byte tmp[12];
+  int i = 0;
+
+  do
+    tmp[i++] = '0' + x % 10;
+  while (x /= 10);
+  while (i)
+    *p++ = tmp[--i];
+  return p;
+}
+
+static void
+rt_show_bulk(struct cli *c, rte *e)
+{
+  static char *dest_names[] = { "router", "device", "blackhole", "unreachable", "prohibit" };
+  byte buf[RT_BULK_LINE], *p = buf;
+  rta *a = e->attrs;
+
+  p = rt_bulk_raw(p, "{\"net\":\"");
+  p = ip_ntop(e->net->n.prefix, p);
+  *p++ = '/';
+  p = rt_bulk_num(p, e->net->n.pxlen);
+  p = rt_bulk_raw(p, "\",\"proto\":");
+  p = rt_bulk_str(p, a->proto->name);
+  p = rt_bulk_raw(p, ",\"dest\":\"");
+  p = rt_bulk_raw(p, (a->dest < RTD_NONE) ? dest_names[a->dest] : "none");
+  *p++ = '"';
+  if (a->dest == RTD_ROUTER)
+    {
+      p = rt_bulk_raw(p, ",\"gw\":\"");
+      p = ip_ntop(a->gw, p);
+      *p++ = '"';
+    }
+  if (a->iface)
+    {
+      p = rt_bulk_raw(p, ",\"iface\":");
+      p = rt_bulk_str(p, a->iface->name);
+    }
+  if (ipa_nonzero(a->from))
+    {
+      p = rt_bulk_raw(p, ",\"from\":\"");
+      p = ip_ntop(a->from, p);
+      *p++ = '"';
+    }
+  p = rt_bulk_raw(p, ",\"pref\":");
+  p = rt_bulk_num(p, e->pref);
+  p = rt_bulk_raw(p, ",\"age\":");
+  p = rt_bulk_num(p, now - e->lastmod);
+  if (e->net->routes == e)
+    p = rt_bulk_raw(p, ",\"primary\":true");
+  *p++ = '}';
+  cli_put_line(c, -1020, buf, p - buf);
+}
+
 static void
 rt_show_net(struct cli *c, net *n, struct rt_show_data *d)
 {
@@ -1183,7 +1995,12 @@ rt_show_net(struct cli *c, net *n, struct rt_show_data *d)
       if (ok)
 	{
 	  d->show_counter++;
-	  if (d->stats < 2)
+	  d->src_counter[ee->attrs->source]++;
+	  if (d->stats >= 2)
+	    ;
+	  else if (d->bulk)
+	    rt_show_bulk(c, e);
+	  else
 	    rt_show_rte(c, ia, e, d, tmpa);
 	  ia[0] = 0;
 	}
@@ -1196,42 +2013,158 @@ rt_show_net(struct cli *c, net *n, struct rt_show_data *d)
 }
 
 static void
-rt_show_cont(struct cli *c)
+rt_show_stats(struct cli *c, struct rt_show_data *d)
 {
-  struct rt_show_data *d = c->rover;
+  static char *src_names[RTS_MAX] = { "dummy", "static", "inherit", "device", "static-device", "redirect",
+				      "RIP", "OSPF", "OSPF-IA", "OSPF-ext1", "OSPF-ext2", "BGP", "pipe",
+				      "aggregate" };
+  int i;
+
+  for (i = 0; i < RTS_MAX; i++)
+    if (d->src_counter[i])
+      cli_printf(c, -1021, "%-18s %d", src_names[i], d->src_counter[i]);
+  cli_printf(c, 14, "%d of %d routes for %d networks", d->show_counter, d->rt_counter, d->net_counter);
+}
+
+/*
+ * When all routes of the table are to be counted, the counters maintained
+ * by rte_recalculate() give the answer without walking the table.
+ */
+static int
+rt_show_count_quick(struct rt_show_data *d)
+{
+  rtable *t = d->table;
+
+  if (d->stats < 2 || d->filter != FILTER_ACCEPT || d->show_protocol ||
+      d->export_mode || d->primary_only || d->show_in)
+    return 0;
+
+  d->show_counter = d->rt_counter = t->rte_count;
+  d->net_counter = t->net_count;
+  memcpy(d->src_counter, t->src_count, sizeof(d->src_counter));
+  rt_show_stats(this_cli, d);
+  return 1;
+}
+
+static int
+rt_show_stopped(struct cli *c, struct rt_show_data *d)
+{
+  if (d->running_on_config && d->running_on_config != config)
+    {
+      cli_printf(c, 8004, "Stopped due to reconfiguration");
+      return 1;
+    }
+  if (d->export_protocol &&
+      d->export_protocol->core_state != FS_HAPPY &&
+      d->export_protocol->core_state != FS_FEEDING)
+    {
+      cli_printf(c, 8005, "Protocol is down");
+      return 1;
+    }
+  return 0;
+}
+
+/*
+ *  The continuations are called only after all the output has been sent to
+ *  the client. They list networks until CLI_MAX_CONT_QUEUE bytes of output
+ *  are queued, so a slow client doesn't make us buffer the whole table.
+ *  The number of networks examined in a single run is limited as well,
+ *  so that a filter rejecting most of them doesn't stall other events.
+ */
 #ifdef DEBUGGING
-  unsigned max = 4;
+#define RT_SHOW_MAX 4
 #else
-  unsigned max = 64;
+#define RT_SHOW_MAX 4096
 #endif
+
+static void
+rt_show_cont(struct cli *c)
+{
+  struct rt_show_data *d = c->rover;
+  unsigned max = RT_SHOW_MAX;
   struct fib *fib = &d->table->fib;
   struct fib_iterator *it = &d->fit;
 
   FIB_ITERATE_START(fib, it, f)
     {
       net *n = (net *) f;
-      if (d->running_on_config && d->running_on_config != config)
-	{
-	  cli_printf(c, 8004, "Stopped due to reconfiguration");
-	  goto done;
-	}
-      if (d->export_protocol &&
-	  d->export_protocol->core_state != FS_HAPPY &&
-	  d->export_protocol->core_state != FS_FEEDING)
-	{
-	  cli_printf(c, 8005, "Protocol is down");
-	  goto done;
-	}
-      if (!max--)
+      if (rt_show_stopped(c, d))
+	goto done;
+      if (!max-- || cli_tx_full(c))
 	{
 	  FIB_ITERATE_PUT(it, f);
 	  return;
 	}
-      rt_show_net(c, n, d);
+      if (!d->show_in || ((n->n.pxlen >= d->pxlen) && ipa_in_net(n->n.prefix, d->prefix, d->pxlen)))
+	rt_show_net(c, n, d);
     }
   FIB_ITERATE_END(f);
   if (d->stats)
-    cli_printf(c, 14, "%d of %d routes for %d networks", d->show_counter, d->rt_counter, d->net_counter);
+    rt_show_stats(c, d);
+  else
+    cli_printf(c, 0, "");
+done:
+  c->cont = c->cleanup = NULL;
+}
+
+/*
+ * The index is walked in the preorder. The continuation remembers the last
+ * network shown and skips everything up to it, so the index may freely
+ * change between the calls.
+ */
+static int
+rt_show_subtree(struct cli *c, struct rt_show_data *d, struct rt_index_node *n, int *max)
+{
+  if (!n)
+    return 1;
+
+  if ((d->last_plen >= 0) &&
+      (ipa_compare(ipa_or(n->addr, ipa_not(ipa_mkmask(n->plen))), d->last_addr) < 0))
+    return 1;
+
+  if (n->net && ((d->last_plen < 0) || (ipa_compare(n->addr, d->last_addr) > 0) ||
+		 (ipa_equal(n->addr, d->last_addr) && (n->plen > d->last_plen))))
+    {
+      if (!(*max)-- || cli_tx_full(c))
+	return 0;
+      rt_show_net(c, n->net, d);
+      d->last_addr = n->addr;
+      d->last_plen = n->plen;
+    }
+
+  return rt_show_subtree(c, d, n->c[0], max) && rt_show_subtree(c, d, n->c[1], max);
+}
+
+static void
+rt_show_index_cont(struct cli *c)
+{
+  struct rt_show_data *d = c->rover;
+  struct rt_index_node *n = d->table->index;
+  int max = RT_SHOW_MAX;
+
+  if (!n)
+    {
+      /* The table is no longer sorted */
+      cli_printf(c, 8004, "Stopped due to reconfiguration");
+      goto done;
+    }
+  if (rt_show_stopped(c, d))
+    goto done;
+
+  if (d->show_in)
+    {
+      /* Find the root of the subtree of networks in d->prefix */
+      while (n && (n->plen < d->pxlen) && ipa_in_net(d->prefix, n->addr, n->plen))
+	n = n->c[ipa_getbit(d->prefix, n->plen) ? 1 : 0];
+      if (n && ((n->plen < d->pxlen) || !ipa_in_net(n->addr, d->prefix, d->pxlen)))
+	n = NULL;
+    }
+
+  if (!rt_show_subtree(c, d, n, &max))
+    return;
+
+  if (d->stats)
+    rt_show_stats(c, d);
   else
     cli_printf(c, 0, "");
 done:
@@ -1252,12 +2185,23 @@ rt_show(struct rt_show_data *d)
 {
   net *n;
 
-  if (d->pxlen == 256)
+  if (d->pxlen == 256 || d->show_in)
     {
-      FIB_ITERATE_INIT(&d->fit, &d->table->fib);
-      this_cli->cont = rt_show_cont;
-      this_cli->cleanup = rt_show_cleanup;
+      if (rt_show_count_quick(d))
+	return;
       this_cli->rover = d;
+      if (d->table->index)
+	{
+	  d->last_plen = -1;
+	  this_cli->cont = rt_show_index_cont;
+	  this_cli->cleanup = NULL;
+	}
+      else
+	{
+	  FIB_ITERATE_INIT(&d->fit, &d->table->fib);
+	  this_cli->cont = rt_show_cont;
+	  this_cli->cleanup = rt_show_cleanup;
+	}
     }
   else
     {
@@ -0,0 +1,262 @@
+/*
+ *	BIRD -- Binary Event Tracing
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Binary event tracing
+ *
+ * Logging of every route and packet (the &routes, &filters and &packets
+ * debug flags) is too expensive to be left enabled on a busy router.
+ * Protocols can therefore record the same events to a per-protocol ring
+ * of fixed-size &trace_event's instead (see the &trace protocol option).
+ * Recording an event means just filling in a few fields and the events
+ * are formatted only when they're requested by the |dump trace| command,
+ * so the tracing may stay enabled and the last events are at hand when
+ * something goes wrong.
+ *
+ * The ring lives as long as the protocol instance, so it survives restarts
+ * of the protocol, but not its reconfiguration which needs a restart.
+ * Events keep only a pointer to route attributes, which is printed as
+ * an identifier and never dereferenced as the attributes may be gone.
+ */
+
+#include "nest/bird.h"
+#include "nest/protocol.h"
+#include "nest/route.h"
+#include "nest/cli.h"
+#include "nest/trace.h"
+#include "lib/resource.h"
+#include "lib/string.h"
+#include "lib/timer.h"
+#include "conf/conf.h"
+
+static pool *trace_pool;
+
+/**
+ * trace_set - configure binary tracing of a protocol
+ * @p: protocol instance
+ * @mask: events to record (%D_ROUTES, %D_FILTERS and %D_PACKETS)
+ * @events: size of the ring
+ *
+ * Sets the trace mask of the protocol and allocates the ring. The ring
+ * is freed when @mask is zero. Changing of the size loses the recorded
+ * events.
+ */
+void
+trace_set(struct proto *p, u32 mask, unsigned events)
+{
+  struct trace_ring *r = p->trace_ring;
+  unsigned n;
+
+  p->trace = mask;
+  for (n = 1; n < events; n <<= 1)
+    ;
+
+  if (r && (!mask || (r->mask != n - 1)))
+    {
+      mb_free(r);
+      p->trace_ring = r = NULL;
+    }
+
+  if (!mask || r)
+    return;
+
+  if (!trace_pool)
+    trace_pool = rp_new(&root_pool, "Trace");
+  r = mb_alloc(trace_pool, sizeof(struct trace_ring) + n * sizeof(struct trace_event));
+  r->mask = n - 1;
+  r->pos = 0;
+  p->trace_ring = r;
+}
+
+static inline struct trace_event *
+trace_next(struct proto *p)
+{
+  struct trace_ring *r = p->trace_ring;
+  struct trace_event *e = &r->ev[r->pos++ & r->mask];
+
+  e->time = tm_current_usec();
+  return e;
+}
+
+void
+trace_route(struct proto *p, rte *e, int dir, char *msg)
+{
+  struct trace_event *t = trace_next(p);
+
+  t->type = TE_ROUTE;
+  t->msg = msg;
+  t->rta = e->attrs;
+  t->prefix = e->net->n.prefix;
+  t->pxlen = e->net->n.pxlen;
+  t->dir = dir;
+}
+
+void
+trace_packet(struct proto *p, int dir, unsigned code, unsigned length, char *msg)
+{
+  struct trace_event *t = trace_next(p);
+
+  t->type = TE_PACKET;
+  t->msg = msg;
+  t->rta = NULL;
+  t->dir = dir;
+  t->code = code;
+  t->length = length;
+}
+
+/*
+ * The events are shown by a CLI continuation, a limited number of them
+ * at once. The protocols are walked in the order of the global protocol
+ * list, which may change only by a reconfiguration.
+ */
+
+#ifdef LOCAL_DEBUG
+#define TRACE_DUMP_MAX 4
+#else
+#define TRACE_DUMP_MAX 256
+#endif
+
+struct trace_dump_data {
+  struct proto_spec ps;			/* Protocols to show */
+  unsigned count;			/* Maximum number of events per protocol, 0 for all */
+  struct proto *proto;			/* Protocol being shown */
+  u32 pos, end;				/* Next event to show and the one after the last */
+  u64 now;				/* Time of the command */
+  struct config *running_on_config;
+};
+
+static struct proto *
+trace_dump_next(struct trace_dump_data *d)
+{
+  node *nn;
+
+  if (!d->ps.patt)
+    return d->proto ? NULL : ((struct proto_config *) ((struct symbol *) d->ps.ptr)->def)->proto;
+
+  for (nn = d->proto ? d->proto->glob_node.next : HEAD(proto_list); nn->next; nn = nn->next)
+    {
+      struct proto *p = SKIP_BACK(struct proto, glob_node, nn);
+
+      if (!d->ps.ptr || patmatch(d->ps.ptr, p->name))
+	return p;
+    }
+  return NULL;
+}
+
+static void
+trace_dump_start(struct cli *c, struct trace_dump_data *d)
+{
+  struct proto *p = d->proto;
+  struct trace_ring *r = p->trace_ring;
+  u32 n;
+
+  if (!r)
+    {
+      cli_printf(c, -1023, "%s: binary tracing disabled", p->name);
+      d->pos = d->end = 0;
+      return;
+    }
+
+  n = MIN(r->pos, r->mask + 1);
+  if (d->count && (d->count < n))
+    n = d->count;
+
+  cli_printf(c, -1023, "%s: %u events recorded, showing %u", p->name, r->pos, n);
+  d->end = r->pos;
+  d->pos = r->pos - n;
+}
+
+static void
+trace_dump_event(struct cli *c, struct trace_dump_data *d, struct trace_event *e)
+{
+  u64 age = d->now - e->time;
+
+  if (e->type == TE_ROUTE)
+    cli_printf(c, -1023, " -%u.%06u %c %s %I/%d rta %p", (u32) (age / 1000000), (u32) (age % 1000000),
+	       e->dir, e->msg, e->prefix, e->pxlen, e->rta);
+  else
+    cli_printf(c, -1023, " -%u.%06u %c %s (type %d, %u bytes)", (u32) (age / 1000000), (u32) (age % 1000000),
+	       e->dir, e->msg, e->code, e->length);
+}
+
+static void
+trace_dump_cont(struct cli *c)
+{
+  struct trace_dump_data *d = c->rover;
+  unsigned max = TRACE_DUMP_MAX;
+
+  if (d->running_on_config != config)
+    {
+      cli_printf(c, 8004, "Stopped due to reconfiguration");
+      goto done;
+    }
+
+  while (d->proto)
+    {
+      struct trace_ring *r = d->proto->trace_ring;
+
+      /* The protocol may have overwritten the events while we were waiting */
+      if (r && (r->pos - d->pos > r->mask + 1))
+	{
+	  u32 lost = MIN(r->pos - (r->mask + 1) - d->pos, d->end - d->pos);
+
+	  cli_printf(c, -1023, " %u events overwritten", lost);
+	  d->pos += lost;
+	}
+
+      for (; d->pos != d->end; d->pos++)
+	{
+	  if (!max-- || cli_tx_full(c))
+	    return;
+	  trace_dump_event(c, d, &r->ev[d->pos & r->mask]);
+	}
+
+      if (d->proto = trace_dump_next(d))
+	trace_dump_start(c, d);
+    }
+
+  cli_printf(c, 0, "");
+done:
+  c->cont = c->cleanup = NULL;
+}
+
+/**
+ * trace_dump - show recorded events of protocols
+ * @ps: protocol specification
+ * @count: maximum number of events per protocol to show, 0 for all
+ *
+ * Formats the events in the order they were recorded. Their times
+ * are shown relative to the time of the command. Long dumps are
+ * continued as the CLI output buffer drains.
+ */
+void
+trace_dump(struct proto_spec ps, unsigned count)
+{
+  struct trace_dump_data *d;
+
+  if (!ps.patt && (((struct symbol *) ps.ptr)->class != SYM_PROTO))
+    {
+      cli_msg(9002, "%s is not a protocol", ((struct symbol *) ps.ptr)->name);
+      return;
+    }
+
+  d = cfg_allocz(sizeof(struct trace_dump_data));
+  d->ps = ps;
+  d->count = count;
+  d->now = tm_current_usec();
+  d->running_on_config = config;
+
+  if (!(d->proto = trace_dump_next(d)))
+    {
+      cli_msg(8003, "No protocols match");
+      return;
+    }
+
+  trace_dump_start(this_cli, d);
+  this_cli->rover = d;
+  this_cli->cont = trace_dump_cont;
+  this_cli->cleanup = NULL;
+}
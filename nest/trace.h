@@ -0,0 +1,44 @@
+/*
+ *	BIRD -- Binary Event Tracing
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_TRACE_H_
+#define _BIRD_TRACE_H_
+
+struct proto;
+struct proto_spec;
+struct rte;
+struct rta;
+
+struct trace_event {
+  u64 time;				/* tm_current_usec() */
+  char *msg;				/* Static description of the event */
+  struct rta *rta;			/* Attributes of the route (just for identification, may be gone) */
+  ip_addr prefix;			/* Network of route events */
+  byte pxlen;
+  byte dir;				/* '>' for import or received packet, '<' for export or sent packet */
+  byte type;				/* TE_* */
+  byte code;				/* Packet type */
+  u32 length;				/* Packet length */
+};
+
+#define TE_ROUTE	1
+#define TE_PACKET	2
+
+struct trace_ring {
+  unsigned mask;			/* Number of events minus one, it's a power of two */
+  u32 pos;				/* Number of events ever recorded */
+  struct trace_event ev[0];
+};
+
+#define TRACE_DEFAULT_EVENTS	1024
+#define TRACE_MAX_EVENTS	(1 << 20)
+
+void trace_set(struct proto *p, u32 mask, unsigned events);
+void trace_route(struct proto *p, struct rte *e, int dir, char *msg);
+void trace_packet(struct proto *p, int dir, unsigned code, unsigned length, char *msg);
+void trace_dump(struct proto_spec ps, unsigned count);
+
+#endif
@@ -0,0 +1,599 @@
+/*
+ *	BIRD -- Route Aggregation
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Aggregator
+ *
+ * The Aggregator protocol originates configured aggregate routes (e.g.
+ * 10.0.0.0/8) as long as at least one component route (a more specific
+ * route inside the aggregate accepted by the export filter) exists in
+ * its table. The aggregate carries BGP attributes merged from all its
+ * components: the ORIGIN, optionally an AS_SET of all AS numbers found
+ * in the AS paths of the components and optionally the union of their
+ * communities.
+ *
+ * Recomputing the attributes from all components on each change would
+ * be far too slow for aggregates covering big parts of a full table,
+ * so each aggregate keeps the number of its components by their ORIGIN
+ * and two sorted sets of AS numbers and communities with reference
+ * counts (&agg_set). A component change only adds its attributes to
+ * and removes the previous ones from the aggregates covering it, which
+ * costs a binary search per value. The aggregates covering a prefix
+ * are found by probing the hash of aggregates with the prefix masked to
+ * each of the configured aggregate lengths.
+ *
+ * We don't rely on the @old route passed to rt_notify(), because the
+ * nest may report withdraws of routes which have never been exported to
+ * us. Instead, each component remembers the cached &rta it has been
+ * accounted with (&agg_comp), which also makes refeeds cheap, as the
+ * unchanged routes are recognized by a pointer comparison.
+ *
+ * The visible attributes of an aggregate change only when a counter or
+ * a value in one of the sets drops to zero or rises from it. Only then
+ * the aggregate is put on a list of pending aggregates, which are
+ * recomputed by an event after the current batch of updates is done.
+ * The result is looked up in the attribute cache and compared with the
+ * announced &rta, so the aggregate is announced again only if its
+ * attributes really differ. A component flapping within a batch or
+ * a change of a component which doesn't affect the merged attributes
+ * therefore never reaches the neighbors.
+ */
+
+#undef LOCAL_DEBUG
+
+#include "nest/bird.h"
+#include "nest/iface.h"
+#include "nest/protocol.h"
+#include "nest/route.h"
+#include "nest/attrs.h"
+#include "nest/cli.h"
+#include "conf/conf.h"
+#include "lib/resource.h"
+#include "lib/string.h"
+#include "lib/unaligned.h"
+#include "proto/bgp/bgp.h"
+
+#include "aggregator.h"
+
+/*
+ *	Sets of values with reference counts
+ */
+
+static unsigned
+agg_set_find(struct agg_set *s, u32 v)
+{
+  unsigned l = 0, h = s->len, m;
+
+  while (l < h)
+    {
+      m = (l + h) / 2;
+      if (s->val[m] < v)
+	l = m + 1;
+      else
+	h = m;
+    }
+  return l;
+}
+
+/* Returns 1 if the value is new in the set */
+static int
+agg_set_add(struct aggregator_proto *p, struct agg_set *s, u32 v)
+{
+  unsigned i = agg_set_find(s, v);
+
+  if ((i < s->len) && (s->val[i] == v))
+    {
+      s->cnt[i]++;
+      return 0;
+    }
+
+  if (s->len == s->size)
+    {
+      s->size = s->size ? 2 * s->size : 16;
+      s->val = mb_realloc(p->p.pool, s->val, s->size * sizeof(u32));
+      s->cnt = mb_realloc(p->p.pool, s->cnt, s->size * sizeof(u32));
+    }
+  memmove(s->val + i + 1, s->val + i, (s->len - i) * sizeof(u32));
+  memmove(s->cnt + i + 1, s->cnt + i, (s->len - i) * sizeof(u32));
+  s->val[i] = v;
+  s->cnt[i] = 1;
+  s->len++;
+  return 1;
+}
+
+/* Returns 1 if the value has disappeared from the set */
+static int
+agg_set_del(struct agg_set *s, u32 v)
+{
+  unsigned i = agg_set_find(s, v);
+
+  if ((i == s->len) || (s->val[i] != v))
+    bug("Aggregator: Value %u not in the set", v);
+
+  if (--s->cnt[i])
+    return 0;
+
+  s->len--;
+  memmove(s->val + i, s->val + i + 1, (s->len - i) * sizeof(u32));
+  memmove(s->cnt + i, s->cnt + i + 1, (s->len - i) * sizeof(u32));
+  return 1;
+}
+
+/*
+ *	Accounting of components
+ */
+
+static inline int
+agg_crossed(u32 cnt, int add)
+{
+  /* The counter has just risen from zero or dropped to it */
+  return add ? (cnt == 1) : !cnt;
+}
+
+static int
+agg_account_path(struct aggregator_proto *p, struct agg_net *g, struct adata *path, int add)
+{
+  byte *x = path->data;
+  byte *end = x + path->length;
+  int changed = 0;
+  int i, n;
+
+  while (x < end)
+    {
+      n = x[1];
+      x += 2;
+      /* Confederation segments never leave the confederation, skip them */
+      if ((x[-2] == AS_PATH_SET) || (x[-2] == AS_PATH_SEQUENCE))
+	for (i = 0; i < n; i++)
+	  changed |= add ? agg_set_add(p, &g->asns, get_u32(x + 4*i)) : agg_set_del(&g->asns, get_u32(x + 4*i));
+      x += 4*n;
+    }
+  return changed;
+}
+
+static int
+agg_account_comms(struct aggregator_proto *p, struct agg_net *g, struct adata *list, int add)
+{
+  u32 *l = (u32 *) list->data;
+  int changed = 0;
+  int i;
+
+  for (i = 0; i < int_set_get_size(list); i++)
+    changed |= add ? agg_set_add(p, &g->comms, l[i]) : agg_set_del(&g->comms, l[i]);
+  return changed;
+}
+
+static void
+agg_account(struct aggregator_proto *p, struct agg_net *g, rta *a, int add)
+{
+  struct agg_config *cf = g->cf;
+  int d = add ? 1 : -1;
+  struct adata *path = NULL;
+  u32 origin = ORIGIN_IGP;
+  int changed;
+  eattr *e;
+
+  g->count += d;
+  changed = agg_crossed(g->count, add);
+
+  if (e = ea_find(a->eattrs, EA_CODE(EAP_BGP, BA_ORIGIN)))
+    origin = MIN(e->u.data, ORIGIN_INCOMPLETE);
+  g->origin[origin] += d;
+  changed |= agg_crossed(g->origin[origin], add);
+
+  if (e = ea_find(a->eattrs, EA_CODE(EAP_BGP, BA_AS_PATH)))
+    path = e->u.ptr;
+
+  /* Without AS_SET, the path information of the components is lost */
+  if (ea_find(a->eattrs, EA_CODE(EAP_BGP, BA_ATOMIC_AGGR)) ||
+      (!cf->as_set && path && path->length))
+    {
+      g->atomic += d;
+      changed |= agg_crossed(g->atomic, add);
+    }
+
+  if (cf->as_set && path)
+    changed |= agg_account_path(p, g, path, add);
+
+  if (cf->communities && (e = ea_find(a->eattrs, EA_CODE(EAP_BGP, BA_COMMUNITY))))
+    changed |= agg_account_comms(p, g, e->u.ptr, add);
+
+  if (changed && !g->pending)
+    {
+      g->pending = 1;
+      g->next_pending = p->pending;
+      p->pending = g;
+      ev_schedule(p->ev);
+    }
+}
+
+/* Find the aggregates covering a prefix, from the shortest one */
+static int
+agg_find_covers(struct aggregator_proto *p, ip_addr px, int pxlen, struct agg_net **cover)
+{
+  struct agg_net *g;
+  ip_addr a;
+  int i, k = 0;
+
+  for (i = 0; (i < p->num_lens) && (p->lens[i] < pxlen); i++)
+    {
+      a = ipa_and(px, ipa_mkmask(p->lens[i]));
+      if (g = fib_find(&p->aggs, &a, p->lens[i]))
+	cover[k++] = g;
+    }
+  return k;
+}
+
+static void
+agg_rt_notify(struct proto *P, rtable *tbl UNUSED, net *n, rte *new, rte *old UNUSED, ea_list *attrs UNUSED)
+{
+  struct aggregator_proto *p = (struct aggregator_proto *) P;
+  struct agg_net *cover[MAX_PREFIX_LENGTH+1];
+  struct agg_comp *c;
+  rta *a = NULL;
+  int i, k;
+
+  if (!(k = agg_find_covers(p, n->n.prefix, n->n.pxlen, cover)))
+    return;
+
+  c = fib_find(&p->comps, &n->n.prefix, n->n.pxlen);
+  if (new)
+    a = (new->attrs->aflags & RTAF_CACHED) ? rta_clone(new->attrs) : rta_lookup(new->attrs);
+
+  /* Refeeds and spurious withdraws */
+  if (c ? (a == c->attrs) : !a)
+    {
+      rta_free(a);
+      return;
+    }
+
+  /* Adding first keeps the counters of unchanged values above zero */
+  for (i = 0; i < k; i++)
+    {
+      if (a)
+	agg_account(p, cover[i], a, 1);
+      if (c)
+	agg_account(p, cover[i], c->attrs, 0);
+    }
+  p->changes++;
+
+  if (c)
+    rta_free(c->attrs);
+  if (!a)
+    {
+      fib_delete(&p->comps, c);
+      return;
+    }
+  if (!c)
+    c = fib_get(&p->comps, &n->n.prefix, n->n.pxlen);
+  c->attrs = a;
+}
+
+static int
+agg_import_control(struct proto *P, rte **ee, ea_list **ea UNUSED, struct linpool *pool UNUSED)
+{
+  /* Our own aggregates are never components */
+  return ((*ee)->attrs->proto == P) ? -1 : 0;
+}
+
+/*
+ *	Announcement of aggregates
+ */
+
+static inline void
+agg_set_attr(eattr *e, unsigned code, unsigned flags, unsigned type, uintptr_t val)
+{
+  e->id = EA_CODE(EAP_BGP, code);
+  e->flags = flags;
+  e->type = type;
+  if (type & EAF_EMBEDDED)
+    e->u.data = val;
+  else
+    e->u.ptr = (struct adata *) val;
+}
+
+static struct adata *
+agg_build_path(struct aggregator_proto *p, struct agg_set *s)
+{
+  unsigned segs = (s->len + 254) / 255;
+  struct adata *a = lp_alloc(p->lp, sizeof(struct adata) + 2*segs + 4*s->len);
+  byte *x = a->data;
+  unsigned i = 0, n;
+
+  /* The AS numbers are sorted, so equal sets give equal paths */
+  a->length = 2*segs + 4*s->len;
+  while (i < s->len)
+    {
+      n = MIN(s->len - i, 255);
+      *x++ = AS_PATH_SET;
+      *x++ = n;
+      for (; n; n--, i++, x += 4)
+	put_u32(x, s->val[i]);
+    }
+  return a;
+}
+
+static struct adata *
+agg_build_comms(struct aggregator_proto *p, struct agg_set *s)
+{
+  struct adata *a = lp_alloc(p->lp, sizeof(struct adata) + 4*s->len);
+
+  a->length = 4*s->len;
+  memcpy(a->data, s->val, 4*s->len);
+  return a;
+}
+
+static void
+agg_withdraw(struct aggregator_proto *p, struct agg_net *g)
+{
+  net *n;
+
+  if (n = net_find(p->p.table, g->n.prefix, g->n.pxlen))
+    rte_update(p->p.table, n, &p->p, &p->p, NULL);
+
+  rta_free(g->attrs);
+  g->attrs = NULL;
+  g->updates++;
+  p->active--;
+  p->updates++;
+}
+
+static void
+agg_update(struct aggregator_proto *p, struct agg_net *g)
+{
+  struct agg_config *cf = g->cf;
+  ea_list *ea = lp_alloc(p->lp, sizeof(ea_list) + 4*sizeof(eattr));
+  struct adata *empty = lp_allocz(p->lp, sizeof(struct adata));
+  u32 origin;
+  rta a, *r;
+  net *n;
+  rte *e;
+
+  if (!g->count)
+    {
+      if (g->attrs)
+	agg_withdraw(p, g);
+      return;
+    }
+
+  if (g->origin[ORIGIN_INCOMPLETE])
+    origin = ORIGIN_INCOMPLETE;
+  else if (g->origin[ORIGIN_EGP])
+    origin = ORIGIN_EGP;
+  else
+    origin = ORIGIN_IGP;
+
+  /* The attributes are sorted by their codes */
+  ea->next = NULL;
+  ea->flags = EALF_SORTED;
+  ea->count = 0;
+  agg_set_attr(&ea->attrs[ea->count++], BA_ORIGIN, BAF_TRANSITIVE, EAF_TYPE_INT, origin);
+  agg_set_attr(&ea->attrs[ea->count++], BA_AS_PATH, BAF_TRANSITIVE, EAF_TYPE_AS_PATH,
+	       (uintptr_t) (cf->as_set ? agg_build_path(p, &g->asns) : empty));
+  if (g->atomic)
+    agg_set_attr(&ea->attrs[ea->count++], BA_ATOMIC_AGGR, BAF_TRANSITIVE, EAF_TYPE_OPAQUE,
+		 (uintptr_t) empty);
+  if (cf->communities && g->comms.len)
+    agg_set_attr(&ea->attrs[ea->count++], BA_COMMUNITY, BAF_OPTIONAL | BAF_TRANSITIVE, EAF_TYPE_INT_SET,
+		 (uintptr_t) agg_build_comms(p, &g->comms));
+
+  bzero(&a, sizeof(a));
+  a.proto = &p->p;
+  a.source = RTS_AGGREGATE;
+  a.scope = SCOPE_UNIVERSE;
+  a.cast = RTC_UNICAST;
+  a.dest = RTD_BLACKHOLE;
+  a.eattrs = ea;
+
+  /* Cached attributes are equal iff they are the same */
+  r = rta_lookup(&a);
+  if (r == g->attrs)
+    {
+      rta_free(r);
+      return;
+    }
+
+  if (!g->attrs)
+    p->active++;
+  rta_free(g->attrs);
+  g->attrs = r;
+  g->updates++;
+  p->updates++;
+
+  n = net_get(p->p.table, g->n.prefix, g->n.pxlen);
+  e = rte_get_temp(rta_clone(r));
+  e->net = n;
+  e->pflags = 0;
+  rte_update(p->p.table, n, &p->p, &p->p, e);
+}
+
+static void
+agg_run(void *data)
+{
+  struct aggregator_proto *p = data;
+  struct agg_net *g;
+
+  if (p->p.proto_state != PS_UP)
+    return;
+
+  while (g = p->pending)
+    {
+      p->pending = g->next_pending;
+      g->pending = 0;
+      agg_update(p, g);
+    }
+  lp_flush(p->lp);
+}
+
+/*
+ *	Protocol glue
+ */
+
+static void
+agg_init_net(struct fib_node *N)
+{
+  struct agg_net *g = (struct agg_net *) N;
+
+  g->cf = NULL;
+  g->next_pending = NULL;
+  g->pending = 0;
+  g->count = g->atomic = g->updates = 0;
+  g->origin[0] = g->origin[1] = g->origin[2] = 0;
+  bzero(&g->asns, sizeof(g->asns));
+  bzero(&g->comms, sizeof(g->comms));
+  g->attrs = NULL;
+}
+
+static void
+agg_init_comp(struct fib_node *N)
+{
+  ((struct agg_comp *) N)->attrs = NULL;
+}
+
+static struct proto *
+aggregator_init(struct proto_config *C)
+{
+  struct proto *P = proto_new(C, sizeof(struct aggregator_proto));
+
+  P->accept_ra_types = RA_OPTIMAL;
+  P->rt_notify = agg_rt_notify;
+  P->import_control = agg_import_control;
+  return P;
+}
+
+static int
+aggregator_start(struct proto *P)
+{
+  struct aggregator_proto *p = (struct aggregator_proto *) P;
+  struct aggregator_config *c = (struct aggregator_config *) P->cf;
+  byte seen[MAX_PREFIX_LENGTH+1];
+  struct agg_config *ac;
+  struct agg_net *g;
+  int l;
+
+  p->cf = c;
+  fib_init(&p->aggs, P->pool, sizeof(struct agg_net), 0, agg_init_net);
+  fib_init(&p->comps, P->pool, sizeof(struct agg_comp), 0, agg_init_comp);
+
+  bzero(seen, sizeof(seen));
+  WALK_LIST(ac, c->aggregates)
+    {
+      g = fib_get(&p->aggs, &ac->prefix, ac->pxlen);
+      g->cf = ac;
+      seen[ac->pxlen] = 1;
+    }
+  p->num_lens = 0;
+  for (l = 0; l <= MAX_PREFIX_LENGTH; l++)
+    if (seen[l])
+      p->lens[p->num_lens++] = l;
+
+  p->pending = NULL;
+  p->lp = lp_new(P->pool, 4080);
+  p->ev = ev_new(P->pool);
+  p->ev->hook = agg_run;
+  p->ev->data = p;
+  p->active = 0;
+  p->changes = p->updates = 0;
+  return PS_UP;
+}
+
+static int
+aggregator_shutdown(struct proto *P)
+{
+  struct aggregator_proto *p = (struct aggregator_proto *) P;
+
+  /* The routes are flushed by the nest, we just drop our references */
+  FIB_WALK(&p->comps, f)
+    {
+      rta_free(((struct agg_comp *) f)->attrs);
+    }
+  FIB_WALK_END;
+  FIB_WALK(&p->aggs, f)
+    {
+      rta_free(((struct agg_net *) f)->attrs);
+      ((struct agg_net *) f)->attrs = NULL;
+    }
+  FIB_WALK_END;
+  p->pending = NULL;
+  return PS_DOWN;
+}
+
+static int
+agg_same_aggregates(list *a, list *b)
+{
+  struct agg_config *x = HEAD(*a);
+  struct agg_config *y = HEAD(*b);
+
+  for (; x->n.next && y->n.next; x = (void *) x->n.next, y = (void *) y->n.next)
+    if (!ipa_equal(x->prefix, y->prefix) || (x->pxlen != y->pxlen) ||
+	(x->as_set != y->as_set) || (x->communities != y->communities))
+      return 0;
+  return !x->n.next && !y->n.next;
+}
+
+static int
+aggregator_reconfigure(struct proto *P, struct proto_config *new)
+{
+  struct aggregator_proto *p = (struct aggregator_proto *) P;
+  struct aggregator_config *o = (struct aggregator_config *) P->cf;
+  struct aggregator_config *n = (struct aggregator_config *) new;
+  struct agg_config *ac;
+
+  if (!agg_same_aggregates(&o->aggregates, &n->aggregates))
+    return 0;
+
+  /* The aggregates point to the old configuration */
+  p->cf = n;
+  WALK_LIST(ac, n->aggregates)
+    ((struct agg_net *) fib_find(&p->aggs, &ac->prefix, ac->pxlen))->cf = ac;
+  return 1;
+}
+
+static void
+aggregator_get_status(struct proto *P, byte *buf)
+{
+  struct aggregator_proto *p = (struct aggregator_proto *) P;
+
+  if (P->proto_state == PS_UP)
+    bsprintf(buf, "%u of %u aggregates", p->active, p->aggs.entries);
+}
+
+struct protocol proto_aggregator = {
+  name:		"Aggregator",
+  template:	"aggregator%d",
+  init:		aggregator_init,
+  start:	aggregator_start,
+  shutdown:	aggregator_shutdown,
+  reconfigure:	aggregator_reconfigure,
+  get_status:	aggregator_get_status,
+};
+
+void
+aggregator_show(struct proto *P)
+{
+  struct aggregator_proto *p = (struct aggregator_proto *) P;
+  struct agg_config *ac;
+  struct agg_net *g;
+
+  if (P->proto_state != PS_UP)
+    {
+      cli_msg(-1025, "%s: not running", P->name);
+      cli_msg(0, "");
+      return;
+    }
+
+  cli_msg(-1025, "%s:", P->name);
+  cli_msg(-1025, "  Components:     %u routes, %Lu changes", p->comps.entries, p->changes);
+  cli_msg(-1025, "  Aggregates:     %u of %u announced, %Lu updates", p->active, p->aggs.entries, p->updates);
+  WALK_LIST(ac, p->cf->aggregates)
+    {
+      g = fib_find(&p->aggs, &ac->prefix, ac->pxlen);
+      cli_msg(-1025, "  %I/%d: %u components, %u AS numbers, %u communities, %u updates%s",
+	      ac->prefix, ac->pxlen, g->count, g->asns.len, g->comms.len, g->updates,
+	      g->attrs ? "" : ", not announced");
+    }
+  cli_msg(0, "");
+}
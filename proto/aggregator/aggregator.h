@@ -0,0 +1,63 @@
+/*
+ *	BIRD -- Route Aggregation
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_AGGREGATOR_H_
+#define _BIRD_AGGREGATOR_H_
+
+struct aggregator_config {
+  struct proto_config c;
+  list aggregates;			/* List of struct agg_config */
+};
+
+struct agg_config {
+  node n;
+  ip_addr prefix;
+  int pxlen;
+  int as_set;				/* Merge AS paths of the components to AS_SET */
+  int communities;			/* Merge communities of the components */
+};
+
+/* Sorted set of values with reference counts */
+struct agg_set {
+  u32 *val, *cnt;
+  unsigned len, size;
+};
+
+struct agg_net {			/* Configured aggregate */
+  struct fib_node n;
+  struct agg_config *cf;
+  struct agg_net *next_pending;		/* Chain of aggregates to be recomputed */
+  int pending;
+  u32 count;				/* Number of components */
+  u32 origin[3];			/* Components by their ORIGIN */
+  u32 atomic;				/* Components whose path information is lost */
+  struct agg_set asns, comms;		/* Merged AS numbers and communities */
+  rta *attrs;				/* Announced attributes, NULL if not announced */
+  u32 updates;				/* Number of announcements and withdraws */
+};
+
+struct agg_comp {			/* Component route */
+  struct fib_node n;
+  rta *attrs;				/* Cached attributes the route is accounted with */
+};
+
+struct aggregator_proto {
+  struct proto p;
+  struct aggregator_config *cf;		/* Shortcut to aggregator configuration */
+  struct fib aggs;			/* Aggregates (struct agg_net) */
+  struct fib comps;			/* Components (struct agg_comp) */
+  byte lens[MAX_PREFIX_LENGTH+1];	/* Distinct lengths of aggregates in ascending order */
+  int num_lens;
+  struct agg_net *pending;		/* Aggregates to be recomputed by the event */
+  struct event *ev;
+  struct linpool *lp;			/* Attribute data while building an aggregate */
+  u32 active;				/* Announced aggregates */
+  u64 changes, updates;			/* Component changes and aggregate updates */
+};
+
+void aggregator_show(struct proto *P);
+
+#endif
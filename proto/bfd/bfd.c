@@ -0,0 +1,865 @@
+/*
+ *	BIRD -- Bidirectional Forwarding Detection (BFD)
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Bidirectional Forwarding Detection
+ *
+ * The BFD protocol implements single hop BFD sessions according to
+ * RFC 5880 and RFC 5881 in the asynchronous mode, without the echo
+ * function and without authentication. Its purpose is to detect a
+ * failure of a neighbor (or of the path to it) within tens of
+ * milliseconds, much faster than the hold timers of routing protocols.
+ *
+ * Sessions are kept in a &fib indexed by the neighbor address and in a
+ * hash of local discriminators which are used to match the received
+ * packets. A session is created either for a neighbor listed in the
+ * configuration, or on a request of another protocol (&bfd_request)
+ * made by bfd_request_session(). Requests are resources of the pool of
+ * the requesting protocol. A session without any requests which is not
+ * configured is removed when its last request is freed.
+ *
+ * Requests survive restarts and reconfigurations of the BFD protocol
+ * itself: while no BFD protocol is running, they wait in a global list
+ * with the %BFD_STATE_ADMIN_DOWN state and they are attached to the
+ * sessions as soon as the protocol starts. Only one instance of the
+ * protocol may be configured.
+ *
+ * The requesting protocols are not notified directly from the packet
+ * and timer hooks, but from an event running the queue of changed
+ * requests, so that they are free to do anything (including freeing the
+ * request) in their hooks. The @down flag of a request tells whether
+ * the session has failed since the last notification, which may be the
+ * case even if the session is up again.
+ *
+ * The intervals are in microseconds as in the packets themselves, the
+ * transmission and detection timers are &utimer<!-- -->s with
+ * microsecond resolution. A session which is not up transmits at a
+ * slow idle rate; when it comes up, the configured fast rate is
+ * negotiated by a poll sequence, as described in RFC 5880 6.8.3.
+ */
+
+#undef LOCAL_DEBUG
+
+#include "nest/bird.h"
+#include "nest/iface.h"
+#include "nest/protocol.h"
+#include "nest/route.h"
+#include "nest/cli.h"
+#include "conf/conf.h"
+#include "lib/socket.h"
+#include "lib/resource.h"
+#include "lib/event.h"
+#include "lib/string.h"
+
+#include "bfd.h"
+
+#define TRACE(flags, msg, args...) do { if (p->p.debug & flags) \
+	log(L_TRACE "%s: " msg, p->p.name , ## args ); } while(0)
+
+static list bfd_wait_list;		/* Requests waiting for a BFD protocol */
+static list bfd_notify_list;		/* Requests to be notified (by notify_n) */
+static event *bfd_notify_event;
+static struct bfd_proto *bfd_global;	/* The running BFD protocol, if any */
+
+static char *bfd_state_names[] = { "AdminDown", "Down", "Init", "Up" };
+
+static char *bfd_diag_names[] = { "", "Timeout", "Echo failed", "Neighbor down", "Fwd reset",
+				  "Path down", "Concat path down", "Admin down", "Rev concat path down" };
+
+static void bfd_send_ctl(struct bfd_session *s, int final);
+
+
+/*
+ *	Requests
+ */
+
+static void
+bfd_notify_run(void *data UNUSED)
+{
+  struct bfd_request *req;
+  node *n;
+
+  while ((n = HEAD(bfd_notify_list))->next)
+    {
+      req = SKIP_BACK(struct bfd_request, notify_n, n);
+      rem_node(n);
+      n->next = NULL;
+      /* The hook may free the request */
+      req->hook(req);
+    }
+}
+
+static void
+bfd_request_notify(struct bfd_request *req, u8 state, u8 diag, int failed)
+{
+  u8 old_state = req->state;
+
+  req->state = state;
+  req->diag = diag;
+
+  if (!req->notify_n.next)
+    {
+      req->down = 0;
+      add_tail(&bfd_notify_list, &req->notify_n);
+      ev_schedule(bfd_notify_event);
+    }
+
+  if (failed && (old_state == BFD_STATE_UP) && (state != BFD_STATE_UP))
+    req->down = 1;
+}
+
+static void
+bfd_session_notify(struct bfd_session *s, int failed)
+{
+  node *n;
+
+  WALK_LIST(n, s->requests)
+    bfd_request_notify(SKIP_BACK(struct bfd_request, n, n), s->loc_state, s->loc_diag, failed);
+}
+
+static void bfd_remove_session(struct bfd_proto *p, struct bfd_session *s);
+
+static void
+bfd_request_free(resource *r)
+{
+  struct bfd_request *req = (struct bfd_request *) r;
+  struct bfd_session *s = req->session;
+
+  rem_node(&req->n);
+  if (req->notify_n.next)
+    rem_node(&req->notify_n);
+
+  if (s && !s->configured && EMPTY_LIST(s->requests))
+    bfd_remove_session(s->bfd, s);
+}
+
+static void
+bfd_request_dump(resource *r)
+{
+  struct bfd_request *req = (struct bfd_request *) r;
+
+  debug("(%I, %s)\n", req->addr, bfd_state_names[req->state]);
+}
+
+static struct resclass bfd_request_class = {
+  "BFD request",
+  sizeof(struct bfd_request),
+  bfd_request_free,
+  bfd_request_dump,
+  NULL
+};
+
+static struct bfd_session *bfd_get_session(struct bfd_proto *p, ip_addr addr);
+
+static void
+bfd_attach_request(struct bfd_proto *p, struct bfd_request *req)
+{
+  struct bfd_session *s = bfd_get_session(p, req->addr);
+
+  rem_node(&req->n);
+  add_tail(&s->requests, &req->n);
+  req->session = s;
+  bfd_request_notify(req, s->loc_state, s->loc_diag, 0);
+}
+
+/**
+ * bfd_request_session - watch the liveness of a neighbor
+ * @p: pool to allocate the request from
+ * @addr: address of the neighbor
+ * @hook: function to be called when the state of the session changes
+ * @data: user data for the hook
+ *
+ * This function asks the BFD protocol to run a session with the given
+ * neighbor and to report its state by calling the @hook from an event.
+ * The state is %BFD_STATE_ADMIN_DOWN as long as no BFD protocol is
+ * running. The request is cancelled by freeing it, which also happens
+ * when the @p pool is freed.
+ */
+struct bfd_request *
+bfd_request_session(pool *p, ip_addr addr, void (*hook)(struct bfd_request *), void *data)
+{
+  struct bfd_request *req = ralloc(p, &bfd_request_class);
+
+  req->addr = addr;
+  req->hook = hook;
+  req->data = data;
+  req->state = BFD_STATE_ADMIN_DOWN;
+  req->diag = BFD_DIAG_NOTHING;
+  add_tail(&bfd_wait_list, &req->n);
+
+  if (bfd_global)
+    bfd_attach_request(bfd_global, req);
+
+  return req;
+}
+
+
+/*
+ *	Sessions
+ */
+
+static inline struct bfd_session *
+bfd_find_session_by_id(struct bfd_proto *p, u32 id)
+{
+  struct bfd_session *s = p->id_hash[id & (BFD_ID_HASH_SIZE - 1)];
+
+  while (s && (s->loc_id != id))
+    s = s->next_id;
+  return s;
+}
+
+static u32
+bfd_alloc_id(struct bfd_proto *p)
+{
+  u32 id;
+
+  do
+    id = random_u32();
+  while (!id || bfd_find_session_by_id(p, id));
+  return id;
+}
+
+/* Transmission interval with jitter, RFC 5880 6.8.7 */
+static u64
+bfd_tx_interval(struct bfd_session *s)
+{
+  u64 ival = MAX(s->des_min_tx_int, s->rem_min_rx_int);
+  unsigned j = (s->detect_mult == 1) ? 10 + random_u32() % 16 : random_u32() % 26;
+
+  return ival - ival * j / 100;
+}
+
+static void
+bfd_schedule_tx(struct bfd_session *s)
+{
+  /* The neighbor doesn't want any packets */
+  if (!s->rem_min_rx_int)
+    {
+      ut_stop(s->tx_timer);
+      return;
+    }
+
+  ut_start(s->tx_timer, bfd_tx_interval(s));
+}
+
+static void
+bfd_tx_timer_hook(utimer *t)
+{
+  struct bfd_session *s = t->data;
+
+  bfd_send_ctl(s, 0);
+  bfd_schedule_tx(s);
+}
+
+static void
+bfd_session_update_state(struct bfd_session *s, u8 state, u8 diag);
+
+static void
+bfd_hold_timer_hook(utimer *t)
+{
+  struct bfd_session *s = t->data;
+  struct bfd_proto *p = s->bfd;
+
+  /*
+   * If there are packets waiting on the socket, the main loop has been
+   * stalled and they haven't been processed yet. Give them a chance
+   * before declaring the session down.
+   */
+  if (p->rx_sk && (sk_rx_ready(p->rx_sk) > 0))
+    {
+      ut_start(t, BFD_RX_RECHECK);
+      return;
+    }
+
+  TRACE(D_EVENTS, "Session to %I timed out", s->n.prefix);
+
+  /* Forget the neighbor, RFC 5880 6.8.1 */
+  s->rem_id = 0;
+  s->rem_state = BFD_STATE_DOWN;
+  s->rem_min_tx_int = 0;
+  s->rem_min_rx_int = 1;
+  s->rem_detect_mult = 0;
+
+  if (s->loc_state != BFD_STATE_DOWN)
+    bfd_session_update_state(s, BFD_STATE_DOWN, BFD_DIAG_TIMEOUT);
+  bfd_schedule_tx(s);
+}
+
+/* Finish the poll sequence, the new intervals are confirmed by the neighbor */
+static void
+bfd_session_poll_done(struct bfd_session *s)
+{
+  s->poll_active = 0;
+  s->des_min_tx_int = s->des_min_tx_new;
+  s->req_min_rx_int = s->req_min_rx_new;
+}
+
+static void
+bfd_session_poll(struct bfd_session *s)
+{
+  if (s->loc_state != BFD_STATE_UP)
+    {
+      bfd_session_poll_done(s);
+      return;
+    }
+
+  s->poll_active = 1;
+  bfd_send_ctl(s, 0);
+}
+
+static void
+bfd_session_set_min_tx(struct bfd_session *s, u32 val)
+{
+  if (val == s->des_min_tx_new)
+    return;
+
+  s->des_min_tx_new = val;
+
+  /* A decrease may be used at once, an increase only when confirmed */
+  if (val < s->des_min_tx_int)
+    s->des_min_tx_int = val;
+
+  bfd_session_poll(s);
+}
+
+static void
+bfd_session_set_min_rx(struct bfd_session *s, u32 val)
+{
+  if (val == s->req_min_rx_new)
+    return;
+
+  s->req_min_rx_new = val;
+
+  /* An increase may be used at once, a decrease only when confirmed */
+  if (val > s->req_min_rx_int)
+    s->req_min_rx_int = val;
+
+  bfd_session_poll(s);
+}
+
+static void
+bfd_session_update_state(struct bfd_session *s, u8 state, u8 diag)
+{
+  struct bfd_proto *p = s->bfd;
+  u8 old_state = s->loc_state;
+
+  if (state == old_state)
+    return;
+
+  TRACE(D_EVENTS, "Session to %I changed state from %s to %s%s%s",
+	s->n.prefix, bfd_state_names[old_state], bfd_state_names[state],
+	diag ? " - " : "", bfd_diag_names[diag]);
+
+  s->loc_state = state;
+  s->loc_diag = diag;
+  s->last_state_change = now;
+
+  if (state == BFD_STATE_UP)
+    bfd_session_set_min_tx(s, p->cf->min_tx_int);
+
+  if (old_state == BFD_STATE_UP)
+    bfd_session_set_min_tx(s, p->cf->idle_tx_int);
+
+  /* A session taken down on purpose by the neighbor is not a failure */
+  bfd_session_notify(s, s->rem_state != BFD_STATE_ADMIN_DOWN);
+}
+
+static void
+bfd_session_configure(struct bfd_proto *p, struct bfd_session *s)
+{
+  struct bfd_config *cf = p->cf;
+
+  s->detect_mult = cf->multiplier;
+  bfd_session_set_min_tx(s, (s->loc_state == BFD_STATE_UP) ? cf->min_tx_int : cf->idle_tx_int);
+  bfd_session_set_min_rx(s, cf->min_rx_int);
+}
+
+static struct bfd_session *
+bfd_get_session(struct bfd_proto *p, ip_addr addr)
+{
+  struct bfd_config *cf = p->cf;
+  struct bfd_session *s;
+  unsigned h;
+
+  if (s = fib_find(&p->sessions, &addr, BITS_PER_IP_ADDRESS))
+    return s;
+
+  s = fib_get(&p->sessions, &addr, BITS_PER_IP_ADDRESS);
+  s->bfd = p;
+  init_list(&s->requests);
+  s->configured = 0;
+
+  s->loc_id = bfd_alloc_id(p);
+  h = s->loc_id & (BFD_ID_HASH_SIZE - 1);
+  s->next_id = p->id_hash[h];
+  p->id_hash[h] = s;
+
+  s->loc_state = s->rem_state = BFD_STATE_DOWN;
+  s->loc_diag = s->rem_diag = BFD_DIAG_NOTHING;
+  s->rem_id = 0;
+  s->detect_mult = cf->multiplier;
+  s->rem_detect_mult = 0;
+  s->poll_active = 0;
+  s->des_min_tx_int = s->des_min_tx_new = cf->idle_tx_int;
+  s->req_min_rx_int = s->req_min_rx_new = cf->min_rx_int;
+  s->rem_min_tx_int = 0;
+  s->rem_min_rx_int = 1;
+  s->last_state_change = now;
+  s->rx_packets = s->tx_packets = 0;
+
+  s->tx_timer = ut_new(p->p.pool);
+  s->tx_timer->hook = bfd_tx_timer_hook;
+  s->tx_timer->data = s;
+  s->hold_timer = ut_new(p->p.pool);
+  s->hold_timer->hook = bfd_hold_timer_hook;
+  s->hold_timer->data = s;
+
+  /* Start with a short random delay, so that new sessions don't wait for the idle interval */
+  ut_start(s->tx_timer, random_u32() % 10000);
+
+  TRACE(D_EVENTS, "Session to %I added", addr);
+  return s;
+}
+
+/* Tell the neighbor the session is going down on purpose */
+static void
+bfd_session_admin_down(struct bfd_session *s)
+{
+  if (s->loc_state == BFD_STATE_ADMIN_DOWN)
+    return;
+
+  s->loc_state = BFD_STATE_ADMIN_DOWN;
+  s->loc_diag = BFD_DIAG_ADMIN_DOWN;
+  s->poll_active = 0;
+  if (s->rem_id)
+    bfd_send_ctl(s, 0);
+  ut_stop(s->tx_timer);
+  ut_stop(s->hold_timer);
+}
+
+static void
+bfd_remove_session(struct bfd_proto *p, struct bfd_session *s)
+{
+  struct bfd_session **sp = &p->id_hash[s->loc_id & (BFD_ID_HASH_SIZE - 1)];
+
+  TRACE(D_EVENTS, "Session to %I removed", s->n.prefix);
+
+  bfd_session_admin_down(s);
+  rfree(s->tx_timer);
+  rfree(s->hold_timer);
+
+  while (*sp != s)
+    sp = &(*sp)->next_id;
+  *sp = s->next_id;
+
+  fib_delete(&p->sessions, s);
+}
+
+
+/*
+ *	Packets
+ */
+
+static void
+bfd_send_ctl(struct bfd_session *s, int final)
+{
+  struct bfd_proto *p = s->bfd;
+  sock *sk = p->tx_sk;
+  struct bfd_ctl_packet *pkt = (struct bfd_ctl_packet *) sk->tbuf;
+
+  pkt->vdiag = (BFD_VERSION << 5) | s->loc_diag;
+  pkt->flags = s->loc_state << 6;
+  if (final)
+    pkt->flags |= BFD_FLAG_FINAL;
+  else if (s->poll_active)
+    pkt->flags |= BFD_FLAG_POLL;
+  pkt->detect_mult = s->detect_mult;
+  pkt->length = BFD_BASE_LEN;
+  pkt->snd_id = htonl(s->loc_id);
+  pkt->rcv_id = htonl(s->rem_id);
+  pkt->des_min_tx_int = htonl(s->des_min_tx_new);
+  pkt->req_min_rx_int = htonl(s->req_min_rx_new);
+  pkt->req_min_echo_rx_int = 0;
+
+  if (p->p.debug & D_PACKETS)
+    log(L_TRACE "%s: Sending %s to %I%s", p->p.name, bfd_state_names[s->loc_state], s->n.prefix,
+	(pkt->flags & BFD_FLAG_POLL) ? " (poll)" : (pkt->flags & BFD_FLAG_FINAL) ? " (final)" : "");
+
+  sk_send_to(sk, BFD_BASE_LEN, s->n.prefix, BFD_CONTROL_PORT);
+  s->tx_packets++;
+}
+
+/* State machine, RFC 5880 6.8.6 */
+static void
+bfd_session_process_state(struct bfd_session *s, u8 rem_state)
+{
+  u8 next = s->loc_state, diag = BFD_DIAG_NOTHING;
+
+  if (rem_state == BFD_STATE_ADMIN_DOWN)
+    {
+      next = BFD_STATE_DOWN;
+      diag = BFD_DIAG_NEIGHBOR_DOWN;
+    }
+  else switch (s->loc_state)
+    {
+    case BFD_STATE_DOWN:
+      if (rem_state == BFD_STATE_DOWN)
+	next = BFD_STATE_INIT;
+      else if (rem_state == BFD_STATE_INIT)
+	next = BFD_STATE_UP;
+      break;
+
+    case BFD_STATE_INIT:
+      if (rem_state != BFD_STATE_DOWN)
+	next = BFD_STATE_UP;
+      break;
+
+    case BFD_STATE_UP:
+      if (rem_state == BFD_STATE_DOWN)
+	{
+	  next = BFD_STATE_DOWN;
+	  diag = BFD_DIAG_NEIGHBOR_DOWN;
+	}
+      break;
+    }
+
+  bfd_session_update_state(s, next, diag);
+}
+
+#define DROP(dsc, val) do { err = dsc; err_val = val; goto drop; } while(0)
+
+static int
+bfd_rx_hook(sock *sk, int len)
+{
+  struct bfd_proto *p = sk->data;
+  struct bfd_ctl_packet *pkt = (struct bfd_ctl_packet *) sk->rbuf;
+  struct bfd_session *s;
+  char *err;
+  u32 err_val, id, your_id, old_tx_int;
+  u8 ps;
+
+  /* Single hop sessions are protected by GTSM, RFC 5881 5 */
+  if ((sk->rcv_ttl >= 0) && (sk->rcv_ttl != 255))
+    DROP("wrong TTL", sk->rcv_ttl);
+
+  if (len < (int) BFD_BASE_LEN)
+    DROP("too short", len);
+
+  if (bfd_pkt_get_version(pkt) != BFD_VERSION)
+    DROP("version mismatch", bfd_pkt_get_version(pkt));
+
+  if ((pkt->length < BFD_BASE_LEN) || (pkt->length > len))
+    DROP("length mismatch", pkt->length);
+
+  if (!pkt->detect_mult)
+    DROP("invalid detect mult", 0);
+
+  if (pkt->flags & BFD_FLAG_MULTIPOINT)
+    DROP("invalid multipoint flag", 0);
+
+  if (!(id = ntohl(pkt->snd_id)))
+    DROP("invalid my discriminator", 0);
+
+  ps = bfd_pkt_get_state(pkt);
+  if (your_id = ntohl(pkt->rcv_id))
+    {
+      if (!(s = bfd_find_session_by_id(p, your_id)))
+	DROP("unknown session id", your_id);
+    }
+  else
+    {
+      if (ps > BFD_STATE_DOWN)
+	DROP("invalid init state", ps);
+
+      if (!(s = fib_find(&p->sessions, &sk->faddr, BITS_PER_IP_ADDRESS)))
+	DROP("unknown session", 0);
+    }
+
+  if (pkt->flags & BFD_FLAG_AP)
+    DROP("authentication not supported", 0);
+
+  if (s->loc_state == BFD_STATE_ADMIN_DOWN)
+    return 1;
+
+  if (p->p.debug & D_PACKETS)
+    log(L_TRACE "%s: Received %s from %I%s", p->p.name, bfd_state_names[ps], sk->faddr,
+	(pkt->flags & BFD_FLAG_POLL) ? " (poll)" : (pkt->flags & BFD_FLAG_FINAL) ? " (final)" : "");
+
+  old_tx_int = MAX(s->des_min_tx_int, s->rem_min_rx_int);
+
+  s->rem_id = id;
+  s->rem_state = ps;
+  s->rem_diag = bfd_pkt_get_diag(pkt);
+  s->rem_detect_mult = pkt->detect_mult;
+  s->rem_min_tx_int = ntohl(pkt->des_min_tx_int);
+  s->rem_min_rx_int = ntohl(pkt->req_min_rx_int);
+  s->rx_packets++;
+
+  if ((pkt->flags & BFD_FLAG_FINAL) && s->poll_active)
+    bfd_session_poll_done(s);
+
+  bfd_session_process_state(s, ps);
+
+  /* The response to a poll must not wait for the periodic transmission */
+  if (pkt->flags & BFD_FLAG_POLL)
+    bfd_send_ctl(s, 1);
+
+  /* Don't wait for the old interval when the new one is shorter */
+  if ((MAX(s->des_min_tx_int, s->rem_min_rx_int) < old_tx_int) || !s->tx_timer->expires)
+    bfd_schedule_tx(s);
+
+  /* Detection time, RFC 5880 6.8.4 */
+  ut_start(s->hold_timer, (u64) s->rem_detect_mult * MAX(s->req_min_rx_int, s->rem_min_tx_int));
+  return 1;
+
+drop:
+  log_rl(&p->rl_rx, L_REMOTE "%s: Bad packet from %I - %s (%u)", p->p.name, sk->faddr, err, err_val);
+  return 1;
+}
+
+static void
+bfd_err_hook(sock *sk, int err)
+{
+  struct bfd_proto *p = sk->data;
+
+  log(L_ERR "%s: Socket error: %M", p->p.name, err);
+}
+
+static sock *
+bfd_open_rx_sk(struct bfd_proto *p)
+{
+  sock *sk = sk_new(p->p.pool);
+
+  sk->type = SK_UDP;
+  sk->sport = BFD_CONTROL_PORT;
+  sk->flags = SKF_TTL_RX;
+  sk->data = p;
+  sk->rbsize = 1024;
+  sk->rx_hook = bfd_rx_hook;
+  sk->err_hook = bfd_err_hook;
+
+  if (sk_open(sk) < 0)
+    {
+      rfree(sk);
+      return NULL;
+    }
+  return sk;
+}
+
+static sock *
+bfd_open_tx_sk(struct bfd_proto *p)
+{
+  sock *sk = sk_new(p->p.pool);
+
+  sk->type = SK_UDP;
+  /* Source port must be in the dynamic range, RFC 5881 4 */
+  sk->sport = BFD_SOURCE_PORT_MIN + random_u32() % (65536 - BFD_SOURCE_PORT_MIN);
+  sk->ttl = 255;
+  sk->data = p;
+  sk->tbsize = 1024;
+  sk->err_hook = bfd_err_hook;
+
+  if (sk_open(sk) < 0)
+    {
+      rfree(sk);
+      return NULL;
+    }
+  return sk;
+}
+
+
+/*
+ *	Protocol glue
+ */
+
+static void
+bfd_preconfig(struct protocol *P UNUSED, struct config *c UNUSED)
+{
+  if (bfd_notify_event)
+    return;
+
+  init_list(&bfd_wait_list);
+  init_list(&bfd_notify_list);
+  bfd_notify_event = ev_new(&root_pool);
+  bfd_notify_event->hook = bfd_notify_run;
+}
+
+static struct proto *
+bfd_init(struct proto_config *C)
+{
+  return proto_new(C, sizeof(struct bfd_proto));
+}
+
+static int
+bfd_start(struct proto *P)
+{
+  struct bfd_proto *p = (struct bfd_proto *) P;
+  struct bfd_neighbor *nb;
+  node *n, *nxt;
+
+  p->cf = (struct bfd_config *) P->cf;
+  fib_init(&p->sessions, P->pool, sizeof(struct bfd_session), 0, NULL);
+  bzero(p->id_hash, sizeof(p->id_hash));
+  bzero(&p->rl_rx, sizeof(p->rl_rx));
+
+  if (!(p->rx_sk = bfd_open_rx_sk(p)) || !(p->tx_sk = bfd_open_tx_sk(p)))
+    {
+      /* Stay up, so that a reconfiguration restarts us */
+      log(L_ERR "%s: Cannot open sockets, sessions disabled", P->name);
+      return PS_UP;
+    }
+
+  bfd_global = p;
+
+  WALK_LIST(nb, p->cf->neighbors)
+    bfd_get_session(p, nb->addr)->configured = 1;
+
+  WALK_LIST_DELSAFE(n, nxt, bfd_wait_list)
+    bfd_attach_request(p, SKIP_BACK(struct bfd_request, n, n));
+
+  return PS_UP;
+}
+
+static int
+bfd_shutdown(struct proto *P)
+{
+  struct bfd_proto *p = (struct bfd_proto *) P;
+  struct bfd_request *req;
+  node *n, *nxt;
+
+  if (bfd_global != p)
+    return PS_DOWN;
+
+  /* Sessions are freed with the pool, requests wait for the next BFD protocol */
+  FIB_WALK(&p->sessions, f)
+    {
+      struct bfd_session *s = (struct bfd_session *) f;
+
+      bfd_session_admin_down(s);
+      WALK_LIST_DELSAFE(n, nxt, s->requests)
+	{
+	  req = SKIP_BACK(struct bfd_request, n, n);
+	  rem_node(&req->n);
+	  add_tail(&bfd_wait_list, &req->n);
+	  req->session = NULL;
+	  bfd_request_notify(req, BFD_STATE_ADMIN_DOWN, BFD_DIAG_ADMIN_DOWN, 0);
+	}
+    }
+  FIB_WALK_END;
+
+  rfree(p->rx_sk);
+  rfree(p->tx_sk);
+  p->rx_sk = p->tx_sk = NULL;
+  bfd_global = NULL;
+  return PS_DOWN;
+}
+
+static int
+bfd_reconfigure(struct proto *P, struct proto_config *C)
+{
+  struct bfd_proto *p = (struct bfd_proto *) P;
+  struct bfd_config *new = (struct bfd_config *) C;
+  struct bfd_session *gc = NULL, *s;
+  struct bfd_neighbor *nb;
+
+  if (bfd_global != p)
+    return 0;
+
+  p->cf = new;
+
+  FIB_WALK(&p->sessions, f)
+    ((struct bfd_session *) f)->configured = 0;
+  FIB_WALK_END;
+
+  WALK_LIST(nb, new->neighbors)
+    bfd_get_session(p, nb->addr)->configured = 1;
+
+  FIB_WALK(&p->sessions, f)
+    {
+      s = (struct bfd_session *) f;
+      if (!s->configured && EMPTY_LIST(s->requests))
+	{
+	  s->next_gc = gc;
+	  gc = s;
+	}
+      else
+	{
+	  bfd_session_configure(p, s);
+	  bfd_schedule_tx(s);
+	}
+    }
+  FIB_WALK_END;
+
+  while (s = gc)
+    {
+      gc = s->next_gc;
+      bfd_remove_session(p, s);
+    }
+
+  return 1;
+}
+
+static void
+bfd_get_status(struct proto *P, byte *buf)
+{
+  struct bfd_proto *p = (struct bfd_proto *) P;
+  unsigned up = 0;
+
+  if (P->proto_state != PS_UP)
+    return;
+
+  FIB_WALK(&p->sessions, f)
+    if (((struct bfd_session *) f)->loc_state == BFD_STATE_UP)
+      up++;
+  FIB_WALK_END;
+
+  bsprintf(buf, "%u of %u sessions up", up, p->sessions.entries);
+}
+
+struct protocol proto_bfd = {
+  name:		"BFD",
+  template:	"bfd%d",
+  preconfig:	bfd_preconfig,
+  init:		bfd_init,
+  start:	bfd_start,
+  shutdown:	bfd_shutdown,
+  reconfigure:	bfd_reconfigure,
+  get_status:	bfd_get_status,
+};
+
+void
+bfd_show_sessions(struct proto *P)
+{
+  struct bfd_proto *p = (struct bfd_proto *) P;
+  byte tbuf[TM_DATETIME_BUFFER_SIZE];
+  struct bfd_session *s;
+
+  if (P->proto_state != PS_UP)
+    {
+      cli_msg(-1026, "%s: not running", P->name);
+      cli_msg(0, "");
+      return;
+    }
+
+  cli_msg(-1026, "%s:", P->name);
+  cli_msg(-1026, "%-*s %-10s %-10s %8s %8s %12s  %s", STD_ADDRESS_P_LENGTH, "Neighbor", "State", "Since",
+	  "TX [ms]", "RX [ms]", "Detect [ms]", "Info");
+  FIB_WALK(&p->sessions, f)
+    {
+      s = (struct bfd_session *) f;
+      tm_format_datetime(tbuf, &config->tf_proto, s->last_state_change);
+      cli_msg(-1026, "%-*I %-10s %-10s %8u %8u %12u  %s%s%s",
+	      STD_ADDRESS_P_LENGTH, s->n.prefix, bfd_state_names[s->loc_state], tbuf,
+	      MAX(s->des_min_tx_int, s->rem_min_rx_int) / 1000,
+	      MAX(s->req_min_rx_int, s->rem_min_tx_int) / 1000,
+	      s->rem_detect_mult * MAX(s->req_min_rx_int, s->rem_min_tx_int) / 1000,
+	      bfd_diag_names[s->loc_diag],
+	      (s->loc_diag && s->rem_diag) ? ", remote " : (s->rem_diag ? "remote " : ""),
+	      s->rem_diag ? bfd_diag_names[s->rem_diag] : "");
+    }
+  FIB_WALK_END;
+  cli_msg(0, "");
+}
@@ -0,0 +1,149 @@
+/*
+ *	BIRD -- Bidirectional Forwarding Detection (BFD)
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_BFD_H_
+#define _BIRD_BFD_H_
+
+#define BFD_STATE_ADMIN_DOWN	0
+#define BFD_STATE_DOWN		1
+#define BFD_STATE_INIT		2
+#define BFD_STATE_UP		3
+
+#define BFD_DIAG_NOTHING	0
+#define BFD_DIAG_TIMEOUT	1
+#define BFD_DIAG_ECHO_FAILED	2
+#define BFD_DIAG_NEIGHBOR_DOWN	3
+#define BFD_DIAG_FWD_RESET	4
+#define BFD_DIAG_PATH_DOWN	5
+#define BFD_DIAG_C_PATH_DOWN	6
+#define BFD_DIAG_ADMIN_DOWN	7
+#define BFD_DIAG_RC_PATH_DOWN	8
+
+struct bfd_session;
+
+/*
+ * A request of another protocol to watch the liveness of a neighbor.
+ * It's allocated from the pool of the requesting protocol, so it goes
+ * away together with the protocol. The hook is called from an event
+ * whenever the state of the session changes.
+ */
+struct bfd_request {
+  resource r;
+  node n;				/* Node in the session or in the list of waiting requests */
+  node notify_n;			/* Node in the list of requests to be notified */
+  ip_addr addr;				/* Neighbor address */
+  void (*hook)(struct bfd_request *);
+  void *data;
+  struct bfd_session *session;		/* NULL if no BFD protocol is running */
+  u8 state;				/* Session state (BFD_STATE_*) */
+  u8 diag;				/* Diagnostic code of the last state change (BFD_DIAG_*) */
+  u8 down;				/* The session has failed since the last notification */
+};
+
+#ifdef CONFIG_BFD
+
+struct bfd_request *bfd_request_session(pool *p, ip_addr addr, void (*hook)(struct bfd_request *), void *data);
+static inline void cf_check_bfd(int use UNUSED) { }
+
+#else
+
+static inline struct bfd_request *
+bfd_request_session(pool *p UNUSED, ip_addr addr UNUSED, void (*hook)(struct bfd_request *) UNUSED, void *data UNUSED)
+{ return NULL; }
+
+static inline void cf_check_bfd(int use) { if (use) cf_error("BFD not available"); }
+
+#endif
+
+#define BFD_CONTROL_PORT	3784
+#define BFD_SOURCE_PORT_MIN	49152
+#define BFD_VERSION		1
+
+#define BFD_DEFAULT_MIN_RX_INT	10000		/* 10 ms */
+#define BFD_DEFAULT_MIN_TX_INT	100000		/* 100 ms */
+#define BFD_DEFAULT_IDLE_TX_INT	1000000		/* 1 s, RFC 5880 6.8.3 requires at least that */
+#define BFD_DEFAULT_MULTIPLIER	5
+#define BFD_RX_RECHECK		1000		/* 1 ms, hold timer delay when packets are waiting */
+
+#define BFD_ID_HASH_ORDER	8
+#define BFD_ID_HASH_SIZE	(1 << BFD_ID_HASH_ORDER)
+
+struct bfd_neighbor {
+  node n;
+  ip_addr addr;
+};
+
+struct bfd_config {
+  struct proto_config c;
+  list neighbors;			/* Statically configured sessions (struct bfd_neighbor) */
+  u32 min_rx_int;			/* Required min RX interval [us] */
+  u32 min_tx_int;			/* Desired min TX interval when up [us] */
+  u32 idle_tx_int;			/* Desired min TX interval when not up [us] */
+  u32 multiplier;
+};
+
+struct bfd_session {
+  struct fib_node n;			/* Keyed by the neighbor address */
+  struct bfd_proto *bfd;
+  struct bfd_session *next_id;		/* Next in the hash of local discriminators */
+  struct bfd_session *next_gc;		/* Next in the list of sessions to be removed */
+  list requests;			/* Requests watching this session (struct bfd_request) */
+  int configured;			/* Listed as a neighbor in the configuration */
+
+  u32 loc_id, rem_id;			/* Local and remote discriminators */
+  u8 loc_state, rem_state;
+  u8 loc_diag, rem_diag;
+  u8 detect_mult, rem_detect_mult;
+  u8 poll_active;			/* Poll sequence in progress, new intervals not confirmed yet */
+
+  u32 des_min_tx_int, des_min_tx_new;	/* Desired min TX interval, in use and advertised [us] */
+  u32 req_min_rx_int, req_min_rx_new;	/* Required min RX interval, in use and advertised [us] */
+  u32 rem_min_tx_int, rem_min_rx_int;	/* Intervals advertised by the neighbor [us] */
+
+  utimer *tx_timer;			/* Periodic transmission */
+  utimer *hold_timer;			/* Detection time */
+  bird_clock_t last_state_change;
+  u32 rx_packets, tx_packets;
+};
+
+struct bfd_proto {
+  struct proto p;
+  struct bfd_config *cf;		/* Shortcut to BFD configuration */
+  struct fib sessions;			/* Sessions by neighbor address (struct bfd_session) */
+  struct bfd_session *id_hash[BFD_ID_HASH_SIZE];	/* Sessions by local discriminator */
+  struct birdsock *rx_sk, *tx_sk;
+  struct rate_limit rl_rx;		/* Rate limit for logging of bad packets */
+};
+
+/* Control packet, RFC 5880 4.1 */
+struct bfd_ctl_packet {
+  u8 vdiag;				/* Version and diagnostic */
+  u8 flags;				/* State and flags */
+  u8 detect_mult;
+  u8 length;
+  u32 snd_id;				/* Sender ID, My Discriminator */
+  u32 rcv_id;				/* Receiver ID, Your Discriminator */
+  u32 des_min_tx_int;
+  u32 req_min_rx_int;
+  u32 req_min_echo_rx_int;
+};
+
+#define BFD_BASE_LEN		sizeof(struct bfd_ctl_packet)
+
+#define BFD_FLAG_POLL		(1 << 5)
+#define BFD_FLAG_FINAL		(1 << 4)
+#define BFD_FLAG_CPI		(1 << 3)
+#define BFD_FLAG_AP		(1 << 2)
+#define BFD_FLAG_DEMAND		(1 << 1)
+#define BFD_FLAG_MULTIPOINT	(1 << 0)
+
+static inline u8 bfd_pkt_get_version(struct bfd_ctl_packet *pkt) { return pkt->vdiag >> 5; }
+static inline u8 bfd_pkt_get_diag(struct bfd_ctl_packet *pkt) { return pkt->vdiag & 0x1f; }
+static inline u8 bfd_pkt_get_state(struct bfd_ctl_packet *pkt) { return pkt->flags >> 6; }
+
+void bfd_show_sessions(struct proto *P);
+
+#endif
@@ -15,6 +15,7 @@
 #include "nest/protocol.h"
 #include "nest/route.h"
 #include "nest/attrs.h"
+#include "nest/latency.h"
 #include "conf/conf.h"
 #include "lib/resource.h"
 #include "lib/string.h"
@@ -560,6 +561,49 @@ bgp_encode_attrs(struct bgp_proto *p, byte *w, ea_list *attrs, int remains)
   return -1;
 }
 
+/**
+ * bgp_encode_route_attrs - encode BGP attributes of a stored route
+ * @p: BGP instance the route has been received from
+ * @w: buffer
+ * @attrs: attributes of the route (possibly a chain of lists)
+ * @remains: remaining space in the buffer
+ *
+ * This function encodes the BGP attributes of a route as they are stored
+ * in the routing table. Unlike the export path, it doesn't add or drop
+ * any attributes according to the session type, it only skips attributes
+ * of other protocols and fixes the flags of attributes set by filters.
+ *
+ * Result: Length of the attribute block generated or -1 if not enough space.
+ */
+int
+bgp_encode_route_attrs(struct bgp_proto *p, byte *w, ea_list *attrs, int remains)
+{
+  ea_list *new;
+  unsigned i, cnt, code;
+  eattr *a, *d;
+
+  new = alloca(ea_scan(attrs));
+  ea_merge(attrs, new);
+  ea_sort(new);
+
+  d = new->attrs;
+  cnt = new->count;
+  new->count = 0;
+  for(i=0; i<cnt; i++)
+    {
+      a = &new->attrs[i];
+      if (EA_PROTO(a->id) != EAP_BGP)
+	continue;
+      code = EA_ID(a->id);
+      if (ATTR_KNOWN(code))
+	a->flags = (a->flags & BAF_PARTIAL) | bgp_attr_table[code].expected_flags;
+      *d++ = *a;
+      new->count++;
+    }
+
+  return bgp_encode_attrs(p, w, new, remains);
+}
+
 static void
 bgp_init_prefix(struct fib_node *N)
 {
@@ -639,6 +683,7 @@ bgp_new_bucket(struct bgp_proto *p, ea_list *new, unsigned hash)
   b->hash = hash;
   add_tail(&p->bucket_queue, &b->send_node);
   init_list(&b->prefixes);
+  b->lat_hist = NULL;
   memcpy(b->eattrs, new, ea_size);
   dest = ((byte *)b->eattrs) + ea_size_aligned;
 
@@ -792,8 +837,14 @@ bgp_rt_notify(struct proto *P, rtable *tbl UNUSED, net *n, rte *new, rte *old UN
 	{
 	  buck = p->withdraw_bucket = mb_alloc(P->pool, sizeof(struct bgp_bucket));
 	  init_list(&buck->prefixes);
+	  buck->lat_hist = NULL;
 	}
     }
+  if (latency_origin && !buck->lat_hist)
+    {
+      buck->lat_hist = latency_get(LAT_TX, P->name);
+      buck->lat_start = latency_origin;
+    }
   px = fib_get(&p->prefix_fib, &n->n.prefix, n->n.pxlen);
   if (px->bucket_node.next)
     {
@@ -932,6 +983,27 @@ bgp_update_attrs(struct bgp_proto *p, rte *e, ea_list **attrs, struct linpool *p
   return 0;				/* Leave decision to the filters */
 }
 
+/* Aggregates bring their merged ORIGIN, AS_PATH and ATOMIC_AGGR, we keep them */
+static int
+bgp_aggregate_attrs(struct bgp_proto *p, rte *e, ea_list **attrs, struct linpool *pool)
+{
+  byte *z;
+
+  if (!p->is_internal && !p->rs_client)
+    bgp_path_prepend(e, attrs, pool, p->local_as);
+
+  z = bgp_attach_attr_wa(attrs, pool, BA_NEXT_HOP, NEXT_HOP_LENGTH);
+  set_next_hop(z, p->source_addr);
+
+  z = bgp_attach_attr_wa(attrs, pool, BA_AGGREGATOR, 8);
+  put_u32(z, p->local_as);
+  put_u32(z+4, p->local_id);
+
+  bgp_attach_attr(attrs, pool, BA_LOCAL_PREF, p->cf->default_local_pref);
+
+  return 0;				/* Leave decision to the filters */
+}
+
 static int
 bgp_community_filter(struct bgp_proto *p, rte *e)
 {
@@ -991,6 +1063,10 @@ bgp_import_control(struct proto *P, rte **new, ea_list **attrs, struct linpool *
       else
 	return bgp_update_attrs(p, e, attrs, pool, 0);
     }
+  else if ((e->attrs->source == RTS_AGGREGATE) &&
+	   ea_find(e->attrs->eattrs, EA_CODE(EAP_BGP, BA_ORIGIN)) &&
+	   ea_find(e->attrs->eattrs, EA_CODE(EAP_BGP, BA_AS_PATH)))
+    return bgp_aggregate_attrs(p, e, attrs, pool);
   else
     return bgp_create_attrs(p, e, attrs, pool);
 }
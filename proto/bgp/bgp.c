@@ -65,8 +65,14 @@
 #include "lib/resource.h"
 #include "lib/string.h"
 
+#include "proto/bfd/bfd.h"
+
 #include "bgp.h"
 
+#ifdef CONFIG_BMP
+#include "proto/bmp/bmp.h"
+#endif
+
 struct linpool *bgp_linpool;		/* Global temporary pool */
 static sock *bgp_listen_sk;		/* Global listening socket */
 static int bgp_counter;			/* Number of protocol instances using the listening socket */
@@ -217,6 +223,13 @@ bgp_close_conn(struct bgp_conn *conn)
   conn->sk = NULL;
   rfree(conn->tx_ev);
   conn->tx_ev = NULL;
+#ifdef CONFIG_BMP
+  if (conn->local_open_msg)
+    mb_free(conn->local_open_msg);
+  if (conn->remote_open_msg)
+    mb_free(conn->remote_open_msg);
+  conn->local_open_msg = conn->remote_open_msg = NULL;
+#endif
 }
 
 
@@ -342,6 +355,9 @@ bgp_conn_enter_established_state(struct bgp_conn *conn)
   p->last_error_code = 0;
   bgp_attr_init(conn->bgp);
   bgp_conn_set_state(conn, BS_ESTABLISHED);
+#ifdef CONFIG_BMP
+  bmp_peer_up(p);
+#endif
   proto_notify_state(&p->p, PS_UP);
 }
 
@@ -349,6 +365,9 @@ static void
 bgp_conn_leave_established_state(struct bgp_proto *p)
 {
   BGP_TRACE(D_EVENTS, "BGP session closed");
+#ifdef CONFIG_BMP
+  bmp_peer_down(p);
+#endif
   p->conn = NULL;
 
   if (p->p.proto_state == PS_UP)
@@ -705,6 +724,19 @@ bgp_neigh_notify(neighbor *n)
     }
 }
 
+static void
+bgp_bfd_notify(struct bfd_request *req)
+{
+  struct bgp_proto *p = req->data;
+
+  if (req->down && ((p->p.proto_state == PS_START) || (p->p.proto_state == PS_UP)))
+    {
+      BGP_TRACE(D_EVENTS, "BFD session down");
+      bgp_store_error(p, NULL, BE_MISC, BEM_BFD_DOWN);
+      bgp_stop(p, 0);
+    }
+}
+
 static int
 bgp_reload_routes(struct proto *P)
 {
@@ -773,6 +805,7 @@ bgp_start(struct proto *P)
   p->outgoing_conn.state = BS_IDLE;
   p->incoming_conn.state = BS_IDLE;
   p->neigh = NULL;
+  p->bfd_req = NULL;
 
   p->event = ev_new(p->p.pool);
   p->event->hook = bgp_decision;
@@ -797,6 +830,9 @@ bgp_start(struct proto *P)
   lock->data = p;
   olock_acquire(lock);
 
+  if (p->cf->bfd)
+    p->bfd_req = bfd_request_session(p->p.pool, p->cf->remote_ip, bgp_bfd_notify, p);
+
   return PS_START;
 }
 
@@ -867,12 +903,14 @@ bgp_error(struct bgp_conn *c, unsigned code, unsigned subcode, byte *data, int l
 
   bgp_log_error(p, BE_BGP_TX, "Error", code, subcode, data, (len > 0) ? len : -len);
   bgp_store_error(p, c, BE_BGP_TX, (code << 16) | subcode);
-  bgp_conn_enter_close_state(c);
 
+  /* Set before leaving the established state, so that it can be reported */
   c->notify_code = code;
   c->notify_subcode = subcode;
   c->notify_data = data;
   c->notify_size = (len > 0) ? len : 0;
+
+  bgp_conn_enter_close_state(c);
   bgp_schedule_packet(c, PKT_NOTIFICATION);
 
   if (code != 6)
@@ -927,6 +965,11 @@ bgp_check(struct bgp_config *c)
   if ((c->local_as == c->remote_as) && (c->rs_client))
     cf_error("Only external neighbor can be RS client");
 
+  cf_check_bfd(c->bfd);
+
+  if (c->bfd && c->multihop)
+    cf_error("BFD is not supported for multihop sessions");
+
   /* Different default based on rs_client */
   if (c->missing_lladdr == 0)
     c->missing_lladdr = c->rs_client ? MLL_DROP : MLL_SELF;
@@ -934,7 +977,7 @@ bgp_check(struct bgp_config *c)
 
 static char *bgp_state_names[] = { "Idle", "Connect", "Active", "OpenSent", "OpenConfirm", "Established", "Close" };
 static char *bgp_err_classes[] = { "", "Error: ", "Socket: ", "Received: ", "BGP Error: ", "Automatic shutdown: ", ""};
-static char *bgp_misc_errors[] = { "", "Neighbor lost", "Invalid next hop", "Kernel MD5 auth failed" };
+static char *bgp_misc_errors[] = { "", "Neighbor lost", "Invalid next hop", "Kernel MD5 auth failed", "BFD session down" };
 static char *bgp_auto_errors[] = { "", "Route limit exceeded"};
 
 
@@ -993,6 +1036,14 @@ bgp_reconfigure(struct proto *P, struct proto_config *C)
   return same;
 }
 
+static void
+bgp_adopt(struct proto *P, struct proto_config *C)
+{
+  struct bgp_proto *p = (struct bgp_proto *) P;
+
+  p->cf = (struct bgp_config *) C;
+}
+
 struct protocol proto_bgp = {
   name:			"BGP",
   template:		"bgp%d",
@@ -1003,5 +1054,6 @@ struct protocol proto_bgp = {
   get_status:		bgp_get_status,
   get_attr:		bgp_get_attr,
   reconfigure:		bgp_reconfigure,
+  adopt:		bgp_adopt,
   get_route_info:	bgp_get_route_info,
 };
@@ -38,6 +38,7 @@ struct bgp_config {
   u32 route_limit;			/* Number of routes that may be imported, 0 means disable limit */
   int passive;				/* Do not initiate outgoing connection */
   int interpret_communities;		/* Hardwired handling of well-known communities */
+  int bfd;				/* Use BFD to detect a failure of the neighbor */
   unsigned connect_retry_time;
   unsigned hold_time, initial_hold_time;
   unsigned keepalive_time;
@@ -71,6 +72,10 @@ struct bgp_conn {
   int peer_as4_support;			/* Peer supports 4B AS numbers [RFC4893] */
   int peer_refresh_support;		/* Peer supports route refresh [RFC2918] */
   unsigned hold_time, keepalive_time;	/* Times calculated from my and neighbor's requirements */
+#ifdef CONFIG_BMP
+  byte *local_open_msg, *remote_open_msg; /* Copies of OPEN messages for monitoring stations */
+  unsigned local_open_length, remote_open_length;
+#endif
 };
 
 struct bgp_proto {
@@ -91,6 +96,7 @@ struct bgp_proto {
   struct object_lock *lock;		/* Lock for neighbor connection */
   ip_addr next_hop;			/* Either the peer or multihop_via */
   struct neighbor *neigh;		/* Neighbor entry corresponding to next_hop */
+  struct bfd_request *bfd_req;		/* BFD session watching the neighbor */
   ip_addr local_addr;			/* Address of the local end of the link to next_hop */
   ip_addr source_addr;			/* Address used as advertised next hop, usually local_addr */
   struct event *event;			/* Event for respawning and shutting process */
@@ -122,6 +128,8 @@ struct bgp_bucket {
   struct bgp_bucket *hash_next, *hash_prev;	/* Node in bucket hash table */
   unsigned hash;			/* Hash over extended attributes */
   list prefixes;			/* Prefixes in this buckets */
+  struct latency_hist *lat_hist;	/* Traced latency of sending the bucket, see nest/latency.c */
+  u64 lat_start;
   ea_list eattrs[0];			/* Per-bucket extended attributes */
 };
 
@@ -184,6 +192,7 @@ void bgp_rt_notify(struct proto *P, rtable *tbl UNUSED, net *n, rte *new, rte *o
 int bgp_import_control(struct proto *, struct rte **, struct ea_list **, struct linpool *);
 void bgp_attr_init(struct bgp_proto *);
 unsigned int bgp_encode_attrs(struct bgp_proto *p, byte *w, ea_list *attrs, int remains);
+int bgp_encode_route_attrs(struct bgp_proto *p, byte *w, ea_list *attrs, int remains);
 void bgp_free_bucket(struct bgp_proto *p, struct bgp_bucket *buck);
 void bgp_get_route_info(struct rte *, byte *buf, struct ea_list *attrs);
 
@@ -199,6 +208,7 @@ void bgp_tx(struct birdsock *sk);
 int bgp_rx(struct birdsock *sk, int size);
 const byte * bgp_error_dsc(byte *buff, unsigned code, unsigned subcode);
 void bgp_log_error(struct bgp_proto *p, u8 class, char *msg, unsigned code, unsigned subcode, byte *data, unsigned len);
+byte *bgp_create_single_update(struct bgp_proto *p, byte *buf, net *n, ea_list *attrs, struct linpool *pool);
 
 /* Packet types */
 
@@ -276,6 +286,7 @@ void bgp_log_error(struct bgp_proto *p, u8 class, char *msg, unsigned code, unsi
 #define BEM_NEIGHBOR_LOST	1
 #define BEM_INVALID_NEXT_HOP	2
 #define BEM_INVALID_MD5		3	/* MD5 authentication kernel request failed (possibly not supported) */
+#define BEM_BFD_DOWN		4	/* BFD session to the neighbor went down */
 
 /* Automatic shutdown error codes */
 
@@ -14,6 +14,9 @@
 #include "nest/route.h"
 #include "nest/attrs.h"
 #include "nest/mrtdump.h"
+#include "nest/latency.h"
+#include "nest/trace.h"
+#include "lib/probe.h"
 #include "conf/conf.h"
 #include "lib/unaligned.h"
 #include "lib/socket.h"
@@ -22,6 +25,10 @@
 
 #include "bgp.h"
 
+#ifdef CONFIG_BMP
+#include "proto/bmp/bmp.h"
+#endif
+
 static struct rate_limit rl_rcv_update,  rl_snd_update;
 
 /*
@@ -67,6 +74,16 @@ mrt_put_bgp4_hdr(byte *buf, struct bgp_conn *conn, int as4)
   return buf;
 }
 
+static char *bgp_packet_names[] = { "???", "OPEN", "UPDATE", "NOTIFICATION", "KEEPALIVE", "ROUTE-REFRESH" };
+
+static void
+bgp_trace_packet(struct bgp_proto *p, int dir, byte *pkt, unsigned len)
+{
+  unsigned type = pkt[18];
+
+  trace_packet(&p->p, dir, type, len, (type <= PKT_ROUTE_REFRESH) ? bgp_packet_names[type] : bgp_packet_names[0]);
+}
+
 static void
 mrt_dump_bgp_packet(struct bgp_conn *conn, byte *pkt, unsigned len)
 {
@@ -101,6 +118,18 @@ mrt_dump_bgp_state_change(struct bgp_conn *conn, unsigned old, unsigned new)
   mrt_dump_message(&conn->bgp->p, BGP4MP, BGP4MP_STATE_CHANGE_AS4, buf, bp-buf);
 }
 
+#ifdef CONFIG_BMP
+static void
+bgp_save_open(struct bgp_conn *conn, byte **msg, unsigned *length, byte *pkt, unsigned len)
+{
+  if (*msg)
+    mb_free(*msg);
+  *msg = mb_alloc(conn->bgp->p.pool, len);
+  memcpy(*msg, pkt, len);
+  *length = len;
+}
+#endif
+
 static byte *
 bgp_create_notification(struct bgp_conn *conn, byte *buf)
 {
@@ -233,6 +262,11 @@ bgp_encode_prefixes(struct bgp_proto *p, byte *w, struct bgp_bucket *buck, unsig
       rem_node(&px->bucket_node);
       fib_delete(&p->prefix_fib, px);
     }
+  if (buck->lat_hist)
+    {
+      latency_add(buck->lat_hist, buck->lat_start);
+      buck->lat_hist = NULL;
+    }
   return w - start;
 }
 
@@ -496,6 +530,118 @@ bgp_create_header(byte *buf, unsigned int len, unsigned int type)
   buf[18] = type;
 }
 
+static byte *
+bgp_put_prefix(byte *w, ip_addr prefix, int pxlen)
+{
+  int bytes = (pxlen + 7) / 8;
+
+  *w++ = pxlen;
+  ipa_hton(prefix);
+  memcpy(w, &prefix, bytes);
+  return w + bytes;
+}
+
+/**
+ * bgp_create_single_update - build an update for a single network
+ * @p: BGP instance the route has been received from
+ * @buf: buffer of at least %BGP_MAX_PACKET_LENGTH bytes
+ * @n: network
+ * @attrs: attributes of the route or %NULL for a withdraw
+ * @pool: linear pool for temporary data
+ *
+ * This function builds a complete Update message (including its header)
+ * which announces or withdraws a single network, encoding the attributes
+ * as they are stored in the routing table. It's not used for talking
+ * to the neighbor, but for reporting routes to monitoring stations.
+ *
+ * Result: End of the message or %NULL if the attributes don't fit in.
+ */
+byte *
+bgp_create_single_update(struct bgp_proto *p, byte *buf, net *n, ea_list *attrs, struct linpool *pool)
+{
+  int remains = BGP_MAX_PACKET_LENGTH - BGP_HEADER_LENGTH - 4 - (1 + sizeof(ip_addr));
+  byte *w = buf + BGP_HEADER_LENGTH;
+  int size;
+
+#ifndef IPV6
+  if (!attrs)
+    {
+      byte *end = bgp_put_prefix(w+2, n->n.prefix, n->n.pxlen);
+      put_u16(w, end - (w+2));
+      put_u16(end, 0);
+      w = end + 2;
+    }
+  else
+    {
+      put_u16(w, 0);
+      size = bgp_encode_route_attrs(p, w+4, attrs, remains);
+      if (size < 0)
+	return NULL;
+      put_u16(w+2, size);
+      w = bgp_put_prefix(w+4+size, n->n.prefix, n->n.pxlen);
+    }
+#else
+  ea_list *ea = NULL;
+  byte *tmp, *tstart;
+
+  put_u16(w, 0);
+  w += 4;
+  remains -= 4 + 3 + 1 + 32 + 1;	/* Room for the rest of MP_REACH_NLRI */
+
+  if (attrs)
+    {
+      eattr *nh = ea_find(attrs, EA_CODE(EAP_BGP, BA_NEXT_HOP));
+      ip_addr ip = IPA_NONE, ip_ll = IPA_NONE;
+
+      size = bgp_encode_route_attrs(p, w, attrs, remains);
+      if (size < 0)
+	return NULL;
+      w += size;
+
+      if (nh)
+	{
+	  ip_addr *ipp = (ip_addr *) nh->u.ptr->data;
+	  ip = ipp[0];
+	  if (nh->u.ptr->length == NEXT_HOP_LENGTH)
+	    ip_ll = ipp[1];
+	}
+
+      tstart = tmp = bgp_attach_attr_wa(&ea, pool, BA_MP_REACH_NLRI, 3 + 1 + 32 + 1 + 1 + sizeof(ip_addr));
+      *tmp++ = 0;
+      *tmp++ = BGP_AF_IPV6;
+      *tmp++ = 1;
+      *tmp++ = ipa_nonzero(ip_ll) ? 32 : 16;
+      ipa_hton(ip);
+      memcpy(tmp, &ip, 16);
+      tmp += 16;
+      if (ipa_nonzero(ip_ll))
+	{
+	  ipa_hton(ip_ll);
+	  memcpy(tmp, &ip_ll, 16);
+	  tmp += 16;
+	}
+      *tmp++ = 0;			/* No SNPA information */
+    }
+  else
+    {
+      tstart = tmp = bgp_attach_attr_wa(&ea, pool, BA_MP_UNREACH_NLRI, 3 + 1 + sizeof(ip_addr));
+      *tmp++ = 0;
+      *tmp++ = BGP_AF_IPV6;
+      *tmp++ = 1;
+    }
+
+  tmp = bgp_put_prefix(tmp, n->n.prefix, n->n.pxlen);
+  ea->attrs[0].u.ptr->length = tmp - tstart;
+  size = bgp_encode_attrs(p, w, ea, 4 + 3 + 1 + 32 + 1 + 1 + sizeof(ip_addr));
+  ASSERT(size >= 0);
+  w += size;
+  put_u16(buf + BGP_HEADER_LENGTH + 2, w - (buf + BGP_HEADER_LENGTH + 4));
+#endif
+
+  bgp_create_header(buf, w - buf, PKT_UPDATE);
+  return w;
+}
+
 /**
  * bgp_fire_tx - transmit packets
  * @conn: connection
@@ -569,6 +715,13 @@ bgp_fire_tx(struct bgp_conn *conn)
     return 0;
   conn->packets_to_send = s;
   bgp_create_header(buf, end - buf, type);
+  PROBE3(bgp_tx_packet, p->p.name, type, end - buf);
+  if (p->p.trace & D_PACKETS)
+    bgp_trace_packet(p, '<', buf, end - buf);
+#ifdef CONFIG_BMP
+  if (type == PKT_OPEN)
+    bgp_save_open(conn, &conn->local_open_msg, &conn->local_open_length, buf, end - buf);
+#endif
   return sk_send(sk, end - buf);
 }
 
@@ -774,6 +927,9 @@ bgp_rx_open(struct bgp_conn *conn, byte *pkt, int len)
     }
 
   /* Update our local variables */
+#ifdef CONFIG_BMP
+  bgp_save_open(conn, &conn->remote_open_msg, &conn->remote_open_length, pkt, len);
+#endif
   conn->hold_time = MIN(hold, p->cf->hold_time);
   conn->keepalive_time = p->cf->keepalive_time ? : conn->hold_time / 3;
   p->remote_id = id;
@@ -1030,9 +1186,15 @@ bgp_rx_update(struct bgp_conn *conn, byte *pkt, int len)
     goto malformed;
   DBG("Sizes: withdrawn=%d, attrs=%d, NLRI=%d\n", withdrawn_len, attr_len, nlri_len);
 
+#ifdef CONFIG_BMP
+  bmp_route_monitor(p, pkt, len);
+#endif
+
   lp_flush(bgp_linpool);
 
+  latency_begin(&p->p);
   bgp_do_rx_update(conn, withdrawn, withdrawn_len, nlri, nlri_len, attrs, attr_len);
+  latency_end();
   return;
 
 malformed:
@@ -1243,10 +1405,14 @@ bgp_rx_packet(struct bgp_conn *conn, byte *pkt, unsigned len)
   byte type = pkt[18];
 
   DBG("BGP: Got packet %02x (%d bytes)\n", type, len);
+  PROBE3(bgp_rx_packet, conn->bgp->p.name, type, len);
 
   if (conn->bgp->p.mrtdump & MD_MESSAGES)
     mrt_dump_bgp_packet(conn, pkt, len);
 
+  if (conn->bgp->p.trace & D_PACKETS)
+    bgp_trace_packet(conn->bgp, '>', pkt, len);
+
   switch (type)
     {
     case PKT_OPEN:		return bgp_rx_open(conn, pkt, len);
@@ -0,0 +1,690 @@
+/*
+ *	BIRD -- BGP Monitoring Protocol
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: BGP Monitoring Protocol
+ *
+ * The BMP protocol (RFC 7854) streams the state of our BGP sessions to
+ * a monitoring station. An instance is attached to a routing table and
+ * it monitors all BGP protocols connected to the same table. It keeps
+ * a TCP connection to the station (reconnecting when it's lost) and
+ * reports establishment and loss of BGP sessions by Peer Up and Peer Down
+ * messages, periodic Statistics Reports and two streams of Route Monitoring
+ * messages:
+ *
+ * The pre-policy stream consists of the UPDATE messages exactly as they
+ * have been received from the neighbors. The BGP code hands them over by
+ * calling bmp_route_monitor() before it starts processing them.
+ *
+ * The post-policy stream describes routes which have passed the import
+ * filters. The instance is connected to the table with %RA_ANY, so it
+ * sees every change of a route of each BGP protocol and it encodes it as
+ * a new UPDATE by bgp_create_single_update(). When the station connects,
+ * the table is fed to the instance again, so the station gets a complete
+ * picture. There is no way to replay the pre-policy stream, though.
+ *
+ * The messages are never allowed to slow down the rest of BIRD. They are
+ * appended to a queue of large chunks which is flushed to the socket by
+ * an event, so many messages are written together. When the station is
+ * too slow and the queue reaches its limit, new messages are dropped and
+ * counted.
+ */
+
+#undef LOCAL_DEBUG
+
+#include "nest/bird.h"
+#include "nest/iface.h"
+#include "nest/protocol.h"
+#include "nest/route.h"
+#include "conf/conf.h"
+#include "lib/event.h"
+#include "lib/socket.h"
+#include "lib/resource.h"
+#include "lib/string.h"
+#include "lib/timer.h"
+#include "lib/unaligned.h"
+
+#include "proto/bgp/bgp.h"
+#include "bmp.h"
+
+#define BMP_TRACE(flags, msg, args...) do { if ((p->p.debug) & flags) \
+  log(L_TRACE "%s: " msg, p->p.name , ## args ); } while(0)
+
+#define BMP_MAX_INFO_LENGTH 1024	/* Longer information strings are truncated */
+
+static list bmp_instances;		/* Running BMP instances */
+static int bmp_counter;			/* Number of running BMP instances */
+static byte bmp_buf[BMP_MAX_MESSAGE_LENGTH];
+static struct rate_limit rl_too_long;
+
+/*
+ *	Transmit queue
+ */
+
+static void
+bmp_fire_tx(struct bmp_proto *p)
+{
+  struct bmp_chunk *c;
+  unsigned len;
+
+  if (!p->connected)
+    return;
+
+  while (!p->tx_busy && !EMPTY_LIST(p->tx_queue))
+    {
+      c = HEAD(p->tx_queue);
+      if (c->pos == c->end)
+	{
+	  if (c == TAIL(p->tx_queue))
+	    {
+	      /* Keep the last chunk for new messages */
+	      c->pos = c->end = 0;
+	      break;
+	    }
+	  rem_node(&c->n);
+	  mb_free(c);
+	  continue;
+	}
+
+      len = c->end - c->pos;
+      p->sk->tbuf = c->data + c->pos;
+      c->pos = c->end;
+      p->tx_busy = len;
+      if (sk_send(p->sk, len) <= 0)
+	return;				/* Either pending or the socket has failed */
+      p->tx_queued -= len;
+      p->tx_busy = 0;
+    }
+
+  if (p->dropping && !p->tx_queued)
+    {
+      log(L_INFO "%s: Queue drained, %u messages dropped", p->p.name, p->tx_drops);
+      p->dropping = 0;
+    }
+}
+
+static void
+bmp_kick_tx(void *vp)
+{
+  bmp_fire_tx(vp);
+}
+
+static void
+bmp_tx(sock *sk)
+{
+  struct bmp_proto *p = sk->data;
+
+  p->tx_queued -= p->tx_busy;
+  p->tx_busy = 0;
+  bmp_fire_tx(p);
+}
+
+/*
+ * Finish the message built in bmp_buf up to @end by filling in the common
+ * header and append it to the queue.
+ */
+static void
+bmp_send(struct bmp_proto *p, unsigned type, byte *end)
+{
+  unsigned len = end - bmp_buf;
+  struct bmp_chunk *c;
+
+  if (!p->connected)
+    return;
+
+  if (p->tx_queued + len > p->cf->buffer_limit)
+    {
+      if (!p->dropping)
+	log(L_WARN "%s: Station is too slow, dropping messages", p->p.name);
+      p->dropping = 1;
+      p->tx_drops++;
+      return;
+    }
+
+  bmp_buf[0] = BMP_VERSION;
+  put_u32(bmp_buf+1, len);
+  bmp_buf[5] = type;
+
+  c = TAIL(p->tx_queue);
+  if (EMPTY_LIST(p->tx_queue) || (c->end + len > BMP_CHUNK_SIZE))
+    {
+      c = mb_alloc(p->p.pool, sizeof(struct bmp_chunk) + BMP_CHUNK_SIZE);
+      c->pos = c->end = 0;
+      add_tail(&p->tx_queue, &c->n);
+    }
+  memcpy(c->data + c->end, bmp_buf, len);
+  c->end += len;
+  p->tx_queued += len;
+
+  if (!p->tx_busy)
+    ev_schedule(p->tx_ev);
+}
+
+/*
+ *	Message construction
+ */
+
+static byte *
+bmp_put_ip(byte *buf, ip_addr a)
+{
+#ifndef IPV6
+  /* IPv4 addresses are stored in the last four bytes of a 16-byte field */
+  bzero(buf, 12);
+  buf += 12;
+#endif
+  return ipa_put_addr(buf, a);
+}
+
+static byte *
+bmp_put_peer_header(byte *buf, struct bgp_proto *bgp, unsigned flags)
+{
+  buf[0] = 0;				/* Global instance peer */
+  buf[1] = flags | (bgp->as4_session ? 0 : BMP_PF_AS2);
+#ifdef IPV6
+  buf[1] |= BMP_PF_V6;
+#endif
+  bzero(buf+2, 8);			/* Peer distinguisher */
+  buf = bmp_put_ip(buf+10, bgp->cf->remote_ip);
+  put_u32(buf, bgp->remote_as);
+  put_u32(buf+4, bgp->remote_id);
+  put_u32(buf+8, now_real);
+  put_u32(buf+12, 0);
+  return buf+16;
+}
+
+static byte *
+bmp_put_info(byte *buf, unsigned type, char *str)
+{
+  unsigned len = MIN(strlen(str), BMP_MAX_INFO_LENGTH);
+
+  put_u16(buf, type);
+  put_u16(buf+2, len);
+  memcpy(buf+4, str, len);
+  return buf+4+len;
+}
+
+static byte *
+bmp_put_notification(byte *buf, unsigned code, unsigned subcode, byte *data, unsigned len)
+{
+  len = MIN(len, BGP_MAX_PACKET_LENGTH - BGP_HEADER_LENGTH - 2);
+  memset(buf, 0xff, 16);
+  put_u16(buf+16, BGP_HEADER_LENGTH + 2 + len);
+  buf[18] = PKT_NOTIFICATION;
+  buf[19] = code;
+  buf[20] = subcode;
+  memcpy(buf+21, data, len);
+  return buf+21+len;
+}
+
+static byte *
+bmp_put_stat(byte *buf, unsigned type, u32 val, int wide)
+{
+  put_u16(buf, type);
+  put_u16(buf+2, wide ? 8 : 4);
+  buf += 4;
+  if (wide)
+    {
+      put_u32(buf, 0);
+      buf += 4;
+    }
+  put_u32(buf, val);
+  return buf+4;
+}
+
+static void
+bmp_send_initiation(struct bmp_proto *p)
+{
+  byte *pos = bmp_buf + BMP_HEADER_LENGTH;
+  char name[16];
+
+  pos = bmp_put_info(pos, BMP_INFO_SYS_DESCR, p->cf->sys_descr ? : "BIRD " BIRD_VERSION);
+  if (!p->cf->sys_name)
+    bsprintf(name, "%R", p->p.cf->global->router_id);
+  pos = bmp_put_info(pos, BMP_INFO_SYS_NAME, p->cf->sys_name ? : name);
+  bmp_send(p, BMP_INITIATION, pos);
+}
+
+static void
+bmp_send_termination(struct bmp_proto *p)
+{
+  byte *pos = bmp_buf + BMP_HEADER_LENGTH;
+
+  put_u16(pos, BMP_TERM_REASON);
+  put_u16(pos+2, 2);
+  put_u16(pos+4, BMP_TERM_ADMIN_CLOSE);
+  bmp_send(p, BMP_TERMINATION, pos+6);
+}
+
+static void
+bmp_send_peer_up(struct bmp_proto *p, struct bgp_proto *bgp)
+{
+  struct bgp_conn *conn = bgp->conn;
+  byte *pos;
+
+  if (!conn->local_open_msg || !conn->remote_open_msg)
+    return;
+
+  pos = bmp_put_peer_header(bmp_buf + BMP_HEADER_LENGTH, bgp, 0);
+  pos = bmp_put_ip(pos, conn->sk->saddr);
+  put_u16(pos, conn->sk->sport);
+  put_u16(pos+2, conn->sk->dport);
+  pos += 4;
+  memcpy(pos, conn->local_open_msg, conn->local_open_length);
+  pos += conn->local_open_length;
+  memcpy(pos, conn->remote_open_msg, conn->remote_open_length);
+  pos += conn->remote_open_length;
+  bmp_send(p, BMP_PEER_UP, pos);
+}
+
+static void
+bmp_send_peer_down(struct bmp_proto *p, struct bgp_proto *bgp)
+{
+  struct bgp_conn *conn = bgp->conn;
+  byte *pos = bmp_put_peer_header(bmp_buf + BMP_HEADER_LENGTH, bgp, 0);
+
+  switch (bgp->last_error_class)
+    {
+    case BE_BGP_RX:
+      *pos++ = BMP_PD_REMOTE_NOTIFY;
+      pos = bmp_put_notification(pos, bgp->last_error_code >> 16, bgp->last_error_code & 0xffff, NULL, 0);
+      break;
+    case BE_SOCKET:
+      *pos++ = BMP_PD_REMOTE_NO_NOTIFY;
+      break;
+    default:
+      if (conn->notify_code)
+	{
+	  *pos++ = BMP_PD_LOCAL_NOTIFY;
+	  pos = bmp_put_notification(pos, conn->notify_code, conn->notify_subcode, conn->notify_data, conn->notify_size);
+	}
+      else
+	{
+	  *pos++ = BMP_PD_LOCAL_NO_NOTIFY;
+	  put_u16(pos, 0);		/* No FSM event code */
+	  pos += 2;
+	}
+    }
+  bmp_send(p, BMP_PEER_DOWN, pos);
+}
+
+static void
+bmp_send_stats(struct bmp_proto *p, struct bgp_proto *bgp)
+{
+  struct proto_stats *s = &bgp->p.stats;
+  byte *pos = bmp_put_peer_header(bmp_buf + BMP_HEADER_LENGTH, bgp, 0);
+
+  put_u32(pos, 3);
+  pos += 4;
+  pos = bmp_put_stat(pos, BMP_STAT_REJECTED, s->imp_updates_filtered, 0);
+  pos = bmp_put_stat(pos, BMP_STAT_ADJ_RIB_IN, s->imp_routes, 1);
+  pos = bmp_put_stat(pos, BMP_STAT_LOC_RIB, s->pref_routes, 1);
+  bmp_send(p, BMP_STATS_REPORT, pos);
+}
+
+static inline int
+bmp_monitors(struct bmp_proto *p, struct bgp_proto *bgp)
+{
+  return p->connected && (p->p.table == bgp->p.table);
+}
+
+/* Call @hook for each established BGP session this instance monitors */
+static void
+bmp_walk_peers(struct bmp_proto *p, void (*hook)(struct bmp_proto *, struct bgp_proto *))
+{
+  struct proto *P;
+
+  WALK_LIST(P, active_proto_list)
+    if ((P->proto == &proto_bgp) && (P->table == p->p.table))
+      {
+	struct bgp_proto *bgp = (struct bgp_proto *) P;
+	if (bgp->conn && (bgp->conn->state == BS_ESTABLISHED))
+	  hook(p, bgp);
+      }
+}
+
+/*
+ *	Hooks called by BGP
+ */
+
+/**
+ * bmp_peer_up - report an established BGP session
+ * @bgp: BGP protocol
+ *
+ * This function is called by BGP when the session reaches the Established
+ * state, before any route is received.
+ */
+void
+bmp_peer_up(struct bgp_proto *bgp)
+{
+  node *n;
+
+  if (!bmp_counter)
+    return;
+
+  WALK_LIST(n, bmp_instances)
+    {
+      struct bmp_proto *p = SKIP_BACK(struct bmp_proto, bmp_node, n);
+      if (bmp_monitors(p, bgp))
+	bmp_send_peer_up(p, bgp);
+    }
+}
+
+/**
+ * bmp_peer_down - report a closed BGP session
+ * @bgp: BGP protocol
+ *
+ * This function is called by BGP when the session leaves the Established
+ * state. The last error of the protocol describes the reason.
+ */
+void
+bmp_peer_down(struct bgp_proto *bgp)
+{
+  node *n;
+
+  if (!bmp_counter)
+    return;
+
+  WALK_LIST(n, bmp_instances)
+    {
+      struct bmp_proto *p = SKIP_BACK(struct bmp_proto, bmp_node, n);
+      if (bmp_monitors(p, bgp))
+	bmp_send_peer_down(p, bgp);
+    }
+}
+
+/**
+ * bmp_route_monitor - report a received UPDATE message
+ * @bgp: BGP protocol
+ * @pkt: the message including its header
+ * @len: length of the message
+ *
+ * This function is called by BGP for each UPDATE received, before
+ * it's processed. It feeds the pre-policy stream.
+ */
+void
+bmp_route_monitor(struct bgp_proto *bgp, byte *pkt, unsigned len)
+{
+  node *n;
+
+  if (!bmp_counter)
+    return;
+
+  WALK_LIST(n, bmp_instances)
+    {
+      struct bmp_proto *p = SKIP_BACK(struct bmp_proto, bmp_node, n);
+      if (p->cf->pre_policy && bmp_monitors(p, bgp))
+	{
+	  byte *pos = bmp_put_peer_header(bmp_buf + BMP_HEADER_LENGTH, bgp, 0);
+	  memcpy(pos, pkt, len);
+	  bmp_send(p, BMP_ROUTE_MONITOR, pos + len);
+	}
+    }
+}
+
+/*
+ *	Post-policy stream
+ */
+
+static void
+bmp_rt_notify(struct proto *P, rtable *tbl UNUSED, net *n, rte *new, rte *old, ea_list *attrs)
+{
+  struct bmp_proto *p = (struct bmp_proto *) P;
+  struct proto *src = (new ? new : old)->attrs->proto;
+  struct bgp_proto *bgp = (struct bgp_proto *) src;
+  byte *pos, *end;
+
+  if (!p->cf->post_policy || !p->connected || (src->proto != &proto_bgp) || !bgp->conn)
+    return;
+
+  pos = bmp_put_peer_header(bmp_buf + BMP_HEADER_LENGTH, bgp, BMP_PF_POST_POLICY);
+  end = bgp_create_single_update(bgp, pos, n, new ? attrs : NULL, p->lp);
+  lp_flush(p->lp);
+  if (!end)
+    {
+      log_rl(&rl_too_long, L_ERR "%s: Attributes of %I/%d are too long to be reported",
+	     p->p.name, n->n.prefix, n->n.pxlen);
+      return;
+    }
+  bmp_send(p, BMP_ROUTE_MONITOR, end);
+}
+
+/*
+ *	Connection to the station
+ */
+
+static void
+bmp_disconnect(struct bmp_proto *p)
+{
+  struct bmp_chunk *c, *next;
+
+  rfree(p->sk);
+  p->sk = NULL;
+  p->connected = 0;
+  WALK_LIST_DELSAFE(c, next, p->tx_queue)
+    mb_free(c);
+  init_list(&p->tx_queue);
+  p->tx_queued = p->tx_busy = 0;
+  p->dropping = 0;
+  tm_stop(p->stats_timer);
+}
+
+static void
+bmp_sock_err(sock *sk, int err)
+{
+  struct bmp_proto *p = sk->data;
+
+  if (p->connected)
+    {
+      if (err)
+	log(L_WARN "%s: Connection lost (%M)", p->p.name, err);
+      else
+	log(L_WARN "%s: Connection closed by the station", p->p.name);
+    }
+  else
+    BMP_TRACE(D_EVENTS, "Connection failed (%M)", err);
+
+  bmp_disconnect(p);
+  tm_start(p->retry_timer, p->cf->retry_time);
+}
+
+static int
+bmp_rx(sock *sk UNUSED, int size UNUSED)
+{
+  /* Stations aren't supposed to send anything, ignore it */
+  return 1;
+}
+
+static void
+bmp_connected(sock *sk)
+{
+  struct bmp_proto *p = sk->data;
+
+  BMP_TRACE(D_EVENTS, "Connected");
+  tm_stop(p->retry_timer);
+  sk->rx_hook = bmp_rx;
+  sk->tx_hook = bmp_tx;
+  p->connected = 1;
+
+  bmp_send_initiation(p);
+  bmp_walk_peers(p, bmp_send_peer_up);
+  if (p->cf->stats_time)
+    tm_start(p->stats_timer, p->cf->stats_time);
+
+  /* The initial feed takes care of the post-policy stream before we're up */
+  if (p->cf->post_policy && (p->p.proto_state == PS_UP))
+    proto_request_feeding(&p->p);
+}
+
+static void
+bmp_connect(struct bmp_proto *p)
+{
+  sock *s = sk_new(p->p.pool);
+
+  s->type = SK_TCP_ACTIVE;
+  s->saddr = p->cf->source_addr;
+  s->daddr = p->cf->station_ip;
+  s->dport = p->cf->station_port;
+  s->rbsize = 1024;
+  s->tos = IP_PREC_INTERNET_CONTROL;
+  s->tx_hook = bmp_connected;
+  s->err_hook = bmp_sock_err;
+  s->data = p;
+  p->sk = s;
+
+  BMP_TRACE(D_EVENTS, "Connecting to %I port %d", s->daddr, s->dport);
+  tm_start(p->retry_timer, p->cf->retry_time);	/* Connect timeout */
+  if (sk_open(s) < 0)
+    bmp_sock_err(s, 0);
+}
+
+static void
+bmp_retry_timeout(timer *t)
+{
+  struct bmp_proto *p = t->data;
+
+  if (p->sk)
+    {
+      BMP_TRACE(D_EVENTS, "Connect timeout");
+      bmp_disconnect(p);
+    }
+  bmp_connect(p);
+}
+
+static void
+bmp_stats_timeout(timer *t)
+{
+  struct bmp_proto *p = t->data;
+
+  bmp_walk_peers(p, bmp_send_stats);
+}
+
+/*
+ *	Protocol glue
+ */
+
+static struct proto *
+bmp_init(struct proto_config *C)
+{
+  struct proto *P = proto_new(C, sizeof(struct bmp_proto));
+
+  P->accept_ra_types = RA_ANY;
+  P->rt_notify = bmp_rt_notify;
+  return P;
+}
+
+static int
+bmp_start(struct proto *P)
+{
+  struct bmp_proto *p = (struct bmp_proto *) P;
+
+  p->cf = (struct bmp_config *) P->cf;
+  p->sk = NULL;
+  p->connected = 0;
+  init_list(&p->tx_queue);
+  p->tx_queued = p->tx_busy = 0;
+  p->tx_drops = 0;
+  p->dropping = 0;
+  p->lp = lp_new(P->pool, 4080);
+
+  p->tx_ev = ev_new(P->pool);
+  p->tx_ev->hook = bmp_kick_tx;
+  p->tx_ev->data = p;
+
+  p->retry_timer = tm_new(P->pool);
+  p->retry_timer->hook = bmp_retry_timeout;
+  p->retry_timer->data = p;
+
+  p->stats_timer = tm_new(P->pool);
+  p->stats_timer->hook = bmp_stats_timeout;
+  p->stats_timer->data = p;
+  p->stats_timer->recurrent = p->cf->stats_time;
+
+  if (!bmp_counter++)
+    init_list(&bmp_instances);
+  add_tail(&bmp_instances, &p->bmp_node);
+
+  bmp_connect(p);
+  return PS_UP;
+}
+
+static int
+bmp_shutdown(struct proto *P)
+{
+  struct bmp_proto *p = (struct bmp_proto *) P;
+
+  /* Best effort, what doesn't fit in the socket is lost with the pool */
+  bmp_send_termination(p);
+  bmp_fire_tx(p);
+
+  rem_node(&p->bmp_node);
+  bmp_counter--;
+  p->connected = 0;
+  tm_stop(p->retry_timer);
+  tm_stop(p->stats_timer);
+  rfree(p->sk);
+  p->sk = NULL;
+  return PS_DOWN;
+}
+
+static void
+bmp_postconfig(struct proto_config *C)
+{
+  struct bmp_config *c = (struct bmp_config *) C;
+
+  if (ipa_zero(c->station_ip))
+    cf_error("Station address not specified");
+}
+
+static inline int
+bmp_same_str(char *a, char *b)
+{
+  return (a == b) || (a && b && !strcmp(a, b));
+}
+
+static int
+bmp_reconfigure(struct proto *P, struct proto_config *new)
+{
+  struct bmp_proto *p = (struct bmp_proto *) P;
+  struct bmp_config *o = (struct bmp_config *) P->cf;
+  struct bmp_config *n = (struct bmp_config *) new;
+
+  if (!ipa_equal(o->station_ip, n->station_ip) || (o->station_port != n->station_port) ||
+      !ipa_equal(o->source_addr, n->source_addr) ||
+      (o->pre_policy != n->pre_policy) || (o->post_policy != n->post_policy) ||
+      (o->stats_time != n->stats_time) || (o->retry_time != n->retry_time) ||
+      !bmp_same_str(o->sys_name, n->sys_name) || !bmp_same_str(o->sys_descr, n->sys_descr))
+    return 0;
+
+  /* The queue limit is checked for each message, so it can change on the fly */
+  p->cf = n;
+  return 1;
+}
+
+static void
+bmp_get_status(struct proto *P, byte *buf)
+{
+  struct bmp_proto *p = (struct bmp_proto *) P;
+
+  if (P->proto_state == PS_DOWN)
+    return;
+  if (!p->connected)
+    strcpy(buf, "Connecting");
+  else if (p->tx_drops)
+    bsprintf(buf, "Connected, %u messages dropped", p->tx_drops);
+  else
+    strcpy(buf, "Connected");
+}
+
+struct protocol proto_bmp = {
+  name:		"BMP",
+  template:	"bmp%d",
+  postconfig:	bmp_postconfig,
+  init:		bmp_init,
+  start:	bmp_start,
+  shutdown:	bmp_shutdown,
+  reconfigure:	bmp_reconfigure,
+  get_status:	bmp_get_status,
+};
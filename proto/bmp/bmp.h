@@ -0,0 +1,102 @@
+/*
+ *	BIRD -- BGP Monitoring Protocol
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_BMP_H_
+#define _BIRD_BMP_H_
+
+#include "lib/socket.h"
+
+struct bgp_proto;
+
+struct bmp_config {
+  struct proto_config c;
+  ip_addr station_ip;			/* Address of the monitoring station */
+  unsigned station_port;
+  ip_addr source_addr;			/* Source address to use */
+  int pre_policy;			/* Report routes as received from neighbors */
+  int post_policy;			/* Report routes accepted to the table */
+  unsigned stats_time;			/* Interval of statistics reports, 0 means never */
+  unsigned retry_time;			/* Delay between connection attempts */
+  unsigned buffer_limit;		/* Maximum amount of queued data */
+  char *sys_name, *sys_descr;		/* Information sent in the initiation message */
+};
+
+struct bmp_chunk {
+  node n;
+  unsigned pos;				/* Data before pos have been passed to the socket */
+  unsigned end;				/* Data before end are valid */
+  byte data[0];
+};
+
+struct bmp_proto {
+  struct proto p;
+  struct bmp_config *cf;		/* Shortcut to BMP configuration */
+  node bmp_node;			/* Node in the list of BMP instances */
+  sock *sk;				/* Connection to the station */
+  int connected;			/* The station is ready for messages */
+  struct timer *retry_timer;		/* Reconnect and connect timeout */
+  struct timer *stats_timer;
+  struct event *tx_ev;			/* Flushes the queue after the current batch of messages */
+  struct linpool *lp;			/* Temporary data for encoding of updates */
+  list tx_queue;			/* Queue of &bmp_chunk's to be sent */
+  unsigned tx_queued;			/* Amount of data in the queue */
+  unsigned tx_busy;			/* Amount of data being written by the socket */
+  u32 tx_drops;				/* Number of messages dropped because of full queue */
+  int dropping;				/* Some messages dropped since the queue was drained */
+};
+
+#define BMP_PORT		1790
+#define BMP_VERSION		3
+#define BMP_HEADER_LENGTH	6
+#define BMP_PEER_HEADER_LENGTH	42
+#define BMP_MAX_MESSAGE_LENGTH	(2*BGP_MAX_PACKET_LENGTH + 256)
+#define BMP_CHUNK_SIZE		65536	/* Allocation unit of the queue */
+#define BMP_DEFAULT_BUFFER	(4 << 20)
+
+/* Message types */
+
+#define BMP_ROUTE_MONITOR	0
+#define BMP_STATS_REPORT	1
+#define BMP_PEER_DOWN		2
+#define BMP_PEER_UP		3
+#define BMP_INITIATION		4
+#define BMP_TERMINATION		5
+
+/* Per-peer header flags */
+
+#define BMP_PF_V6		0x80	/* Peer address is IPv6 */
+#define BMP_PF_POST_POLICY	0x40	/* Routes after the import filter */
+#define BMP_PF_AS2		0x20	/* Legacy 2-byte AS_PATH format */
+
+/* Peer down reasons */
+
+#define BMP_PD_LOCAL_NOTIFY	1	/* Local system closed, NOTIFICATION follows */
+#define BMP_PD_LOCAL_NO_NOTIFY	2	/* Local system closed, FSM event follows */
+#define BMP_PD_REMOTE_NOTIFY	3	/* Remote system closed, NOTIFICATION follows */
+#define BMP_PD_REMOTE_NO_NOTIFY	4	/* Remote system closed without notification */
+
+/* Statistics types */
+
+#define BMP_STAT_REJECTED	0	/* Updates rejected by the import filter */
+#define BMP_STAT_ADJ_RIB_IN	7	/* Routes imported to the table */
+#define BMP_STAT_LOC_RIB	8	/* Routes preferred in the table */
+
+/* Information TLV types */
+
+#define BMP_INFO_STRING		0
+#define BMP_INFO_SYS_DESCR	1
+#define BMP_INFO_SYS_NAME	2
+#define BMP_TERM_REASON		1
+
+#define BMP_TERM_ADMIN_CLOSE	0
+
+/* Hooks called by BGP */
+
+void bmp_peer_up(struct bgp_proto *p);
+void bmp_peer_down(struct bgp_proto *p);
+void bmp_route_monitor(struct bgp_proto *p, byte *pkt, unsigned len);
+
+#endif
@@ -0,0 +1,499 @@
+/*
+ *	BIRD -- Synthetic Route Generator
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Generator
+ *
+ * The Generator protocol exists for load testing of the core. It feeds
+ * its table with a configured number of synthetic routes and after they
+ * are all in, it keeps changing them at a configured rate. Combined with
+ * pipes, filters and a kernel protocol, it gives a repeatable benchmark
+ * of the import and export paths without any external peers.
+ *
+ * The routes are numbered from 0 and their prefixes are derived from
+ * their numbers: the routes are split to blocks by the prefix length
+ * distribution (computed by generator_postconfig()) and the k-th route
+ * of a block with length L is the k-th prefix of length L inside the
+ * configured range. The AS paths and community lists are built when the
+ * protocol starts and each route gets a random one of them, so the number
+ * of distinct attribute sets in the route attribute cache is bounded by
+ * the configuration. All randomness comes from a PRNG with a configured
+ * seed, so two runs with the same configuration do the same changes in
+ * the same order.
+ *
+ * Both the initial load and the churn are done by an event in batches,
+ * so the rest of the daemon keeps running. The churn is paced by a timer
+ * ticking every second: it computes how many changes should have been
+ * done since the start and schedules the event to catch up. If the
+ * daemon can't keep up with the rate, the achieved rate shown by
+ * the |show generator| command is lower than the configured one.
+ *
+ * Routes exported from the table to the generator are just counted, so
+ * an instance generating no routes can serve as a sink measuring the
+ * rate of exports.
+ */
+
+#undef LOCAL_DEBUG
+
+#include "nest/bird.h"
+#include "nest/iface.h"
+#include "nest/protocol.h"
+#include "nest/route.h"
+#include "nest/attrs.h"
+#include "nest/cli.h"
+#include "nest/latency.h"
+#include "conf/conf.h"
+#include "lib/alloca.h"
+#include "lib/resource.h"
+#include "lib/string.h"
+#include "lib/timer.h"
+#include "proto/bgp/bgp.h"
+
+#include "generator.h"
+
+static inline u32
+gen_random(struct generator_proto *p)
+{
+  u32 x = p->rnd;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return p->rnd = x;
+}
+
+/* The k-th prefix of length len inside the configured range */
+static ip_addr
+gen_addr(ip_addr base, int len, u32 k)
+{
+#ifdef IPV6
+  int i;
+
+  for (i = len - 1; k; i--, k >>= 1)
+    if (k & 1)
+      base.addr[i / 32] |= 0x80000000 >> (i % 32);
+  return base;
+#else
+  return len ? ipa_or(base, ipa_from_u32(k << (32 - len))) : base;
+#endif
+}
+
+static void
+gen_prefix(struct generator_config *c, u32 i, ip_addr *px, int *pxlen)
+{
+  int l;
+
+  for (l = c->pxlen; i >= c->count[l]; l++)
+    i -= c->count[l];
+  *px = gen_addr(c->prefix, l, i);
+  *pxlen = l;
+}
+
+static void
+gen_build_attrs(struct generator_proto *p)
+{
+  struct generator_config *c = p->cf;
+  struct adata *empty;
+  unsigned i, j, n;
+
+  if (!c->routes)
+    return;
+
+  empty = lp_allocz(p->lp, sizeof(struct adata));
+  p->paths = mb_alloc(p->p.pool, c->paths * sizeof(struct adata *));
+  for (i = 0; i < c->paths; i++)
+    {
+      struct adata *a = empty;
+      n = 1 + gen_random(p) % c->path_length;
+      for (j = 0; j < n; j++)
+	a = as_path_prepend(p->lp, a, 1 + gen_random(p) % 64999);
+      p->paths[i] = a;
+    }
+
+  if (!c->communities)
+    return;
+
+  p->comms = mb_alloc(p->p.pool, c->communities * sizeof(struct adata *));
+  for (i = 0; i < c->communities; i++)
+    {
+      struct adata *a = NULL;
+      n = 1 + gen_random(p) % 4;
+      for (j = 0; j < n; j++)
+	a = int_set_add(p->lp, a, ((1 + gen_random(p) % 65534) << 16) | (gen_random(p) & 0xffff));
+      p->comms[i] = a;
+    }
+}
+
+static void
+gen_announce(struct generator_proto *p, u32 i)
+{
+  struct generator_config *c = p->cf;
+  ea_list *ea = alloca(sizeof(ea_list) + 3*sizeof(eattr));
+  ip_addr px;
+  int pxlen;
+  net *n;
+  rta a;
+  rte *e;
+
+  gen_prefix(c, i, &px, &pxlen);
+
+  /* The attributes are sorted by their codes */
+  ea->next = NULL;
+  ea->flags = EALF_SORTED;
+  ea->count = c->communities ? 3 : 2;
+  ea->attrs[0].id = EA_CODE(EAP_BGP, BA_ORIGIN);
+  ea->attrs[0].flags = BAF_TRANSITIVE;
+  ea->attrs[0].type = EAF_TYPE_INT;
+  ea->attrs[0].u.data = ORIGIN_IGP;
+  ea->attrs[1].id = EA_CODE(EAP_BGP, BA_AS_PATH);
+  ea->attrs[1].flags = BAF_TRANSITIVE;
+  ea->attrs[1].type = EAF_TYPE_AS_PATH;
+  ea->attrs[1].u.ptr = p->paths[gen_random(p) % c->paths];
+  if (c->communities)
+    {
+      ea->attrs[2].id = EA_CODE(EAP_BGP, BA_COMMUNITY);
+      ea->attrs[2].flags = BAF_OPTIONAL | BAF_TRANSITIVE;
+      ea->attrs[2].type = EAF_TYPE_INT_SET;
+      ea->attrs[2].u.ptr = p->comms[gen_random(p) % c->communities];
+    }
+
+  bzero(&a, sizeof(a));
+  a.proto = &p->p;
+  a.source = RTS_STATIC;
+  a.scope = SCOPE_UNIVERSE;
+  a.cast = RTC_UNICAST;
+  a.dest = RTD_BLACKHOLE;
+  a.eattrs = ea;
+
+  n = net_get(p->p.table, px, pxlen);
+  e = rte_get_temp(rta_lookup(&a));
+  e->net = n;
+  e->pflags = 0;
+  rte_update(p->p.table, n, &p->p, &p->p, e);
+
+  if (!p->installed[i])
+    {
+      p->installed[i] = 1;
+      p->active++;
+    }
+  p->updates++;
+}
+
+static void
+gen_withdraw(struct generator_proto *p, u32 i)
+{
+  ip_addr px;
+  int pxlen;
+  net *n;
+
+  gen_prefix(p->cf, i, &px, &pxlen);
+  if (n = net_find(p->p.table, px, pxlen))
+    rte_update(p->p.table, n, &p->p, &p->p, NULL);
+
+  p->installed[i] = 0;
+  p->active--;
+  p->withdraws++;
+}
+
+static void
+gen_change(struct generator_proto *p)
+{
+  u32 i = gen_random(p) % p->cf->routes;
+
+  if (p->installed[i] && (gen_random(p) % 100 < p->cf->withdraw))
+    gen_withdraw(p, i);
+  else
+    gen_announce(p, i);
+}
+
+static inline unsigned
+gen_rate(u64 cnt, u64 us)
+{
+  return us ? cnt * 1000000 / us : 0;
+}
+
+static inline u64
+gen_changes_due(struct generator_proto *p, u64 now)
+{
+  return (now - p->churn_start) * p->cf->churn / 1000000;
+}
+
+static unsigned
+gen_achieved(struct generator_proto *p)
+{
+  u64 end = p->behind ? tm_current_usec() : p->caught_up;
+
+  return gen_rate(p->churn_done, end - p->churn_start);
+}
+
+static void
+gen_run(void *data)
+{
+  struct generator_proto *p = data;
+  struct generator_config *c = p->cf;
+  unsigned n = c->batch;
+  u64 now, due;
+
+  if (p->p.proto_state != PS_UP)
+    return;
+
+  latency_begin(&p->p);
+
+  if (p->loaded < c->routes)
+    {
+      while (n-- && (p->loaded < c->routes))
+	gen_announce(p, p->loaded++);
+      latency_end();
+
+      if (p->loaded < c->routes)
+	ev_schedule(p->ev);
+      else
+	{
+	  now = tm_current_usec();
+	  p->load_time = now - p->load_start;
+	  log(L_INFO "%s: %u routes loaded in %u ms (%u routes/s)", p->p.name, c->routes,
+	      (u32) (p->load_time / 1000), gen_rate(c->routes, p->load_time));
+	  p->churn_start = p->caught_up = now;
+	  p->churn_done = p->updates = p->withdraws = 0;
+	}
+      return;
+    }
+
+  now = tm_current_usec();
+  due = gen_changes_due(p, now);
+  while (n-- && (p->churn_done < due))
+    {
+      gen_change(p);
+      p->churn_done++;
+    }
+  latency_end();
+
+  /* The rate is achieved only up to the moment we have caught up */
+  if (p->behind = (p->churn_done < due))
+    ev_schedule(p->ev);
+  else
+    p->caught_up = now;
+}
+
+static void
+gen_tick(timer *t)
+{
+  struct generator_proto *p = t->data;
+
+  if (p->churn_start && p->cf->churn && p->cf->routes)
+    ev_schedule(p->ev);
+}
+
+static void
+gen_rt_notify(struct proto *P, rtable *tbl UNUSED, net *n UNUSED, rte *new, rte *old UNUSED, ea_list *attrs UNUSED)
+{
+  struct generator_proto *p = (struct generator_proto *) P;
+
+  p->exp_last = tm_current_usec();
+  if (!p->exp_first)
+    p->exp_first = p->exp_last;
+  if (new)
+    p->exp_updates++;
+  else
+    p->exp_withdraws++;
+}
+
+static int
+gen_import_control(struct proto *P, rte **ee, ea_list **ea UNUSED, struct linpool *pool UNUSED)
+{
+  /* Our own routes are not interesting */
+  return ((*ee)->attrs->proto == P) ? -1 : 0;
+}
+
+/*
+ *	Protocol glue
+ */
+
+static struct proto *
+generator_init(struct proto_config *C)
+{
+  struct proto *P = proto_new(C, sizeof(struct generator_proto));
+
+  P->accept_ra_types = RA_OPTIMAL;
+  P->rt_notify = gen_rt_notify;
+  P->import_control = gen_import_control;
+  return P;
+}
+
+static int
+generator_start(struct proto *P)
+{
+  struct generator_proto *p = (struct generator_proto *) P;
+  struct generator_config *c = (struct generator_config *) P->cf;
+
+  p->cf = c;
+  p->rnd = c->seed;
+  p->lp = lp_new(P->pool, 4080);
+  p->paths = p->comms = NULL;
+  p->installed = c->routes ? mb_allocz(P->pool, c->routes) : NULL;
+  p->loaded = p->active = 0;
+  p->load_time = p->churn_start = p->churn_done = p->caught_up = 0;
+  p->behind = 0;
+  p->updates = p->withdraws = p->exp_updates = p->exp_withdraws = 0;
+  p->exp_first = p->exp_last = 0;
+  gen_build_attrs(p);
+
+  p->ev = ev_new(P->pool);
+  p->ev->hook = gen_run;
+  p->ev->data = p;
+
+  p->timer = tm_new(P->pool);
+  p->timer->hook = gen_tick;
+  p->timer->data = p;
+  p->timer->recurrent = 1;
+  tm_start(p->timer, 1);
+
+  p->load_start = tm_current_usec();
+  if (c->routes)
+    ev_schedule(p->ev);
+  return PS_UP;
+}
+
+static int
+generator_shutdown(struct proto *P UNUSED)
+{
+  /* The routes are flushed by the nest, the event and timer go with the pool */
+  return PS_DOWN;
+}
+
+void
+generator_init_config(struct generator_config *c)
+{
+#ifdef IPV6
+  c->prefix = ipa_build(0x20010db8, 0, 0, 0);
+  c->pxlen = 32;
+#else
+  c->prefix = ipa_from_u32(0x0a000000);
+  c->pxlen = 8;
+#endif
+  c->routes = GEN_DEFAULT_ROUTES;
+  c->paths = GEN_DEFAULT_PATHS;
+  c->path_length = GEN_DEFAULT_PATH_LENGTH;
+  c->batch = GEN_DEFAULT_BATCH;
+  c->seed = 1;
+}
+
+static void
+generator_postconfig(struct proto_config *C)
+{
+  struct generator_config *c = (struct generator_config *) C;
+  u64 total = 0, sum = 0;
+  u32 done = 0;
+  int l;
+
+  for (l = 0; l <= MAX_PREFIX_LENGTH; l++)
+    total += c->weight[l];
+  if (!total)
+    {
+#ifdef IPV6
+      l = MAX(48, c->pxlen);
+#else
+      l = MAX(24, c->pxlen);
+#endif
+      c->weight[l] = total = 1;
+    }
+
+  /* Split the routes so that the counts add up to exactly c->routes */
+  for (l = 0; l <= MAX_PREFIX_LENGTH; l++)
+    {
+      if (c->weight[l] && (l < c->pxlen))
+	cf_error("Prefix length %d is shorter than the range %I/%d", l, c->prefix, c->pxlen);
+      sum += c->weight[l];
+      c->count[l] = (u32) (sum * c->routes / total) - done;
+      done += c->count[l];
+      if (c->count[l] && (l - c->pxlen < 32) && (c->count[l] > (1ULL << (l - c->pxlen))))
+	cf_error("Range %I/%d is too small for %u routes of length %d", c->prefix, c->pxlen, c->count[l], l);
+    }
+}
+
+static int
+generator_reconfigure(struct proto *P, struct proto_config *new)
+{
+  struct generator_proto *p = (struct generator_proto *) P;
+  struct generator_config *o = (struct generator_config *) P->cf;
+  struct generator_config *n = (struct generator_config *) new;
+
+  if (!ipa_equal(o->prefix, n->prefix) || (o->pxlen != n->pxlen) || (o->routes != n->routes) ||
+      memcmp(o->count, n->count, sizeof(o->count)) ||
+      (o->paths != n->paths) || (o->path_length != n->path_length) ||
+      (o->communities != n->communities) || (o->seed != n->seed))
+    return 0;
+
+  /* The churn parameters can change on the fly, the pacing starts again */
+  p->cf = n;
+  if (p->churn_start)
+    {
+      p->churn_start = p->caught_up = tm_current_usec();
+      p->churn_done = 0;
+    }
+  return 1;
+}
+
+static void
+generator_get_status(struct proto *P, byte *buf)
+{
+  struct generator_proto *p = (struct generator_proto *) P;
+
+  if (P->proto_state == PS_DOWN)
+    return;
+  if (p->loaded < p->cf->routes)
+    bsprintf(buf, "Loading %u/%u", p->loaded, p->cf->routes);
+  else if (p->cf->churn && p->cf->routes)
+    bsprintf(buf, "Running %u changes/s", gen_achieved(p));
+  else if (p->cf->routes)
+    strcpy(buf, "Loaded");
+}
+
+struct protocol proto_generator = {
+  name:		"Generator",
+  template:	"generator%d",
+  postconfig:	generator_postconfig,
+  init:		generator_init,
+  start:	generator_start,
+  shutdown:	generator_shutdown,
+  reconfigure:	generator_reconfigure,
+  get_status:	generator_get_status,
+};
+
+void
+generator_show(struct proto *P)
+{
+  struct generator_proto *p = (struct generator_proto *) P;
+  struct generator_config *c = p->cf;
+  u64 now = tm_current_usec();
+
+  if (P->proto_state != PS_UP)
+    {
+      cli_msg(-1024, "%s: not running", P->name);
+      cli_msg(0, "");
+      return;
+    }
+
+  cli_msg(-1024, "%s:", P->name);
+  if (c->routes)
+    cli_msg(-1024, "  Routes:         %u of %u in the table, %u AS paths, %u community lists",
+	    p->active, c->routes, c->paths, c->communities);
+  if (p->loaded < c->routes)
+    cli_msg(-1024, "  Initial load:   %u routes in %u ms so far",
+	    p->loaded, (u32) ((now - p->load_start) / 1000));
+  else if (c->routes)
+    cli_msg(-1024, "  Initial load:   %u routes in %u ms (%u routes/s)",
+	    c->routes, (u32) (p->load_time / 1000), gen_rate(c->routes, p->load_time));
+  if (c->churn && c->routes)
+    cli_msg(-1024, "  Churn:          %u/s configured, %u/s achieved, %Lu changes behind",
+	    c->churn, gen_achieved(p), p->behind ? gen_changes_due(p, now) - p->churn_done : 0);
+  if (p->churn_start)
+    cli_msg(-1024, "  Changes:        %Lu updates, %Lu withdraws", p->updates, p->withdraws);
+  cli_msg(-1024, "  Exported to us: %Lu updates, %Lu withdraws, %u/s on average",
+	  p->exp_updates, p->exp_withdraws,
+	  gen_rate(p->exp_updates + p->exp_withdraws, p->exp_last - p->exp_first));
+  cli_msg(0, "");
+}
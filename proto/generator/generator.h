@@ -0,0 +1,56 @@
+/*
+ *	BIRD -- Synthetic Route Generator
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_GENERATOR_H_
+#define _BIRD_GENERATOR_H_
+
+struct generator_config {
+  struct proto_config c;
+  ip_addr prefix;			/* Range the routes are generated from */
+  int pxlen;
+  u32 routes;				/* Number of generated routes */
+  u32 weight[MAX_PREFIX_LENGTH+1];	/* Prefix length distribution */
+  u32 count[MAX_PREFIX_LENGTH+1];	/* Number of routes of each length, set by postconfig */
+  unsigned paths;			/* Number of distinct AS paths */
+  unsigned path_length;			/* Maximum length of AS paths */
+  unsigned communities;			/* Number of distinct community lists, 0 means none */
+  unsigned churn;			/* Route changes per second after the initial load */
+  unsigned withdraw;			/* Percentage of withdraws among the changes */
+  unsigned batch;			/* Route changes done in one event */
+  u32 seed;
+};
+
+struct generator_proto {
+  struct proto p;
+  struct generator_config *cf;		/* Shortcut to generator configuration */
+  struct event *ev;			/* Loads and changes routes in batches */
+  struct timer *timer;			/* Paces the churn */
+  struct linpool *lp;			/* Attribute data of the generated routes */
+  struct adata **paths;			/* Prebuilt AS paths */
+  struct adata **comms;			/* Prebuilt community lists */
+  byte *installed;			/* Which routes are in the table */
+  u32 rnd;				/* State of the PRNG */
+  u32 loaded;				/* Routes announced by the initial load */
+  u32 active;				/* Routes currently in the table */
+  u64 load_start, load_time;		/* Timing of the initial load [us] */
+  u64 churn_start;			/* Start of the churn [us], 0 before the load is done */
+  u64 churn_done;			/* Route changes done since churn_start */
+  u64 caught_up;			/* When the churn was last done up to date [us] */
+  int behind;				/* The churn is not up to date */
+  u64 updates, withdraws;		/* Route changes since the start of the churn */
+  u64 exp_updates, exp_withdraws;	/* Routes exported to us from the table */
+  u64 exp_first, exp_last;		/* Times of the first and the last export [us] */
+};
+
+#define GEN_DEFAULT_ROUTES	1000
+#define GEN_DEFAULT_PATHS	1000
+#define GEN_DEFAULT_PATH_LENGTH	6
+#define GEN_DEFAULT_BATCH	1000
+
+void generator_init_config(struct generator_config *c);
+void generator_show(struct proto *P);
+
+#endif
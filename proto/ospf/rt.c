@@ -7,6 +7,8 @@
  */
 
 #include "ospf.h"
+#include "nest/latency.h"
+#include "lib/probe.h"
 
 static void add_cand(list * l, struct top_hash_entry *en, 
 		     struct top_hash_entry *par, u32 dist,
@@ -748,8 +750,10 @@ ospf_rt_spf(struct proto_ospf *po)
   if (po->areano == 0) return;
 
   po->cleanup = 1;
+  latency_begin(p);
 
   OSPF_TRACE(D_EVENTS, "Starting routing table calculation");
+  PROBE2(ospf_spf_phase, p->name, 1);
 
   /* 16. (1) - Invalidate old routing table */
   FIB_WALK(&po->rtf, nftmp)
@@ -780,10 +784,12 @@ ospf_rt_spf(struct proto_ospf *po)
     FIB_WALK_END;
 
     /* 16. (2) */
+    PROBE2(ospf_spf_phase, p->name, 2);
     ospf_rt_spfa(oa);
   }
 
   /* 16. (3) */
+  PROBE2(ospf_spf_phase, p->name, 3);
   if ((po->areano == 1) || (!po->backbone))
   {
     ospf_rt_sum(HEAD(po->area_list));
@@ -794,6 +800,7 @@ ospf_rt_spf(struct proto_ospf *po)
   }
 
   /* 16. (4) */
+  PROBE2(ospf_spf_phase, p->name, 4);
   WALK_LIST(oa, po->area_list)
   {
     if (oa->trcap && (oa->areaid != 0))
@@ -804,11 +811,15 @@ ospf_rt_spf(struct proto_ospf *po)
   }
 
   /* 16. (5) */
+  PROBE2(ospf_spf_phase, p->name, 5);
   ospf_ext_spf(po);
 
+  PROBE2(ospf_spf_phase, p->name, 6);
   rt_sync(po);
 
   po->calcrt = 0;
+  PROBE1(ospf_spf_done, p->name);
+  latency_end();
 }
 
 /**
@@ -178,6 +178,12 @@ pipe_reconfigure(struct proto *P, struct proto_config *new)
   return 1;
 }
 
+static void
+pipe_adopt(struct proto *P UNUSED, struct proto_config *new UNUSED)
+{
+  /* We keep no private pointers to the configuration */
+}
+
 
 struct protocol proto_pipe = {
   name:		"Pipe",
@@ -186,5 +192,6 @@ struct protocol proto_pipe = {
   init:		pipe_init,
   start:	pipe_start,
   reconfigure:	pipe_reconfigure,
+  adopt:	pipe_adopt,
   get_status:	pipe_get_status,
 };
@@ -13,14 +13,19 @@
  * two lists of static routes: one containing interface routes and one
  * holding the remaining ones. Interface routes are inserted and removed according
  * to interface events received from the core via the if_notify() hook. Routes
- * pointing to a neighboring router use a sticky node in the neighbor cache
- * to be notified about gaining or losing the neighbor. Special
- * routes like black holes or rejects are inserted all the time.
+ * pointing to a neighboring router are grouped by the router to gateways
+ * (&static_gw, kept in a &fib). Each gateway uses a sticky node in the
+ * neighbor cache to be notified about gaining or losing the neighbor and
+ * optionally a BFD session, and when its state changes, all routes via
+ * it are updated at once. Special routes like black holes or rejects
+ * are inserted all the time.
  *
  * The only other thing worth mentioning is that when asked for reconfiguration,
  * Static not only compares the two configurations, but it also calculates
  * difference between the lists of static routes and it just inserts the
- * newly added routes and removes the obsolete ones.
+ * newly added routes and removes the obsolete ones. The new routes are
+ * indexed by prefix in a temporary &fib for that, so that configurations
+ * with many routes don't need a quadratic number of comparisons.
  */
 
 #undef LOCAL_DEBUG
@@ -32,6 +37,7 @@
 #include "nest/cli.h"
 #include "conf/conf.h"
 #include "lib/string.h"
+#include "proto/bfd/bfd.h"
 
 #include "static.h"
 
@@ -79,22 +85,91 @@ static_remove(struct proto *p, struct static_route *r)
   r->installed = 0;
 }
 
+/* Whether a route via the gateway may be installed */
+static inline int
+static_gw_route_up(struct static_gw *gw, struct static_route *r)
+{
+  return gw->neigh->iface &&
+    (!r->use_bfd || (gw->bfd_req && (gw->bfd_req->state == BFD_STATE_UP)));
+}
+
+static void
+static_gw_update(struct proto *p, struct static_gw *gw)
+{
+  struct static_route *r;
+
+  DBG("Static: gateway %I: iface %p\n", gw->n.prefix, gw->neigh->iface);
+  for (r = gw->routes; r; r = r->chain)
+    if (static_gw_route_up(gw, r))
+      static_install(p, r, gw->neigh->iface);
+    else
+      static_remove(p, r);
+}
+
+static void
+static_bfd_notify(struct bfd_request *req)
+{
+  struct static_gw *gw = req->data;
+  struct proto *p = gw->neigh->proto;
+
+  if (p->proto_state != PS_UP)
+    return;
+
+  static_gw_update(p, gw);
+}
+
+static void
+static_init_gw(struct fib_node *N)
+{
+  struct static_gw *gw = (struct static_gw *) N;
+
+  gw->neigh = NULL;
+  gw->bfd_req = NULL;
+  gw->routes = NULL;
+  gw->bfd_routes = 0;
+}
+
+static struct static_gw *
+static_get_gw(struct static_proto *p, ip_addr addr)
+{
+  struct static_gw *gw = fib_find(&p->gateways, &addr, BITS_PER_IP_ADDRESS);
+  struct neighbor *n;
+
+  if (gw)
+    return gw;
+
+  if (!(n = neigh_find(&p->p, &addr, NEF_STICKY)))
+    return NULL;
+
+  gw = fib_get(&p->gateways, &addr, BITS_PER_IP_ADDRESS);
+  gw->neigh = n;
+  n->data = gw;
+  return gw;
+}
+
 static void
-static_add(struct proto *p, struct static_route *r)
+static_add(struct proto *P, struct static_route *r)
 {
+  struct static_proto *p = (struct static_proto *) P;
+
   DBG("static_add(%I/%d,%d)\n", r->net, r->masklen, r->dest);
   switch (r->dest)
     {
     case RTD_ROUTER:
       {
-	struct neighbor *n = neigh_find(p, &r->via, NEF_STICKY);
-	if (n)
+	struct static_gw *gw = static_get_gw(p, r->via);
+	if (gw)
 	  {
-	    r->chain = n->data;
-	    n->data = r;
-	    r->neigh = n;
-	    if (n->iface)
-	      static_install(p, r, n->iface);
+	    r->chain = gw->routes;
+	    gw->routes = r;
+	    if (r->use_bfd)
+	      {
+		gw->bfd_routes++;
+		if (!gw->bfd_req)
+		  gw->bfd_req = bfd_request_session(P->pool, r->via, static_bfd_notify, gw);
+	      }
+	    if (static_gw_route_up(gw, r))
+	      static_install(P, r, gw->neigh->iface);
 	  }
 	else
 	  log(L_ERR "Static route destination %I is invalid. Ignoring.", r->via);
@@ -103,19 +178,21 @@ static_add(struct proto *p, struct static_route *r)
     case RTD_DEVICE:
       break;
     default:
-      static_install(p, r, NULL);
+      static_install(P, r, NULL);
     }
 }
 
 static int
-static_start(struct proto *p)
+static_start(struct proto *P)
 {
-  struct static_config *c = (void *) p->cf;
+  struct static_proto *p = (struct static_proto *) P;
+  struct static_config *c = (void *) P->cf;
   struct static_route *r;
 
   DBG("Static: take off!\n");
+  fib_init(&p->gateways, P->pool, sizeof(struct static_gw), 0, static_init_gw);
   WALK_LIST(r, c->other_routes)
-    static_add(p, r);
+    static_add(P, r);
   return PS_UP;
 }
 
@@ -137,15 +214,8 @@ static_shutdown(struct proto *p)
 static void
 static_neigh_notify(struct neighbor *n)
 {
-  struct proto *p = n->proto;
-  struct static_route *r;
-
   DBG("Static: neighbor notify for %I: iface %p\n", n->addr, n->iface);
-  for(r=n->data; r; r=r->chain)
-    if (n->iface)
-      static_install(p, r, n->iface);
-    else
-      static_remove(p, r);
+  static_gw_update(n->proto, n->data);
 }
 
 static void
@@ -211,7 +281,7 @@ static_init_config(struct static_config *c)
 static struct proto *
 static_init(struct proto_config *c)
 {
-  struct proto *p = proto_new(c, sizeof(struct proto));
+  struct proto *p = proto_new(c, sizeof(struct static_proto));
 
   p->neigh_notify = static_neigh_notify;
   p->if_notify = static_if_notify;
@@ -224,55 +294,100 @@ static_same_route(struct static_route *x, struct static_route *y)
   return ipa_equal(x->net, y->net)
     && x->masklen == y->masklen
     && x->dest == y->dest
-    && (x->dest != RTD_ROUTER || ipa_equal(x->via, y->via))
+    && (x->dest != RTD_ROUTER || (ipa_equal(x->via, y->via) && x->use_bfd == y->use_bfd))
     && (x->dest != RTD_DEVICE || !strcmp(x->if_name, y->if_name))
     ;
 }
 
 static void
-static_match(struct proto *p, struct static_route *r, struct static_config *n)
+static_init_px(struct fib_node *N)
+{
+  ((struct static_px *) N)->routes = NULL;
+}
+
+static void
+static_index_routes(struct fib *idx, list *l)
+{
+  struct static_route *r;
+  struct static_px *x;
+
+  WALK_LIST(r, *l)
+    {
+      x = fib_get(idx, &r->net, r->masklen);
+      r->next_px = x->routes;
+      x->routes = r;
+    }
+}
+
+static void
+static_match(struct proto *p, struct static_route *r, struct fib *idx)
 {
+  struct static_px *x = fib_find(idx, &r->net, r->masklen);
   struct static_route *t;
 
-  if (r->neigh)
-    r->neigh->data = NULL;
-  WALK_LIST(t, n->iface_routes)
-    if (static_same_route(r, t))
-      {
-	t->installed = 1;
-	return;
-      }
-  WALK_LIST(t, n->other_routes)
+  for (t = x ? x->routes : NULL; t; t = t->next_px)
     if (static_same_route(r, t))
       {
-	t->installed = 1;
+	t->installed = r->installed;
 	return;
       }
   static_remove(p, r);
 }
 
 static int
-static_reconfigure(struct proto *p, struct proto_config *new)
+static_reconfigure(struct proto *P, struct proto_config *new)
 {
-  struct static_config *o = (void *) p->cf;
+  struct static_proto *p = (struct static_proto *) P;
+  struct static_config *o = (void *) P->cf;
   struct static_config *n = (void *) new;
   struct static_route *r;
+  struct static_gw *gw;
+  struct fib idx;
+  pool *tmp;
+
+  /* Index the new routes by prefix */
+  tmp = rp_new(P->pool, "Static reconfiguration");
+  fib_init(&idx, tmp, sizeof(struct static_px), 0, static_init_px);
+  static_index_routes(&idx, &n->iface_routes);
+  static_index_routes(&idx, &n->other_routes);
+
+  /* Reset gateways, the routes will be linked to them again by static_add() */
+  FIB_WALK(&p->gateways, f)
+    {
+      gw = (struct static_gw *) f;
+      gw->routes = NULL;
+      gw->bfd_routes = 0;
+    }
+  FIB_WALK_END;
 
-  /* Delete all obsolete routes and reset neighbor entries */
+  /* Delete all obsolete routes */
   WALK_LIST(r, o->iface_routes)
-    static_match(p, r, n);
+    static_match(P, r, &idx);
   WALK_LIST(r, o->other_routes)
-    static_match(p, r, n);
+    static_match(P, r, &idx);
+  rfree(tmp);
 
   /* Now add all new routes, those not changed will be ignored by static_install() */
   WALK_LIST(r, n->iface_routes)
     {
       struct iface *ifa;
       if (ifa = if_find_by_name(r->if_name))
-	static_install(p, r, ifa);
+	static_install(P, r, ifa);
     }
   WALK_LIST(r, n->other_routes)
-    static_add(p, r);
+    static_add(P, r);
+
+  /* Gateways are kept with their neighbor entries, just drop unused BFD sessions */
+  FIB_WALK(&p->gateways, f)
+    {
+      gw = (struct static_gw *) f;
+      if (!gw->bfd_routes && gw->bfd_req)
+	{
+	  rfree(gw->bfd_req);
+	  gw->bfd_req = NULL;
+	}
+    }
+  FIB_WALK_END;
 
   return 1;
 }
@@ -294,7 +409,7 @@ static_show_rt(struct static_route *r)
 
   switch (r->dest)
     {
-    case RTD_ROUTER:	bsprintf(via, "via %I", r->via); break;
+    case RTD_ROUTER:	bsprintf(via, "via %I%s", r->via, r->use_bfd ? " bfd" : ""); break;
     case RTD_DEVICE:	bsprintf(via, "dev %s", r->if_name); break;
     case RTD_BLACKHOLE:	bsprintf(via, "blackhole"); break;
     case RTD_UNREACHABLE:	bsprintf(via, "unreachable"); break;
@@ -19,16 +19,35 @@ void static_init_config(struct static_config *);
 
 struct static_route {
   node n;
-  struct static_route *chain;		/* Next for the same neighbor */
+  struct static_route *chain;		/* Next for the same gateway */
+  struct static_route *next_px;		/* Next for the same prefix in the reconfiguration index */
   ip_addr net;				/* Network we route */
   int masklen;				/* Mask length */
   int dest;				/* Destination type (RTD_*) */
   ip_addr via;				/* Destination router */
-  struct neighbor *neigh;
+  int use_bfd;				/* Install only if a BFD session to the router is up */
   byte *if_name;			/* Name for RTD_DEVICE routes */
   int installed;			/* Installed in master table */
 };
 
+struct static_gw {			/* Router shared by RTD_ROUTER routes */
+  struct fib_node n;			/* Keyed by the router address */
+  struct neighbor *neigh;		/* Sticky neighbor entry */
+  struct bfd_request *bfd_req;		/* BFD session, if any route via this router needs it */
+  struct static_route *routes;		/* Routes via this router, linked by chain */
+  unsigned bfd_routes;			/* Number of routes using BFD */
+};
+
+struct static_px {			/* Node of the index of routes by prefix */
+  struct fib_node n;
+  struct static_route *routes;		/* Routes for this prefix, linked by next_px */
+};
+
+struct static_proto {
+  struct proto p;
+  struct fib gateways;			/* Routers of RTD_ROUTER routes (struct static_gw) */
+};
+
 void static_show(struct proto *);
 
 #endif
@@ -24,6 +24,7 @@
 #include "lib/krt.h"
 #include "lib/socket.h"
 #include "lib/string.h"
+#include "lib/probe.h"
 #include "conf/conf.h"
 
 #include <asm/types.h>
@@ -497,6 +498,7 @@ nl_send_route(struct krt_proto *p, rte *e, int new)
   } r;
 
   DBG("nl_send_route(%I/%d,new=%d)\n", net->n.prefix, net->n.pxlen, new);
+  PROBE4(nl_send_route, p->p.name, &net->n.prefix, net->n.pxlen, new);
 
   bzero(&r.h, sizeof(r.h));
   bzero(&r.r, sizeof(r.r));
@@ -542,6 +544,7 @@ nl_send_route(struct krt_proto *p, rte *e, int new)
     }
 
   nl_exchange(&r.h);
+  PROBE3(nl_send_route_done, &net->n.prefix, net->n.pxlen, new);
 }
 
 void
@@ -15,6 +15,7 @@
 #include <sys/socket.h>
 #include <sys/fcntl.h>
 #include <sys/un.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -29,6 +30,7 @@
 
 #include "lib/unix.h"
 #include "lib/sysio.h"
+#include "lib/probe.h"
 
 /* Maximum number of calls of tx handler for one socket in one
  * select iteration. Should be small enough to not monopolize CPU by
@@ -87,6 +89,91 @@ tracked_fopen(pool *p, char *name, char *mode)
   return f;
 }
 
+/*
+ *	Shared memory mappings
+ */
+
+struct rmap {
+  resource r;
+  void *addr;
+  unsigned size;
+};
+
+static void
+rm_free(resource *r)
+{
+  struct rmap *m = (struct rmap *) r;
+
+  munmap(m->addr, m->size);
+}
+
+static void
+rm_dump(resource *r)
+{
+  struct rmap *m = (struct rmap *) r;
+
+  debug("(mapping %p, size %u)\n", m->addr, m->size);
+}
+
+static unsigned long
+rm_memsize(resource *r)
+{
+  struct rmap *m = (struct rmap *) r;
+
+  return ALLOC_OVERHEAD + sizeof(struct rmap) + m->size;
+}
+
+static struct resclass rm_class = {
+  "Mapping",
+  sizeof(struct rmap),
+  rm_free,
+  rm_dump,
+  NULL,
+  rm_memsize
+};
+
+/**
+ * tracked_mmap - create a shared memory mapping of a file
+ * @p: pool
+ * @name: file name
+ * @size: size of the mapping
+ *
+ * tracked_mmap() creates the file @name, extends it to @size zeroed bytes
+ * and maps it to memory shared with other processes. The mapping is
+ * a resource in the pool @p. An existing file of the same name is replaced
+ * by a new one instead of being truncated, so that other processes which
+ * still have it mapped don't get hurt.
+ *
+ * Result: address of the mapping or %NULL if any of the steps failed
+ * (with @errno set accordingly).
+ */
+void *
+tracked_mmap(pool *p, char *name, unsigned size)
+{
+  struct rmap *m;
+  void *addr;
+  int fd;
+
+  unlink(name);
+  fd = open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    return NULL;
+  if (ftruncate(fd, size) < 0)
+    {
+      close(fd);
+      return NULL;
+    }
+  addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return NULL;
+
+  m = ralloc(p, &rm_class);
+  m->addr = addr;
+  m->size = size;
+  return addr;
+}
+
 /**
  * DOC: Timers
  *
@@ -158,6 +245,26 @@ update_times(void)
     update_times_plain();
 }
 
+/**
+ * tm_current_usec - read a high resolution clock
+ *
+ * Returns monotonic time in microseconds since an unspecified point
+ * in the past. Unlike @now, it's read directly from the OS on each
+ * call, so it's suitable for measuring short time intervals.
+ */
+u64
+tm_current_usec(void)
+{
+  struct timespec ts;
+  struct timeval tv;
+
+  if (clock_monotonic_available && !clock_gettime(CLOCK_MONOTONIC, &ts))
+    return (u64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+  gettimeofday(&tv, NULL);
+  return (u64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
 static inline void
 init_times(void)
 {
@@ -363,6 +470,141 @@ tm_shot(void)
     }
 }
 
+/*
+ *	Microsecond Timers
+ */
+
+static list utimers;			/* Active utimers sorted by expiration */
+
+static void
+ut_free(resource *r)
+{
+  ut_stop((utimer *) r);
+}
+
+static void
+ut_dump(resource *r)
+{
+  utimer *t = (utimer *) r;
+
+  debug("(code %p, data %p, ", t->hook, t->data);
+  if (t->expires)
+    debug("expires in %d us)\n", (int) (t->expires - tm_current_usec()));
+  else
+    debug("inactive)\n");
+}
+
+static struct resclass ut_class = {
+  "Microtimer",
+  sizeof(utimer),
+  ut_free,
+  ut_dump,
+  NULL
+};
+
+/**
+ * ut_new - create a microsecond timer
+ * @p: pool
+ *
+ * This function creates a new timer with a resolution of microseconds.
+ * It's used like a &timer, only the time is given in microseconds
+ * and there are no @randomize and @recurrent fields.
+ */
+utimer *
+ut_new(pool *p)
+{
+  return ralloc(p, &ut_class);
+}
+
+/**
+ * ut_start - start a microsecond timer
+ * @t: timer
+ * @after: number of microseconds the timer should be run after
+ *
+ * This function schedules the hook function of the timer to be called
+ * after @after microseconds (at least one). If the timer has been
+ * already started, its expiration time is replaced by the new value.
+ */
+void
+ut_start(utimer *t, u64 after)
+{
+  u64 when = tm_current_usec() + MAX(after, 1);
+  node *n;
+
+  if (t->expires)
+    rem_node(&t->n);
+  t->expires = when;
+
+  /* Timers are usually restarted with the longest timeout, search from the tail */
+  n = TAIL(utimers);
+  while (n->prev && (SKIP_BACK(utimer, n, n)->expires > when))
+    n = n->prev;
+  insert_node(&t->n, n);
+}
+
+/**
+ * ut_stop - stop a microsecond timer
+ * @t: timer
+ *
+ * This function stops a timer. If the timer is already stopped,
+ * nothing happens.
+ */
+void
+ut_stop(utimer *t)
+{
+  if (t->expires)
+    {
+      rem_node(&t->n);
+      t->expires = 0;
+    }
+}
+
+/* Run expired timers, returns 1 if there were any */
+static int
+ut_shot(void)
+{
+  u64 now_us;
+  utimer *t;
+  node *n;
+  int fired = 0;
+
+  if (EMPTY_LIST(utimers))
+    return 0;
+
+  now_us = tm_current_usec();
+  while ((n = HEAD(utimers))->next)
+    {
+      t = SKIP_BACK(utimer, n, n);
+      if (t->expires > now_us)
+	break;
+      rem_node(n);
+      t->expires = 0;
+      t->hook(t);
+      fired = 1;
+    }
+  return fired;
+}
+
+/* Shorten the timeout of select() to the first microsecond timer */
+static void
+ut_limit_timeout(struct timeval *timo)
+{
+  u64 now_us, left;
+  utimer *t;
+
+  if (EMPTY_LIST(utimers))
+    return;
+
+  t = SKIP_BACK(utimer, n, HEAD(utimers));
+  now_us = tm_current_usec();
+  left = (t->expires > now_us) ? t->expires - now_us : 0;
+  if (left < (u64) timo->tv_sec * 1000000 + timo->tv_usec)
+    {
+      timo->tv_sec = left / 1000000;
+      timo->tv_usec = left % 1000000;
+    }
+}
+
 /**
  * tm_parse_datetime - parse a date and time
  * @x: datetime string
@@ -562,12 +804,23 @@ sk_dump(resource *r)
 	s->iface ? s->iface->name : "none");
 }
 
+static unsigned long
+sk_memsize(resource *r)
+{
+  sock *s = (sock *) r;
+
+  return ALLOC_OVERHEAD + sizeof(sock) +
+    (s->rbuf_alloc ? ALLOC_OVERHEAD + s->rbsize : 0) +
+    (s->tbuf_alloc ? ALLOC_OVERHEAD + s->tbsize : 0);
+}
+
 static struct resclass sk_class = {
   "Socket",
   sizeof(sock),
   sk_free,
   sk_dump,
-  NULL
+  NULL,
+  sk_memsize
 };
 
 /**
@@ -584,7 +837,7 @@ sk_new(pool *p)
   sock *s = ralloc(p, &sk_class);
   s->pool = p;
   // s->saddr = s->daddr = IPA_NONE;
-  s->tos = s->ttl = -1;
+  s->tos = s->ttl = s->rcv_ttl = -1;
   s->fd = -1;
   return s;
 }
@@ -678,6 +931,58 @@ sk_set_ttl_int(sock *s)
   return NULL;
 }
 
+static char *
+sk_set_ttl_rx_int(sock *s)
+{
+  int one = 1;
+
+#ifdef IPV6
+  if (setsockopt(s->fd, SOL_IPV6, IPV6_RECVHOPLIMIT, &one, sizeof(one)) < 0)
+    return "IPV6_RECVHOPLIMIT";
+#else
+  if (setsockopt(s->fd, SOL_IP, IP_RECVTTL, &one, sizeof(one)) < 0)
+    return "IP_RECVTTL";
+#endif
+  return NULL;
+}
+
+/* Like recvfrom(), but it also fills in s->rcv_ttl */
+static int
+sk_recvmsg_ttl(sock *s, sockaddr *sa, int *al)
+{
+  byte cbuf[CMSG_SPACE(sizeof(int)) + 64];
+  struct iovec iov = { s->rbuf, s->rbsize };
+  struct msghdr msg;
+  struct cmsghdr *cm;
+  int e;
+
+  bzero(&msg, sizeof(msg));
+  msg.msg_name = sa;
+  msg.msg_namelen = *al;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+
+  s->rcv_ttl = -1;
+  if ((e = recvmsg(s->fd, &msg, 0)) < 0)
+    return e;
+  *al = msg.msg_namelen;
+
+  for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+#ifdef IPV6
+    if ((cm->cmsg_level == SOL_IPV6) && (cm->cmsg_type == IPV6_HOPLIMIT))
+      s->rcv_ttl = * (int *) CMSG_DATA(cm);
+#else
+    /* Linux reports IP_TTL as int, BSDs report IP_RECVTTL as a byte */
+    if ((cm->cmsg_level == SOL_IP) && (cm->cmsg_type == IP_TTL))
+      s->rcv_ttl = * (int *) CMSG_DATA(cm);
+    else if ((cm->cmsg_level == SOL_IP) && (cm->cmsg_type == IP_RECVTTL))
+      s->rcv_ttl = * (byte *) CMSG_DATA(cm);
+#endif
+  return e;
+}
+
 #define ERR(x) do { err = x; goto bad; } while(0)
 #define WARN(x) log(L_WARN "sk_setup: %s: %m", x)
 
@@ -707,6 +1012,9 @@ sk_setup(sock *s)
   else
     err = NULL;
 
+  if (!err && (s->flags & SKF_TTL_RX))
+    err = sk_set_ttl_rx_int(s);
+
 bad:
   return err;
 }
@@ -909,6 +1217,11 @@ sk_leave_group(sock *s, ip_addr maddr)
 static void
 sk_tcp_connected(sock *s)
 {
+  sockaddr lsa;
+  int lsa_len = sizeof(lsa);
+  if (getsockname(s->fd, (struct sockaddr *) &lsa, &lsa_len) == 0)
+    get_sockaddr(&lsa, &s->saddr, &s->sport, 1);
+
   s->type = SK_TCP;
   sk_alloc_bufs(s);
   s->tx_hook(s);
@@ -1075,7 +1388,7 @@ bad_no_log:
   return -1;
 }
 
-void
+int
 sk_open_unix(sock *s, char *name)
 {
   int fd;
@@ -1098,11 +1411,13 @@ sk_open_unix(sock *s, char *name)
   if (listen(fd, 8))
     ERR("listen");
   sk_insert(s);
-  return;
+  return 0;
 
  bad:
   log(L_ERR "sk_open_unix: %s: %m", err);
-  die("Unable to create control socket %s", name);
+  close(fd);
+  s->fd = -1;
+  return -1;
 }
 
 static int
@@ -1272,7 +1587,12 @@ sk_read(sock *s)
       {
 	sockaddr sa;
 	int al = sizeof(sa);
-	int e = recvfrom(s->fd, s->rbuf, s->rbsize, 0, (struct sockaddr *) &sa, &al);
+	int e;
+
+	if (s->flags & SKF_TTL_RX)
+	  e = sk_recvmsg_ttl(s, &sa, &al);
+	else
+	  e = recvfrom(s->fd, s->rbuf, s->rbsize, 0, (struct sockaddr *) &sa, &al);
 
 	if (e < 0)
 	  {
@@ -1344,6 +1664,7 @@ io_init(void)
 {
   init_list(&near_timers);
   init_list(&far_timers);
+  init_list(&utimers);
   init_list(&sock_list);
   init_list(&global_event_list);
   krt_io_init();
@@ -1355,6 +1676,22 @@ io_init(void)
 static int short_loops = 0;
 #define SHORT_LOOP_MAX 10
 
+struct io_loop_stats io_loop_stats;
+
+static void
+io_loop_account(u64 busy)
+{
+  struct io_loop_stats *st = &io_loop_stats;
+  u64 limit = 100;
+  int i;
+
+  st->loops++;
+  st->busy_usec += busy;
+  for (i = 0; (i < IO_LOOP_BUCKETS - 1) && (busy > limit); i++)
+    limit *= 10;
+  st->hist[i]++;
+}
+
 void
 io_loop(void)
 {
@@ -1364,6 +1701,7 @@ io_loop(void)
   int hi, events;
   sock *s;
   node *n;
+  u64 busy, busy_since = tm_current_usec();
 
   sock_recalc_fdsets_p = 1;
   for(;;)
@@ -1376,8 +1714,11 @@ io_loop(void)
 	  tm_shot();
 	  continue;
 	}
+      if (ut_shot())
+	continue;
       timo.tv_sec = events ? 0 : tout - now;
       timo.tv_usec = 0;
+      ut_limit_timeout(&timo);
 
       if (sock_recalc_fdsets_p)
 	{
@@ -1433,7 +1774,12 @@ io_loop(void)
 	}
 
       /* And finally enter select() to find active sockets */
+      busy = tm_current_usec() - busy_since;
+      io_loop_account(busy);
+      PROBE2(io_loop_sleep, busy, events);
       hi = select(hi+1, &rd, &wr, NULL, &timo);
+      busy_since = tm_current_usec();
+      PROBE1(io_loop_wakeup, hi);
 
       if (hi < 0)
 	{
@@ -34,6 +34,22 @@
  * When starting up, we cheat by looking if there is another
  * KRT instance to be initialized later and performing table scan
  * only once for all the instances.
+ *
+ * With the |compress| option, routes which forward the same way as their
+ * covering routes are not installed, as the kernel falls back to the covering
+ * route for them anyway. A route is redundant if the longest network with any
+ * routes covering it has a route exported to us (%KRF_WANTED) with the same
+ * destination, which is enough even if the covering route is redundant itself.
+ * A change of a route may therefore only affect the network itself and
+ * the networks directly inside it, which are found using the index of
+ * the (sorted) routing table. The networks are reconsidered from an event,
+ * when the table is consistent again. Networks with routes which are not
+ * exported to us (e.g., device routes) are never skipped when looking for
+ * the cover, so no redundant route is hidden behind a different kernel route.
+ * As such networks need not be announced to us due to filters, we also
+ * watch networks appearing in and disappearing from the index of the table
+ * (see &rtable->index_notify). The whole table is reconsidered before each
+ * scan as well, which recounts the statistics.
  */
 
 /*
@@ -46,7 +62,9 @@
 #include "nest/iface.h"
 #include "nest/route.h"
 #include "nest/protocol.h"
+#include "nest/latency.h"
 #include "lib/timer.h"
+#include "lib/event.h"
 #include "conf/conf.h"
 #include "lib/string.h"
 
@@ -216,6 +234,12 @@ kif_reconfigure(struct proto *p, struct proto_config *new)
   return 1;
 }
 
+static void
+kif_adopt(struct proto *p UNUSED, struct proto_config *new UNUSED)
+{
+  /* Everything uses p->cf, which is updated by the core */
+}
+
 struct protocol proto_unix_iface = {
   name:		"Device",
   template:	"device%d",
@@ -224,6 +248,7 @@ struct protocol proto_unix_iface = {
   start:	kif_start,
   shutdown:	kif_shutdown,
   reconfigure:	kif_reconfigure,
+  adopt:	kif_adopt,
 };
 
 /*
@@ -699,6 +724,183 @@ krt_got_route_async(struct krt_proto *p, rte *e, int new)
   rte_free(e);
 }
 
+/*
+ *	FIB compression
+ */
+
+struct krt_cover {
+  struct krt_proto *p;
+  net *cover;
+  unsigned *count;			/* Wanted and installed routes, counted by krt_compress_all() */
+};
+
+static int
+krt_same_dest(rte *k, rte *e)
+{
+  rta *ka = k->attrs, *ea = e->attrs;
+
+  if (ka->dest != ea->dest)
+    return 0;
+  switch (ka->dest)
+    {
+    case RTD_ROUTER:
+      return ipa_equal(ka->gw, ea->gw) && ka->iface == ea->iface;
+    case RTD_DEVICE:
+      return ka->iface == ea->iface;
+    default:
+      return 1;
+    }
+}
+
+static inline int
+krt_redundant(rte *e, net *cover)
+{
+  return cover && (cover->n.flags & KRF_WANTED) && krt_same_dest(e, cover->routes);
+}
+
+static void
+krt_set_installed(struct krt_proto *p, net *n, rte *new, rte *old)
+{
+  if (new && !(n->n.flags & KRF_INSTALLED))
+    p->fib_installed++;
+  if (!new && (n->n.flags & KRF_INSTALLED))
+    p->fib_installed--;
+  if (new)
+    n->n.flags |= KRF_INSTALLED;
+  else
+    n->n.flags &= ~KRF_INSTALLED;
+  if (p->initialized)			/* Before first scan we don't touch the routes */
+    krt_set_notify(p, n, new, old);
+}
+
+static void
+krt_compress_net(struct krt_proto *p, net *n, net *cover)
+{
+  int inst = (n->n.flags & KRF_WANTED) && !krt_redundant(n->routes, cover);
+
+  if (inst && !(n->n.flags & KRF_INSTALLED))
+    {
+      krt_trace_in(p, n->routes, "no longer redundant");
+      krt_set_installed(p, n, n->routes, NULL);
+    }
+  else if (!inst && (n->n.flags & KRF_INSTALLED))
+    {
+      krt_trace_in(p, n->routes, "redundant");
+      krt_set_installed(p, n, NULL, n->routes);
+    }
+}
+
+static void
+krt_compress_hook(net *n, void *data)
+{
+  struct krt_cover *c = data;
+
+  krt_compress_net(c->p, n, c->cover);
+}
+
+static void
+krt_compress_pending(void *P)
+{
+  struct krt_proto *p = P;
+  rtable *t = p->p.table;
+  struct krt_cover c = { p, NULL, NULL };
+  unsigned i;
+
+  for (i = 0; i < p->pending_count; i++)
+    {
+      struct krt_pending *x = &p->pending[i];
+      net *n = net_find(t, x->prefix, x->pxlen);
+
+      c.cover = (n && n->routes) ? n : rt_index_cover(t, x->prefix, x->pxlen);
+      rt_index_walk(t, x->prefix, x->pxlen, krt_compress_hook, &c);
+    }
+  p->pending_count = 0;
+}
+
+/* Queue @n and the networks inside to be reconsidered */
+static void
+krt_compress_queue(struct krt_proto *p, net *n)
+{
+  struct krt_pending *x;
+
+  /* Before the first scan, everything is decided by krt_compress_all() */
+  if (!p->initialized)
+    return;
+
+  if (p->pending_count == p->pending_size)
+    {
+      p->pending_size = p->pending_size ? 2 * p->pending_size : 64;
+      p->pending = mb_realloc(p->p.pool, p->pending, p->pending_size * sizeof(struct krt_pending));
+    }
+  x = &p->pending[p->pending_count++];
+  x->prefix = n->n.prefix;
+  x->pxlen = n->n.pxlen;
+  ev_schedule(p->compress_event);
+}
+
+/* A network has got its first route or lost its last one, exported to us or not */
+static void
+krt_compress_index_hook(net *n, void *P)
+{
+  krt_compress_queue(P, n);
+}
+
+/* Decide whether a new route of @n is redundant and queue the networks inside */
+static rte *
+krt_compress_notify(struct krt_proto *p, net *n, rte *new)
+{
+  if (new && !(n->n.flags & KRF_WANTED))
+    p->fib_wanted++;
+  if (!new && (n->n.flags & KRF_WANTED))
+    p->fib_wanted--;
+  if (new)
+    n->n.flags |= KRF_WANTED;
+  else
+    n->n.flags &= ~KRF_WANTED;
+
+  krt_compress_queue(p, n);
+
+  if (new && krt_redundant(new, rt_index_cover(p->p.table, n->n.prefix, n->n.pxlen)))
+    {
+      krt_trace_in(p, new, "redundant");
+      return NULL;
+    }
+  return new;
+}
+
+static void
+krt_compress_subtree(net *n, void *data)
+{
+  struct krt_cover *c = data;
+  struct krt_cover d = { c->p, n, c->count };
+
+  krt_compress_net(c->p, n, c->cover);
+  if (n->n.flags & KRF_WANTED)
+    c->count[0]++;
+  if (n->n.flags & KRF_INSTALLED)
+    c->count[1]++;
+  rt_index_walk(c->p->p.table, n->n.prefix, n->n.pxlen, krt_compress_subtree, &d);
+}
+
+/* Reconsider all networks in the table and recount the statistics */
+static void
+krt_compress_all(struct krt_proto *p)
+{
+  rtable *t = p->p.table;
+  unsigned count[2] = { 0, 0 };
+  struct krt_cover c = { p, NULL, count };
+  net *n;
+
+  p->pending_count = 0;
+  n = net_find(t, IPA_NONE, 0);
+  if (n && n->routes)
+    krt_compress_subtree(n, &c);
+  else
+    rt_index_walk(t, IPA_NONE, 0, krt_compress_subtree, &c);
+  p->fib_wanted = count[0];
+  p->fib_installed = count[1];
+}
+
 /*
  *	Periodic scanning
  */
@@ -716,6 +918,12 @@ krt_scan(timer *t UNUSED)
     p = SKIP_BACK(struct krt_proto, instance_node, HEAD(krt_instance_list));
     if (p->instance_node.next)
       KRT_TRACE(p, D_EVENTS, "Scanning routing table");
+    WALK_LIST(q, krt_instance_list)
+      {
+	p = SKIP_BACK(struct krt_proto, instance_node, q);
+	if (KRT_CF->compress)
+	  krt_compress_all(p);
+      }
     krt_scan_fire(NULL);
     WALK_LIST(q, krt_instance_list)
       {
@@ -726,6 +934,8 @@ krt_scan(timer *t UNUSED)
 #else
   p = t->data;
   KRT_TRACE(p, D_EVENTS, "Scanning routing table");
+  if (KRT_CF->compress)
+    krt_compress_all(p);
   krt_scan_fire(p);
   krt_prune(p);
 #endif
@@ -747,12 +957,11 @@ krt_notify(struct proto *P, struct rtable *table UNUSED, net *net,
     new = NULL;
   if (!(net->n.flags & KRF_INSTALLED))
     old = NULL;
-  if (new)
-    net->n.flags |= KRF_INSTALLED;
-  else
-    net->n.flags &= ~KRF_INSTALLED;
-  if (p->initialized)			/* Before first scan we don't touch the routes */
-    krt_set_notify(p, net, new, old);
+  if (KRT_CF->compress)
+    new = krt_compress_notify(p, net, new);
+  krt_set_installed(p, net, new, old);
+  if (p->initialized && latency_origin)
+    latency_record(LAT_KERNEL, p->p.name);
 }
 
 /*
@@ -782,6 +991,8 @@ krt_postconfig(struct proto_config *C)
   if (C->table->krt_attached)
     cf_error("Kernel syncer (%s) already attached to table %s", C->table->krt_attached->name, C->table->name);
   C->table->krt_attached = C;
+  if (c->compress)
+    C->table->sorted = 1;		/* Compression needs the index of networks */
   krt_scan_postconfig(c);
 }
 
@@ -819,6 +1030,18 @@ krt_start(struct proto *P)
   krt_learn_init(p);
 #endif
 
+  p->compress_event = ev_new(P->pool);
+  p->compress_event->hook = krt_compress_pending;
+  p->compress_event->data = p;
+  p->pending = NULL;
+  p->pending_count = p->pending_size = 0;
+  p->fib_wanted = p->fib_installed = 0;
+  if (KRT_CF->compress)
+    {
+      P->table->index_notify = krt_compress_index_hook;
+      P->table->index_notify_data = p;
+    }
+
   krt_scan_start(p, first);
   krt_set_start(p, first);
 
@@ -850,6 +1073,9 @@ krt_shutdown(struct proto *P)
 #endif
     tm_stop(p->scan_timer);
 
+  if (P->table->index_notify_data == p)
+    P->table->index_notify = NULL;
+
   /* FIXME we should flush routes even when persist during reconfiguration */
   if (p->initialized && !KRT_CF->persist)
     krt_flush_routes(p);
@@ -883,11 +1109,27 @@ krt_reconfigure(struct proto *p, struct proto_config *new)
 
   return o->scan_time == n->scan_time
     && o->learn == n->learn		/* persist needn't be the same */
+    && o->compress == n->compress
     && krt_set_params_same(&o->set, &n->set)
     && krt_scan_params_same(&o->scan, &n->scan)
     ;
 }
 
+static void
+krt_get_status(struct proto *P, byte *buf)
+{
+  struct krt_proto *p = (struct krt_proto *) P;
+
+  if ((P->proto_state == PS_UP) && KRT_CF->compress && p->initialized)
+    bsprintf(buf, "%u of %u routes installed", p->fib_installed, p->fib_wanted);
+}
+
+static void
+krt_adopt(struct proto *p UNUSED, struct proto_config *new UNUSED)
+{
+  /* Everything uses p->cf, which is updated by the core */
+}
+
 struct protocol proto_unix_kernel = {
   name:		"Kernel",
   template:	"kernel%d",
@@ -897,6 +1139,8 @@ struct protocol proto_unix_kernel = {
   start:	krt_start,
   shutdown:	krt_shutdown,
   reconfigure:	krt_reconfigure,
+  adopt:	krt_adopt,
+  get_status:	krt_get_status,
 #ifdef KRT_ALLOW_LEARN
   dump:		krt_dump,
   dump_attrs:	krt_dump_attrs,
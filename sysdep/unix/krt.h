@@ -28,6 +28,7 @@ struct kif_proto;
 #define KRF_DELETE 3			/* Should be deleted */
 #define KRF_IGNORE 4			/* To be ignored */
 
+#define KRF_WANTED 0x40			/* The best route was exported to us, but it may be redundant */
 #define KRF_INSTALLED 0x80		/* This route should be installed in the kernel */
 
 /* Whenever we recognize our own routes, we allow learing of foreign routes */
@@ -47,6 +48,12 @@ struct krt_config {
   int persist;			/* Keep routes when we exit */
   int scan_time;		/* How often we re-scan routes */
   int learn;			/* Learn routes from other sources */
+  int compress;			/* Don't install routes redundant to their covering routes */
+};
+
+struct krt_pending {
+  ip_addr prefix;
+  int pxlen;
 };
 
 struct krt_proto {
@@ -63,6 +70,11 @@ struct krt_proto {
   node instance_node;		/* Node in krt instance list */
 #endif
   int initialized;		/* First scan has already been finished */
+  struct event *compress_event; /* Reconsiders networks inside the pending ones */
+  struct krt_pending *pending;	/* Networks whose forwarding has changed */
+  unsigned pending_count, pending_size;
+  unsigned fib_wanted;		/* Routes exported to us */
+  unsigned fib_installed;	/* Routes really installed in the kernel */
 };
 
 extern struct proto_config *cf_krt;
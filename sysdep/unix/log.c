@@ -13,6 +13,21 @@
  * messages to system logs and to the debug output. Message classes
  * used by this module are described in |birdlib.h| and also in the
  * user's manual.
+ *
+ * When BIRD is built with POSIX threads, messages are not written by
+ * the main loop. vlog() formats the message and its timestamp and puts
+ * the record to a bounded ring buffer which is drained by a writer
+ * thread. There is exactly one producer (the main loop) and one consumer,
+ * so the ring needs no locks: the producer moves only @log_head, the
+ * consumer only @log_tail. A sleeping side is woken up by a byte sent
+ * through a pipe, but only if it has announced that it's going to sleep,
+ * so the pipes are not touched while both sides are busy. When the ring is
+ * full, the main loop either waits for the writer or drops the message
+ * and later reports the number of dropped messages (see the &log buffer
+ * option). Fatal errors are always written synchronously after the ring
+ * has been drained, so that they're not lost when the process exits.
+ * When the ring is resized, the writer thread is parked on a condition
+ * variable first, so it never sees the ring while it's being replaced.
  */
 
 #include <stdio.h>
@@ -20,6 +35,10 @@
 #include <stdarg.h>
 #include <time.h>
 #include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
 
 #include "nest/bird.h"
 #include "nest/cli.h"
@@ -27,6 +46,11 @@
 #include "lib/string.h"
 #include "lib/lists.h"
 #include "lib/unix.h"
+#include "conf/conf.h"
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 
 static FILE *dbgf = NULL;
 static list *current_log_list;
@@ -66,14 +90,10 @@ static char *class_names[] = {
 };
 
 static void
-vlog(int class, char *msg, va_list args)
+log_write(int class, char *tbuf, char *msg, int flush)
 {
-  char buf[1024];
   struct log_config *l;
 
-  if (bvsnprintf(buf, sizeof(buf)-1, msg, args) < 0)
-    bsprintf(buf + sizeof(buf) - 100, " ... <too long>");
-
   WALK_LIST(l, *current_log_list)
     {
       if (!(l->mask & (1 << class)))
@@ -83,20 +103,384 @@ vlog(int class, char *msg, va_list args)
 	  if (l->terminal_flag)
 	    fputs("bird: ", l->fh);
 	  else
-	    {
-	      byte tbuf[TM_DATETIME_BUFFER_SIZE];
-	      tm_format_datetime(tbuf, &config->tf_log, now);
-	      fprintf(l->fh, "%s <%s> ", tbuf, class_names[class]);
-	    }
-	  fputs(buf, l->fh);
+	    fprintf(l->fh, "%s <%s> ", tbuf, class_names[class]);
+	  fputs(msg, l->fh);
 	  fputc('\n', l->fh);
-	  fflush(l->fh);
+	  if (flush)
+	    fflush(l->fh);
 	}
 #ifdef HAVE_SYSLOG
       else
-	syslog(syslog_priorities[class], "%s", buf);
+	syslog(syslog_priorities[class], "%s", msg);
 #endif
     }
+}
+
+/* Does any target need the timestamp? */
+static int
+log_need_time(void)
+{
+  struct log_config *l;
+
+  WALK_LIST(l, *current_log_list)
+    if (l->fh && !l->terminal_flag)
+      return 1;
+  return 0;
+}
+
+#ifdef HAVE_PTHREADS
+
+struct log_record {
+  u32 len;				/* Length including the header and padding, 0 class means a skipped area */
+  byte class;
+  byte tlen;				/* Length of the timestamp including its NUL */
+  u16 unused;
+  /* Timestamp and message follow, both NUL-terminated */
+};
+
+static byte *log_ring;
+static unsigned log_ring_size;		/* Power of two, 0 if logging is synchronous */
+static int log_drop_policy;		/* Drop messages when the ring is full */
+static unsigned log_dropped;		/* Messages dropped since the last report */
+static int log_thread_running;
+static int log_wake_fd[2], log_space_fd[2];
+
+static volatile u32 log_head;		/* Written by the main loop */
+static volatile u32 log_tail;		/* Written by the writer thread */
+static volatile u32 log_flushed;	/* Everything before it has been flushed to the targets */
+static volatile int log_writer_idle;	/* Writer thread sleeps (or is going to sleep) on log_wake_fd */
+static volatile int log_producer_waiting; /* Main loop sleeps on log_space_fd */
+
+static pthread_mutex_t log_park_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_park_cond = PTHREAD_COND_INITIALIZER;
+static volatile int log_park_req;	/* Main loop wants the writer thread to stop touching the ring */
+static int log_parked;			/* Writer thread waits for log_park_req to be cleared */
+
+static void
+log_poke(int fd)
+{
+  byte c = 0;
+
+  while ((write(fd, &c, 1) < 0) && (errno == EINTR))
+    ;
+}
+
+static void
+log_sleep(int fd)
+{
+  byte c;
+
+  while ((read(fd, &c, 1) < 0) && (errno == EINTR))
+    ;
+}
+
+static void
+log_flush_targets(void)
+{
+  struct log_config *l;
+
+  WALK_LIST(l, *current_log_list)
+    if (l->fh)
+      fflush(l->fh);
+}
+
+static void *
+log_thread(void *arg UNUSED)
+{
+  struct log_record *r;
+  int dirty = 0;
+  u32 t;
+
+  for (;;)
+    {
+      t = log_tail;
+      if (t == log_head)
+	{
+	  if (dirty)
+	    log_flush_targets();
+	  dirty = 0;
+	  log_flushed = t;
+	  __sync_synchronize();
+	  if (log_producer_waiting)
+	    {
+	      log_producer_waiting = 0;
+	      log_poke(log_space_fd[1]);
+	    }
+
+	  if (log_park_req)
+	    {
+	      /* The ring is empty and flushed, wait until it's replaced */
+	      pthread_mutex_lock(&log_park_lock);
+	      log_parked = 1;
+	      pthread_cond_broadcast(&log_park_cond);
+	      while (log_park_req)
+		pthread_cond_wait(&log_park_cond, &log_park_lock);
+	      log_parked = 0;
+	      pthread_mutex_unlock(&log_park_lock);
+	      continue;
+	    }
+
+	  log_writer_idle = 1;
+	  __sync_synchronize();
+	  if ((t == log_head) && !log_park_req)
+	    log_sleep(log_wake_fd[0]);
+	  log_writer_idle = 0;
+	  continue;
+	}
+
+      __sync_synchronize();
+      r = (struct log_record *) (log_ring + (t & (log_ring_size - 1)));
+      if (r->class)
+	{
+	  char *tbuf = (char *) (r + 1);
+	  log_write(r->class, tbuf, tbuf + r->tlen, 0);
+	  dirty = 1;
+	}
+
+      /* The record must be read before its space is released */
+      __sync_synchronize();
+      log_tail = t + r->len;
+      __sync_synchronize();
+      if (log_producer_waiting)
+	{
+	  log_producer_waiting = 0;
+	  log_poke(log_space_fd[1]);
+	}
+    }
+  return NULL;
+}
+
+/* Wait until the writer thread moves @log_tail from @tail or, if @tail is NULL, until it flushes everything */
+static void
+log_wait(u32 *tail)
+{
+  log_producer_waiting = 1;
+  __sync_synchronize();
+  if (tail ? (log_tail == *tail) : (log_flushed != log_head))
+    log_sleep(log_space_fd[0]);
+  log_producer_waiting = 0;
+}
+
+static int
+log_put(int class, char *tbuf, char *msg)
+{
+  unsigned tl = strlen(tbuf) + 1;
+  unsigned ml = strlen(msg) + 1;
+  unsigned len = BIRD_ALIGN(sizeof(struct log_record) + tl + ml, 8);
+  unsigned mask = log_ring_size - 1;
+  u32 h = log_head;
+  unsigned pos = h & mask;
+  unsigned pad = (pos + len > log_ring_size) ? log_ring_size - pos : 0;
+  struct log_record *r;
+
+  if (h + pad + len - log_tail > log_ring_size)
+    return 0;
+
+  if (pad)
+    {
+      r = (struct log_record *) (log_ring + pos);
+      r->len = pad;
+      r->class = 0;
+      h += pad;
+      pos = 0;
+    }
+
+  r = (struct log_record *) (log_ring + pos);
+  r->len = len;
+  r->class = class;
+  r->tlen = tl;
+  memcpy(r + 1, tbuf, tl);
+  memcpy((byte *) (r + 1) + tl, msg, ml);
+
+  __sync_synchronize();
+  log_head = h + len;
+  __sync_synchronize();
+  if (log_writer_idle)
+    {
+      log_writer_idle = 0;
+      log_poke(log_wake_fd[1]);
+    }
+  return 1;
+}
+
+static void
+log_enqueue(int class, char *tbuf, char *msg)
+{
+  u32 t;
+
+  if (log_dropped)
+    {
+      char nbuf[64];
+      bsprintf(nbuf, "%u log messages dropped", log_dropped);
+      if (log_put(L_WARN[0], tbuf, nbuf))
+	log_dropped = 0;
+    }
+
+  while (!log_put(class, tbuf, msg))
+    {
+      if (log_drop_policy)
+	{
+	  log_dropped++;
+	  return;
+	}
+      t = log_tail;
+      log_wait(&t);
+    }
+}
+
+/**
+ * log_drain - wait for the log writer
+ *
+ * Waits until all messages in the log ring have been written
+ * and flushed. It must be called before the log targets are changed.
+ */
+void
+log_drain(void)
+{
+  if (!log_thread_running)
+    return;
+
+  while (log_flushed != log_head)
+    log_wait(NULL);
+}
+
+/* Stop the writer thread outside of the ring, it must be drained before */
+static void
+log_park(void)
+{
+  pthread_mutex_lock(&log_park_lock);
+  log_park_req = 1;
+  __sync_synchronize();
+  if (log_writer_idle)
+    {
+      log_writer_idle = 0;
+      log_poke(log_wake_fd[1]);
+    }
+  while (!log_parked)
+    pthread_cond_wait(&log_park_cond, &log_park_lock);
+  pthread_mutex_unlock(&log_park_lock);
+}
+
+static void
+log_unpark(void)
+{
+  pthread_mutex_lock(&log_park_lock);
+  log_park_req = 0;
+  pthread_cond_broadcast(&log_park_cond);
+  pthread_mutex_unlock(&log_park_lock);
+}
+
+/**
+ * log_set_buffer - configure the log ring
+ * @size: size of the ring in bytes, 0 for synchronous logging
+ * @drop: drop messages instead of waiting when the ring is full
+ */
+void
+log_set_buffer(unsigned size, int drop)
+{
+  unsigned s = 0;
+
+  if (size)
+    for (s = 1; s < size; s <<= 1)
+      ;
+
+  log_drop_policy = drop;
+  if (s == log_ring_size)
+    return;
+
+  if (log_thread_running)
+    {
+      log_drain();
+      log_park();
+    }
+
+  /* The count of dropped messages is kept, it's reported with the next message */
+  if (log_ring)
+    xfree(log_ring);
+  log_ring = s ? xmalloc(s) : NULL;
+  log_ring_size = s;
+  log_head = log_tail = log_flushed = 0;
+
+  if (log_thread_running)
+    log_unpark();
+}
+
+/**
+ * log_start - start the log writer
+ *
+ * Starts the writer thread which drains the log ring. It's called
+ * after the daemon has forked, until then all messages are written
+ * synchronously.
+ */
+void
+log_start(void)
+{
+  pthread_t thread;
+  sigset_t all, old;
+  int err;
+
+  if (log_thread_running)
+    return;
+
+  if ((pipe(log_wake_fd) < 0) || (pipe(log_space_fd) < 0))
+    {
+      log(L_ERR "Cannot create log writer pipes: %m");
+      return;
+    }
+  fcntl(log_wake_fd[1], F_SETFL, O_NONBLOCK);
+  fcntl(log_space_fd[1], F_SETFL, O_NONBLOCK);
+
+  /* Signals are handled by the main loop only */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  err = pthread_create(&thread, NULL, log_thread, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (err)
+    {
+      errno = err;
+      log(L_ERR "Cannot start log writer thread: %m");
+      return;
+    }
+  pthread_detach(thread);
+  log_thread_running = 1;
+  atexit(log_drain);
+}
+
+#else
+
+void log_drain(void) { }
+void log_set_buffer(unsigned size UNUSED, int drop UNUSED) { }
+void log_start(void) { }
+
+#endif
+
+static void
+vlog(int class, char *msg, va_list args)
+{
+  char buf[1024];
+  byte tbuf[TM_DATETIME_BUFFER_SIZE] = "";
+
+  if (bvsnprintf(buf, sizeof(buf)-1, msg, args) < 0)
+    bsprintf(buf + sizeof(buf) - 100, " ... <too long>");
+
+  if (log_need_time())
+    tm_format_datetime(tbuf, &config->tf_log, now);
+
+#ifdef HAVE_PTHREADS
+  if (log_thread_running && log_ring_size)
+    {
+      if (class < L_FATAL[0])
+	log_enqueue(class, tbuf, buf);
+      else
+	{
+	  log_drain();
+	  log_write(class, tbuf, buf, 1);
+	}
+    }
+  else
+#endif
+    log_write(class, tbuf, buf, 1);
+
   cli_echo(class, buf);
 }
 
@@ -235,6 +619,7 @@ log_init(int debug, int init)
 void
 log_switch(int debug, list *l)
 {
+  log_drain();
   if (EMPTY_LIST(*l))
     log_init(debug, 0);
   else
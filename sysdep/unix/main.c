@@ -25,11 +25,14 @@
 #include "nest/iface.h"
 #include "nest/cli.h"
 #include "nest/locks.h"
+#include "nest/roa.h"
+#include "nest/metrics.h"
 #include "conf/conf.h"
 #include "filter/filter.h"
 
 #include "unix.h"
 #include "krt.h"
+#include "shm.h"
 
 /*
  *	Debugging
@@ -64,6 +67,7 @@ async_dump(void)
 
 static int conf_fd;
 static char *config_name = PATH_CONFIG;
+static int parse_and_exit;
 
 static int
 cf_read(byte *dest, unsigned int len)
@@ -78,12 +82,18 @@ void
 sysdep_preconfig(struct config *c)
 {
   init_list(&c->logfiles);
+  c->log_buffer = LOG_BUFFER_DEFAULT;
 }
 
+static void metrics_commit(char *name);
+
 int
 sysdep_commit(struct config *new, struct config *old UNUSED)
 {
+  log_set_buffer(new->log_buffer, new->log_drop);
   log_switch(debug_flag, &new->logfiles);
+  if (!parse_and_exit)
+    metrics_commit(new->metrics_socket);
   return 0;
 }
 
@@ -118,60 +128,117 @@ read_config(void)
   config_commit(conf, RECONFIG_HARD);
 }
 
-void
-async_config(void)
+/*
+ *  Reconfiguration parses the new configuration in the background
+ *  (see config_parse_async()) and commits it when parsing is finished.
+ *  The CLI which has asked for it waits for the result meanwhile.
+ */
+
+static cli *reconfig_cli;
+static int reconfig_type;
+
+static void
+reconfig_cont(cli *c UNUSED)
 {
-  struct config *conf;
+  /* Nothing to do, reconfig_done() will wake us up */
+}
 
-  log(L_INFO "Reconfiguration requested by SIGHUP");
-  if (!unix_read_config(&conf, config_name))
+static void
+reconfig_cleanup(cli *c UNUSED)
+{
+  reconfig_cli = NULL;
+}
+
+static void
+reconfig_done(struct config *conf, int res)
+{
+  cli *c = reconfig_cli;
+
+  close(conf_fd);
+  reconfig_cli = NULL;
+  if (shutting_down)
     {
-      if (conf->err_msg)
-	log(L_ERR "%s, line %d: %s", config_name, conf->err_lino, conf->err_msg);
+      config_free(conf);
+      res = CONF_SHUTDOWN;
+    }
+  else if (!res)
+    {
+      if (c)
+	cli_printf(c, 8002, "%s, line %d: %s", conf->file_name, conf->err_lino, conf->err_msg);
       else
-	log(L_ERR "Unable to open configuration file %s: %m", config_name);
+	log(L_ERR "%s, line %d: %s", conf->file_name, conf->err_lino, conf->err_msg);
       config_free(conf);
+      res = -1;
     }
   else
-    config_commit(conf, RECONFIG_HARD);
+    res = config_commit(conf, reconfig_type);
+
+  if (!c)
+    return;
+  switch (res)
+    {
+    case -1:
+      break;
+    case CONF_DONE:
+      cli_printf(c, 3, "Reconfigured.");
+      break;
+    case CONF_PROGRESS:
+      cli_printf(c, 4, "Reconfiguration in progress.");
+      break;
+    case CONF_SHUTDOWN:
+      cli_printf(c, 6, "Reconfiguration ignored, shutting down.");
+      break;
+    default:
+      cli_printf(c, 5, "Reconfiguration already in progress, queueing new config");
+    }
+  c->cont = c->cleanup = NULL;
+  ev_schedule(c->event);
+}
+
+static int
+reconfig_start(char *name, int type, cli *c)
+{
+  struct config *conf = config_alloc(name);
+
+  conf_fd = open(name, O_RDONLY);
+  if (conf_fd < 0)
+    {
+      config_free(conf);
+      return 0;
+    }
+  cf_read_hook = cf_read;
+  reconfig_type = type;
+  reconfig_cli = c;
+  config_parse_async(conf, reconfig_done);
+  return 1;
 }
 
 void
-cmd_reconfig(char *name, int type)
+async_config(void)
 {
-  struct config *conf;
+  log(L_INFO "Reconfiguration requested by SIGHUP");
+  if (config_parse_busy())
+    log(L_INFO "New configuration is already being read, ignoring SIGHUP");
+  else if (!reconfig_start(config_name, RECONFIG_HARD, NULL))
+    log(L_ERR "Unable to open configuration file %s: %m", config_name);
+}
 
+void
+cmd_reconfig(char *name, int type)
+{
   if (cli_access_restricted())
     return;
 
   if (!name)
     name = config_name;
   cli_msg(-2, "Reading configuration from %s", name);
-  if (!unix_read_config(&conf, name))
+  if (!reconfig_start(name, type, this_cli))
     {
-      if (conf->err_msg)
-	cli_msg(8002, "%s, line %d: %s", name, conf->err_lino, conf->err_msg);
-      else
-	cli_msg(8002, "%s: %m", name);
-      config_free(conf);
-    }
-  else
-    {
-      switch (config_commit(conf, type))
-	{
-	case CONF_DONE:
-	  cli_msg(3, "Reconfigured.");
-	  break;
-	case CONF_PROGRESS:
-	  cli_msg(4, "Reconfiguration in progress.");
-	  break;
-	case CONF_SHUTDOWN:
-	  cli_msg(6, "Reconfiguration ignored, shutting down.");
-	  break;
-	default:
-	  cli_msg(5, "Reconfiguration already in progress, queueing new config");
-	}
+      cli_msg(8002, "%s: %m", name);
+      return;
     }
+  this_cli->cont = reconfig_cont;
+  this_cli->cleanup = reconfig_cleanup;
 }
 
 /*
@@ -298,7 +365,96 @@ cli_init_unix(void)
   s->type = SK_UNIX_PASSIVE;
   s->rx_hook = cli_connect;
   s->rbsize = 1024;
-  sk_open_unix(s, path_control_socket);
+  if (sk_open_unix(s, path_control_socket) < 0)
+    die("Unable to create control socket %s", path_control_socket);
+}
+
+/*
+ *	Metrics
+ *
+ *	Each connection to the metrics socket gets a snapshot rendered
+ *	by metrics_render() and the socket is closed as soon as it's sent.
+ */
+
+static pool *metrics_pool;
+static sock *metrics_sk;
+static char *metrics_name;
+
+static void
+metrics_close(sock *s)
+{
+  mb_free(s->data);
+  rfree(s);
+}
+
+static void
+metrics_tx(sock *s)
+{
+  /* Everything is written */
+  metrics_close(s);
+}
+
+static void
+metrics_err(sock *s, int err)
+{
+  if (config->cli_debug && err)
+    log(L_INFO "Metrics connection dropped: %s", strerror(err));
+  metrics_close(s);
+}
+
+static int
+metrics_connect(sock *s, int size UNUSED)
+{
+  unsigned len;
+
+  s->tx_hook = metrics_tx;
+  s->err_hook = metrics_err;
+  s->data = s->tbuf = metrics_render(metrics_pool, &len);
+  if (sk_send(s, len) > 0)
+    metrics_close(s);
+  return 1;
+}
+
+static void
+metrics_listen_err(sock *s UNUSED, int err)
+{
+  log(L_ERR "Metrics socket: %s", strerror(err));
+}
+
+static void
+metrics_commit(char *name)
+{
+  sock *s;
+
+  if (metrics_name && name && !strcmp(metrics_name, name))
+    return;
+
+  if (metrics_sk)
+    {
+      rfree(metrics_sk);
+      unlink(metrics_name);
+      mb_free(metrics_name);
+      metrics_sk = NULL;
+      metrics_name = NULL;
+    }
+  if (!name)
+    return;
+
+  if (!metrics_pool)
+    metrics_pool = rp_new(&root_pool, "Metrics");
+  s = sk_new(metrics_pool);
+  s->type = SK_UNIX_PASSIVE;
+  s->rx_hook = metrics_connect;
+  s->err_hook = metrics_listen_err;
+  if (sk_open_unix(s, name) < 0)
+    {
+      log(L_ERR "Unable to create metrics socket %s", name);
+      rfree(s);
+      return;
+    }
+  metrics_sk = s;
+  metrics_name = mb_alloc(metrics_pool, strlen(name) + 1);
+  strcpy(metrics_name, name);
 }
 
 /*
@@ -326,6 +482,8 @@ void
 sysdep_shutdown_done(void)
 {
   unlink(path_control_socket);
+  if (metrics_name)
+    unlink(metrics_name);
   log_msg(L_FATAL "Shutdown completed");
   exit(0);
 }
@@ -386,8 +544,6 @@ usage(void)
   exit(1);
 }
 
-int parse_and_exit;
-
 static void
 parse_args(int argc, char **argv)
 {
@@ -454,6 +610,7 @@ main(int argc, char **argv)
   olock_init();
   io_init();
   rt_init();
+  roa_init();
   if_init();
 
   if (!parse_and_exit)
@@ -462,6 +619,7 @@ main(int argc, char **argv)
   protos_build();
   proto_build(&proto_unix_kernel);
   proto_build(&proto_unix_iface);
+  proto_build(&proto_unix_shm);
 
   read_config();
 
@@ -484,6 +642,7 @@ main(int argc, char **argv)
     }
 
   signal_init();
+  log_start();
 
 #ifdef LOCAL_DEBUG
   async_dump_flag = 1;
@@ -0,0 +1,200 @@
+/*
+ *	BIRD -- Layout of Shared Memory Table Export
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/*
+ *  This header describes the shared memory segment written by the SHM
+ *  protocol and provides an inline lookup function for external readers.
+ *  It doesn't depend on any other BIRD header, so it can be copied to
+ *  other programs as is.
+ *
+ *  The segment is a file (usually on a tmpfs like /dev/shm) which
+ *  the reader maps read-only. It starts with &shm_header, followed by
+ *  an array of trie nodes and an area of route blobs. The trie is a binary
+ *  radix trie with path compression, node 1 is its root covering the
+ *  whole address space. All numbers are in host byte order, addresses are
+ *  stored as 32-bit words with the most significant one first (IPv4 uses
+ *  just the first word).
+ *
+ *  The daemon is the only writer and it never blocks on readers. It protects
+ *  the segment by a sequence counter: the counter is odd while the segment
+ *  is being changed and it's incremented after each change. A reader
+ *  remembers an even value of the counter, copies out whatever it needs
+ *  and retries if the counter has changed meanwhile. Readers must not trust
+ *  any index or offset read during an unfinished change, so they check
+ *  all of them against the bounds of the segment.
+ */
+
+#ifndef _BIRD_SHM_FORMAT_H_
+#define _BIRD_SHM_FORMAT_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define SHM_MAGIC 0x42495244		/* "BIRD" */
+#define SHM_VERSION 1
+
+#define SHM_STATE_DOWN 0		/* Segment is no longer maintained, reopen it */
+#define SHM_STATE_UP 1
+
+#define SHM_BLOB_CLASSES 8		/* Blobs have sizes of 32 << class bytes */
+#define SHM_BLOB_MAX (32 << (SHM_BLOB_CLASSES - 1))
+
+struct shm_header {
+  uint32_t magic;			/* SHM_MAGIC */
+  uint32_t version;			/* SHM_VERSION */
+  volatile uint32_t seq;		/* Sequence counter, odd during changes */
+  uint32_t state;			/* SHM_STATE_* */
+  uint32_t addr_words;			/* Address length in 32-bit words (1 for IPv4, 4 for IPv6) */
+  uint32_t size;			/* Size of the whole segment */
+  uint32_t node_off;			/* Offset of the node array */
+  uint32_t node_max;			/* Number of nodes in the array */
+  uint32_t blob_off;			/* Offset of the blob area */
+  uint32_t blob_size;			/* Size of the blob area */
+  uint32_t routes;			/* Number of routes in the segment */
+  uint32_t overflow;			/* Number of routes which didn't fit in */
+
+  /* Allocator state, used by the writer only */
+  uint32_t node_free;			/* First free node */
+  uint32_t node_used;			/* Number of nodes ever allocated */
+  uint32_t blob_used;			/* Bytes of the blob area ever allocated */
+  uint32_t blob_free[SHM_BLOB_CLASSES];	/* First free blob of each size class */
+};
+
+struct shm_node {
+  uint32_t child[2];			/* Indices of children, 0 if none */
+  uint32_t blob;			/* Offset of the route in the blob area, 0 if none */
+  uint32_t plen;			/* Prefix length */
+  uint32_t addr[4];			/* Prefix */
+};
+
+struct shm_route {
+  uint32_t length;			/* Length of the blob used, including this header */
+  uint8_t source;			/* Route source (RTS_* in BIRD) */
+  uint8_t dest;				/* Destination type (RTD_* in BIRD) */
+  uint8_t scope;			/* Route scope (SCOPE_* in BIRD) */
+  uint8_t flags;			/* SHM_RF_* */
+  uint32_t gw[4];			/* Next hop for RTD_ROUTER */
+  uint32_t ifindex;			/* Outgoing interface, 0 if none */
+  uint32_t pref;			/* Route preference */
+  uint32_t proto_len;			/* Length of the protocol name which follows, including the padding */
+  uint32_t attr_count;			/* Number of attributes following the name */
+  /* NUL-terminated name of the protocol which the route came from, padded to 4 bytes */
+  /* Route attributes (&shm_attr), the first occurrence of an attribute ID wins */
+};
+
+#define SHM_RF_TRUNCATED 1		/* Some attributes didn't fit in SHM_BLOB_MAX */
+
+struct shm_attr {
+  uint16_t id;				/* Attribute ID (EA_CODE() in BIRD) */
+  uint8_t flags;			/* Protocol dependent flags */
+  uint8_t type;				/* Attribute type (EAF_TYPE_* in BIRD) */
+  uint32_t value;			/* Value of integer-like types, length of the data otherwise */
+  /* Data of other types follow, padded to 4 bytes */
+};
+
+#define SHM_ATTR_EMBEDDED(a) ((a)->type & 1)
+
+#define SHM_MAX_DEPTH 130		/* No valid path through the trie is longer */
+#define SHM_READ_SPINS 10000000		/* Give up waiting for an unfinished change after that many reads */
+
+/*
+ * Wait until no change is in progress and return the sequence counter.
+ * If the counter stays odd for too long (e.g. the daemon died in the
+ * middle of a change), the odd value is returned and the reader should
+ * give up and reopen the segment.
+ */
+static inline uint32_t
+shm_read_begin(const struct shm_header *h)
+{
+  uint32_t seq, spins = SHM_READ_SPINS;
+
+  while (((seq = h->seq) & 1) && --spins)
+    ;
+  __sync_synchronize();
+  return seq;
+}
+
+static inline int
+shm_read_retry(const struct shm_header *h, uint32_t seq)
+{
+  __sync_synchronize();
+  return h->seq != seq;
+}
+
+static inline int
+shm_addr_bit(const uint32_t *addr, uint32_t pos)
+{
+  return (addr[pos / 32] >> (31 - pos % 32)) & 1;
+}
+
+/* Does the prefix @n->addr/@n->plen contain @addr? */
+static inline int
+shm_node_match(const struct shm_header *h, const struct shm_node *n, const uint32_t *addr)
+{
+  uint32_t i, plen = n->plen;
+
+  if (plen > 32 * h->addr_words)
+    return 0;
+  for (i = 0; plen >= 32; i++, plen -= 32)
+    if (n->addr[i] != addr[i])
+      return 0;
+  return !plen || !((n->addr[i] ^ addr[i]) >> (32 - plen));
+}
+
+/*
+ * Find the longest prefix matching @addr and copy its route blob to @buf
+ * of @size bytes (at most SHM_BLOB_MAX bytes are needed). Returns length
+ * of the prefix, -1 if there is no matching route or -2 if the segment
+ * is stuck in an unfinished change and should be reopened.
+ */
+static inline int
+shm_lookup(const void *base, const uint32_t *addr, void *buf, uint32_t size)
+{
+  const struct shm_header *h = base;
+  const struct shm_node *nodes = (const void *) ((const char *) base + h->node_off);
+  const char *blobs = (const char *) base + h->blob_off;
+  uint32_t seq, i, depth, best, plen;
+  int res;
+
+  do
+    {
+      seq = shm_read_begin(h);
+      if (seq & 1)
+	return -2;
+      res = -1;
+      best = 0;
+      plen = 0;
+      for (i = 1, depth = 0; i && (i < h->node_max) && (depth < SHM_MAX_DEPTH); depth++)
+	{
+	  const struct shm_node *n = &nodes[i];
+
+	  if (!shm_node_match(h, n, addr))
+	    break;
+	  if (n->blob)
+	    {
+	      best = n->blob;
+	      plen = n->plen;
+	    }
+	  if (n->plen >= 32 * h->addr_words)
+	    break;
+	  i = n->child[shm_addr_bit(addr, n->plen)];
+	}
+      if (best && (best < h->blob_size))
+	{
+	  uint32_t len = ((const struct shm_route *) (blobs + best))->length;
+	  if ((len <= size) && (len <= h->blob_size - best))
+	    {
+	      memcpy(buf, blobs + best, len);
+	      res = plen;
+	    }
+	}
+    }
+  while (shm_read_retry(h, seq));
+
+  return res;
+}
+
+#endif
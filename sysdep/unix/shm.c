@@ -0,0 +1,542 @@
+/*
+ *	BIRD -- Shared Memory Table Export
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Shared memory export
+ *
+ * The SHM protocol publishes the best routes of its table (as accepted
+ * by its export filter) in a shared memory segment, so that other
+ * processes on the same host can look up routes for arbitrary addresses
+ * without talking to the CLI and without any locking. The layout of the
+ * segment and the lookup procedure for readers are described
+ * in |shm-format.h|.
+ *
+ * The segment is a file mapped to memory by tracked_mmap() when the
+ * protocol starts. Its size is fixed by the configured capacity: there
+ * is an array of trie nodes (at most two per route, as the trie is
+ * path-compressed) and an area of route blobs divided to power-of-two
+ * size classes with a free list per class. Routes which don't fit
+ * are only counted.
+ *
+ * Each rt_notify() call makes a single change of the segment guarded by
+ * the sequence counter in the header. The trie is maintained in the same
+ * way as the ordered network index of routing tables, just with node
+ * indices instead of pointers. When the protocol shuts down, it marks
+ * the segment as down and removes the file.
+ */
+
+#undef LOCAL_DEBUG
+
+#include <unistd.h>
+
+#include "nest/bird.h"
+#include "nest/iface.h"
+#include "nest/protocol.h"
+#include "nest/route.h"
+#include "conf/conf.h"
+#include "lib/string.h"
+#include "lib/unix.h"
+
+#include "shm.h"
+
+#define SHM_ROOT 1			/* Index of the root node */
+#define SHM_HEADER_SIZE BIRD_ALIGN(sizeof(struct shm_header), 64)
+#define SHM_MAX_SIZE 0x80000000		/* Limit of the segment size */
+
+static inline void
+shm_put_addr(u32 *w, ip_addr a)
+{
+#ifdef IPV6
+  w[0] = _I0(a);
+  w[1] = _I1(a);
+  w[2] = _I2(a);
+  w[3] = _I3(a);
+#else
+  w[0] = _I(a);
+#endif
+}
+
+static inline ip_addr
+shm_get_addr(u32 *w)
+{
+#ifdef IPV6
+  return _MI(w[0], w[1], w[2], w[3]);
+#else
+  return _MI(w[0]);
+#endif
+}
+
+static inline void
+shm_change_begin(struct shm_header *h)
+{
+  h->seq++;
+  __sync_synchronize();
+}
+
+static inline void
+shm_change_end(struct shm_header *h)
+{
+  __sync_synchronize();
+  h->seq++;
+}
+
+/*
+ *	Route blobs
+ */
+
+static inline int
+shm_blob_class(unsigned len)
+{
+  int c = 0;
+
+  while ((32U << c) < len)
+    c++;
+  return c;
+}
+
+static u32
+shm_blob_alloc(struct shm_proto *p, unsigned len)
+{
+  struct shm_header *h = p->hdr;
+  int c = shm_blob_class(len);
+  u32 off;
+
+  if (off = h->blob_free[c])
+    {
+      h->blob_free[c] = *(u32 *) (p->blobs + off);
+      return off;
+    }
+  if (h->blob_size - h->blob_used < (32U << c))
+    return 0;
+  off = h->blob_used;
+  h->blob_used += 32 << c;
+  return off;
+}
+
+static void
+shm_blob_free(struct shm_proto *p, u32 off)
+{
+  struct shm_header *h = p->hdr;
+  int c = shm_blob_class(((struct shm_route *) (p->blobs + off))->length);
+
+  *(u32 *) (p->blobs + off) = h->blob_free[c];
+  h->blob_free[c] = off;
+}
+
+static byte *
+shm_encode_attrs(struct shm_route *r, byte *pos, byte *end, ea_list *l)
+{
+  int i;
+
+  for (; l; l = l->next)
+    for (i = 0; i < l->count; i++)
+      {
+	eattr *e = &l->attrs[i];
+	struct shm_attr *a = (struct shm_attr *) pos;
+	unsigned len = (e->type & EAF_EMBEDDED) ? 0 : e->u.ptr->length;
+
+	if ((e->type & EAF_TYPE_MASK) == EAF_TYPE_UNDEF)
+	  continue;
+	if (end - pos < (int) (sizeof(struct shm_attr) + BIRD_ALIGN(len, 4)))
+	  {
+	    r->flags |= SHM_RF_TRUNCATED;
+	    continue;
+	  }
+	a->id = e->id;
+	a->flags = e->flags;
+	a->type = e->type & EAF_TYPE_MASK;
+	a->value = (e->type & EAF_EMBEDDED) ? e->u.data : len;
+	pos += sizeof(struct shm_attr);
+	if (len)
+	  {
+	    memcpy(pos, e->u.ptr->data, len);
+	    bzero(pos + len, BIRD_ALIGN(len, 4) - len);
+	    pos += BIRD_ALIGN(len, 4);
+	  }
+	r->attr_count++;
+      }
+  return pos;
+}
+
+/* Encode route @e with temporary attributes @tmpa to @buf of SHM_BLOB_MAX bytes */
+static unsigned
+shm_encode(byte *buf, rte *e, ea_list *tmpa)
+{
+  struct shm_route *r = (struct shm_route *) buf;
+  rta *a = e->attrs;
+  char *name = a->proto->name;
+  unsigned nl = strlen(name) + 1;
+  byte *pos;
+
+  bzero(r, sizeof(struct shm_route));
+  r->source = a->source;
+  r->dest = a->dest;
+  r->scope = a->scope;
+  if (a->dest == RTD_ROUTER)
+    shm_put_addr(r->gw, a->gw);
+  r->ifindex = a->iface ? a->iface->index : 0;
+  r->pref = e->pref;
+  r->proto_len = BIRD_ALIGN(nl, 4);
+
+  pos = buf + sizeof(struct shm_route);
+  bzero(pos, r->proto_len);
+  memcpy(pos, name, nl);
+  pos += r->proto_len;
+
+  /* Temporary attributes go first as they override the stored ones */
+  pos = shm_encode_attrs(r, pos, buf + SHM_BLOB_MAX, tmpa);
+  pos = shm_encode_attrs(r, pos, buf + SHM_BLOB_MAX, a->eattrs);
+  r->length = pos - buf;
+  return r->length;
+}
+
+/*
+ *	Trie
+ */
+
+static u32
+shm_node_new(struct shm_proto *p, ip_addr addr, int plen)
+{
+  struct shm_header *h = p->hdr;
+  struct shm_node *n;
+  u32 i;
+
+  if (i = h->node_free)
+    h->node_free = p->nodes[i].child[0];
+  else
+    i = h->node_used++;
+  ASSERT(i < h->node_max);
+  p->node_avail--;
+
+  n = &p->nodes[i];
+  bzero(n, sizeof(struct shm_node));
+  shm_put_addr(n->addr, addr);
+  n->plen = plen;
+  return i;
+}
+
+static void
+shm_node_free(struct shm_proto *p, u32 i)
+{
+  struct shm_node *n = &p->nodes[i];
+
+  n->child[0] = p->hdr->node_free;
+  n->child[1] = 0;
+  p->hdr->node_free = i;
+  p->node_avail++;
+}
+
+static inline void
+shm_attach(struct shm_proto *p, u32 parent, u32 child)
+{
+  struct shm_node *o = &p->nodes[parent];
+
+  o->child[ipa_getbit(shm_get_addr(p->nodes[child].addr), o->plen) ? 1 : 0] = child;
+}
+
+/* Find or create a node for @addr/@plen, at most two nodes are created */
+static u32
+shm_get(struct shm_proto *p, ip_addr addr, int plen)
+{
+  u32 o = 0, i = SHM_ROOT, a, b;
+
+  while (i)
+    {
+      struct shm_node *n = &p->nodes[i];
+      ip_addr naddr = shm_get_addr(n->addr);
+      ip_addr cmask = ipa_mkmask(MIN(plen, (int) n->plen));
+
+      if (ipa_nonzero(ipa_and(ipa_xor(addr, naddr), cmask)))
+	{
+	  /* We are out of path - add branching node 'b' between 'o' and 'n' */
+	  int blen = ipa_pxlen(addr, naddr);
+	  b = shm_node_new(p, ipa_and(addr, ipa_mkmask(blen)), blen);
+	  a = shm_node_new(p, addr, plen);
+	  shm_attach(p, o, b);
+	  shm_attach(p, b, i);
+	  shm_attach(p, b, a);
+	  return a;
+	}
+
+      if (plen == (int) n->plen)
+	return i;
+
+      if (plen < (int) n->plen)
+	{
+	  /* The new node goes between 'o' and 'n' */
+	  a = shm_node_new(p, addr, plen);
+	  shm_attach(p, o, a);
+	  shm_attach(p, a, i);
+	  return a;
+	}
+
+      o = i;
+      i = n->child[ipa_getbit(addr, n->plen) ? 1 : 0];
+    }
+
+  a = shm_node_new(p, addr, plen);
+  shm_attach(p, o, a);
+  return a;
+}
+
+/*
+ * Remove node @i with parent @o if it's useless, i.e., it has no route
+ * and it's not a branching node. The root is never removed.
+ */
+static int
+shm_unlink(struct shm_proto *p, u32 i, u32 o)
+{
+  struct shm_node *n = &p->nodes[i];
+  struct shm_node *on = &p->nodes[o];
+
+  if (n->blob || !o || (n->child[0] && n->child[1]))
+    return 0;
+
+  on->child[on->child[1] == i] = n->child[0] ? n->child[0] : n->child[1];
+  shm_node_free(p, i);
+  return 1;
+}
+
+/* Remove route for @addr/@plen, returns 0 if there was none */
+static int
+shm_remove(struct shm_proto *p, ip_addr addr, int plen)
+{
+  u32 g = 0, o = 0, i = SHM_ROOT;
+  struct shm_node *n;
+
+  while (p->nodes[i].plen < (u32) plen)
+    {
+      g = o;
+      o = i;
+      i = p->nodes[i].child[ipa_getbit(addr, p->nodes[i].plen) ? 1 : 0];
+      if (!i)
+	return 0;
+    }
+
+  n = &p->nodes[i];
+  if ((n->plen != (u32) plen) || !n->blob || !ipa_equal(shm_get_addr(n->addr), addr))
+    return 0;
+
+  shm_blob_free(p, n->blob);
+  n->blob = 0;
+  p->hdr->routes--;
+
+  /* The parent may have become a useless branching node */
+  if (shm_unlink(p, i, o))
+    shm_unlink(p, o, g);
+  return 1;
+}
+
+static u32
+shm_find(struct shm_proto *p, ip_addr addr, int plen)
+{
+  u32 i = SHM_ROOT;
+
+  while (i && (p->nodes[i].plen < (u32) plen))
+    i = p->nodes[i].child[ipa_getbit(addr, p->nodes[i].plen) ? 1 : 0];
+
+  if (i && (p->nodes[i].plen == (u32) plen) && ipa_equal(shm_get_addr(p->nodes[i].addr), addr))
+    return i;
+  return 0;
+}
+
+/*
+ *	Protocol glue
+ */
+
+static void
+shm_update(struct shm_proto *p, net *n, rte *new, ea_list *tmpa, int replace)
+{
+  struct shm_header *h = p->hdr;
+  byte buf[SHM_BLOB_MAX];
+  unsigned len = shm_encode(buf, new, tmpa);
+  u32 blob = shm_blob_alloc(p, len);
+  u32 i;
+
+  if (blob)
+    memcpy(p->blobs + blob, buf, len);
+
+  i = shm_find(p, n->n.prefix, n->n.pxlen);
+  if (i && p->nodes[i].blob)
+    {
+      if (blob)
+	{
+	  shm_blob_free(p, p->nodes[i].blob);
+	  p->nodes[i].blob = blob;
+	}
+      else
+	{
+	  /* Better no route than a stale one */
+	  shm_remove(p, n->n.prefix, n->n.pxlen);
+	  h->overflow++;
+	}
+      return;
+    }
+
+  if (!blob || (p->node_avail < 2))
+    {
+      if (blob)
+	shm_blob_free(p, blob);
+      if (!replace)
+	h->overflow++;
+      return;
+    }
+
+  i = shm_get(p, n->n.prefix, n->n.pxlen);
+  p->nodes[i].blob = blob;
+  h->routes++;
+  if (replace)
+    h->overflow--;	/* The old route didn't fit */
+}
+
+static void
+shm_rt_notify(struct proto *P, rtable *table UNUSED, net *n, rte *new, rte *old, ea_list *attrs)
+{
+  struct shm_proto *p = (struct shm_proto *) P;
+  struct shm_header *h = p->hdr;
+
+  if (!h)
+    return;
+
+  shm_change_begin(h);
+  if (new)
+    shm_update(p, n, new, attrs, !!old);
+  else if (!shm_remove(p, n->n.prefix, n->n.pxlen) && h->overflow)
+    h->overflow--;
+  shm_change_end(h);
+}
+
+static int
+shm_start(struct proto *P)
+{
+  struct shm_proto *p = (struct shm_proto *) P;
+  struct shm_config *c = (struct shm_config *) P->cf;
+  unsigned node_max = 2 * c->routes + 2;
+  unsigned blob_off = BIRD_ALIGN(SHM_HEADER_SIZE + node_max * sizeof(struct shm_node), 64);
+  unsigned size = blob_off + c->attr_memory;
+  struct shm_header *h;
+
+  h = tracked_mmap(P->pool, c->file, size);
+  if (!h)
+    {
+      log(L_ERR "%s: Cannot create shared memory segment %s: %m", P->name, c->file);
+      return PS_UP;
+    }
+
+  p->hdr = h;
+  p->nodes = (struct shm_node *) ((byte *) h + SHM_HEADER_SIZE);
+  p->blobs = (byte *) h + blob_off;
+  p->node_avail = node_max - 2;
+
+  /* The file is zeroed, so the root node covering everything is ready */
+  h->version = SHM_VERSION;
+  h->addr_words = BITS_PER_IP_ADDRESS / 32;
+  h->size = size;
+  h->node_off = SHM_HEADER_SIZE;
+  h->node_max = node_max;
+  h->blob_off = blob_off;
+  h->blob_size = c->attr_memory;
+  h->node_used = SHM_ROOT + 1;
+  h->blob_used = 32;			/* Offset 0 means no blob */
+  ASSERT(h->blob_size >= h->blob_used);
+  h->state = SHM_STATE_UP;
+  __sync_synchronize();
+  h->magic = SHM_MAGIC;
+
+  return PS_UP;
+}
+
+static int
+shm_shutdown(struct proto *P)
+{
+  struct shm_proto *p = (struct shm_proto *) P;
+  struct shm_config *c = (struct shm_config *) P->cf;
+  struct shm_header *h = p->hdr;
+
+  if (h)
+    {
+      shm_change_begin(h);
+      h->state = SHM_STATE_DOWN;
+      shm_change_end(h);
+      unlink(c->file);
+
+      /* The mapping itself is freed together with the protocol pool */
+      p->hdr = NULL;
+    }
+  return PS_DOWN;
+}
+
+static struct proto *
+shm_init(struct proto_config *C)
+{
+  struct proto *P = proto_new(C, sizeof(struct shm_proto));
+
+  P->accept_ra_types = RA_OPTIMAL;
+  P->rt_notify = shm_rt_notify;
+  return P;
+}
+
+static void
+shm_postconfig(struct proto_config *C)
+{
+  struct shm_config *c = (struct shm_config *) C;
+  u64 mem, size;
+
+  if (!c->file)
+    cf_error("Path of the shared memory segment not specified");
+
+  /* Computed in 64 bits, the default blob area of a large table doesn't fit in 32 */
+  mem = c->attr_memory ? c->attr_memory : (u64) c->routes * SHM_DEFAULT_BLOB;
+  mem = BIRD_ALIGN(mem, 64);
+
+  size = SHM_HEADER_SIZE + (2 * (u64) c->routes + 2) * sizeof(struct shm_node) + 64 + mem;
+  if (size > SHM_MAX_SIZE)
+    cf_error("Shared memory segment too large");
+  c->attr_memory = mem;
+}
+
+static int
+shm_reconfigure(struct proto *P, struct proto_config *new)
+{
+  struct shm_config *o = (struct shm_config *) P->cf;
+  struct shm_config *n = (struct shm_config *) new;
+
+  return !strcmp(o->file, n->file) && (o->routes == n->routes) && (o->attr_memory == n->attr_memory);
+}
+
+static void
+shm_adopt(struct proto *P UNUSED, struct proto_config *new UNUSED)
+{
+  /* We keep no private pointers to the configuration */
+}
+
+static void
+shm_get_status(struct proto *P, byte *buf)
+{
+  struct shm_proto *p = (struct shm_proto *) P;
+  struct shm_header *h = p->hdr;
+
+  if (P->proto_state == PS_DOWN)
+    return;
+  if (!h)
+    strcpy(buf, "Error: no segment");
+  else if (h->overflow)
+    bsprintf(buf, "%u routes, %u did not fit", h->routes, h->overflow);
+  else
+    bsprintf(buf, "%u routes", h->routes);
+}
+
+struct protocol proto_unix_shm = {
+  name:		"SHM",
+  template:	"shm%d",
+  postconfig:	shm_postconfig,
+  init:		shm_init,
+  start:	shm_start,
+  shutdown:	shm_shutdown,
+  reconfigure:	shm_reconfigure,
+  adopt:	shm_adopt,
+  get_status:	shm_get_status,
+};
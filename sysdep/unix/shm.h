@@ -0,0 +1,32 @@
+/*
+ *	BIRD -- Shared Memory Table Export
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_SHM_H_
+#define _BIRD_SHM_H_
+
+#include "lib/shm-format.h"
+
+struct shm_config {
+  struct proto_config c;
+  char *file;				/* Name of the segment file */
+  unsigned routes;			/* Capacity of the segment in routes */
+  unsigned attr_memory;			/* Size of the blob area */
+};
+
+struct shm_proto {
+  struct proto p;
+  struct shm_header *hdr;		/* The segment, NULL if it couldn't be created */
+  struct shm_node *nodes;
+  byte *blobs;
+  unsigned node_avail;			/* Number of nodes still available */
+};
+
+#define SHM_DEFAULT_ROUTES 65536
+#define SHM_DEFAULT_BLOB 256		/* Default size of the blob area per route */
+
+extern struct protocol proto_unix_shm;
+
+#endif
@@ -33,6 +33,44 @@ void tm_dump_all(void);
 extern bird_clock_t now; 		/* Relative, monotonic time in seconds */
 extern bird_clock_t now_real;		/* Time in seconds since fixed known epoch */
 
+u64 tm_current_usec(void);		/* Monotonic time in microseconds */
+
+/*
+ *  Timers with microsecond resolution, for protocols which need
+ *  to react faster than in a second. They are kept in one sorted
+ *  list, so they are meant for a moderate number of users.
+ */
+
+typedef struct utimer {
+  resource r;
+  void (*hook)(struct utimer *);
+  void *data;
+  node n;				/* Internal link */
+  u64 expires;				/* Monotonic time [us], 0=inactive */
+} utimer;
+
+utimer *ut_new(pool *);
+void ut_start(utimer *, u64 after);	/* After given number of microseconds */
+void ut_stop(utimer *);
+
+/*
+ *  Statistics of the main loop. Each iteration is accounted by the time
+ *  spent between two successive polls for socket activity, which is the
+ *  longest time an incoming packet may wait for us. Bucket i of the
+ *  histogram counts iterations taking at most 100*10^i microseconds,
+ *  the last bucket counts all the longer ones.
+ */
+
+#define IO_LOOP_BUCKETS 7
+
+struct io_loop_stats {
+  u64 loops;				/* Number of iterations */
+  u64 busy_usec;			/* Total time spent outside of poll */
+  u64 hist[IO_LOOP_BUCKETS];		/* Histogram of iteration times */
+};
+
+extern struct io_loop_stats io_loop_stats;
+
 struct timeformat {
   char *fmt1, *fmt2;
   bird_clock_t limit;
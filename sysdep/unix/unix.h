@@ -49,8 +49,9 @@ void io_init(void);
 void io_loop(void);
 void fill_in_sockaddr(sockaddr *sa, ip_addr a, unsigned port);
 void get_sockaddr(sockaddr *sa, ip_addr *a, unsigned *port, int check);
-void sk_open_unix(struct birdsock *s, char *name);
+int sk_open_unix(struct birdsock *s, char *name);
 void *tracked_fopen(struct pool *, char *name, char *mode);
+void *tracked_mmap(struct pool *, char *name, unsigned size);
 void test_old_bird(char *path);
 
 
@@ -63,6 +64,13 @@ void krt_io_init(void);
 void log_init(int debug, int init);
 void log_init_debug(char *);		/* Initialize debug dump to given file (NULL=stderr, ""=off) */
 void log_switch(int debug, struct list *);
+void log_set_buffer(unsigned size, int drop);
+void log_start(void);
+void log_drain(void);
+
+#define LOG_BUFFER_DEFAULT	(1 << 20)
+#define LOG_BUFFER_MIN		16384
+#define LOG_BUFFER_MAX		(1 << 30)
 
 struct log_config {
   node n;